@@ -5,6 +5,15 @@ import audio_utilities
 from mpl_toolkits.axisartist.parasite_axes import HostAxes, ParasiteAxes
 import matplotlib.pyplot as plt
 
+def loadTensor(path, comments):
+    '''
+    load a tensor dumped with af::toString, or a .npy written by
+    DiagnosticsWriter (--diagdir), whose shape is the reversed af shape
+    '''
+    if path.endswith('.npy'):
+        return np.load(path).T
+    return np.loadtxt(path, comments=comments)
+
 def getM(txtdir):
     '''
     to get M feature map
@@ -12,7 +21,7 @@ def getM(txtdir):
     :return: dimMeans(K-dim),frameMeans(T-dim)
     '''
 
-    norm = np.loadtxt(txtdir, comments=['m', '[', '#', 'l'])
+    norm = loadTensor(txtdir, ['m', '[', '#', 'l'])
     norm = norm.T #T*K
 
     # print(np.mean(norm[:int(norm.shape[0] / 2), :]))这是为了看前后两部分音乐m的值变化
@@ -107,7 +116,7 @@ def makeVoice(prefftdir, dimMeans, frameMeans, norm, dimThreshes=None, frameThre
     # normThreshes = [0.1,0.2,0.3,0.4,0.5,0.6,0.7,0.8,0.9]
     normThreshes = [0.2,0.5,0.8]
 
-    fft = np.loadtxt(prefftdir, comments=['p', '[', '#', 'l'])
+    fft = loadTensor(prefftdir, ['p', '[', '#', 'l'])
     fft = fft.T
 
     fftnorm = np.zeros((fft.shape[0], int(fft.shape[1] / 2)))
@@ -206,7 +215,7 @@ def makeVoicefor_mask(maskdirs, ismask_KT=False, fftangle=None):
     '''
     if ismask_KT:
         for maskdir in maskdirs:
-            music_mask_norm = np.loadtxt(maskdir, comments=['m', '[', '#', 'l'])
+            music_mask_norm = loadTensor(maskdir, ['m', '[', '#', 'l'])
             music_mask_norm = music_mask_norm.T
             music_mask_norm /= 32768.0
 
@@ -224,7 +233,7 @@ def makeVoicefor_mask(maskdirs, ismask_KT=False, fftangle=None):
 
     else:
         for maskdir in maskdirs:
-            music_mask = np.loadtxt(maskdir, comments=['m', '[', '#', 'l'])
+            music_mask = loadTensor(maskdir, ['m', '[', '#', 'l'])
             music_mask = music_mask.T
 
             music_mask_norm = np.zeros((music_mask.shape[0], int(music_mask.shape[1] / 2)))
@@ -349,7 +358,7 @@ if __name__ == '__main__':
         plt.savefig(os.path.join(wholeDir, folder, 'm_changes.png'), dpi=150)
         plt.clf()
 
-        outputgrad = np.loadtxt(os.path.join(wholeDir, folder, 'outputGrad.txt'),comments=['o', '[', '#', 'l'])
+        outputgrad = loadTensor(os.path.join(wholeDir, folder, 'outputGrad.txt'), ['o', '[', '#', 'l'])
         plt.figure()
         plt.imshow(outputgrad, cmap='hot', aspect='auto', interpolation='nearest')
         plt.colorbar()
@@ -0,0 +1,58 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <string>
+#include <unordered_map>
+
+#include <flashlight/flashlight.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "common/Defines.h"
+#include "criterion/criterion.h"
+#include "module/module.h"
+#include "runtime/Serial.h"
+#include "runtime/Snapshot.h"
+
+using namespace w2l;
+
+// Rewrites a model saved by W2lSerializer as a snapshot (runtime/Snapshot.h)
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  std::string exec(argv[0]);
+  gflags::SetUsageMessage(
+      "Usage: \n " + exec + " [input_model] [output_snapshot] [flags]");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  if (argc != 3) {
+    LOG(FATAL) << gflags::ProgramUsage();
+  }
+
+  std::unordered_map<std::string, std::string> cfg;
+  std::shared_ptr<fl::Module> network;
+  std::shared_ptr<SequenceCriterion> criterion;
+  LOG(INFO) << "[Convert] Reading model from " << argv[1];
+  loadModel(argv[1], cfg, network, criterion);
+  LOG(INFO) << "[Network] Number of params: " << numTotalParams(network);
+
+  saveSnapshot(argv[2], cfg, network, criterion);
+
+  // read everything back so a bad conversion fails here, not at test time
+  Snapshot snapshot(argv[2]);
+  snapshot.materialize();
+  auto loaded = snapshot.network()->params();
+  auto params = network->params();
+  for (size_t i = 0; i < params.size(); ++i) {
+    if (!af::allTrue<bool>(loaded[i].array() == params[i].array())) {
+      LOG(FATAL) << "[Convert] Parameter " << i << " differs after reload";
+    }
+  }
+  LOG(INFO) << "[Convert] Saved " << snapshot.tensors().size()
+            << " tensors into " << argv[2];
+  return 0;
+}
@@ -7,7 +7,9 @@
  */
 
 #include <stdlib.h>
+#include <atomic>
 #include <cstring>
+#include <functional>
 #include <fstream>
 #include <iomanip>
 #include <mutex>
@@ -18,19 +20,24 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include "common/CompiledLexicon.h"
 #include "common/Defines.h"
 #include "common/Dictionary.h"
+#include "common/Trace.h"
 #include "common/Transforms.h"
 #include "common/Utils.h"
 #include "criterion/criterion.h"
 #include "data/Featurize.h"
+#include "data/SpectrogramMask.h"
 #include "decoder/Decoder.hpp"
 #include "decoder/KenLM.hpp"
 #include "decoder/Trie.hpp"
 #include "module/module.h"
 #include "runtime/Data.h"
+#include "runtime/EmissionStore.h"
 #include "runtime/Logger.h"
 #include "runtime/Serial.h"
+#include "runtime/Snapshot.h"
 
 using namespace w2l;
 
@@ -63,6 +70,7 @@ int main(int argc, char** argv) {
         << "One and only one of flag -am and -emission_dir should be set.";
   }
   EmissionSet emissionSet;
+  std::shared_ptr<EmissionStoreReader> emissionStore;
 
   /* Using acoustic model */
   std::shared_ptr<fl::Module> network;
@@ -71,7 +79,7 @@ int main(int argc, char** argv) {
     std::unordered_map<std::string, std::string> cfg;
     LOG(INFO) << "[Network] Reading acoustic model from " << FLAGS_am;
 
-    W2lSerializer::load(FLAGS_am, cfg, network, criterion);
+    loadModel(FLAGS_am, cfg, network, criterion);
     network->eval();
     LOG(INFO) << "[Network] " << network->prettyString();
     if (criterion) {
@@ -89,12 +97,22 @@ int main(int argc, char** argv) {
   }
   /* Using existing emissions */
   else {
-    std::string cleanedTestPath = cleanFilepath(FLAGS_test);
-    std::string loadPath =
-        pathsConcat(FLAGS_emission_dir, cleanedTestPath + ".bin");
-    LOG(INFO) << "[Serialization] Loading file: " << loadPath;
-    W2lSerializer::load(loadPath, emissionSet);
-    gflags::ReadFlagsFromString(emissionSet.gflags, gflags::GetArgv0(), true);
+    if (FLAGS_emission_shards > 0) {
+      // shards are mapped lazily while decoding, see runtime/EmissionStore.h
+      auto storePath = emissionStorePath(FLAGS_emission_dir, FLAGS_test);
+      LOG(INFO) << "[Serialization] Opening emission store: " << storePath;
+      emissionStore = std::make_shared<EmissionStoreReader>(storePath);
+      gflags::ReadFlagsFromString(
+          emissionStore->meta().gflags, gflags::GetArgv0(), true);
+    } else {
+      std::string cleanedTestPath = cleanFilepath(FLAGS_test);
+      std::string loadPath =
+          pathsConcat(FLAGS_emission_dir, cleanedTestPath + ".bin");
+      LOG(INFO) << "[Serialization] Loading file: " << loadPath;
+      W2lSerializer::load(loadPath, emissionSet);
+      gflags::ReadFlagsFromString(
+          emissionSet.gflags, gflags::GetArgv0(), true);
+    }
   }
 
   // override with user-specified flags
@@ -104,6 +122,9 @@ int main(int argc, char** argv) {
   }
 
   LOG(INFO) << "Gflags after parsing \n" << serializeGflags("; ");
+  if (!FLAGS_tracefile.empty() || FLAGS_tracesummary) {
+    Tracer::get().enable(FLAGS_tracefile, FLAGS_tracesample);
+  }
 
   /* ===================== Create Dictionary ===================== */
 
@@ -114,6 +135,9 @@ int main(int argc, char** argv) {
   auto lexicon = loadWords(FLAGS_lexicon, FLAGS_maxword);
   auto wordDict = createWordDict(lexicon);
   LOG(INFO) << "Number of words: " << wordDict.indexSize();
+  // read-only from here on, and hot while scoring
+  tokenDict.freeze();
+  wordDict.freeze();
 
   DictionaryMap dicts = {{kTargetIdx, tokenDict}, {kWordIdx, wordDict}};
 
@@ -128,6 +152,11 @@ int main(int argc, char** argv) {
     ds->shuffle(3);
     LOG(INFO) << "[Serialization] Running forward pass ...";
 
+    std::shared_ptr<SpectrogramMask> zeroMask;
+    if (!FLAGS_maskspec.empty()) {
+      zeroMask = SpectrogramMask::get(FLAGS_maskspec);
+    }
+
     int cnt = 0;
     for (auto& sample : *ds) {
       auto rawinput = sample[kInputIdx];
@@ -135,17 +164,9 @@ int main(int argc, char** argv) {
       auto mean = af::mean<float>(rawinput);
       auto stdev = af::stdev<float>(rawinput);
       auto finalinput = (rawinput - mean) / stdev;
-      /*
-      std::ifstream zerof("zero.txt");
-      std::string line;
-      int row, col;
-      while(std::getline(zerof, line))
-      {
-	 row = std::atoi(line.c_str());
-         std::getline(zerof, line);
-         col = std::atoi(line.c_str());
-         finalinput(row, col, af::span, af::span) = 0;
-      }*/
+      if (zeroMask) {
+        finalinput = zeroMask->apply(finalinput);
+      }
 
 
       auto rawEmission =
@@ -180,7 +201,10 @@ int main(int argc, char** argv) {
   nSample = FLAGS_maxload > 0 ? std::min(nSample, FLAGS_maxload) : nSample;
   int nSamplePerThread =
       std::ceil(nSample / static_cast<float>(FLAGS_nthread_decoder));
-  LOG(INFO) << "[Dataset] Number of samples per thread: " << nSamplePerThread;
+  if (!emissionStore) {
+    LOG(INFO) << "[Dataset] Number of samples per thread: "
+              << nSamplePerThread;
+  }
 
   /* ===================== Decode ===================== */
   // Prepare counters
@@ -199,7 +223,8 @@ int main(int argc, char** argv) {
     LOG(FATAL) << "[Decoder] Invalid model type: " << FLAGS_criterion;
   }
 
-  const auto& transition = emissionSet.transition;
+  const auto& transition = emissionStore ? emissionStore->meta().transition
+                                         : emissionSet.transition;
 
   // Prepare decoder options
   DecoderOptions decoderOpt(
@@ -275,16 +300,22 @@ int main(int argc, char** argv) {
       std::make_shared<Trie>(tokenDict.indexSize(), silIdx);
   auto start_state = lm->start(false);
 
-  for (auto& it : lexicon) {
-    std::string word = it.first;
+  auto compiledLexicon = FLAGS_lexiconcache.empty()
+      ? std::make_shared<CompiledLexicon>(lexicon, tokenDict)
+      : loadCompiledLexicon(
+            FLAGS_lexicon, FLAGS_maxword, tokenDict, FLAGS_lexiconcache);
+  for (int64_t w = 0; w < compiledLexicon->size(); ++w) {
+    std::string word = compiledLexicon->word(w);
     int lmIdx = lm->index(word);
     if (lmIdx == unkIdx) { // We don't insert unknown words
       continue;
     }
     float score;
     auto dummyState = lm->score(start_state, lmIdx, score);
-    for (auto& tokens : it.second) {
-      auto tokensTensor = tokens2Tensor(tokens, tokenDict);
+    for (int64_t s = 0; s < compiledLexicon->numSpellings(w); ++s) {
+      auto spelling = compiledLexicon->spelling(w, s);
+      std::vector<int> tokensTensor(spelling.begin(), spelling.end());
+      replaceReplabels(tokensTensor, FLAGS_replabel, tokenDict);
       trie->insert(
           tokensTensor,
           std::make_shared<TrieLabel>(lmIdx, wordDict.getIndex(word)),
@@ -305,8 +336,21 @@ int main(int argc, char** argv) {
   trie->smear(smear_mode);
   LOG(INFO) << "[Decoder] Trie smeared.\n";
 
-  // Decoding
-  auto runDecoder = [&](int tid, int start, int end) {
+  // One utterance handed to a decoder thread
+  struct DecodeSample {
+    const float* emission;
+    int T;
+    int N;
+    std::vector<int> wordTarget;
+    std::vector<int> letterTarget;
+    std::string sampleId;
+    float progress; // through the thread's current slice or shard
+  };
+
+  // Decoding; `next` fills in the next sample for thread `tid` and returns
+  // false once there is nothing left
+  auto runDecoder = [&](int tid,
+                        std::function<bool(DecodeSample&)> next) {
     try {
       // Build Decoder
       std::shared_ptr<TrieLabel> unk =
@@ -316,22 +360,22 @@ int main(int argc, char** argv) {
 
       // Get data and run decoder
       TestMeters meters;
-      int sliceSize = end - start;
+      int sliceSize = 0;
       meters.timer.resume();
-      for (int s = start; s < end; s++) {
-        auto emission = emissionSet.emissions[s];
-        auto wordTarget = emissionSet.wordTargets[s];
-        auto letterTarget = emissionSet.letterTargets[s];
-        auto sampleId = emissionSet.sampleIds[s];
-        auto T = emissionSet.emissionT[s];
-        auto N = emissionSet.emissionN;
+      DecodeSample sample;
+      std::string wordTargetStr, wordPredictionStr;
+      while (next(sample)) {
+        auto& wordTarget = sample.wordTarget;
+        auto& letterTarget = sample.letterTarget;
+        const auto& sampleId = sample.sampleId;
 
         std::vector<float> score;
         std::vector<std::vector<int>> wordPredictions;
         std::vector<std::vector<int>> letterPredictions;
 
         std::tie(score, wordPredictions, letterPredictions) = decoder.decode(
-            decoderOpt, transition.data(), emission.data(), T, N);
+            decoderOpt, transition.data(), sample.emission, sample.T, sample.N);
+        Tracer::count("decoder/frames", sample.T);
 
         // Cleanup predictions
         auto wordPrediction = wordPredictions[0];
@@ -360,8 +404,8 @@ int main(int argc, char** argv) {
           meters.wer.add(wordPrediction, wordTarget);
           meters.ler.add(letterPrediction, letterTarget);
 
-          auto wordTargetStr = tensor2words(wordTarget, wordDict);
-          auto wordPredictionStr = tensor2words(wordPrediction, wordDict);
+          tensor2words(wordTarget, wordDict, wordTargetStr);
+          tensor2words(wordPrediction, wordDict, wordPredictionStr);
 
           std::stringstream buffer;
           buffer << "|T|: " << wordTargetStr << std::endl;
@@ -377,8 +421,7 @@ int main(int argc, char** argv) {
                  << "\%, LER: " << meters.ler.value()[0]
                  << "\%, slice WER: " << meters.werSlice.value()[0]
                  << "\%, slice LER: " << meters.lerSlice.value()[0]
-                 << "\%, progress: "
-                 << static_cast<float>(s - start + 1) / sliceSize * 100 << "\%]"
+                 << "\%, progress: " << sample.progress * 100 << "\%]"
                  << std::endl;
 
           std::cout << buffer.str();
@@ -393,6 +436,7 @@ int main(int argc, char** argv) {
         // Update conters
         sliceNumWords[tid] += wordTarget.size();
         sliceNumLetters[tid] += letterTarget.size();
+        ++sliceSize;
       }
       meters.timer.stop();
       sliceWer[tid] = meters.werSlice.value()[0];
@@ -406,14 +450,68 @@ int main(int argc, char** argv) {
 
   /* Spread threades */
   auto startThreads = [&]() {
+    // shared by the threads below, so it must outlive the pool
+    std::atomic<int64_t> nextShard(0);
+    std::atomic<int> nClaimed(0);
     fl::ThreadPool threadPool(FLAGS_nthread_decoder);
+    if (emissionStore) {
+      // every thread takes whole shards as soon as the producer seals them
+      const auto& meta = emissionStore->meta();
+      for (int i = 0; i < FLAGS_nthread_decoder; i++) {
+        std::shared_ptr<EmissionShard> shard;
+        size_t pos = 0;
+        std::vector<float> scratch;
+        auto next = [&emissionStore, &meta, &nextShard, &nClaimed, shard,
+                     pos, scratch](DecodeSample& sample) mutable -> bool {
+          while (!shard || pos >= shard->size()) {
+            shard = emissionStore->shard(nextShard++);
+            pos = 0;
+            if (!shard) {
+              return false;
+            }
+          }
+          if (FLAGS_maxload > 0 && nClaimed++ >= FLAGS_maxload) {
+            return false;
+          }
+          const auto& rec = shard->record(pos);
+          sample.emission =
+              shard->emission(pos, meta.emissionN, meta.fp16, scratch);
+          sample.T = rec.emissionT;
+          sample.N = meta.emissionN;
+          sample.wordTarget = rec.wordTarget;
+          sample.letterTarget = rec.letterTarget;
+          sample.sampleId = rec.sampleId;
+          ++pos;
+          sample.progress = static_cast<float>(pos) / shard->size();
+          return true;
+        };
+        threadPool.enqueue(runDecoder, i, next);
+      }
+      return;
+    }
     for (int i = 0; i < FLAGS_nthread_decoder; i++) {
       int start = i * nSamplePerThread;
       if (start >= nSample) {
         break;
       }
       int end = std::min((i + 1) * nSamplePerThread, nSample);
-      threadPool.enqueue(runDecoder, i, start, end);
+      int s = start;
+      auto next = [&emissionSet, s, start, end](
+                      DecodeSample& sample) mutable -> bool {
+        if (s >= end) {
+          return false;
+        }
+        sample.emission = emissionSet.emissions[s].data();
+        sample.T = emissionSet.emissionT[s];
+        sample.N = emissionSet.emissionN;
+        sample.wordTarget = emissionSet.wordTargets[s];
+        sample.letterTarget = emissionSet.letterTargets[s];
+        sample.sampleId = emissionSet.sampleIds[s];
+        ++s;
+        sample.progress = static_cast<float>(s - start) / (end - start);
+        return true;
+      };
+      threadPool.enqueue(runDecoder, i, next);
     }
   };
   auto timer = fl::TimeMeter();
@@ -443,6 +541,10 @@ int main(int argc, char** argv) {
          << "s/sample) -- WER: " << std::setprecision(6) << totalWer
          << ", LER: " << totalLer << "]" << std::endl;
   LOG(INFO) << buffer.str();
+  if (FLAGS_tracesummary) {
+    LOG(INFO) << "[Trace]\n" << Tracer::get().summary();
+  }
+  Tracer::get().disable();
   if (!FLAGS_sclite.empty()) {
     writeLog(buffer.str());
     hypStream.close();
@@ -0,0 +1,206 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <stdlib.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <flashlight/flashlight.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "common/Defines.h"
+#include "common/Dictionary.h"
+#include "common/Transforms.h"
+#include "common/Utils.h"
+#include "criterion/criterion.h"
+#include "module/module.h"
+#include "runtime/Data.h"
+#include "runtime/Serial.h"
+#include "runtime/Snapshot.h"
+
+using namespace w2l;
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  std::string exec(argv[0]);
+  gflags::SetUsageMessage(
+      "Usage: \n " + exec +
+      " --am=[model] --quantout=[int8 model] --test=[list] [flags]");
+  if (argc <= 1) {
+    LOG(FATAL) << gflags::ProgramUsage();
+  }
+
+  /* ===================== Parse Options ===================== */
+  LOG(INFO) << "Parsing command line flags";
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  auto flagsfile = FLAGS_flagsfile;
+  if (!flagsfile.empty()) {
+    LOG(INFO) << "Reading flags from file " << flagsfile;
+    gflags::ReadFromFlagsFile(flagsfile, argv[0], true);
+  }
+
+  /* ===================== Create Network ===================== */
+  std::shared_ptr<fl::Module> network;
+  std::shared_ptr<SequenceCriterion> criterion;
+  std::unordered_map<std::string, std::string> cfg;
+  LOG(INFO) << "[Network] Reading acoustic model from " << FLAGS_am;
+  loadModel(FLAGS_am, cfg, network, criterion);
+  network->eval();
+  criterion->eval();
+  auto seqNetwork = std::dynamic_pointer_cast<fl::Sequential>(network);
+  if (!seqNetwork) {
+    LOG(FATAL) << "[Quantize] Only fl::Sequential acoustic models supported";
+  }
+
+  auto flags = cfg.find(kGflags);
+  if (flags == cfg.end()) {
+    LOG(FATAL) << "[Network] Invalid config loaded from " << FLAGS_am;
+  }
+  LOG(INFO) << "[Network] Updating flags from config file: " << FLAGS_am;
+  gflags::ReadFlagsFromString(flags->second, gflags::GetArgv0(), true);
+
+  // override with user-specified flags
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  if (!flagsfile.empty()) {
+    gflags::ReadFromFlagsFile(flagsfile, argv[0], true);
+  }
+  if (FLAGS_quantout.empty()) {
+    LOG(FATAL) << "[Quantize] --quantout is required";
+  }
+
+  /* ===================== Create Dictionary ===================== */
+  auto tokenDict = createTokenDict(pathsConcat(FLAGS_tokensdir, FLAGS_tokens));
+  int numClasses = tokenDict.indexSize();
+  auto lexicon = loadWords(FLAGS_lexicon, FLAGS_maxword);
+  auto wordDict = createWordDict(lexicon);
+  DictionaryMap dicts = {{kTargetIdx, tokenDict}, {kWordIdx, wordDict}};
+
+  auto normalize = [](const af::array& input) {
+    auto mean = af::mean<float>(input);
+    auto stdev = af::stdev<float>(input);
+    return (input - mean) / stdev;
+  };
+
+  /* ===================== Calibrate ===================== */
+  auto calibList = FLAGS_quantcalib.empty() ? FLAGS_test : FLAGS_quantcalib;
+  auto calibds = createDataset(calibList, dicts, lexicon, 1, 0, 1);
+  std::vector<af::array> calibration;
+  int64_t nCalib = std::min<int64_t>(calibds->size(), FLAGS_quantcalibsize);
+  for (int64_t i = 0; i < nCalib; ++i) {
+    calibration.emplace_back(normalize(calibds->get(i)[kInputIdx]));
+  }
+  LOG(INFO) << "[Quantize] Calibrating on " << nCalib << " utterances of "
+            << calibList;
+
+  int64_t nFeatures = nCalib > 0 ? calibration.front().dims(1) : 0;
+  auto archLines = getW2lArchLines(
+      pathsConcat(FLAGS_archdir, FLAGS_arch), nFeatures, numClasses);
+  auto qnetwork = quantizeW2lSeqModule(seqNetwork, archLines, calibration);
+  calibration.clear();
+  LOG(INFO) << "[Quantize] " << qnetwork->prettyString();
+
+  saveSnapshot(FLAGS_quantout, cfg, qnetwork, criterion);
+  LOG(INFO) << "[Quantize] Saved int8 model to " << FLAGS_quantout;
+
+  /* ===================== Compare ===================== */
+  struct ModelStats {
+    fl::EditDistanceMeter wer;
+    fl::EditDistanceMeter ler;
+    fl::TimeMeter timer;
+  };
+  ModelStats floatStats, int8Stats;
+
+  /* viterbiPath + remove duplication/blank, as in Test */
+  auto score = [&](const af::array& emission,
+                   const std::vector<int>& ltrTarget,
+                   const std::vector<int>& wrdTarget,
+                   ModelStats& stats) {
+    auto viterbiPath = afToVector<int>(criterion->viterbiPath(emission));
+    if (FLAGS_criterion == kCtcCriterion || FLAGS_criterion == kAsgCriterion) {
+      uniq(viterbiPath);
+    }
+    if (FLAGS_criterion == kCtcCriterion) {
+      auto blankidx = tokenDict.getIndex(kBlankToken);
+      viterbiPath.erase(
+          std::remove(viterbiPath.begin(), viterbiPath.end(), blankidx),
+          viterbiPath.end());
+    }
+    remapLabels(viterbiPath, tokenDict);
+    auto wordViterbi = tknTensor2wrdTensor(
+        viterbiPath, wordDict, tokenDict, tokenDict.getIndex(kSilToken));
+    stats.ler.add(viterbiPath, ltrTarget);
+    stats.wer.add(wordViterbi, wrdTarget);
+  };
+
+  auto ds = createDataset(FLAGS_test, dicts, lexicon, 1, 0, 1);
+  int64_t nSamples = ds->size();
+  if (FLAGS_maxload > 0) {
+    nSamples = std::min<int64_t>(nSamples, FLAGS_maxload);
+  }
+  float maxDiff = 0;
+  int64_t nFrames = 0, nAgree = 0;
+  for (int64_t i = 0; i < nSamples; ++i) {
+    auto sample = ds->get(i);
+    auto input = normalize(sample[kInputIdx]);
+    input.eval();
+    af::sync();
+    auto ltrTarget = afToVector<int>(sample[kTargetIdx]);
+    auto wrdTarget = afToVector<int>(sample[kWordIdx]);
+    remapLabels(ltrTarget, tokenDict);
+
+    floatStats.timer.resume();
+    auto floatOut = seqNetwork->forward({fl::input(input)}).front().array();
+    floatOut.eval();
+    af::sync();
+    floatStats.timer.stop();
+
+    int8Stats.timer.resume();
+    auto int8Out = qnetwork->forward({fl::input(input)}).front().array();
+    int8Out.eval();
+    af::sync();
+    int8Stats.timer.stop();
+
+    score(floatOut, ltrTarget, wrdTarget, floatStats);
+    score(int8Out, ltrTarget, wrdTarget, int8Stats);
+
+    af::array floatMax, floatIdx, int8Max, int8Idx;
+    af::max(floatMax, floatIdx, floatOut, 0);
+    af::max(int8Max, int8Idx, int8Out, 0);
+    maxDiff = std::max(maxDiff, af::max<float>(af::abs(floatOut - int8Out)));
+    nAgree += af::count<int64_t>(floatIdx == int8Idx);
+    nFrames += floatIdx.elements();
+  }
+
+  auto row = [nSamples](const std::string& name, ModelStats& stats) {
+    return format(
+        "%-6s %8.2f %8.2f %10.2f",
+        name.c_str(),
+        stats.wer.value()[0],
+        stats.ler.value()[0],
+        stats.timer.value() * 1000 / std::max<int64_t>(nSamples, 1));
+  };
+  std::cout << "---\n[Quantize] " << nSamples << " utterances of "
+            << FLAGS_test << "\n"
+            << format("%-6s %8s %8s %10s", "model", "WER", "LER", "ms/utt")
+            << "\n"
+            << row("float", floatStats) << "\n"
+            << row("int8", int8Stats) << "\n"
+            << format(
+                   "speedup %.2fx, frame argmax agreement %.2f%%, "
+                   "max |emission diff| %.4f",
+                   floatStats.timer.value() /
+                       std::max(int8Stats.timer.value(), 1e-9),
+                   100.0 * nAgree / std::max<int64_t>(nFrames, 1),
+                   maxDiff)
+            << std::endl;
+  return 0;
+}
@@ -7,7 +7,13 @@
  */
 
 #include <stdlib.h>
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -17,17 +23,20 @@
 
 #include "common/Defines.h"
 #include "common/Dictionary.h"
+#include "common/Trace.h"
 #include "common/Transforms.h"
 #include "common/Utils.h"
 #include "criterion/criterion.h"
+#include "data/SpectrogramMask.h"
 #include "module/module.h"
 #include "runtime/Data.h"
+#include "runtime/Diagnostics.h"
+#include "runtime/EmissionStore.h"
 #include "runtime/Logger.h"
 #include "runtime/Serial.h"
+#include "runtime/Snapshot.h"
 
 using namespace w2l;
-//zeroMode = 1 means use zero mode;
-bool zeroMode = 0;
 
 int main(int argc, char** argv) {
   google::InitGoogleLogging(argv[0]);
@@ -57,7 +66,7 @@ int main(int argc, char** argv) {
   std::shared_ptr<SequenceCriterion> criterion;
   std::unordered_map<std::string, std::string> cfg;
   LOG(INFO) << "[Network] Reading acoustic model from " << FLAGS_am;
-  W2lSerializer::load(FLAGS_am, cfg, network, criterion);
+  loadModel(FLAGS_am, cfg, network, criterion);
   network->eval();
   criterion->eval();
 
@@ -79,6 +88,9 @@ int main(int argc, char** argv) {
   }
 
   LOG(INFO) << "Gflags after parsing \n" << serializeGflags("; ");
+  if (!FLAGS_tracefile.empty() || FLAGS_tracesummary) {
+    Tracer::get().enable(FLAGS_tracefile, FLAGS_tracesample);
+  }
   /* ===================== Create Dictionary ===================== */
 
   auto tokenDict = createTokenDict(pathsConcat(FLAGS_tokensdir, FLAGS_tokens));
@@ -88,6 +100,9 @@ int main(int argc, char** argv) {
   auto lexicon = loadWords(FLAGS_lexicon, FLAGS_maxword);
   auto wordDict = createWordDict(lexicon);
   LOG(INFO) << "Number of words: " << wordDict.indexSize();
+  // read-only from here on, and hot while scoring
+  tokenDict.freeze();
+  wordDict.freeze();
 
   DictionaryMap dicts = {{kTargetIdx, tokenDict}, {kWordIdx, wordDict}};
 
@@ -98,83 +113,62 @@ int main(int argc, char** argv) {
   auto ds = createDataset(FLAGS_test, dicts, lexicon, 1, worldRank, worldSize);
 
   ds->shuffle(3);
+  // --maxload only applies with --show
   int nSamples = ds->size();
-  if (FLAGS_maxload > 0) {
+  if (FLAGS_show && FLAGS_maxload > 0) {
     nSamples = std::min(nSamples, FLAGS_maxload);
   }
   LOG(INFO) << "[Dataset] Dataset loaded.";
+
+  std::function<af::array(const af::array&)> forward =
+      [&network](const af::array& input) {
+        W2L_TRACE_SCOPE("test/forward");
+        return network->forward({fl::input(input)}).front().array();
+      };
+  if (FLAGS_inferencegraph && nSamples > 0) {
+    auto seqNetwork = std::dynamic_pointer_cast<fl::Sequential>(network);
+    if (!seqNetwork) {
+      LOG(FATAL) << "[Network] --inferencegraph needs a Sequential network";
+    }
+    auto archLines = getW2lArchLines(
+        pathsConcat(FLAGS_archdir, FLAGS_arch),
+        ds->get(0)[kInputIdx].dims(1),
+        numClasses);
+    auto graph = std::make_shared<InferenceGraph>(seqNetwork, archLines);
+    LOG(INFO) << "[Network] " << graph->prettyString();
+    forward = [graph](const af::array& input) {
+      W2L_TRACE_SCOPE("test/forward");
+      return graph->forward(input);
+    };
+  }
   /* ===================== Test ===================== */
   TestMeters meters;
 
   EmissionSet emissionSet;
   meters.timer.resume();
   int cnt = 1;
-  for (auto& sample:*ds){
-  bool whether_threhold = true;
-  auto rawinput = sample[kInputIdx];
-  
-  //to get prefft.txt
-  std::ofstream preinput("/root/w2l/aboutFft/myfft.txt");
-  if(preinput.is_open()){
-  	preinput<<af::toString("myfft input:",rawinput);
-  	preinput.close();
+  std::shared_ptr<SpectrogramMask> zeroMask;
+  if (!FLAGS_maskspec.empty()) {
+    zeroMask = SpectrogramMask::get(FLAGS_maskspec);
   }
-  af::array finalinput;
-   
-  LOG(INFO)<<"rawinput 's dimension"<<rawinput.dims();
-  int countzero=0;
-    if(zeroMode)  //rawinput = raw audio
-    {
-	std::cout<<"read zero 's mode";
-
-    	std::ifstream zerof("/root/wav2letter/50low.txt");
-    	std::string line;
-    	int row, col;
-    	while(std::getline(zerof, line))
-    	{
-		countzero+=1;
-		col = std::atoi(line.c_str());
-         	std::getline(zerof, line);
-         	row = std::atoi(line.c_str());
-         	//LOG(INFO)<<"cols,raw "<<row<<' '<<col<<'\t';
-		rawinput(row, col/2, af::span, af::span) = 0;
-		//LOG(INFO)<<af::sum<float>(finalinput(row,col/2,af::span,af::span));
-    	}
-	zerof.close();
-        //normalize after zeros
-	auto mean = af::mean<float>(rawinput);
-    	auto stdev = af::stdev<float>(rawinput);
-        finalinput = (rawinput - mean) / stdev;
-    }
-    else  // rawinput = audio from zeros fft
-    {    
-    	auto mean = af::mean<float>(rawinput);
-    	auto stdev = af::stdev<float>(rawinput);
-    	finalinput = (rawinput - mean) / stdev;
-    }
-    std::cout<<"zeros number::"<<countzero<<std::endl;
-	//edit @5.27
-    auto rawEmission = network->forward({fl::input(finalinput)}).front();
-	std::ofstream nowOutFile("/root/w2l/CTC/last_Test_Output.txt");
-            if(nowOutFile.is_open())
-            {
-               nowOutFile<<af::toString("lastOutput is:", rawEmission.array());
-               nowOutFile.close();
-            }
-	//endedit @5.27
-
-    std::string emisspath = "/root/w2l/rawEmission.bin";
-    W2lSerializer::save(emisspath, rawEmission);
-    LOG(INFO) << "rawEmission norm is:" << af::norm(rawEmission.array()); 
-
-
-    auto emission = afToVector<float>(rawEmission);
-    auto ltrTarget = afToVector<int>(sample[kTargetIdx]);
-    auto wrdTarget = afToVector<int>(sample[kWordIdx]);
-
-    /* viterbiPath + remove duplication/blank */
-    auto viterbiPath =
-        afToVector<int>(criterion->viterbiPath(rawEmission.array()));
+  DiagnosticsWriter diagnostics(FLAGS_diagdir, FLAGS_diaginterval);
+
+  // host-side view of one decoded utterance
+  struct UttResult {
+    std::vector<float> emission;
+    std::vector<int> ltrTarget;
+    std::vector<int> wrdTarget;
+    std::vector<int> viterbiPath;
+    std::vector<int> wordViterbi;
+    std::string sampleId;
+    int N;
+    int T;
+  };
+
+  /* viterbiPath + remove duplication/blank, then map to words */
+  auto decode = [&tokenDict, &wordDict](UttResult& res) {
+    W2L_TRACE_SCOPE("test/decode");
+    auto& viterbiPath = res.viterbiPath;
     if (FLAGS_criterion == kCtcCriterion || FLAGS_criterion == kAsgCriterion) {
       uniq(viterbiPath);
     }
@@ -185,23 +179,30 @@ int main(int argc, char** argv) {
           viterbiPath.end());
     }
     remapLabels(viterbiPath, tokenDict);
-    remapLabels(ltrTarget, tokenDict);
-
-    meters.lerSlice.add(viterbiPath, ltrTarget);
-
-    auto wordViterbi = tknTensor2wrdTensor(
-        viterbiPath, wordDict, tokenDict, tokenDict.getIndex(kSilToken));
-
-    meters.werSlice.add(wordViterbi, wrdTarget);
+    remapLabels(res.ltrTarget, tokenDict);
+    std::string word;
+    tknTensor2wrdTensor(
+        viterbiPath,
+        wordDict,
+        tokenDict,
+        tokenDict.getIndex(kSilToken),
+        res.wordViterbi,
+        word);
+  };
+
+  auto score = [&meters, &cnt, &nSamples, &tokenDict](const UttResult& res) {
+    meters.lerSlice.add(res.viterbiPath, res.ltrTarget);
+    meters.werSlice.add(res.wordViterbi, res.wrdTarget);
 
     if (FLAGS_show) {
       meters.ler.reset();
       meters.wer.reset();
-      meters.ler.add(viterbiPath, ltrTarget);
-      meters.wer.add(wordViterbi, wrdTarget);
+      meters.ler.add(res.viterbiPath, res.ltrTarget);
+      meters.wer.add(res.wordViterbi, res.wrdTarget);
 
-      std::cout << "|T|: " << tensor2letters(ltrTarget, tokenDict) << std::endl;
-      std::cout << "|P|: " << tensor2letters(viterbiPath, tokenDict)
+      std::cout << "|T|: " << tensor2letters(res.ltrTarget, tokenDict)
+                << std::endl;
+      std::cout << "|P|: " << tensor2letters(res.viterbiPath, tokenDict)
                 << std::endl;
       std::cout << "[sample: " << cnt << ", WER: " << meters.wer.value()[0]
                 << "\%, LER: " << meters.ler.value()[0]
@@ -210,24 +211,254 @@ int main(int argc, char** argv) {
                 << "\%, progress: " << static_cast<float>(cnt) / nSamples * 100
                 << "\%]" << std::endl;
       ++cnt;
-      if (cnt == FLAGS_maxload) {
-        break;
+    }
+  };
+
+  // with --emission_shards the decoder can start on the first shard while
+  // the rest of the test set is still being evaluated
+  std::unique_ptr<EmissionStoreWriter> emissionStore;
+  if (FLAGS_emission_shards > 0) {
+    std::vector<float> transition;
+    if (FLAGS_criterion == kAsgCriterion) {
+      transition = afToVector<float>(criterion->param(0).array());
+    }
+    auto storePath = emissionStorePath(FLAGS_emission_dir, FLAGS_test);
+    LOG(INFO) << "[Serialization] Streaming emissions into: " << storePath;
+    emissionStore.reset(new EmissionStoreWriter(
+        storePath,
+        FLAGS_emission_shards,
+        FLAGS_emission_fp16,
+        transition,
+        serializeGflags()));
+  }
+
+  /* Save emission and targets */
+  auto store = [&emissionSet, &emissionStore](UttResult& res) {
+    if (emissionStore) {
+      emissionStore->add(
+          res.emission,
+          res.N,
+          res.T,
+          res.wrdTarget,
+          res.ltrTarget,
+          res.sampleId);
+      return;
+    }
+    emissionSet.emissions.emplace_back(std::move(res.emission));
+    emissionSet.letterTargets.emplace_back(std::move(res.ltrTarget));
+    emissionSet.wordTargets.emplace_back(std::move(res.wrdTarget));
+    emissionSet.sampleIds.emplace_back(std::move(res.sampleId));
+    emissionSet.emissionT.emplace_back(res.T);
+    emissionSet.emissionN = res.N;
+  };
+
+  // zero the masked bins, then normalize per utterance
+  auto normalize = [&zeroMask](af::array rawinput) {
+    if (zeroMask) {
+      rawinput = zeroMask->apply(rawinput);
+    }
+    auto mean = af::mean<float>(rawinput);
+    auto stdev = af::stdev<float>(rawinput);
+    return (rawinput - mean) / stdev;
+  };
+
+  int64_t nProcessed = 0;
+  fl::TimeMeter loadTimer, fwdTimer, scoreTimer;
+  std::atomic<int64_t> workerScoreUs(0);
+  if (FLAGS_evalbatchsize <= 1) {
+    for (int64_t i = 0; i < nSamples; ++i) {
+      loadTimer.resume();
+      auto sample = ds->get(i);
+      auto rawinput = sample[kInputIdx];
+
+      // to get prefft.txt
+      diagnostics.sample("myfft", rawinput, cnt);
+      LOG(INFO) << "rawinput 's dimension" << rawinput.dims();
+      auto finalinput = normalize(rawinput);
+      loadTimer.stop();
+
+      fwdTimer.resume();
+      auto rawEmission = fl::Variable(forward(finalinput), false);
+      diagnostics.sample("last_Test_Output", rawEmission.array(), cnt);
+
+      std::string emisspath = "/root/w2l/rawEmission.bin";
+      W2lSerializer::save(emisspath, rawEmission);
+      LOG(INFO) << "rawEmission norm is:" << af::norm(rawEmission.array());
+
+      UttResult res;
+      res.emission = afToVector<float>(rawEmission);
+      res.viterbiPath =
+          afToVector<int>(criterion->viterbiPath(rawEmission.array()));
+      fwdTimer.stop();
+
+      scoreTimer.resume();
+      res.ltrTarget = afToVector<int>(sample[kTargetIdx]);
+      res.wrdTarget = afToVector<int>(sample[kWordIdx]);
+      // while testing we use batchsize 1 and hence ds only has 1 sampleid
+      res.sampleId = afToVector<std::string>(sample[kFileIdIdx]).front();
+      res.N = rawEmission.dims(0);
+      res.T = rawEmission.dims(1);
+      Tracer::count("test/frames", res.T);
+      decode(res);
+      score(res);
+      ++nProcessed;
+      store(res);
+      scoreTimer.stop();
+    }
+  } else {
+    // Utterances are grouped into buckets of similar input length and run
+    // through the network as one zero-padded batch; the emission of each
+    // utterance is cropped to the output length of its own input, from the
+    // strides and filters of the arch (see getW2lOutputFrames). The forward
+    // pass and the viterbi alignment stay on this thread while
+    // post-processing runs on `evalworkers` threads. Results are scored in
+    // dataset order so meters, --show output and the emission set match the
+    // sequential loop. With the default --evalbucketwidth=0 a batch never
+    // holds padding, so emissions (and therefore WER/LER) are identical.
+    // A bucket runs when full, or once its oldest utterance is `window`
+    // utterances old: at most that many inputs and results wait, whatever
+    // the size of the test set.
+    struct PendingUtt {
+      int64_t idx;
+      af::array input;
+      std::vector<af::array> sample;
+    };
+    fl::ThreadPool workers(std::max<int64_t>(FLAGS_evalworkers, 1));
+    std::vector<std::future<UttResult>> futures(nSamples);
+    std::vector<bool> launched(nSamples, false);
+    std::map<int64_t, std::vector<PendingUtt>> buckets;
+    const int64_t window = 4 * FLAGS_evalbatchsize;
+    int64_t nextScore = 0;
+    af::array lastEmission;
+
+    int64_t bucketWidth = std::max<int64_t>(FLAGS_evalbucketwidth, 0) + 1;
+    std::vector<std::string> archLines;
+    if (bucketWidth > 1 && nSamples > 0) {
+      auto firstInput = ds->get(0)[kInputIdx];
+      archLines = getW2lArchLines(
+          pathsConcat(FLAGS_archdir, FLAGS_arch),
+          firstInput.dims(1),
+          numClasses);
+      if (getW2lOutputFrames(archLines, firstInput.dims(0)) < 0) {
+        LOG(WARNING) << "[Test] output length of " << FLAGS_arch
+                     << " unknown, batching equal-length utterances only";
+        bucketWidth = 1;
       }
     }
 
-    /* Save emission and targets */
-    int N = rawEmission.dims(0);
-    int T = rawEmission.dims(1);
-    emissionSet.emissions.emplace_back(emission);
-    emissionSet.letterTargets.emplace_back(ltrTarget);
-    emissionSet.wordTargets.emplace_back(wrdTarget);
+    // score every finished utterance at the front of the dataset order
+    auto drain = [&](bool wait) {
+      while (nextScore < nSamples && launched[nextScore]) {
+        auto& fut = futures[nextScore];
+        if (!wait &&
+            fut.wait_for(std::chrono::seconds(0)) !=
+                std::future_status::ready) {
+          break;
+        }
+        scoreTimer.resume();
+        auto res = fut.get();
+        score(res);
+        store(res);
+        scoreTimer.stop();
+        ++nextScore;
+      }
+    };
 
-    // while testing we use batchsize 1 and hence ds only has 1 sampleid
-    emissionSet.sampleIds.emplace_back(
-        afToVector<std::string>(sample[kFileIdIdx]).front());
+    auto runBatch = [&](std::vector<PendingUtt>& batch) {
+      fwdTimer.resume();
+      int64_t maxT = 0;
+      for (auto& utt : batch) {
+        maxT = std::max<int64_t>(maxT, utt.input.dims(0));
+      }
+      auto inDims = batch.front().input.dims();
+      af::array padded = af::constant(
+          0.0, maxT, inDims[1], inDims[2], batch.size(), af::dtype::f32);
+      for (size_t b = 0; b < batch.size(); ++b) {
+        auto& in = batch[b].input;
+        padded(af::seq(in.dims(0)), af::span, af::span, static_cast<int>(b)) =
+            in;
+      }
+      auto output = forward(padded);
+      int64_t outT = output.dims(1);
+      if (bucketWidth > 1) {
+        LOG_IF(FATAL, getW2lOutputFrames(archLines, maxT) != outT)
+            << "[Test] " << FLAGS_arch << " gives " << outT << " frames for "
+            << maxT << ", not " << getW2lOutputFrames(archLines, maxT);
+      }
+      for (size_t b = 0; b < batch.size(); ++b) {
+        auto& utt = batch[b];
+        // frames of the output that only saw padding are dropped
+        int64_t inT = utt.input.dims(0);
+        int64_t T = (inT == maxT) ? outT : getW2lOutputFrames(archLines, inT);
+        af::array emission =
+            output(af::span, af::seq(T), static_cast<int>(b));
+        diagnostics.sample("last_Test_Output", emission, utt.idx + 1);
+        auto viterbiPath = criterion->viterbiPath(emission);
+
+        auto res = std::make_shared<UttResult>();
+        res->emission = afToVector<float>(emission);
+        res->viterbiPath = afToVector<int>(viterbiPath);
+        res->ltrTarget = afToVector<int>(utt.sample[kTargetIdx]);
+        res->wrdTarget = afToVector<int>(utt.sample[kWordIdx]);
+        res->sampleId =
+            afToVector<std::string>(utt.sample[kFileIdIdx]).front();
+        res->N = emission.dims(0);
+        res->T = T;
+        Tracer::count("test/frames", T);
+        if (utt.idx == nSamples - 1) {
+          lastEmission = emission;
+        }
+        futures[utt.idx] =
+            workers.enqueue([res, &decode, &workerScoreUs]() -> UttResult {
+              auto start = std::chrono::steady_clock::now();
+              decode(*res);
+              auto elapsed = std::chrono::steady_clock::now() - start;
+              workerScoreUs +=
+                  std::chrono::duration_cast<std::chrono::microseconds>(
+                      elapsed)
+                      .count();
+              return std::move(*res);
+            });
+        launched[utt.idx] = true;
+        ++nProcessed;
+      }
+      fwdTimer.stop();
+      batch.clear();
+      drain(false);
+    };
+
+    for (int64_t i = 0; i < nSamples; ++i) {
+      loadTimer.resume();
+      auto sample = ds->get(i);
+      diagnostics.sample("myfft", sample[kInputIdx], i + 1);
+      auto input = normalize(sample[kInputIdx]);
+      loadTimer.stop();
+
+      auto key = input.dims(0) / bucketWidth;
+      auto& bucket = buckets[key];
+      bucket.push_back({i, input, std::move(sample)});
+      if (static_cast<int64_t>(bucket.size()) >= FLAGS_evalbatchsize) {
+        runBatch(bucket);
+        buckets.erase(key);
+      }
+      for (auto it = buckets.begin(); it != buckets.end();) {
+        if (i - it->second.front().idx >= window) {
+          runBatch(it->second);
+          it = buckets.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+    for (auto& bucket : buckets) {
+      runBatch(bucket.second);
+    }
+    drain(true);
 
-    emissionSet.emissionT.emplace_back(T);
-    emissionSet.emissionN = N;
+    if (!lastEmission.isempty()) {
+      std::string emisspath = "/root/w2l/rawEmission.bin";
+      W2lSerializer::save(emisspath, fl::Variable(lastEmission, false));
+    }
   }
   if (FLAGS_criterion == kAsgCriterion) {
     emissionSet.transition = afToVector<float>(criterion->param(0).array());
@@ -238,8 +469,24 @@ int main(int argc, char** argv) {
   std::cout << "---\n[total WER: " << meters.werSlice.value()[0]
             << "\%, total LER: " << meters.lerSlice.value()[0]
             << "\%, time: " << meters.timer.value() << "s]" << std::endl;
+  std::cout << "[load: " << loadTimer.value()
+            << "s, forward+viterbi: " << fwdTimer.value()
+            << "s, scoring: " << scoreTimer.value()
+            << "s, worker scoring: " << workerScoreUs / 1e6
+            << "s, throughput: " << nProcessed / meters.timer.value()
+            << " utt/s]" << std::endl;
+  if (FLAGS_tracesummary) {
+    LOG(INFO) << "[Trace]\n" << Tracer::get().summary();
+  }
+  Tracer::get().disable();
 
   /* ====== Serialize emission and targets for decoding ====== */
+  if (emissionStore) {
+    emissionStore->close();
+    LOG(INFO) << "[Serialization] Stored " << emissionStore->size()
+              << " emissions";
+    return 0;
+  }
   std::string cleanedTestPath = cleanFilepath(FLAGS_test);
   std::string savePath =
       pathsConcat(FLAGS_emission_dir, cleanedTestPath + ".bin");
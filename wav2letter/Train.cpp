@@ -20,6 +20,7 @@
 
 #include "common/Defines.h"
 #include "common/Dictionary.h"
+#include "common/Trace.h"
 #include "common/Transforms.h"
 #include "common/Utils.h"
 #include "criterion/criterion.h"
@@ -66,7 +67,7 @@ int main(int argc, char** argv) {
     reloadPath = argv[2];
     /* ===================== Create Network ===================== */
     LOG(INFO) << "Network reading pre-trained model from " << reloadPath;
-    W2lSerializer::load(reloadPath, cfg, network, criterion);
+    loadModel(reloadPath, cfg, network, criterion);
     pretrained_params = network->params();
 
     //pre-trained network architecture
@@ -113,6 +114,14 @@ int main(int argc, char** argv) {
   auto worldSize = fl::getWorldSize();
   bool isMaster = (worldRank == 0);
 
+  if (!FLAGS_tracefile.empty() || FLAGS_tracesummary) {
+    auto tracePath = FLAGS_tracefile;
+    if (!tracePath.empty() && worldSize > 1) {
+      tracePath += "." + std::to_string(worldRank);
+    }
+    Tracer::get().enable(tracePath, FLAGS_tracesample);
+  }
+
   LOG_MASTER(INFO) << "Gflags after parsing \n" << serializeGflags("; ");
   LOG_MASTER(INFO) << "Experiment path: " << runPath;
   LOG_MASTER(INFO) << "Experiment runidx: " << runIdx;
@@ -165,15 +174,26 @@ int main(int argc, char** argv) {
   /* ===================== Create Dataset ===================== */
   auto trainds = createDataset(
       FLAGS_train, dicts, lexicon, FLAGS_batchsize, worldRank, worldSize);
+  LOG_MASTER(INFO) << "[Dataset] " << trainds->size() << " batches, padding "
+                   << "efficiency " << trainds->paddingEfficiency();
+
+  auto augmentation = AugmentationOptions::fromFlags();
+  if (augmentation.enabled()) {
+    trainds->setAugmentation(augmentation);
+    LOG_MASTER(INFO) << "[Dataset] augmenting the training data";
+  }
 
 
   /* ===================== Hooks ===================== */
 
   double gradNorm = 1.0 / (FLAGS_batchsize * worldSize);
 
+  DiagnosticsWriter diagnostics(FLAGS_diagdir, FLAGS_diaginterval);
+
   auto train = [gradNorm,
                 pretrained_params,
-                &startEpoch](
+                &startEpoch,
+                &diagnostics](
                    std::shared_ptr<fl::Module> ntwrk,
                    std::shared_ptr<SequenceCriterion> crit,
                    std::shared_ptr<W2lDataset> trainset,
@@ -199,6 +219,7 @@ int main(int argc, char** argv) {
       critopt->setLr(lrScale * initcritlr);
 
       ++curEpoch;
+      trainset->setEpoch(curEpoch);
       ntwrk->train();
       crit->train();
 
@@ -208,25 +229,20 @@ int main(int argc, char** argv) {
 
       //the size of trainset is just 1.
       auto pre_sample = trainset->get(0); //make noises for one audio sample
-      int numNoise = 1000; //make 1000 noise sub-samples for the audio sample
-      std::vector<float> Yloss(numNoise); //loss written into Yloss
       std::ofstream Yfile("/root/w2l/CTC/newDFT/loss.txt", std::ios::out);
       std::ofstream Y1("/root/w2l/CTC/newDFT/loss1.txt", std::ios::out);
       std::ofstream Y2("/root/w2l/CTC/newDFT/loss2.txt", std::ios::out);
   
 
     
-      af::dim4 noiseDims = pre_sample[kFftIdx].dims(); //2K x T x FLAGS_channels x batchSz
-      int T = noiseDims[1];
-      int K = noiseDims[0]/2;
-
-      float mylr = 0.01;
-      float lamda = 0;
 
       //pre_sample[kInputIdx] dims: T x K(257) x 1 x 1
       LOG_MASTER(INFO) << "pre_sample[kInputIdx] dims: " << pre_sample[kInputIdx].dims();
       //pre_sample[kFftIdx] dims: 2K(514) x T x 1 x 1
-      LOG_MASTER(INFO) << "pre_sample[kFftIdx] dims: " << pre_sample[kFftIdx].dims();
+      if (FLAGS_powfft) {
+        LOG_MASTER(INFO) << "pre_sample[kFftIdx] dims: "
+                         << pre_sample[kFftIdx].dims();
+      }
       //LOG_MASTER(INFO) << af::toString("pre_sample fft's 6 values :", pre_sample[kFftIdx](af::seq(6)));
     
       //std::ofstream preInput("/root/w2l/CTC/newDFT/preDft.txt");
@@ -251,141 +267,27 @@ int main(int argc, char** argv) {
       preOutput = ntwrk->forward({preTrueInput}).front();
       af::sync();
 
-      std::ofstream preInput("/root/w2l/CTC/newDFT/preDft.txt");
-      if(preInput.is_open())
-      {
-	preInput << af::toString("preDft is:", preStarInput);
-	preInput.close();
-      }
-
-     
-      std::ofstream preOutFile("/root/w2l/CTC/newDFT/preOutput.txt");
-      if(preOutFile.is_open())
-      {
-	preOutFile << af::toString("preOutput is:", preOutput.array());
-	preOutFile.close();
-      }
-      
-      fl::Variable preRawInput(preStarInput, false);   // T x K x 1 x 1
-      af::array m = af::constant(1.0, af::dim4(T, K, noiseDims[2], noiseDims[3])); // Now m is T x K x FLAGS_channels x batchSz
+      diagnostics.write("preDft", preStarInput, curEpoch);
+      diagnostics.write("preOutput", preOutput.array(), curEpoch);
       
-      auto mVar = fl::Variable(m, true);   // T x K x 1 x 1
-
-      ntwrk->train();
-      crit->train();
+      // learn the input mask from batches of noise draws, see
+      // runtime/Attribution.h and the --attr* flags
+      MaskAttribution attribution(ntwrk, MaskAttributionOptions::fromFlags());
+      auto m = attribution.run(
+          preStarInput, [&Yfile, &Y1, &Y2](const MaskAttributionStats& stats) {
+            LOG(INFO) << "mask step " << stats.iteration << " loss "
+                      << stats.loss << " fit " << stats.fitLoss << " mask "
+                      << stats.maskLoss << " m mean " << stats.maskMean;
+            Yfile << stats.loss << std::endl;
+            Y1 << stats.fitLoss << std::endl;
+            Y2 << stats.maskLoss << std::endl;
+            if (FLAGS_tracesummary) {
+              LOG(INFO) << "trace at mask step " << stats.iteration << "\n"
+                        << Tracer::get().summary();
+              Tracer::get().resetSummary();
+            }
+          });
 
-      auto epsilon = fl::Variable(af::constant(0.005, m.dims()), false);
-
-      for (int i = 0; i < numNoise; i++) {
-
-        LOG(INFO) << "=================noise sample " << i << "==================";
-        af::sync();
-
-        if ((i+1)%100==0) {
-           mylr *= 0.9;
-        }
-	
-	//if (i==2000) {
-         //   mylr *= 0.3;
-       // }
-
-        // noise
-	auto epsilon = fl::normal(noiseDims, 0.1, 0);  //stdev=0.1 mean=0
-        
-        auto realInput =  mVar + preRawInput;
-        
-        if (af::anyTrue<bool>(af::isNaN(realInput.array()))) {
-          LOG(FATAL) << "real Input has NaN values";
-        }
-
-        // forward
-        auto output = ntwrk->forward({realInput}).front();
-
-        //std::ofstream nowOutFile("/root/w2l/CTC/newDFT/lastOutput.txt");
-	//if(nowOutFile.is_open())
-	//{
-	  // nowOutFile<<af::toString("lastOutput is:", output.array());
-	   //nowOutFile.close();
-	//}
-
-        
-        //auto f_L2 = fl::norm(output - preOutput, {0,1,2,3});
-	auto f_L2 = fl::flat(output-preOutput);
-	LOG(INFO) << "f_L2 dims is:" << f_L2.array().dims();
-        auto loss1 = fl::sum(f_L2 * f_L2, {0});
-	LOG(INFO) << "loss1 dims is:" << loss1.array().dims();
-        auto loss2 = lamda * fl::sum(fl::log(mVar * mVar), {0,1,2,3});
-        auto myloss = loss1 - loss2;
-
-        float totloss = myloss.scalar<float>();
-
-        //LOG(INFO) << "f star norm is:" << af::norm(preOutput.array());
-        //LOG(INFO) << "f now norm is:" << af::norm(output.array());
-        Yfile << totloss << std::endl;
-        Y1 << loss1.scalar<float>() << std::endl;
-        Y2 << loss2.scalar<float>() <<std::endl;
-
-        af::sync();
-       
-
-        if (af::anyTrue<bool>(af::isNaN(myloss.array()))) {
-          LOG(FATAL) << "Loss has NaN values";
-        }
-
-        //clear the gradients for next iteration
-        netopt->zeroGrad();
-        critopt->zeroGrad();
-
-        //Compute gradients using backprop
-        myloss.backward();
-        af::sync();
-	//Print output's Grad
-	if(i == numNoise-1)
-	{
-	   std::ofstream lastOutFile("/root/w2l/CTC/newDFT/lastOutput.txt");
-	   if(lastOutFile.is_open())
-	   {
- 	       lastOutFile << af::toString("lastOutput is:", output.array());
-	       lastOutFile.close();
-	   }
-
-	   std::ofstream outputGradFile("/root/w2l/CTC/newDFT/outputGrad.txt");
-           if(outputGradFile.is_open())
-           {
-	       outputGradFile << af::toString("output Grad is:", mVar.grad().array());
-	       outputGradFile.close();
-           }
-	}
-	if(i==0){
-           std::ofstream firstMgradFile("/root/w2l/CTC/newDFT/firstGrad.txt");
-	   if(firstMgradFile.is_open())
-   	   {
-		firstMgradFile << af::toString("output first grad is:", mVar.grad().array());
-		firstMgradFile.close();
-  	   }
-        }
-
-
- 	LOG(INFO) << "mVar grad abs mean:" << af::mean<float>(mVar.grad().array());
-	//LOG(INFO) << "m-input grad is:" << af::sum<float>(mVar.grad().array() - preRawInput.grad().array());
-
-	mVar.array() = mVar.array() - mylr * mVar.grad().array();  
-        
-	if (FLAGS_maxgradnorm > 0) {
-          auto params = ntwrk->params();
-          if (clampCrit) {
-            auto critparams = crit->params();
-            params.insert(params.end(), critparams.begin(), critparams.end());
-          }
-          fl::clipGradNorm(params, FLAGS_maxgradnorm);
-        }
-
-        //critopt.step();
-        //netopt.step();
-        //update parameter mVar
-              
-      }
-	  
       af::sync();
       //network params whether to be changed
       fl::MSEMeter mymeter;
@@ -402,12 +304,7 @@ int main(int argc, char** argv) {
         //std::string mpath = "/root/w2l/aboutM/last_m.bin";
         //W2lSerializer::save(mpath, m);
 
-        std::ofstream mfile("/root/w2l/CTC/newDFT/lastm.txt");
-        if(mfile.is_open())
-        {
-          mfile << af::toString("last m is:", mVar.array());
-          mfile.close();
-        }
+        diagnostics.write("lastm", m, curEpoch);
       }
     }
   };
@@ -425,6 +322,7 @@ int main(int argc, char** argv) {
       FLAGS_iter);
 
   LOG_MASTER(INFO) << "Finished my training";
+  Tracer::get().disable();
   return 0;
 }
 
@@ -66,7 +66,7 @@ int main(int argc, char** argv) {
     reloadPath = argv[2];
     /* ===================== Create Network ===================== */
     LOG(INFO) << "Network reading pre-trained model from " << reloadPath;
-    W2lSerializer::load(reloadPath, cfg, network, criterion);
+    loadModel(reloadPath, cfg, network, criterion);
     pretrained_params = network->params();
 
     //pre-trained network architecture
@@ -170,6 +170,8 @@ int main(int argc, char** argv) {
   
 
   /* ===================== Create Dataset ===================== */
+  // the noise loop reads the complex spectrum of the batches (kFftIdx)
+  FLAGS_powfft = true;
   auto trainds = createDataset(
       FLAGS_train, dicts, lexicon, FLAGS_batchsize, worldRank, worldSize);
 
@@ -178,9 +180,12 @@ int main(int argc, char** argv) {
 
   double gradNorm = 1.0 / (FLAGS_batchsize * worldSize);
 
+  DiagnosticsWriter diagnostics(FLAGS_diagdir, FLAGS_diaginterval);
+
   auto train = [gradNorm,
                 pretrained_params,
-                &startEpoch](
+                &startEpoch,
+                &diagnostics](
                    std::shared_ptr<fl::Module> ntwrk,
                    std::shared_ptr<SequenceCriterion> crit,
                    std::shared_ptr<W2lDataset> trainset,
@@ -264,12 +269,7 @@ int main(int argc, char** argv) {
       //LOG_MASTER(INFO) << "dft mean is:" << af::mean<float>(pre_sample[kInputIdx]);//2136.15
       //LOG_MASTER(INFO) << "dft stdev is:" << af::stdev<float>(pre_sample[kInputIdx]);//5646.45
 
-      std::ofstream preinput("/root/w2l/CTC/preFft.txt");
-      if(preinput.is_open())
-      {
-        preinput << af::toString("pre_fft values:",pre_sample[kFftIdx]);
-        preinput.close();
-      }
+      diagnostics.write("preFft", pre_sample[kFftIdx], curEpoch);
       //Notice:here prefft is 2K*T
       //Notice:but maskMusic is K*T
 
@@ -302,12 +302,7 @@ int main(int argc, char** argv) {
       //}
 
 
-      std::ofstream preOutFile("/root/w2l/CTC/preOutput.txt");
-      if(preOutFile.is_open())
-      {
-  preOutFile << af::toString("preOutput is:", preOutput_arr);
-  preOutFile.close();
-      }
+      diagnostics.write("preOutput", preOutput_arr, curEpoch);
 
       // af::array zerowgt = af::identity(31,31);
       // zerowgt(0, 0) = 0;
@@ -334,12 +329,7 @@ int main(int argc, char** argv) {
 
 
 
-      std::ofstream preOutFile_0("/root/w2l/CTC/preOutput_0.txt");
-      if(preOutFile_0.is_open())
-      {
-  preOutFile_0 << af::toString("preOutput_0 is:", softmax_add_preOutput.array());
-  preOutFile_0.close();
-      }
+      diagnostics.write("preOutput_0", softmax_add_preOutput.array(), curEpoch);
       
       
       ntwrk->train();
@@ -349,9 +339,6 @@ int main(int argc, char** argv) {
       ///////////////////////////////////////////////////////////////////////////////////////////////
       auto rawinput = pre_sample[kFftIdx];
       af::array absinput(af::dim4(K, T, noiseDims[2], noiseDims[3]));
-      auto Z_add = af::constant (0,af::dim4(K, T, K, noiseDims[3])); // Z_add is Z
-      auto Z_grad = af::constant (0,af::dim4(K, T, K, noiseDims[3])); // Z_grad is partial(Z_pji)/partial(m_p_j)
-      af::array absinput_after_blur(af::dim4(K, T, noiseDims[2], noiseDims[3]));
 
       for (size_t j = 0; j < 2*K; j=j+2)
         {
@@ -384,12 +371,7 @@ int main(int argc, char** argv) {
   //save last iter epsilon parameter:
   if (i == numNoise-1)
   {
-     std::ofstream epsfile("/root/w2l/CTC/epsilon.txt");
-     if(epsfile.is_open())
-       {
-        epsfile << af::toString("epsilon values:", epsilon);
-              epsfile.close();
-     }
+     diagnostics.write("epsilon", epsilon, i);
   }
 
 
@@ -403,58 +385,20 @@ int main(int argc, char** argv) {
         //LOG(INFO) << "m_epsilon stdev :" << af::stdev<float>(m*epsilon);
       
 
-        for (size_t iloop = 0; iloop < K; ++iloop){
-          for (size_t jloop = 0; jloop < T; ++jloop){
-            absinput_after_blur(iloop,jloop,af::span,af::span) = absinput(iloop,jloop,af::span,af::span);
-
-            
-            // gfor (af::seq ploop, std::max(iloop-int(m_p_j),0), std::min(iloop+int(m_p_j),K-1)){
-            gfor (af::seq ploop, K){
-              auto m_p_j = af::moddims(m(ploop,jloop,0,0),K); // dim of K*1*1*1
-              auto m_floor = af::floor(m_p_j); // dim of K*1*1*1
-
-              auto sum_m_p_j=m_floor*(2*m_p_j-m_floor-1) + m_p_j; // dim of K*1*1*1
-              auto sum_mpj_partial_to_mpj=2*m_p_j; // dim of K*1*1*1
-
-              //这里只看 abs(ploop-iloop)<m_p_j 的部分
-              auto condition1 = (af::abs(ploop-iloop)<m_p_j);
-              auto condition2 = ((ploop - iloop)==0);
-
-
-              auto Z_add_pji = condition1.as(f32) * ((!condition2).as(f32) * (af::moddims(absinput(ploop,jloop,0,0),K)*(m_p_j-af::abs(iloop-ploop))/sum_m_p_j) + condition2.as(f32) * (af::moddims(absinput(ploop,jloop,0,0),K)*(m_p_j-sum_m_p_j)/sum_m_p_j));
-              auto Z_grad_pji = condition1.as(f32) * ((!condition2).as(f32) * (af::moddims(absinput(ploop,jloop,0,0),K)*(sum_m_p_j - sum_mpj_partial_to_mpj*(m_p_j-abs(iloop-ploop)))/(sum_m_p_j*sum_m_p_j)) + condition2.as(f32) * (af::moddims(absinput(ploop,jloop,0,0),K)*((1-sum_mpj_partial_to_mpj)*sum_m_p_j-sum_mpj_partial_to_mpj*(m_p_j-sum_m_p_j))/(sum_m_p_j*sum_m_p_j)));
-              
-
-              Z_add(ploop,jloop,iloop,af::span) = Z_add_pji;
-              Z_grad(ploop,jloop,iloop,af::span) = Z_grad_pji;
-            } 
-
-            absinput_after_blur(iloop,jloop,af::span)+=af::sum(Z_add(af::span,jloop,iloop),0);
-          }
-          printf("i=%d\n",iloop);
-        } 
+        // adaptive triangular blur of every frequency bin, differentiable
+        // w.r.t. the widths m (see module/FrequencyBlur.h)
+        auto mVar = fl::Variable(m, true);
+        auto blurred = frequencyBlur(fl::Variable(absinput, false), mVar);
         
 
         //Notice:here prefft is 2K*T
         //Notice:but maskMusic is K*T, and angle remains still
-        if(i%1000 == 0)
-        {
-            char outdir[80];
-
-            sprintf(outdir, "/root/w2l/CTC/music_mask_%d.txt", i);
-        
-            std::ofstream fft_mask_now(outdir);
-            if(fft_mask_now.is_open())
-            {
-               fft_mask_now<<af::toString("mask music is:", absinput_after_blur);
-               fft_mask_now.close();
-            }
-        }
+        diagnostics.sample("music_mask", blurred.array(), i);
 
         //T x K x FLAGS_channels x batchSz
         // af::array trInput = af::transpose(absinput);
 
-        af::array trInput = af::transpose(absinput_after_blur);
+        auto trInput = fl::transpose(blurred);
         printf("trInput okok\n");
 
         // dft kInputIdx not normalized
@@ -462,12 +406,13 @@ int main(int argc, char** argv) {
         //LOG(INFO) << "dft abs stdev :" << af::stdev<float>(absinput);
 
         // normalization
-        auto mean = af::mean<float>(trInput); // along T and K two dimensions 1x1x1x1
-        auto stdev = af::stdev<float>(trInput); //1 scalar
-        auto finalInput = (trInput - mean) / stdev;
-        fl::Variable trueInput(finalInput, true);
+        auto mean = fl::tileAs(fl::mean(trInput, {0, 1}), trInput);
+        auto centered = trInput - mean;
+        auto stdev = fl::tileAs(
+            fl::sqrt(fl::mean(centered * centered, {0, 1})), trInput);
+        auto trueInput = centered / stdev;
         
-        auto indif = af::mean<float>(trInput - pre_sample[kInputIdx]);
+        auto indif = af::mean<float>(trInput.array() - pre_sample[kInputIdx]);
         LOG(INFO) << "dft input difference mean is:" << indif;
         /*
         std::ofstream exfile("/home/zd/beforenorm.txt");
@@ -495,12 +440,7 @@ int main(int argc, char** argv) {
           
       //}
 
-        std::ofstream nowOutFile("/root/w2l/CTC/lastOutput.txt");
-      if(nowOutFile.is_open())
-      {
-         nowOutFile<<af::toString("lastOutput is:", output_arr);
-         nowOutFile.close();
-      }
+        diagnostics.sample("lastOutput", output_arr, i);
  //        af::array wgt = af::identity(31, 31); // numClasses are 31 tokens
   // wgt(0, 0) = 0;
  //        wgt(1, 1) = 0;
@@ -520,12 +460,7 @@ int main(int argc, char** argv) {
         af::sync();
   if(i == numNoise-1)
   {
-      std::ofstream nowOutFile_0("/root/w2l/CTC/lastOutput_0.txt");
-      if(nowOutFile_0.is_open())
-      {
-         nowOutFile_0<<af::toString("lastOutput_0 is:", softmax_add_output.array());
-         nowOutFile_0.close();
-      }
+      diagnostics.write("lastOutput_0", softmax_add_output.array(), i);
   }
         
         //LOG(INFO) << "network forward output dims is "<< output.array().dims();
@@ -577,12 +512,7 @@ int main(int argc, char** argv) {
   //Print output's Grad
   if(i == numNoise-1)
   {
-            std::ofstream outputGradFile("/root/w2l/CTC/outputGrad.txt");
-      if(outputGradFile.is_open())
-      {
-          outputGradFile << af::toString("output Grad is:", output.grad().array());
-                outputGradFile.close();
-      }
+            diagnostics.write("outputGrad", output.grad().array(), i);
   }
 
         if (FLAGS_maxgradnorm > 0) {
@@ -598,30 +528,8 @@ int main(int argc, char** argv) {
         //netopt.step();
         //update parameter m
 
-        auto sigma2 = stdev * stdev;
-        auto dy = trueInput.grad().array(); //T x K
-        auto dsigma2 = af::sum<float>(dy * (trInput - mean) * (-0.5) * std::pow(sigma2, -1.5));
-        auto dmu = af::sum<float>(dy * (-1.0/std::pow(sigma2, 0.5))) + af::sum<float>(-2 * (trInput - mean)) * dsigma2 / (T * K);
-        auto dx = dy / std::pow(sigma2, 0.5) + dsigma2 * 2 * (trInput - mean) / (T * K) + dmu / (T * K); 
-        af::array xGrad = af::transpose(dx); // K x T x 1 x 1
-
-        //xGrad is ∂ myloss / ∂ absinput_after_blur;
-
-        printf("xGrad okok\n");
-
-        af::array xGradm = af::constant(0, af::dim4(K, T, T, K));
-        for (size_t i = 0; i < K; i=i+1){
-          for (size_t j = 0; j < T; j=j+1){
-            for (size_t p = 0; p < K; p=p+1){
-              xGradm(i,j,j,p)=Z_grad(p,j,i,0);
-            }
-          }
-        }
-
-        printf("xGradm okok\n");
-          
-
-        auto mGrad = xGrad * xGradm;
+        // myloss.backward() went through the normalization and the blur
+        auto mGrad = mVar.grad().array();
 
         auto mGrad_aboutm_entropy = 1 / m ;
 
@@ -654,12 +562,7 @@ int main(int argc, char** argv) {
         //std::string mpath = "/root/w2l/aboutM/last_m.bin";
         //W2lSerializer::save(mpath, m);
 
-        std::ofstream mfile("/root/w2l/CTC/lastm.txt");
-        if(mfile.is_open())
-        {
-          mfile << af::toString("last m is:", m);
-          mfile.close();
-        }
+        diagnostics.write("lastm", m, curEpoch);
       }
     }
   };
@@ -20,13 +20,15 @@
 #include "common/Transforms.h"
 #include "common/Utils.h"
 #include "criterion/criterion.h"
+#include "data/SpectrogramMask.h"
 #include "module/module.h"
 #include "runtime/Data.h"
+#include "runtime/Diagnostics.h"
 #include "runtime/Logger.h"
 #include "runtime/Serial.h"
+#include "runtime/Snapshot.h"
 
 using namespace w2l;
-bool zeroMode = 1;
 
 int main(int argc, char** argv) {
   google::InitGoogleLogging(argv[0]);
@@ -56,7 +58,7 @@ int main(int argc, char** argv) {
   std::shared_ptr<SequenceCriterion> criterion;
   std::unordered_map<std::string, std::string> cfg;
   LOG(INFO) << "[Network] Reading acoustic model from " << FLAGS_am;
-  W2lSerializer::load(FLAGS_am, cfg, network, criterion);
+  loadModel(FLAGS_am, cfg, network, criterion);
   network->eval();
   criterion->eval();
 
@@ -108,53 +110,30 @@ int main(int argc, char** argv) {
   EmissionSet emissionSet;
   meters.timer.resume();
   int cnt = 1;
+  std::shared_ptr<SpectrogramMask> zeroMask;
+  if (!FLAGS_maskspec.empty()) {
+    zeroMask = SpectrogramMask::get(FLAGS_maskspec);
+  }
+  DiagnosticsWriter diagnostics(FLAGS_diagdir, FLAGS_diaginterval);
   for (auto& sample:*ds){
   bool whether_threhold = true;
   auto rawinput = sample[kInputIdx];
   
   //to get prefft.txt
-  std::ofstream preinput("/root/w2l/aboutFft/myfft.txt");
-  if(preinput.is_open()){
-  	preinput<<af::toString("myfft input:",rawinput);
-  	preinput.close();
-  }
+  diagnostics.write("myfft", rawinput, cnt);
   auto finalinput = sample[kInputIdx];
   
   
   
   
   LOG(INFO)<<"rawinput 's dimension"<<rawinput.dims();
-  int countzero=0;
-    if(zeroMode)
-    {
-	std::cout<<"read zero 's mode";
-    	//normalize
-	auto mean = af::mean<float>(rawinput);
-    	auto stdev = af::stdev<float>(rawinput);
-        finalinput = (rawinput - mean) / stdev;
-
-    	std::ifstream zerof("zero.txt");
-    	std::string line;
-    	int row, col;
-    	while(std::getline(zerof, line))
-    	{
-		countzero+=1;
-		col = std::atoi(line.c_str());
-         	std::getline(zerof, line);
-         	row = std::atoi(line.c_str());
-         	//LOG(INFO)<<"cols,raw "<<row<<' '<<col<<'\t';
-		finalinput(row, col/2, af::span, af::span) = 0;
-		//LOG(INFO)<<af::sum<float>(finalinput(row,col/2,af::span,af::span));
-    	}
-	zerof.close();
-    }
-    else
-    {    
-    	auto mean = af::mean<float>(rawinput);
-    	auto stdev = af::stdev<float>(rawinput);
-    	finalinput = (rawinput - mean) / stdev;
+    auto mean = af::mean<float>(rawinput);
+    auto stdev = af::stdev<float>(rawinput);
+    finalinput = (rawinput - mean) / stdev;
+    if (zeroMask) {
+      // normalize, then zero the masked bins
+      finalinput = zeroMask->apply(finalinput);
     }
-    std::cout<<"zeros number::"<<countzero<<std::endl;
     auto rawEmission = network->forward({fl::input(finalinput)}).front();
     std::string emisspath = "/root/w2l/rawEmission.bin";
     W2lSerializer::save(emisspath, rawEmission);
@@ -163,6 +163,8 @@ int main(int argc, char** argv) {
   
 
   /* ===================== Create Dataset ===================== */
+  // the noise loop reads the complex spectrum of the batches (kFftIdx)
+  FLAGS_powfft = true;
   auto trainds = createDataset(
       FLAGS_train, dicts, lexicon, FLAGS_batchsize, worldRank, worldSize);
 
@@ -0,0 +1,483 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "common/CompiledLexicon.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <glog/logging.h>
+
+#include "common/Defines.h"
+
+namespace w2l {
+
+namespace {
+
+const char kLexiconMagic[] = "W2LLEX02";
+constexpr uint64_t kFnvOffset = 14695981039346656037ULL;
+constexpr uint64_t kFnvPrime = 1099511628211ULL;
+
+enum TokenFlag : uint8_t {
+  kStartsWithSeparator = 1,
+  kEndsWithSeparator = 2,
+};
+
+enum WordFlag : uint8_t {
+  kUnknownTokens = 1,
+};
+
+struct Header {
+  char magic[8];
+  uint64_t fingerprint;
+  uint64_t nWords;
+  uint64_t nSpellings;
+  uint64_t nIndices;
+  uint64_t nTokens;
+  uint64_t hashSize;
+  uint64_t poolBytes;
+};
+
+uint64_t fnv1a(const void* data, size_t bytes, uint64_t h = kFnvOffset) {
+  auto p = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < bytes; ++i) {
+    h = (h ^ p[i]) * kFnvPrime;
+  }
+  return h;
+}
+
+uint64_t padded(uint64_t bytes) {
+  return (bytes + 7) / 8 * 8;
+}
+
+void append(std::string& buf, const void* data, size_t bytes) {
+  buf.append(static_cast<const char*>(data), bytes);
+  buf.resize(padded(buf.size()), '\0');
+}
+
+bool hasPrefix(const std::string& str, const std::string& prefix) {
+  return str.size() >= prefix.size() &&
+      str.compare(0, prefix.size(), prefix) == 0;
+}
+
+bool hasSuffix(const std::string& str, const std::string& suffix) {
+  return str.size() >= suffix.size() &&
+      str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+} // namespace
+
+uint64_t tokenDictFingerprint(const Dictionary& tokenDict) {
+  auto h = fnv1a(kLexiconMagic, sizeof(kLexiconMagic));
+  h = fnv1a(FLAGS_wordseparator.data(), FLAGS_wordseparator.size() + 1, h);
+  for (size_t i = 0; i < tokenDict.indexSize(); ++i) {
+    auto token = tokenDict.getToken(i);
+    h = fnv1a(token.c_str(), token.size() + 1, h);
+  }
+  return h;
+}
+
+CompiledLexicon::CompiledLexicon(
+    const LexiconMap& lexicon,
+    const Dictionary& tokenDict,
+    uint64_t fingerprint /* = 0 */) {
+  if (!tokenDict.isContiguous()) {
+    throw std::invalid_argument(
+        "CompiledLexicon: token dictionary is not contiguous");
+  }
+  std::vector<std::string> words;
+  words.reserve(lexicon.size());
+  for (const auto& it : lexicon) {
+    words.push_back(it.first);
+  }
+  std::sort(words.begin(), words.end());
+
+  std::vector<uint64_t> wordOffsets, spellingBegin, spellingOffsets = {0};
+  std::vector<uint8_t> wordFlags(words.size(), 0);
+  std::vector<int> indices;
+  std::string pool;
+  int64_t numDropped = 0;
+  for (size_t w = 0; w < words.size(); ++w) {
+    const auto& word = words[w];
+    wordOffsets.push_back(pool.size());
+    spellingBegin.push_back(spellingOffsets.size() - 1);
+    pool += word;
+    for (const auto& spelling : lexicon.at(word)) {
+      auto unknown = std::find_if(
+          spelling.begin(), spelling.end(), [&](const std::string& token) {
+            return !tokenDict.contains(token);
+          });
+      if (unknown != spelling.end()) {
+        LOG_IF(WARNING, numDropped == 0)
+            << "[Lexicon] Unknown token '" << *unknown
+            << "' in the spelling of '" << word << "', dropping the spelling";
+        wordFlags[w] |= kUnknownTokens;
+        ++numDropped;
+        continue;
+      }
+      for (const auto& token : spelling) {
+        indices.push_back(tokenDict.getIndex(token));
+      }
+      spellingOffsets.push_back(indices.size());
+    }
+  }
+  LOG_IF(WARNING, numDropped > 1)
+      << "[Lexicon] Dropped " << numDropped
+      << " spellings with tokens missing from the dictionary";
+  wordOffsets.push_back(pool.size());
+  spellingBegin.push_back(spellingOffsets.size() - 1);
+
+  uint64_t hashSize = 1;
+  while (hashSize < 2 * words.size()) {
+    hashSize *= 2;
+  }
+  std::vector<int32_t> hash(hashSize, -1);
+  for (size_t w = 0; w < words.size(); ++w) {
+    auto slot = fnv1a(words[w].data(), words[w].size()) & (hashSize - 1);
+    while (hash[slot] >= 0) {
+      slot = (slot + 1) & (hashSize - 1);
+    }
+    hash[slot] = w;
+  }
+
+  std::vector<uint8_t> tokenFlags(tokenDict.indexSize(), 0);
+  const auto& sep = FLAGS_wordseparator;
+  for (size_t i = 0; i < tokenFlags.size() && !sep.empty(); ++i) {
+    auto token = tokenDict.getToken(i);
+    tokenFlags[i] = (hasPrefix(token, sep) ? kStartsWithSeparator : 0) |
+        (hasSuffix(token, sep) ? kEndsWithSeparator : 0);
+  }
+
+  Header header;
+  std::memcpy(header.magic, kLexiconMagic, sizeof(header.magic));
+  header.fingerprint =
+      fingerprint != 0 ? fingerprint : tokenDictFingerprint(tokenDict);
+  header.nWords = words.size();
+  header.nSpellings = spellingOffsets.size() - 1;
+  header.nIndices = indices.size();
+  header.nTokens = tokenFlags.size();
+  header.hashSize = hashSize;
+  header.poolBytes = pool.size();
+
+  append(buffer_, &header, sizeof(header));
+  append(buffer_, wordOffsets.data(), wordOffsets.size() * sizeof(uint64_t));
+  append(
+      buffer_, spellingBegin.data(), spellingBegin.size() * sizeof(uint64_t));
+  append(
+      buffer_,
+      spellingOffsets.data(),
+      spellingOffsets.size() * sizeof(uint64_t));
+  append(buffer_, hash.data(), hash.size() * sizeof(int32_t));
+  append(buffer_, wordFlags.data(), wordFlags.size());
+  append(buffer_, indices.data(), indices.size() * sizeof(int));
+  append(buffer_, tokenFlags.data(), tokenFlags.size());
+  append(buffer_, pool.data(), pool.size());
+  parse(buffer_.data(), buffer_.size());
+}
+
+CompiledLexicon::CompiledLexicon(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("CompiledLexicon: cannot open " + path);
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+    throw std::runtime_error("CompiledLexicon: cannot stat " + path);
+  }
+  mapBytes_ = st.st_size;
+  map_ = ::mmap(nullptr, mapBytes_, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map_ == MAP_FAILED) {
+    map_ = nullptr;
+    throw std::runtime_error("CompiledLexicon: cannot map " + path);
+  }
+  try {
+    parse(static_cast<const char*>(map_), mapBytes_);
+  } catch (...) {
+    ::munmap(map_, mapBytes_);
+    map_ = nullptr;
+    throw;
+  }
+}
+
+CompiledLexicon::~CompiledLexicon() {
+  if (map_) {
+    ::munmap(map_, mapBytes_);
+  }
+}
+
+void CompiledLexicon::parse(const char* data, size_t bytes) {
+  Header header;
+  if (bytes < sizeof(header)) {
+    throw std::runtime_error("CompiledLexicon: truncated lexicon");
+  }
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, kLexiconMagic, sizeof(header.magic)) != 0) {
+    throw std::runtime_error("CompiledLexicon: not a compiled lexicon");
+  }
+  uint64_t offset = padded(sizeof(header));
+  auto section = [&](uint64_t sectionBytes) {
+    auto ptr = data + offset;
+    offset += padded(sectionBytes);
+    return ptr;
+  };
+  auto wordOffsets = section((header.nWords + 1) * sizeof(uint64_t));
+  auto spellingBegin = section((header.nWords + 1) * sizeof(uint64_t));
+  auto spellingOffsets = section((header.nSpellings + 1) * sizeof(uint64_t));
+  auto hash = section(header.hashSize * sizeof(int32_t));
+  auto wordFlags = section(header.nWords);
+  auto indices = section(header.nIndices * sizeof(int));
+  auto tokenFlags = section(header.nTokens);
+  auto pool = section(header.poolBytes);
+  if (offset != bytes) {
+    throw std::runtime_error("CompiledLexicon: corrupt or truncated lexicon");
+  }
+
+  data_ = data;
+  bytes_ = bytes;
+  wordOffsets_ = reinterpret_cast<const uint64_t*>(wordOffsets);
+  spellingBegin_ = reinterpret_cast<const uint64_t*>(spellingBegin);
+  spellingOffsets_ = reinterpret_cast<const uint64_t*>(spellingOffsets);
+  hash_ = reinterpret_cast<const int32_t*>(hash);
+  wordFlags_ = reinterpret_cast<const uint8_t*>(wordFlags);
+  indices_ = reinterpret_cast<const int*>(indices);
+  tokenFlags_ = reinterpret_cast<const uint8_t*>(tokenFlags);
+  pool_ = pool;
+}
+
+void CompiledLexicon::save(const std::string& path) const {
+  auto tmpPath = path + ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    file.write(data_, bytes_);
+    if (!file.good()) {
+      std::remove(tmpPath.c_str());
+      throw std::runtime_error("CompiledLexicon: cannot write " + tmpPath);
+    }
+  }
+  if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    throw std::runtime_error("CompiledLexicon: cannot rename to " + path);
+  }
+}
+
+int64_t CompiledLexicon::size() const {
+  return reinterpret_cast<const Header*>(data_)->nWords;
+}
+
+int64_t CompiledLexicon::find(const std::string& word) const {
+  uint64_t mask = reinterpret_cast<const Header*>(data_)->hashSize - 1;
+  auto slot = fnv1a(word.data(), word.size()) & mask;
+  for (; hash_[slot] >= 0; slot = (slot + 1) & mask) {
+    auto id = hash_[slot];
+    auto len = wordOffsets_[id + 1] - wordOffsets_[id];
+    if (len == word.size() &&
+        std::memcmp(pool_ + wordOffsets_[id], word.data(), len) == 0) {
+      return id;
+    }
+  }
+  return -1;
+}
+
+int64_t CompiledLexicon::findTargetWord(const std::string& word) const {
+  auto id = find(word);
+  if (id >= 0 && numSpellings(id) == 0 && hasUnknownTokens(id)) {
+    throw std::invalid_argument(
+        "CompiledLexicon: all the spellings of '" + word +
+        "' use tokens missing from the dictionary");
+  }
+  return id;
+}
+
+std::string CompiledLexicon::word(int64_t id) const {
+  return std::string(
+      pool_ + wordOffsets_[id], wordOffsets_[id + 1] - wordOffsets_[id]);
+}
+
+int64_t CompiledLexicon::numSpellings(int64_t id) const {
+  return spellingBegin_[id + 1] - spellingBegin_[id];
+}
+
+IndexSpan CompiledLexicon::spelling(int64_t id, int64_t k) const {
+  auto s = spellingBegin_[id] + k;
+  IndexSpan span;
+  span.data = indices_ + spellingOffsets_[s];
+  span.size = spellingOffsets_[s + 1] - spellingOffsets_[s];
+  return span;
+}
+
+bool CompiledLexicon::hasUnknownTokens(int64_t id) const {
+  return wordFlags_[id] & kUnknownTokens;
+}
+
+IndexSpan CompiledLexicon::sampleSpelling(int64_t id) const {
+  auto n = numSpellings(id);
+  if (n == 0) {
+    return IndexSpan();
+  }
+  if (n > 1 &&
+      FLAGS_sampletarget >
+          static_cast<float>(std::rand()) / static_cast<float>(RAND_MAX)) {
+    return spelling(id, std::rand() % n);
+  }
+  return spelling(id, 0);
+}
+
+bool CompiledLexicon::startsWithSeparator(int token) const {
+  auto nTokens = reinterpret_cast<const Header*>(data_)->nTokens;
+  return token >= 0 && static_cast<uint64_t>(token) < nTokens &&
+      (tokenFlags_[token] & kStartsWithSeparator);
+}
+
+bool CompiledLexicon::endsWithSeparator(int token) const {
+  auto nTokens = reinterpret_cast<const Header*>(data_)->nTokens;
+  return token >= 0 && static_cast<uint64_t>(token) < nTokens &&
+      (tokenFlags_[token] & kEndsWithSeparator);
+}
+
+uint64_t CompiledLexicon::fingerprint() const {
+  return reinterpret_cast<const Header*>(data_)->fingerprint;
+}
+
+std::shared_ptr<CompiledLexicon> loadCompiledLexicon(
+    const std::string& lexiconFile,
+    int64_t maxNumWords,
+    const Dictionary& tokenDict,
+    const std::string& cachePath /* = "" */) {
+  struct stat st;
+  if (::stat(lexiconFile.c_str(), &st) != 0) {
+    throw std::runtime_error("loadCompiledLexicon: cannot stat " + lexiconFile);
+  }
+  int64_t source[] = {st.st_size, st.st_mtime, maxNumWords};
+  auto fingerprint =
+      fnv1a(source, sizeof(source), tokenDictFingerprint(tokenDict));
+
+  if (!cachePath.empty() && fileExists(cachePath)) {
+    try {
+      auto lexicon = std::make_shared<CompiledLexicon>(cachePath);
+      if (lexicon->fingerprint() == fingerprint) {
+        LOG(INFO) << "[Lexicon] Mapped compiled lexicon " << cachePath;
+        return lexicon;
+      }
+      LOG(INFO) << "[Lexicon] " << cachePath << " is stale, recompiling";
+    } catch (const std::exception& ex) {
+      LOG(WARNING) << "[Lexicon] " << ex.what() << ", recompiling";
+    }
+  }
+  auto lexicon = std::make_shared<CompiledLexicon>(
+      loadWords(lexiconFile, maxNumWords), tokenDict, fingerprint);
+  if (!cachePath.empty()) {
+    lexicon->save(cachePath);
+    LOG(INFO) << "[Lexicon] Saved compiled lexicon to " << cachePath;
+  }
+  return lexicon;
+}
+
+std::vector<int> unknownWordTarget(
+    const std::string& word,
+    const Dictionary& dict,
+    bool fallback2Ltr,
+    bool skipUnk) {
+  std::vector<int> res;
+  if (fallback2Ltr) {
+    for (auto& c : word) {
+      if (dict.contains(std::string(1, c))) {
+        res.push_back(dict.getIndex(std::string(1, c)));
+      } else if (skipUnk) {
+        LOG(INFO)
+            << "Skipping unknown character '" << c
+            << "' when falling back to letter target for the unknown word '"
+            << word << "'";
+      } else {
+        LOG(FATAL)
+            << "Unknown character '" << c
+            << "' when falling back to letter target for the unknown word '"
+            << word << "'";
+      }
+    }
+  } else if (skipUnk) {
+    LOG(INFO) << "Skipping unknown word '" << word
+              << "' when generating target";
+  } else {
+    LOG(FATAL) << "Unknown word '" << word << "' in the lexicon";
+  }
+  return res;
+}
+
+std::vector<IndexSpan> joinSpellings(
+    const std::vector<IndexSpan>& spellings,
+    const CompiledLexicon& lexicon,
+    const int* separator) {
+  bool useSeparator = !FLAGS_wordseparator.empty();
+  std::vector<IndexSpan> res;
+  for (const auto& t : spellings) {
+    if (t.empty()) {
+      continue;
+    }
+
+    // remove duplicate word separators in the beginning of each target token
+    if (!res.empty() && useSeparator && lexicon.startsWithSeparator(t[0])) {
+      if (--res.back().size == 0) {
+        res.pop_back();
+      }
+    }
+
+    res.push_back(t);
+
+    if (useSeparator && !lexicon.endsWithSeparator(t[t.size - 1])) {
+      LOG_IF(FATAL, *separator < 0)
+          << "Unknown token in dictionary: '" << FLAGS_wordseparator << "'";
+      res.push_back({separator, 1});
+    }
+  }
+
+  if (!res.empty() && useSeparator &&
+      res.back()[res.back().size - 1] == *separator) {
+    if (--res.back().size == 0) {
+      res.pop_back();
+    }
+  }
+  return res;
+}
+
+std::vector<int> wrd2Target(
+    const std::vector<std::string>& words,
+    const CompiledLexicon& lexicon,
+    const Dictionary& dict,
+    bool fallback2Ltr /* = false */,
+    bool skipUnk /* = false */) {
+  std::vector<std::vector<int>> letters(words.size());
+  std::vector<IndexSpan> spellings(words.size());
+  for (size_t i = 0; i < words.size(); ++i) {
+    auto id = lexicon.findTargetWord(words[i]);
+    if (id >= 0) {
+      spellings[i] = lexicon.sampleSpelling(id);
+    } else {
+      letters[i] = unknownWordTarget(words[i], dict, fallback2Ltr, skipUnk);
+      spellings[i] = {letters[i].data(), letters[i].size()};
+    }
+  }
+
+  const auto& sep = FLAGS_wordseparator;
+  int sepIdx = dict.contains(sep) ? dict.getIndex(sep) : -1;
+  std::vector<int> res;
+  for (const auto& span : joinSpellings(spellings, lexicon, &sepIdx)) {
+    res.insert(res.end(), span.begin(), span.end());
+  }
+  return res;
+}
+
+} // namespace w2l
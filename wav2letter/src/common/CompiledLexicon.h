@@ -0,0 +1,151 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/Dictionary.h"
+#include "common/Utils-base.h"
+
+namespace w2l {
+
+/**
+ * A lexicon with every spelling already mapped to indices of a token
+ * dictionary.
+ *
+ * Words are kept sorted in a string pool and found through an open addressing
+ * hash table; the spellings of word `w` are runs of one flat int32 array. For
+ * each token index it also records whether the token starts / ends with
+ * FLAGS_wordseparator, so targets can be assembled without going back to
+ * strings. Everything lives in one buffer that `save()` writes as is, and the
+ * file constructor maps it back without parsing.
+ *
+ * Spellings using tokens missing from the dictionary are dropped and their
+ * word flagged, so that only transcripts using a word left without any
+ * spelling fail (see `findTargetWord`).
+ *
+ * The fingerprint covers the token dictionary, the word separator and the
+ * source, a compiled file is only reused if it matches (see
+ * `loadCompiledLexicon`).
+ */
+class CompiledLexicon {
+ public:
+  // Compile with the contiguous `tokenDict`
+  CompiledLexicon(
+      const LexiconMap& lexicon,
+      const Dictionary& tokenDict,
+      uint64_t fingerprint = 0);
+
+  // Map a file written by `save()`
+  explicit CompiledLexicon(const std::string& path);
+
+  ~CompiledLexicon();
+
+  CompiledLexicon(const CompiledLexicon&) = delete;
+  CompiledLexicon& operator=(const CompiledLexicon&) = delete;
+
+  void save(const std::string& path) const;
+
+  int64_t size() const;
+
+  // Id of `word`, -1 if not in the lexicon
+  int64_t find(const std::string& word) const;
+
+  // Same as `find` for a word of a transcript, throws std::invalid_argument if
+  // all the spellings of `word` were dropped
+  int64_t findTargetWord(const std::string& word) const;
+
+  std::string word(int64_t id) const;
+
+  int64_t numSpellings(int64_t id) const;
+
+  IndexSpan spelling(int64_t id, int64_t k) const;
+
+  // Whether spellings of word `id` were dropped for using tokens missing from
+  // the dictionary
+  bool hasUnknownTokens(int64_t id) const;
+
+  // The first spelling, or a random one with probability FLAGS_sampletarget
+  IndexSpan sampleSpelling(int64_t id) const;
+
+  bool startsWithSeparator(int token) const;
+  bool endsWithSeparator(int token) const;
+
+  uint64_t fingerprint() const;
+
+ private:
+  void parse(const char* data, size_t bytes);
+
+  std::string buffer_; // compiled in memory
+  void* map_{nullptr}; // or mapped from a file
+  size_t mapBytes_{0};
+
+  const char* data_{nullptr};
+  size_t bytes_{0};
+  const uint64_t* wordOffsets_{nullptr};
+  const uint64_t* spellingBegin_{nullptr};
+  const uint64_t* spellingOffsets_{nullptr};
+  const int32_t* hash_{nullptr};
+  const uint8_t* wordFlags_{nullptr};
+  const uint8_t* tokenFlags_{nullptr};
+  const int* indices_{nullptr};
+  const char* pool_{nullptr};
+};
+
+// Hash of the token dictionary and FLAGS_wordseparator
+uint64_t tokenDictFingerprint(const Dictionary& tokenDict);
+
+/**
+ * Compiled form of `loadWords(lexiconFile, maxNumWords)`. With a non-empty
+ * `cachePath` the compiled lexicon is mapped from there if it was built from
+ * the same lexicon file (size and modification time), `maxNumWords` and token
+ * dictionary, and is otherwise compiled and saved there.
+ */
+std::shared_ptr<CompiledLexicon> loadCompiledLexicon(
+    const std::string& lexiconFile,
+    int64_t maxNumWords,
+    const Dictionary& tokenDict,
+    const std::string& cachePath = "");
+
+/**
+ * Token indices of the letters of `word`, which wrd2Target uses for words
+ * missing from the lexicon if `fallback2Ltr` is set (empty otherwise).
+ */
+std::vector<int> unknownWordTarget(
+    const std::string& word,
+    const Dictionary& dict,
+    bool fallback2Ltr,
+    bool skipUnk);
+
+/**
+ * The word separator handling of wrd2Target applied to already chosen word
+ * spellings. The target is the concatenation of the returned spans, which
+ * view `spellings` and `*separator`, the index of FLAGS_wordseparator (or -1
+ * if it is not in the dictionary).
+ */
+std::vector<IndexSpan> joinSpellings(
+    const std::vector<IndexSpan>& spellings,
+    const CompiledLexicon& lexicon,
+    const int* separator);
+
+/**
+ * Same as the LexiconMap version of wrd2Target, but produces token indices
+ * directly from the compiled spellings.
+ */
+std::vector<int> wrd2Target(
+    const std::vector<std::string>& words,
+    const CompiledLexicon& lexicon,
+    const Dictionary& dict,
+    bool fallback2Ltr = false,
+    bool skipUnk = false);
+
+} // namespace w2l
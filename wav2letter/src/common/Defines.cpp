@@ -11,12 +11,23 @@
 #include <limits>
 
 namespace w2l {
-DEFINE_bool(zeromode,false,"whether use zero.txt to place zero in the dft");
+DEFINE_bool(zeromode, false, "deprecated and ignored, use --maskspec");
+DEFINE_string(
+    maskspec,
+    "",
+    "spectrogram bins to zero before the forward pass, see "
+    "data/SpectrogramMask.h (bitmap .npy, band/region spec or legacy list)");
 // DATA OPTIONS
 DEFINE_string(train, "", "comma-separated list of training data");
 DEFINE_string(valid, "", "comma-separated list of valid data");
 DEFINE_string(test, "", "comma-separated list of test data");
 DEFINE_int64(batchsize, 1, "batch size (per process in distributed training)");
+DEFINE_double(
+    batchframes,
+    0,
+    "if > 0, batches vary in size: samples are added while the padded input "
+    "size of the batch (samples x largest input, unit of --maxisz) stays "
+    "within this budget, and --batchsize only caps the number of samples");
 DEFINE_string(input, "flac", "input feature");
 DEFINE_int64(samplerate, 16000, "sample rate (Hz)");
 DEFINE_int64(channels, 1, "number of input channels");
@@ -47,6 +58,11 @@ DEFINE_double(
     sampletarget,
     0.0,
     "probability [0.0, 1.0] for randomly sampling targets from a lexicon if there are multiple mappings from a word");
+DEFINE_string(
+    indexcache,
+    "",
+    "directory where the sample sizes of the datasets are cached, and reused "
+    "at startup while the list files / data files are unchanged");
 
 // FILTERING OPTIONS
 DEFINE_bool(skipoov, false, "skip everstore samples if letter is oov");
@@ -97,6 +113,11 @@ DEFINE_string(critoptim, kSGDoptimizer, "optimizer for the criterion");
 // MFCC OPTIONS
 DEFINE_bool(mfcc, false, "use standard htk mfcc features as input");
 DEFINE_bool(pow, false, "use standard power spectrum as input");
+DEFINE_bool(
+    powfft,
+    false,
+    "with -pow, also load the raw complex spectrum (2K x T) of the input as "
+    "the kFftIdx array of each batch");
 DEFINE_int64(mfcccoeffs, 13, "number of mfcc coefficients");
 DEFINE_bool(mfsc, false, "use standard mfsc features as input");
 DEFINE_double(melfloor, 1.0, "specify optional mel floor for mfcc/mfsc/pow");
@@ -130,6 +151,45 @@ DEFINE_int64(
     pcttraineval,
     100,
     "percentage of training set (by number of utts) to use for evaluation");
+DEFINE_string(
+    diagdir,
+    "",
+    "directory for .npy diagnostics dumps, disabled if empty");
+DEFINE_int64(
+    diaginterval,
+    1000,
+    "write per-iteration diagnostics every n iterations");
+DEFINE_int64(
+    evalbatchsize,
+    1,
+    "utterances per forward pass in Test, 1 keeps the sequential loop");
+DEFINE_int64(
+    evalbucketwidth,
+    0,
+    "max input length difference (frames) within an evaluation batch, "
+    "0 batches only equal-length utterances");
+DEFINE_int64(
+    evalworkers,
+    2,
+    "threads used for viterbi post-processing and scoring in Test");
+DEFINE_bool(
+    inferencegraph,
+    false,
+    "run Test through the InferenceGraph compiled from --arch instead of "
+    "the trained modules");
+DEFINE_string(
+    tracefile,
+    "",
+    "write a Chrome trace (chrome://tracing) of the data, criterion, decoder "
+    "and training stages to this path");
+DEFINE_bool(
+    tracesummary,
+    false,
+    "log the p50/p95/p99 latency of every traced stage");
+DEFINE_int64(
+    tracesample,
+    1,
+    "trace one in n top-level stages of every thread");
 
 // ARCHITECTURE OPTIONS
 DEFINE_string(arch, "default", "network architecture");
@@ -146,7 +206,17 @@ DEFINE_bool(logadd, false, "use logadd when merging decoder nodes");
 DEFINE_string(smearing, "none", "none, max or logadd");
 DEFINE_string(lmtype, "kenlm", "kenlm, cnnlm");
 DEFINE_string(lexicon, "", "path/to/lexicon.txt");
+DEFINE_string(
+    lexiconcache,
+    "",
+    "path/to/compiled lexicon, built from --lexicon on first use");
 DEFINE_string(emission_dir, "", "path/to/emission_dir/");
+DEFINE_int64(
+    emission_shards,
+    0,
+    "utterances per shard of a streaming emission store, "
+    "0 saves a single EmissionSet file");
+DEFINE_bool(emission_fp16, false, "store sharded emissions as fp16");
 DEFINE_string(lm, "", "path/to/language_model");
 DEFINE_string(am, "", "path/to/acoustic_model");
 DEFINE_string(sclite, "", "path/to/sclite to be written");
@@ -226,6 +296,46 @@ DEFINE_double(
     "std for the soft window shape (=exp(-(t - center)^2 / (2 * std^2)))");
 DEFINE_bool(trainWithWindow, false, "use window in training");
 
+// ATTRIBUTION OPTIONS
+DEFINE_string(
+    attrmode,
+    kNoiseMask,
+    "how the mask perturbs the input: 'noise' (x + m * eps) "
+    "or 'additive' (x + m + eps)");
+DEFINE_string(attroptim, kSGDoptimizer, "optimizer for the input mask");
+DEFINE_int64(attriters, 1000, "number of mask optimization steps");
+DEFINE_int64(attrnoise, 16, "noise draws evaluated in one batch per step");
+DEFINE_int64(attrsync, 100, "read back the loss every n steps");
+DEFINE_int64(attrlrstep, 100, "multiply LR by attrlrdecay every n steps");
+DEFINE_double(attrnoisestd, 0.1, "stddev of the gaussian noise eps");
+DEFINE_double(attrlambda, 0.0, "weight of the sum(log(m^2)) mask term");
+DEFINE_double(attrlr, 0.01, "learning rate for the input mask");
+DEFINE_double(attrlrdecay, 0.9, "mask LR annealing multiplier");
+
+// AUGMENTATION OPTIONS
+DEFINE_double(
+    augsnr,
+    0,
+    "add white gaussian noise at this SNR (dB) to the training audio, "
+    "0 to disable");
+DEFINE_double(
+    augspeed,
+    0,
+    "resample the training audio by a factor in [1 - augspeed, 1 + augspeed]");
+DEFINE_int64(augtimewarp, 0, "warp the training features by up to n frames");
+DEFINE_int64(augfreqmask, 0, "max width of the training frequency masks");
+DEFINE_int64(augnfreqmask, 1, "number of frequency masks per sample");
+DEFINE_int64(augtimemask, 0, "max width (frames) of the training time masks");
+DEFINE_int64(augntimemask, 1, "number of time masks per sample");
+
+// QUANTIZATION OPTIONS
+DEFINE_string(
+    quantcalib,
+    "",
+    "list of utterances used to calibrate int8 activation ranges");
+DEFINE_int64(quantcalibsize, 100, "number of calibration utterances");
+DEFINE_string(quantout, "", "path to save the int8 acoustic model to");
+
 // DISTRIBUTED TRAINING
 DEFINE_bool(enable_distributed, false, "enable distributed training");
 DEFINE_int64(
@@ -37,6 +37,8 @@ constexpr const char* kSGDoptimizer = "sgd";
 constexpr const char* kAdamOptimizer = "adam";
 constexpr const char* kRMSPropOptimizer = "rmsprop";
 constexpr const char* kAdadeltaOptimizer = "adadelta";
+constexpr const char* kNoiseMask = "noise";
+constexpr const char* kAdditiveMask = "additive";
 constexpr const char* kCtcCriterion = "ctc";
 constexpr const char* kAsgCriterion = "asg";
 constexpr const char* kSeq2SeqCriterion = "seq2seq";
@@ -54,8 +56,9 @@ constexpr int kLifterParam = 22;
 constexpr int kPrefetchSize = 2;
 
 /* ========== DATA OPTIONS ========== */
-// zero mode add for select whether use zero.txt to place zero in dft
+// deprecated no-op, kept so old flagfiles still parse; see maskspec
 DECLARE_bool(zeromode);
+DECLARE_string(maskspec);
 
 
 //
@@ -63,6 +66,7 @@ DECLARE_string(train);
 DECLARE_string(valid);
 DECLARE_string(test);
 DECLARE_int64(batchsize);
+DECLARE_double(batchframes);
 DECLARE_string(input);
 DECLARE_int64(samplerate);
 DECLARE_int64(channels);
@@ -78,6 +82,7 @@ DECLARE_int64(outputbinsize);
 DECLARE_bool(listdata);
 DECLARE_string(wordseparator);
 DECLARE_double(sampletarget);
+DECLARE_string(indexcache);
 
 /* ========== FILTERING OPTIONS ========== */
 
@@ -122,6 +127,7 @@ DECLARE_string(critoptim);
 
 DECLARE_bool(mfcc);
 DECLARE_bool(pow);
+DECLARE_bool(powfft);
 DECLARE_int64(mfcccoeffs);
 DECLARE_bool(mfsc);
 DECLARE_double(melfloor);
@@ -143,6 +149,15 @@ DECLARE_int64(seed);
 DECLARE_int64(memstepsize);
 DECLARE_int64(reportiters);
 DECLARE_int64(pcttraineval);
+DECLARE_string(diagdir);
+DECLARE_int64(diaginterval);
+DECLARE_int64(evalbatchsize);
+DECLARE_int64(evalbucketwidth);
+DECLARE_int64(evalworkers);
+DECLARE_bool(inferencegraph);
+DECLARE_string(tracefile);
+DECLARE_bool(tracesummary);
+DECLARE_int64(tracesample);
 
 /* ========== ARCHITECTURE OPTIONS ========== */
 
@@ -161,7 +176,10 @@ DECLARE_bool(logadd);
 DECLARE_string(smearing);
 DECLARE_string(lmtype);
 DECLARE_string(lexicon);
+DECLARE_string(lexiconcache);
 DECLARE_string(emission_dir);
+DECLARE_int64(emission_shards);
+DECLARE_bool(emission_fp16);
 DECLARE_string(lm);
 DECLARE_string(am);
 DECLARE_string(sclite);
@@ -204,6 +222,35 @@ DECLARE_double(softwrate);
 DECLARE_double(softwstd);
 DECLARE_bool(trainWithWindow);
 
+/* ========== ATTRIBUTION OPTIONS ========== */
+
+DECLARE_string(attrmode);
+DECLARE_string(attroptim);
+DECLARE_int64(attriters);
+DECLARE_int64(attrnoise);
+DECLARE_int64(attrsync);
+DECLARE_int64(attrlrstep);
+DECLARE_double(attrnoisestd);
+DECLARE_double(attrlambda);
+DECLARE_double(attrlr);
+DECLARE_double(attrlrdecay);
+
+/* ========== AUGMENTATION OPTIONS ========== */
+
+DECLARE_double(augsnr);
+DECLARE_double(augspeed);
+DECLARE_int64(augtimewarp);
+DECLARE_int64(augfreqmask);
+DECLARE_int64(augnfreqmask);
+DECLARE_int64(augtimemask);
+DECLARE_int64(augntimemask);
+
+/* ========== QUANTIZATION OPTIONS ========== */
+
+DECLARE_string(quantcalib);
+DECLARE_int64(quantcalibsize);
+DECLARE_string(quantout);
+
 /* ========== DISTRIBUTED TRAINING ========== */
 DECLARE_bool(enable_distributed);
 DECLARE_int64(world_rank);
@@ -9,11 +9,28 @@
 #include "Dictionary.h"
 
 #include <glog/logging.h>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 
 namespace w2l {
 
+namespace {
+
+uint64_t hashToken(TokenView token) {
+  uint64_t h = 14695981039346656037ULL; // FNV-1a
+  for (size_t i = 0; i < token.size; ++i) {
+    h = (h ^ static_cast<uint8_t>(token.data[i])) * 1099511628211ULL;
+  }
+  return h;
+}
+
+} // namespace
+
 void Dictionary::addToken(const std::string& token, int idx) {
+  if (frozen_) {
+    LOG(FATAL) << "Adding '" << token << "' to a frozen dictionary";
+  }
   if (token2idx_.find(token) != token2idx_.end()) {
     LOG(FATAL) << "Duplicate entry name in dictionary '" << token << "'";
   }
@@ -33,6 +50,9 @@ void Dictionary::addToken(const std::string& token) {
 }
 
 std::string Dictionary::getToken(int idx) const {
+  if (frozen_) {
+    return getTokenView(idx).str();
+  }
   auto iter = idx2token_.find(idx);
   if (iter == idx2token_.end()) {
     LOG(FATAL) << "Unknown index in dictionary '" << idx << "'";
@@ -45,8 +65,8 @@ void Dictionary::setDefaultIndex(int idx) {
 }
 
 int Dictionary::getIndex(const std::string& token) const {
-  auto iter = token2idx_.find(token);
-  if (iter == token2idx_.end()) {
+  int idx = findIndex(token);
+  if (idx < 0) {
     if (defaultIndex_ < 0) {
       LOG(FATAL) << "Unknown token in dictionary: '" << token << "'";
     } else {
@@ -54,10 +74,13 @@ int Dictionary::getIndex(const std::string& token) const {
       return defaultIndex_;
     }
   }
-  return iter->second;
+  return idx;
 }
 
 bool Dictionary::contains(const std::string& token) const {
+  if (frozen_) {
+    return findIndex(TokenView(token)) >= 0;
+  }
   auto iter = token2idx_.find(token);
   if (iter == token2idx_.end()) {
     return false;
@@ -107,4 +130,86 @@ size_t Dictionary::indexSize() const {
   return idx2token_.size();
 }
 
+void Dictionary::freeze() {
+  if (frozen_) {
+    return;
+  }
+  if (!isContiguous()) {
+    LOG(FATAL) << "Only a dictionary with contiguous indices can be frozen";
+  }
+  frozenTokens_.clear();
+  frozenOffsets_.assign(1, 0);
+  for (size_t i = 0; i < indexSize(); ++i) {
+    frozenTokens_ += idx2token_.at(i);
+    frozenOffsets_.push_back(frozenTokens_.size());
+  }
+
+  frozenKeys_.clear();
+  frozenKeyOffsets_.assign(1, 0);
+  frozenKeyIndices_.clear();
+  size_t nSlots = 1;
+  while (nSlots < 2 * token2idx_.size()) {
+    nSlots *= 2;
+  }
+  frozenSlots_.assign(nSlots, -1);
+  for (const auto& tknidx : token2idx_) {
+    auto slot = hashToken(tknidx.first) & (nSlots - 1);
+    while (frozenSlots_[slot] >= 0) {
+      slot = (slot + 1) & (nSlots - 1);
+    }
+    frozenSlots_[slot] = frozenKeyIndices_.size();
+    frozenKeys_ += tknidx.first;
+    frozenKeyOffsets_.push_back(frozenKeys_.size());
+    frozenKeyIndices_.push_back(tknidx.second);
+  }
+  frozen_ = true;
+}
+
+bool Dictionary::isFrozen() const {
+  return frozen_;
+}
+
+TokenView Dictionary::getTokenView(int idx) const {
+  if (frozen_) {
+    if (idx < 0 || idx >= static_cast<int>(frozenOffsets_.size()) - 1) {
+      LOG(FATAL) << "Unknown index in dictionary '" << idx << "'";
+    }
+    return TokenView(
+        frozenTokens_.data() + frozenOffsets_[idx],
+        frozenOffsets_[idx + 1] - frozenOffsets_[idx]);
+  }
+  auto iter = idx2token_.find(idx);
+  if (iter == idx2token_.end()) {
+    LOG(FATAL) << "Unknown index in dictionary '" << idx << "'";
+  }
+  return iter->second;
+}
+
+int Dictionary::findIndex(TokenView token) const {
+  if (!frozen_) {
+    auto iter = token2idx_.find(token.str());
+    return iter == token2idx_.end() ? -1 : iter->second;
+  }
+  size_t mask = frozenSlots_.size() - 1;
+  for (auto slot = hashToken(token) & mask; frozenSlots_[slot] >= 0;
+       slot = (slot + 1) & mask) {
+    auto key = frozenSlots_[slot];
+    auto begin = frozenKeyOffsets_[key];
+    if (frozenKeyOffsets_[key + 1] - begin == token.size &&
+        std::memcmp(frozenKeys_.data() + begin, token.data, token.size) ==
+            0) {
+      return frozenKeyIndices_[key];
+    }
+  }
+  return -1;
+}
+
+int Dictionary::findIndex(const std::string& token) const {
+  if (frozen_) {
+    return findIndex(TokenView(token));
+  }
+  auto iter = token2idx_.find(token);
+  return iter == token2idx_.end() ? -1 : iter->second;
+}
+
 } // namespace w2l
@@ -14,8 +14,48 @@
 
 namespace w2l {
 
+// Read-only view of contiguous token indices
+struct IndexSpan {
+  const int* data{nullptr};
+  size_t size{0};
+
+  IndexSpan() {}
+  IndexSpan(const int* d, size_t n) : data(d), size(n) {}
+
+  const int* begin() const {
+    return data;
+  }
+  const int* end() const {
+    return data + size;
+  }
+  bool empty() const {
+    return size == 0;
+  }
+  int operator[](size_t i) const {
+    return data[i];
+  }
+};
+
+// Read-only view of the characters of a token (a string_view for C++11)
+struct TokenView {
+  const char* data{nullptr};
+  size_t size{0};
+
+  TokenView() {}
+  TokenView(const char* d, size_t n) : data(d), size(n) {}
+  TokenView(const std::string& str) : data(str.data()), size(str.size()) {}
+
+  std::string str() const {
+    return std::string(data, size);
+  }
+};
+
 // A simple dictionary class which holds a bidirectional map
 // tokens (strings) <--> integer indices. Not thread-safe !
+//
+// Once complete, a dictionary with contiguous indices can be frozen: tokens
+// are then stored back to back in index order and found through a single
+// open addressing table, and adding tokens is an error.
 class Dictionary {
  public:
   Dictionary() {}
@@ -45,10 +85,34 @@ class Dictionary {
   std::vector<std::string> mapIndicesToTokens(
       const std::vector<int>& indices) const;
 
+  void freeze();
+
+  bool isFrozen() const;
+
+  // The token of `idx`, valid as long as the dictionary is not changed
+  TokenView getTokenView(int idx) const;
+
+  // Index of `token`, -1 if it is not in the dictionary (the default index
+  // is not used)
+  int findIndex(TokenView token) const;
+  int findIndex(const std::string& token) const;
+
  private:
   std::unordered_map<std::string, int> token2idx_;
   std::unordered_map<int, std::string> idx2token_;
   int defaultIndex_ = -1;
+
+  // Frozen storage: the token of index i is
+  // frozenTokens_[frozenOffsets_[i], frozenOffsets_[i + 1]). frozenKeys_
+  // holds every token (aliases included) the same way, with the index of
+  // key k in frozenKeyIndices_[k], and frozenSlots_ maps hashes to keys.
+  bool frozen_ = false;
+  std::string frozenTokens_;
+  std::vector<size_t> frozenOffsets_;
+  std::string frozenKeys_;
+  std::vector<size_t> frozenKeyOffsets_;
+  std::vector<int> frozenKeyIndices_;
+  std::vector<int> frozenSlots_;
 };
 
 typedef std::unordered_map<int, Dictionary> DictionaryMap;
@@ -0,0 +1,344 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "common/Trace.h"
+
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <glog/logging.h>
+
+namespace w2l {
+
+namespace {
+
+constexpr size_t kBufferSize = 1 << 14; // events per thread, a power of 2
+constexpr int kMaxDepth = 64;
+constexpr int kBucketsPerOctave = 4;
+constexpr int kNumBuckets = 48 * kBucketsPerOctave; // up to 2^48 ns
+
+int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+struct TraceEvent {
+  const char* name;
+  int64_t startNs;
+  int64_t durNs; // -1 for counters
+  double value;
+  int depth;
+};
+
+// Log-scale histogram, the percentiles are within 10% of the exact ones
+struct StageStats {
+  int64_t count{0};
+  double sumNs{0};
+  int64_t maxNs{0};
+  std::vector<int64_t> buckets = std::vector<int64_t>(kNumBuckets, 0);
+
+  void add(int64_t ns) {
+    ++count;
+    sumNs += ns;
+    maxNs = std::max(maxNs, ns);
+    int b = ns > 1 ? std::log2(static_cast<double>(ns)) * kBucketsPerOctave : 0;
+    ++buckets[std::min(b, kNumBuckets - 1)];
+  }
+
+  double percentileMs(double p) const {
+    int64_t rank = std::ceil(p * count);
+    int64_t seen = 0;
+    for (int b = 0; b < kNumBuckets; ++b) {
+      seen += buckets[b];
+      if (seen >= rank && seen > 0) {
+        double ns = std::pow(2.0, (b + 0.5) / kBucketsPerOctave);
+        return std::min(ns, static_cast<double>(maxNs)) / 1e6;
+      }
+    }
+    return maxNs / 1e6;
+  }
+};
+
+void writeJsonString(std::ostream& out, const char* str) {
+  out << '"';
+  for (; *str; ++str) {
+    if (*str == '"' || *str == '\\') {
+      out << '\\';
+    }
+    out << *str;
+  }
+  out << '"';
+}
+
+} // namespace
+
+// Single producer (the owning thread), single consumer (Tracer::drain) ring
+struct ThreadTrace {
+  std::vector<TraceEvent> events{kBufferSize};
+  std::atomic<uint64_t> head{0};
+  std::atomic<uint64_t> tail{0};
+  std::atomic<int64_t> dropped{0};
+  int tid{0};
+
+  // only used by the owning thread
+  int depth{0};
+  bool sampled{false};
+  uint64_t roots{0};
+
+  void push(const TraceEvent& event) {
+    auto h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= kBufferSize) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    events[h & (kBufferSize - 1)] = event;
+    head.store(h + 1, std::memory_order_release);
+  }
+};
+
+struct Tracer::State {
+  std::mutex threadsMutex;
+  std::vector<std::shared_ptr<ThreadTrace>> threads;
+  int nextTid{0};
+  int64_t droppedByExited{0};
+
+  // guarded by mutex
+  std::mutex mutex;
+  std::ofstream chrome;
+  bool firstEvent{true};
+  std::map<std::string, StageStats> stages;
+  std::map<std::string, double> counters;
+  int64_t windowStartNs{0};
+  int64_t epochNs{0};
+  int pid{0};
+
+  std::mutex stopMutex;
+  std::condition_variable stopCv;
+  bool stop{false};
+  std::thread flusher;
+};
+
+std::atomic<bool> Tracer::enabled_{false};
+
+Tracer& Tracer::get() {
+  static Tracer tracer;
+  return tracer;
+}
+
+Tracer::Tracer() : state_(new State()) {
+  state_->epochNs = nowNs();
+  state_->windowStartNs = state_->epochNs;
+  state_->pid = ::getpid();
+}
+
+Tracer::~Tracer() {
+  disable();
+}
+
+void Tracer::enable(
+    const std::string& chromeTracePath /* = "" */,
+    int64_t samplePeriod /* = 1 */) {
+  disable();
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    if (!chromeTracePath.empty()) {
+      state_->chrome.open(chromeTracePath, std::ios::out | std::ios::trunc);
+      if (!state_->chrome.is_open()) {
+        LOG(FATAL) << "Could not open trace file " << chromeTracePath;
+      }
+      state_->chrome << std::fixed << std::setprecision(3);
+      state_->chrome << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+      state_->firstEvent = true;
+    }
+  }
+  resetSummary();
+  samplePeriod_ = std::max<int64_t>(1, samplePeriod);
+  state_->stop = false;
+  state_->flusher = std::thread(&Tracer::run, this);
+  enabled_ = true;
+}
+
+void Tracer::disable() {
+  if (!state_->flusher.joinable()) {
+    return;
+  }
+  enabled_ = false;
+  {
+    std::lock_guard<std::mutex> lock(state_->stopMutex);
+    state_->stop = true;
+  }
+  state_->stopCv.notify_all();
+  state_->flusher.join();
+  drain();
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  if (state_->chrome.is_open()) {
+    state_->chrome << "\n]}\n";
+    state_->chrome.close();
+  }
+}
+
+void Tracer::flush() {
+  drain();
+}
+
+void Tracer::run() {
+  std::unique_lock<std::mutex> lock(state_->stopMutex);
+  auto stopped = [this] { return state_->stop; };
+  while (!state_->stopCv.wait_for(
+      lock, std::chrono::milliseconds(100), stopped)) {
+    lock.unlock();
+    drain();
+    lock.lock();
+  }
+}
+
+ThreadTrace* Tracer::thread() {
+  thread_local std::shared_ptr<ThreadTrace> local;
+  if (!local) {
+    local = std::make_shared<ThreadTrace>();
+    std::lock_guard<std::mutex> lock(state_->threadsMutex);
+    local->tid = state_->nextTid++;
+    state_->threads.push_back(local);
+  }
+  return local.get();
+}
+
+void Tracer::addCount(const char* name, double value) {
+  auto t = thread();
+  t->push({name, nowNs(), -1, value, t->depth});
+}
+
+void Tracer::drain() {
+  std::vector<std::shared_ptr<ThreadTrace>> threads;
+  {
+    std::lock_guard<std::mutex> lock(state_->threadsMutex);
+    threads = state_->threads;
+  }
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  auto& out = state_->chrome;
+  for (auto& t : threads) {
+    auto head = t->head.load(std::memory_order_acquire);
+    auto tail = t->tail.load(std::memory_order_relaxed);
+    for (; tail < head; ++tail) {
+      const auto& e = t->events[tail & (kBufferSize - 1)];
+      if (e.durNs >= 0) {
+        state_->stages[e.name].add(e.durNs);
+      } else {
+        state_->counters[e.name] += e.value;
+      }
+      if (!out.is_open()) {
+        continue;
+      }
+      out << (state_->firstEvent ? "" : ",\n") << "{\"name\": ";
+      writeJsonString(out, e.name);
+      out << ", \"pid\": " << state_->pid << ", \"tid\": " << t->tid
+          << ", \"ts\": " << (e.startNs - state_->epochNs) / 1e3;
+      if (e.durNs >= 0) {
+        out << ", \"ph\": \"X\", \"dur\": " << e.durNs / 1e3
+            << ", \"args\": {\"depth\": " << e.depth << "}}";
+      } else {
+        out << ", \"ph\": \"C\", \"args\": {\"value\": " << e.value << "}}";
+      }
+      state_->firstEvent = false;
+    }
+    t->tail.store(head, std::memory_order_release);
+  }
+
+  // forget the buffers of exited threads once they are empty
+  std::lock_guard<std::mutex> threadsLock(state_->threadsMutex);
+  auto& all = state_->threads;
+  for (auto it = all.begin(); it != all.end();) {
+    if (it->use_count() == 2 && // held by `all` and `threads` only
+        (*it)->tail.load() == (*it)->head.load()) {
+      state_->droppedByExited += (*it)->dropped.load();
+      it = all.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+std::string Tracer::summary() {
+  drain();
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  double seconds = (nowNs() - state_->windowStartNs) / 1e9;
+  std::ostringstream ss;
+  ss << std::fixed << std::setprecision(3);
+  ss << std::left << std::setw(32) << "stage" << std::right << std::setw(10)
+     << "count" << std::setw(12) << "mean ms" << std::setw(12) << "p50 ms"
+     << std::setw(12) << "p95 ms" << std::setw(12) << "p99 ms"
+     << std::setw(12) << "max ms";
+  for (const auto& it : state_->stages) {
+    const auto& s = it.second;
+    ss << "\n"
+       << std::left << std::setw(32) << it.first << std::right
+       << std::setw(10) << s.count << std::setw(12) << s.sumNs / s.count / 1e6
+       << std::setw(12) << s.percentileMs(0.5) << std::setw(12)
+       << s.percentileMs(0.95) << std::setw(12) << s.percentileMs(0.99)
+       << std::setw(12) << s.maxNs / 1e6;
+  }
+  for (const auto& it : state_->counters) {
+    ss << "\n"
+       << std::left << std::setw(32) << it.first << std::right
+       << std::setw(10) << it.second << " total, "
+       << (seconds > 0 ? it.second / seconds : 0.0) << " per second";
+  }
+  return ss.str();
+}
+
+void Tracer::resetSummary() {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  state_->stages.clear();
+  state_->counters.clear();
+  state_->windowStartNs = nowNs();
+}
+
+int64_t Tracer::dropped() const {
+  std::lock_guard<std::mutex> lock(state_->threadsMutex);
+  int64_t total = state_->droppedByExited;
+  for (const auto& t : state_->threads) {
+    total += t->dropped.load();
+  }
+  return total;
+}
+
+void TraceScope::begin(const char* name) {
+  auto& tracer = Tracer::get();
+  thread_ = tracer.thread();
+  if (thread_->depth == 0) {
+    auto period = tracer.samplePeriod_.load(std::memory_order_relaxed);
+    thread_->sampled = thread_->roots++ % period == 0;
+  }
+  ++thread_->depth;
+  record_ = thread_->sampled && thread_->depth <= kMaxDepth;
+  if (record_) {
+    name_ = name;
+    startNs_ = nowNs();
+  }
+}
+
+void TraceScope::end() {
+  --thread_->depth;
+  if (record_) {
+    auto endNs = nowNs();
+    thread_->push({name_, startNs_, endNs - startNs_, 0.0, thread_->depth});
+  }
+}
+
+} // namespace w2l
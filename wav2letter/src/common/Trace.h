@@ -0,0 +1,121 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace w2l {
+
+struct ThreadTrace;
+
+/**
+ * Lightweight tracing of the coarse stages of a run: data loading,
+ * featurization, criteria, decoding, optimization steps.
+ *
+ * `W2L_TRACE_SCOPE("data/featurize")` times the enclosing block. Scopes nest
+ * per thread and each recorded one becomes an event in a ring buffer owned by
+ * its thread, written without locks. A background thread drains the buffers
+ * every 100ms into
+ *  - a Chrome trace-event JSON (chrome://tracing, Perfetto) if a path is set,
+ *  - per-stage latency histograms, reported by `summary()`.
+ * `Tracer::count("test/frames", T)` adds to a counter, reported as a rate.
+ *
+ * With a sample period n, only one in n top-level scopes of each thread is
+ * recorded, together with everything nested in it. While disabled a scope
+ * costs one relaxed atomic load. Names must be string literals.
+ */
+class Tracer {
+ public:
+  static Tracer& get();
+
+  static bool enabled() {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  static void count(const char* name, double value) {
+    if (enabled()) {
+      get().addCount(name, value);
+    }
+  }
+
+  // Start recording, `chromeTracePath` may be empty to only keep histograms
+  void enable(
+      const std::string& chromeTracePath = "",
+      int64_t samplePeriod = 1);
+
+  // Stop recording, drain the buffers and complete the trace file
+  void disable();
+
+  // Drain all thread buffers now
+  void flush();
+
+  // count, mean, p50, p95, p99 and max latency (ms) of every stage and the
+  // rate of every counter since the last reset, as a table
+  std::string summary();
+
+  void resetSummary();
+
+  // Events lost because a thread buffer was full
+  int64_t dropped() const;
+
+  ~Tracer();
+
+ private:
+  friend class TraceScope;
+  struct State;
+
+  Tracer();
+
+  ThreadTrace* thread();
+  void addCount(const char* name, double value);
+  void drain();
+  void run();
+
+  static std::atomic<bool> enabled_;
+  std::atomic<int64_t> samplePeriod_{1};
+  std::unique_ptr<State> state_;
+};
+
+// Records the time between construction and destruction, see Tracer
+class TraceScope {
+ public:
+  explicit TraceScope(const char* name) {
+    if (Tracer::enabled()) {
+      begin(name);
+    }
+  }
+
+  ~TraceScope() {
+    if (thread_) {
+      end();
+    }
+  }
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+ private:
+  void begin(const char* name);
+  void end();
+
+  ThreadTrace* thread_{nullptr};
+  const char* name_{nullptr};
+  int64_t startNs_{0};
+  bool record_{false};
+};
+
+#define W2L_TRACE_CONCAT_(a, b) a##b
+#define W2L_TRACE_CONCAT(a, b) W2L_TRACE_CONCAT_(a, b)
+#define W2L_TRACE_SCOPE(name) \
+  ::w2l::TraceScope W2L_TRACE_CONCAT(w2lTraceScope, __LINE__)(name)
+
+} // namespace w2l
@@ -108,13 +108,12 @@ void remapLabels(std::vector<T>& labels, const Dictionary& dict) {
 
 // Input: B x inRow x inCol (Row Major), Output: B x inCol x inRow (Row Major)
 template <typename T>
-std::vector<T> transpose2d(
-    const std::vector<T>& in,
+void transpose2d(
+    const T* in,
+    T* out,
     int64_t inRow,
     int64_t inCol,
     int64_t inBatch = 1) {
-  LOG_IF(FATAL, in.size() != inRow * inCol * inBatch);
-  std::vector<T> out(in.size());
   for (size_t b = 0; b < inBatch; ++b) {
     int64_t start = b * inRow * inCol;
     for (size_t c = 0; c < inCol; ++c) {
@@ -123,23 +122,35 @@ std::vector<T> transpose2d(
       }
     }
   }
-  return out;
 }
 
 template <typename T>
-std::vector<T> localNormalize(
+std::vector<T> transpose2d(
     const std::vector<T>& in,
+    int64_t inRow,
+    int64_t inCol,
+    int64_t inBatch = 1) {
+  LOG_IF(FATAL, in.size() != inRow * inCol * inBatch);
+  std::vector<T> out(in.size());
+  transpose2d(in.data(), out.data(), inRow, inCol, inBatch);
+  return out;
+}
+
+// localNormalize of the `size` values at `data`, in place
+template <typename T>
+void localNormalizeInPlace(
+    T* data,
+    int64_t size,
     int64_t leftCtxSize,
     int64_t rightCtxSize,
     int64_t frameSz = 1,
     int64_t batchSz = 1,
     double threshold = 0.0) {
-  if (in.empty()) {
-    return {};
+  if (size == 0) {
+    return;
   }
-  int64_t perBatchSz = in.size() / batchSz;
+  int64_t perBatchSz = size / batchSz;
   int64_t perFrameSz = perBatchSz / frameSz;
-  auto out(in);
   for (size_t b = 0; b < batchSz; ++b) {
     std::vector<T> sum(frameSz, 0.0), sum2(frameSz, 0.0);
     int64_t curFrame = 0;
@@ -148,8 +159,8 @@ std::vector<T> localNormalize(
       auto start = std::max(curFrame - rightCtxSize, 0L);
       auto end = std::min(curFrame + leftCtxSize, frameSz - 1);
       for (int64_t j = start; j <= end; ++j) {
-        sum[j] += in[i];
-        sum2[j] += in[i] * in[i];
+        sum[j] += data[i];
+        sum2[j] += data[i] * data[i];
       }
       curFrame = (curFrame + 1) % frameSz;
     }
@@ -166,13 +177,32 @@ std::vector<T> localNormalize(
     // perform local normalization
     curFrame = 0;
     for (auto i = b * perBatchSz; i < (b + 1) * perBatchSz; ++i) {
-      out[i] -= sum[curFrame];
+      data[i] -= sum[curFrame];
       if (sum2[curFrame] > threshold) {
-        out[i] /= sum2[curFrame];
+        data[i] /= sum2[curFrame];
       }
       curFrame = (curFrame + 1) % frameSz;
     }
   }
+}
+
+template <typename T>
+std::vector<T> localNormalize(
+    const std::vector<T>& in,
+    int64_t leftCtxSize,
+    int64_t rightCtxSize,
+    int64_t frameSz = 1,
+    int64_t batchSz = 1,
+    double threshold = 0.0) {
+  auto out(in);
+  localNormalizeInPlace(
+      out.data(),
+      out.size(),
+      leftCtxSize,
+      rightCtxSize,
+      frameSz,
+      batchSz,
+      threshold);
   return out;
 }
 
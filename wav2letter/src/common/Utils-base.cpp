@@ -438,11 +438,21 @@ std::string tensor2letters(
 std::string tensor2words(
     const std::vector<int>& input,
     const Dictionary& wordDict) {
-  std::string ret = "";
+  std::string ret;
+  tensor2words(input, wordDict, ret);
+  return ret;
+}
+
+void tensor2words(
+    const std::vector<int>& input,
+    const Dictionary& wordDict,
+    std::string& ret) {
+  ret.clear();
   for (auto wrdIdx : input) {
-    ret += wordDict.getToken(wrdIdx) + " ";
+    auto word = wordDict.getTokenView(wrdIdx);
+    ret.append(word.data, word.size);
+    ret += ' ';
   }
-  return ret;
 }
 
 void validateTokens(std::vector<int>& input, const int unkIdx) {
@@ -462,23 +472,40 @@ std::vector<int> tknTensor2wrdTensor(
     const Dictionary& tokenDict,
     const int spliterIdx) {
   std::vector<int> ret;
-  std::string currentWord = "";
+  std::string currentWord;
+  tknTensor2wrdTensor(input, wordDict, tokenDict, spliterIdx, ret, currentWord);
+  return ret;
+}
+
+void tknTensor2wrdTensor(
+    const std::vector<int>& input,
+    const Dictionary& wordDict,
+    const Dictionary& tokenDict,
+    const int spliterIdx,
+    std::vector<int>& ret,
+    std::string& currentWord) {
+  ret.clear();
+  currentWord.clear();
   for (auto ltrIdx : input) {
     if (ltrIdx == spliterIdx) {
       if (!currentWord.empty()) {
-        if (wordDict.contains(currentWord)) {
-          ret.push_back(wordDict.getIndex(currentWord));
+        int wrdIdx = wordDict.findIndex(currentWord);
+        if (wrdIdx >= 0) {
+          ret.push_back(wrdIdx);
         }
-        currentWord = "";
+        currentWord.clear();
       }
     } else {
-      currentWord += tokenDict.getToken(ltrIdx);
+      auto token = tokenDict.getTokenView(ltrIdx);
+      currentWord.append(token.data, token.size);
     }
   }
-  if (!currentWord.empty() && wordDict.contains(currentWord)) {
-    ret.push_back(wordDict.getIndex(currentWord));
+  if (!currentWord.empty()) {
+    int wrdIdx = wordDict.findIndex(currentWord);
+    if (wrdIdx >= 0) {
+      ret.push_back(wrdIdx);
+    }
   }
-  return ret;
 }
 
 std::vector<int> wrdTensor2tknTensor(
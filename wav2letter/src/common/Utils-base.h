@@ -101,6 +101,9 @@ std::string tensor2letters(const std::vector<int>&, const Dictionary&);
 
 std::string tensor2words(const std::vector<int>&, const Dictionary&);
 
+// Writes into `ret`, reusing its storage
+void tensor2words(const std::vector<int>&, const Dictionary&, std::string& ret);
+
 void validateTokens(std::vector<int>&, const int);
 
 std::vector<int> tknTensor2wrdTensor(
@@ -109,6 +112,16 @@ std::vector<int> tknTensor2wrdTensor(
     const Dictionary&,
     const int);
 
+// Writes into `ret`, reusing its storage and `word` as scratch space. Best
+// with frozen dictionaries, where no token is copied or looked up twice.
+void tknTensor2wrdTensor(
+    const std::vector<int>&,
+    const Dictionary&,
+    const Dictionary&,
+    const int,
+    std::vector<int>& ret,
+    std::string& word);
+
 std::vector<int> wrdTensor2tknTensor(
     const std::vector<int>&,
     const Dictionary&,
@@ -10,10 +10,16 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <cstdlib>
+#include <fstream>
 #include <future>
+#include <iterator>
 #include <memory>
+#include <sstream>
 
+#include "common/CompiledLexicon.h"
 #include "common/Dictionary.h"
+#include "common/Trace.h"
 #include "common/Transforms.h"
 #include "common/Utils.h"
 
@@ -247,6 +253,64 @@ TEST(W2lCommonTest, Dictionary) {
   ASSERT_EQ(dict.indexSize(), 5);
 }
 
+TEST(W2lCommonTest, FrozenDictionary) {
+  Dictionary dict;
+  for (int i = 0; i < 100; ++i) {
+    dict.addToken("w" + std::to_string(i));
+  }
+  dict.addToken("alias", 7);
+  Dictionary unfrozen = dict;
+  dict.freeze();
+  ASSERT_TRUE(dict.isFrozen());
+  ASSERT_FALSE(unfrozen.isFrozen());
+
+  ASSERT_EQ(dict.tokenSize(), 101);
+  ASSERT_EQ(dict.indexSize(), 100);
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_EQ(dict.getToken(i), unfrozen.getToken(i));
+    ASSERT_EQ(dict.getTokenView(i).str(), unfrozen.getToken(i));
+    ASSERT_EQ(dict.getIndex(unfrozen.getToken(i)), i);
+  }
+  ASSERT_EQ(dict.getIndex("alias"), 7);
+  ASSERT_TRUE(dict.contains("w99"));
+  ASSERT_FALSE(dict.contains("w100"));
+  ASSERT_EQ(dict.findIndex("w100"), -1);
+  std::string text = "w12w34";
+  ASSERT_EQ(dict.findIndex(TokenView(text.data() + 3, 3)), 34);
+
+  // the frozen tables are copied with the dictionary
+  Dictionary copy = dict;
+  ASSERT_TRUE(copy.isFrozen());
+  ASSERT_EQ(copy.getIndex("w42"), 42);
+  ASSERT_EQ(copy.getToken(42), "w42");
+}
+
+TEST(W2lCommonTest, TknTensorToWrdTensor) {
+  Dictionary tokenDict;
+  for (auto c : std::string("abc|")) {
+    tokenDict.addToken(std::string(1, c));
+  }
+  Dictionary wordDict;
+  wordDict.addToken("ab");
+  wordDict.addToken("c");
+  int sep = tokenDict.getIndex("|");
+  std::vector<int> input = tokenDict.mapTokensToIndices(
+      {"|", "a", "b", "|", "b", "b", "|", "|", "c"});
+
+  auto expected = tknTensor2wrdTensor(input, wordDict, tokenDict, sep);
+  ASSERT_THAT(expected, ::testing::ElementsAre(0, 1));
+  ASSERT_EQ(tensor2words(expected, wordDict), "ab c ");
+
+  tokenDict.freeze();
+  wordDict.freeze();
+  std::vector<int> words = {5, 5, 5};
+  std::string word = "stale", text = "stale";
+  tknTensor2wrdTensor(input, wordDict, tokenDict, sep, words, word);
+  ASSERT_THAT(words, ::testing::ElementsAreArray(expected));
+  tensor2words(words, wordDict, text);
+  ASSERT_EQ(text, "ab c ");
+}
+
 TEST(W2lCommonTest, InvReplabel) {
   Dictionary dict;
   dict.addToken("1", 1);
@@ -424,6 +488,124 @@ TEST(W2lCommonTest, WrdToTarget) {
   ASSERT_THAT(target4, ::testing::ElementsAreArray({"_7", "89"}));
 }
 
+TEST(W2lCommonTest, CompiledLexicon) {
+  gflags::FlagSaver flagsaver;
+  w2l::FLAGS_wordseparator = "_";
+
+  LexiconMap lexicon;
+  lexicon["123"].push_back({"1", "23_"});
+  lexicon["456"].push_back({"456_"});
+  lexicon["789"].push_back({"_7", "89"});
+  lexicon["010"].push_back({"_0", "10"});
+  lexicon["105"].push_back({"10", "5"});
+  lexicon["2100"].push_back({"2", "1", "00"});
+  lexicon["888"].push_back({"8", "8", "8"});
+  lexicon["12"].push_back({"1", "2"});
+  lexicon["12"].push_back({"12"});
+  lexicon[kUnkToken] = {};
+
+  Dictionary dict;
+  for (auto l : lexicon) {
+    for (auto p : l.second) {
+      for (auto c : p) {
+        if (!dict.contains(c)) {
+          dict.addToken(c);
+        }
+      }
+    }
+  }
+  dict.addToken("_");
+  for (int i = 0; i < 10; ++i) {
+    if (!dict.contains(std::to_string(i))) {
+      dict.addToken(std::to_string(i));
+    }
+  }
+
+  CompiledLexicon compiled(lexicon, dict);
+  ASSERT_EQ(compiled.size(), static_cast<int64_t>(lexicon.size()));
+  ASSERT_EQ(compiled.find("999"), -1);
+  for (const auto& it : lexicon) {
+    auto id = compiled.find(it.first);
+    ASSERT_GE(id, 0);
+    ASSERT_EQ(compiled.word(id), it.first);
+    ASSERT_EQ(
+        compiled.numSpellings(id), static_cast<int64_t>(it.second.size()));
+    for (size_t k = 0; k < it.second.size(); ++k) {
+      auto spelling = compiled.spelling(id, k);
+      ASSERT_THAT(
+          std::vector<int>(spelling.begin(), spelling.end()),
+          ::testing::ElementsAreArray(dict.mapTokensToIndices(it.second[k])));
+    }
+  }
+
+  std::vector<std::vector<std::string>> sentences = {{"123", "456"},
+                                                     {"789", "010"},
+                                                     {"105", "2100"},
+                                                     {"12", "888", "12"},
+                                                     {"111", "789", "199"}};
+  for (const auto& words : sentences) {
+    for (bool fallback : {false, true}) {
+      auto expected = dict.mapTokensToIndices(
+          wrd2Target(words, lexicon, dict, fallback, true));
+      ASSERT_THAT(
+          wrd2Target(words, compiled, dict, fallback, true),
+          ::testing::ElementsAreArray(expected));
+    }
+  }
+
+  // spellings with tokens missing from the dictionary are dropped, only the
+  // words left without a spelling can't be in a transcript
+  auto withUnknown = lexicon;
+  withUnknown["12"].push_back({"1", "@"});
+  withUnknown["999"].push_back({"9", "@@"});
+  CompiledLexicon partial(withUnknown, dict);
+  auto id12 = partial.find("12");
+  ASSERT_TRUE(partial.hasUnknownTokens(id12));
+  ASSERT_EQ(partial.numSpellings(id12), 2);
+  ASSERT_FALSE(partial.hasUnknownTokens(partial.find("123")));
+  ASSERT_TRUE(partial.hasUnknownTokens(partial.find("999")));
+  ASSERT_EQ(partial.numSpellings(partial.find("999")), 0);
+  ASSERT_THAT(
+      wrd2Target({"12", "888", "12"}, partial, dict),
+      ::testing::ElementsAreArray(
+          wrd2Target({"12", "888", "12"}, compiled, dict)));
+  ASSERT_THROW(
+      wrd2Target({"123", "999"}, partial, dict), std::invalid_argument);
+
+  // file round trip, and reuse as a cache only while the source is unchanged
+  std::string userstr = "unknown";
+  char* user = getenv("USER");
+  if (user != nullptr) {
+    userstr = std::string(user);
+  }
+  const std::string lexiconfile = "/tmp/" + userstr + "_test_lexicon.txt";
+  const std::string cachefile = "/tmp/" + userstr + "_test_lexicon.bin";
+  {
+    std::ofstream out(lexiconfile);
+    for (const auto& it : lexicon) {
+      for (const auto& spelling : it.second) {
+        out << it.first << " " << join(" ", spelling) << "\n";
+      }
+    }
+  }
+  std::remove(cachefile.c_str());
+  auto built = loadCompiledLexicon(lexiconfile, -1, dict, cachefile);
+  ASSERT_TRUE(fileExists(cachefile));
+  auto mapped = loadCompiledLexicon(lexiconfile, -1, dict, cachefile);
+  ASSERT_EQ(mapped->fingerprint(), built->fingerprint());
+  ASSERT_EQ(mapped->size(), static_cast<int64_t>(lexicon.size()));
+  auto id = mapped->find("2100");
+  ASSERT_EQ(mapped->word(id), "2100");
+  auto spelling = mapped->spelling(id, 0);
+  ASSERT_THAT(
+      std::vector<int>(spelling.begin(), spelling.end()),
+      ::testing::ElementsAreArray(
+          dict.mapTokensToIndices({"2", "1", "00"})));
+  auto limited = loadCompiledLexicon(lexiconfile, 2, dict, cachefile);
+  ASSERT_NE(limited->fingerprint(), built->fingerprint());
+  ASSERT_EQ(limited->size(), 3); // two words and the unknown word
+}
+
 TEST(W2lCommonTest, TargetToSingleLtr) {
   gflags::FlagSaver flagsaver;
   w2l::FLAGS_wordseparator = "_";
@@ -441,6 +623,84 @@ TEST(W2lCommonTest, TargetToSingleLtr) {
   ASSERT_THAT(target, ::testing::ElementsAreArray({1, 2, 3, 10, 4, 5, 6}));
 }
 
+TEST(W2lCommonTest, Tracer) {
+  auto& tracer = Tracer::get();
+  {
+    W2L_TRACE_SCOPE("test/disabled");
+    Tracer::count("test/disabled", 1);
+  }
+
+  std::string userstr = "unknown";
+  char* user = getenv("USER");
+  if (user != nullptr) {
+    userstr = std::string(user);
+  }
+  const std::string tracefile = "/tmp/" + userstr + "_test_trace.json";
+  tracer.enable(tracefile);
+  for (int i = 0; i < 4; ++i) {
+    W2L_TRACE_SCOPE("test/outer");
+    {
+      W2L_TRACE_SCOPE("test/inner");
+      Tracer::count("test/frames", 10);
+    }
+  }
+  auto worker = std::async(std::launch::async, []() {
+    W2L_TRACE_SCOPE("test/worker");
+  });
+  worker.get();
+  auto summary = tracer.summary();
+  ASSERT_NE(summary.find("test/outer"), std::string::npos);
+  ASSERT_NE(summary.find("test/inner"), std::string::npos);
+  ASSERT_NE(summary.find("test/worker"), std::string::npos);
+  ASSERT_NE(summary.find("test/frames"), std::string::npos);
+  ASSERT_EQ(summary.find("test/disabled"), std::string::npos);
+  tracer.disable();
+
+  std::ifstream in(tracefile);
+  std::string json(
+      (std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  auto countOf = [&json](const std::string& str) {
+    int n = 0;
+    for (auto pos = json.find(str); pos != std::string::npos;
+         pos = json.find(str, pos + 1)) {
+      ++n;
+    }
+    return n;
+  };
+  ASSERT_EQ(json.find("{\"displayTimeUnit\""), 0);
+  ASSERT_EQ(json.substr(json.size() - 4), "\n]}\n");
+  ASSERT_EQ(countOf("\"test/outer\""), 4);
+  ASSERT_EQ(countOf("\"test/inner\""), 4);
+  ASSERT_EQ(countOf("\"ph\": \"C\""), 4);
+  ASSERT_EQ(countOf("\"depth\": 1"), 4);
+
+  // one in three top-level scopes, with everything nested in them
+  tracer.enable("", 3);
+  for (int i = 0; i < 9; ++i) {
+    W2L_TRACE_SCOPE("test/sampled");
+    W2L_TRACE_SCOPE("test/child");
+  }
+  summary = tracer.summary();
+  tracer.disable();
+  ASSERT_NE(summary.find("test/sampled"), std::string::npos);
+  ASSERT_EQ(summary.find("test/outer"), std::string::npos);
+  std::istringstream lines(summary);
+  std::string line;
+  int sampledLines = 0;
+  while (std::getline(lines, line)) {
+    std::istringstream fields(line);
+    std::string name;
+    int64_t count = 0;
+    fields >> name >> count;
+    if (name == "test/sampled" || name == "test/child") {
+      ASSERT_EQ(count, 3);
+      ++sampledLines;
+    }
+  }
+  ASSERT_EQ(sampledLines, 2);
+  ASSERT_EQ(tracer.dropped(), 0);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -13,6 +13,7 @@
 #include "ForceAlignmentCriterion.h"
 #include "FullConnectionCriterion.h"
 #include "SequenceCriterion.h"
+#include "common/Trace.h"
 
 namespace w2l {
 
@@ -21,11 +22,12 @@ class AutoSegmentationCriterion : public SequenceCriterion {
   explicit AutoSegmentationCriterion(
       int N,
       w2l::CriterionScaleMode scalemode = w2l::CriterionScaleMode::NONE,
-      double transdiag = 0.0)
+      double transdiag = 0.0,
+      bool checkpoint = false)
       : N_(N),
         scaleMode_(scalemode),
-        fac_(ForceAlignmentCriterion(N, scalemode)),
-        fcc_(FullConnectionCriterion(N, scalemode)) {
+        fac_(ForceAlignmentCriterion(N, scalemode, checkpoint)),
+        fcc_(FullConnectionCriterion(N, scalemode, checkpoint)) {
     if (N_ <= 0) {
       throw af::exception("ASG: N is zero or negative.");
     }
@@ -39,6 +41,7 @@ class AutoSegmentationCriterion : public SequenceCriterion {
     if (inputs.size() != 2) {
       throw std::invalid_argument("Invalid inputs size");
     }
+    W2L_TRACE_SCOPE("criterion/asg");
     return {fcc_.forward(inputs[0], inputs[1]) -
             fac_.forward(inputs[0], inputs[1])};
   }
@@ -80,6 +80,12 @@ CriterionScaleFn getCriterionScaleFn(CriterionScaleMode scale) {
       // return so that compiler doesn't compain
   }
 }
+
+int getCheckpointStride(int T) {
+  int stride = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(T))));
+  return std::max(stride, 1);
+}
+
 Variable getLinearTarget(const Variable& targetVar, int T) {
   int batchL = targetVar.dims(0);
   int B = targetVar.dims(1);
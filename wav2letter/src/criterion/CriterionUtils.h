@@ -83,6 +83,11 @@ CriterionScaleMode getCriterionScaleMode(const std::string& onorm, bool sqnorm);
 
 CriterionScaleFn getCriterionScaleFn(CriterionScaleMode scale);
 
+// Distance between stored alpha frames when a criterion runs in checkpoint
+// mode: ceil(sqrt(T)), so that both the checkpoints and the block recomputed
+// during backward hold O(sqrt(T)) frames.
+int getCheckpointStride(int T);
+
 // Input: N x T x B (type: float), Output: T x B (type: int)
 af::array viterbiPath(const af::array& input, const af::array& trans);
 
@@ -8,16 +8,53 @@
 
 #include "ForceAlignmentCriterion.h"
 
+#include <algorithm>
+
 #include "CriterionUtils.h"
+#include "common/Trace.h"
 
 using namespace fl;
 
 namespace w2l {
 
+namespace {
+
+// Computes frame t of the alpha table from frame t - 1
+void forwardStep(
+    int t,
+    int T,
+    int L,
+    const int* targets,
+    const float* inputsCurFrame,
+    const double* transBuf1,
+    const double* transBuf2,
+    const double* alphaPrevFramep,
+    double* alphaCurFrame) {
+  int high = t < L ? t : L;
+  int low = T - t < L ? L - (T - t) : 1;
+
+  if (T - t >= L) {
+    alphaCurFrame[0] =
+        transBuf1[0] + alphaPrevFramep[0] + inputsCurFrame[targets[0]];
+  }
+  for (int i = low; i < high; i++) {
+    double s1 = transBuf1[i] + alphaPrevFramep[i];
+    double s2 = transBuf2[i] + alphaPrevFramep[i - 1];
+    alphaCurFrame[i] = w2l::logSumExp(s1, s2) + inputsCurFrame[targets[i]];
+  }
+  if (high < L) {
+    alphaCurFrame[high] = transBuf2[high] + alphaPrevFramep[high - 1] +
+        inputsCurFrame[targets[high]];
+  }
+}
+
+} // namespace
+
 ForceAlignmentCriterion::ForceAlignmentCriterion(
     int N,
-    w2l::CriterionScaleMode scalemode)
-    : N_(N), scaleMode_(scalemode) {
+    w2l::CriterionScaleMode scalemode,
+    bool checkpoint)
+    : N_(N), scaleMode_(scalemode), checkpoint_(checkpoint) {
   if (N_ <= 0) {
     throw std::invalid_argument(
         "FAC: Size of transition matrix is less than 0.");
@@ -29,6 +66,7 @@ ForceAlignmentCriterion::ForceAlignmentCriterion(
 Variable ForceAlignmentCriterion::forward(
     const Variable& input,
     const Variable& target) {
+  W2L_TRACE_SCOPE("criterion/fac");
   int N = input.dims(0);
   int T = input.dims(1);
   int B = input.dims(2);
@@ -38,7 +76,9 @@ Variable ForceAlignmentCriterion::forward(
   }
 
   /* Forward */
-  auto fwBuf = fwParams(N, T, B, batchL);
+  bool checkpoint = checkpoint_;
+  int stride = w2l::getCheckpointStride(T);
+  auto fwBuf = fwParams(N, T, B, batchL, checkpoint);
   target.host(fwBuf.targetsRaw.data());
   input.host(fwBuf.inputsRaw.data());
   params_[0].host(fwBuf.transRaw.data());
@@ -48,7 +88,6 @@ Variable ForceAlignmentCriterion::forward(
 #pragma omp parallel for num_threads(B)
   for (int b = 0; b < B; b++) {
     float* inputs = fwBuf.inputsRaw.data() + b * N * T;
-    double* alpha = fwBuf.alpha.data() + b * batchL * T;
     auto targets = fwBuf.targetsRaw.data() + b * batchL;
     int L = w2l::getTargetSize(targets, batchL);
     L = std::min(L, T);
@@ -57,7 +96,20 @@ Variable ForceAlignmentCriterion::forward(
     }
     fwBuf.scale[b] = scaleFn(N, T, L);
 
-    alpha[0] = inputs[targets[0]];
+    // in checkpoint mode the recursion runs on two rolling frames and only
+    // every stride-th frame is copied to `alpha`
+    double* alpha = fwBuf.alpha.data() + b * batchL * T;
+    double* alphaWork = nullptr;
+    if (checkpoint) {
+      alpha = fwBuf.alpha.data() + b * batchL * ((T + stride - 1) / stride);
+      alphaWork = fwBuf.alphaWork.data() + b * batchL * 2;
+      std::fill(alphaWork, alphaWork + 2 * L, 0.0);
+    }
+    double* alphaFirstFrame = checkpoint ? alphaWork : alpha;
+    alphaFirstFrame[0] = inputs[targets[0]];
+    if (checkpoint) {
+      std::copy(alphaWork, alphaWork + L, alpha);
+    }
 
     double* transBuf1 = fwBuf.transBuf1.data() + b * batchL;
     double* transBuf2 = fwBuf.transBuf2.data() + b * batchL;
@@ -67,47 +119,58 @@ Variable ForceAlignmentCriterion::forward(
       transBuf2[i] =
           i > 0 ? fwBuf.transRaw[N * (targets[i]) + targets[i - 1]] : 0;
     }
+    double* alphaLastFrame = alphaFirstFrame;
     for (int t = 1; t < T; t++) {
-      double* alphaPrevFramep = alpha + (t - 1) * L;
-      double* alphaCurFrame = alpha + t * L;
-      const float* inputsCurFrame = inputs + t * N;
-      int high = t < L ? t : L;
-      int low = T - t < L ? L - (T - t) : 1;
-
-      if (T - t >= L) {
-        alphaCurFrame[0] =
-            transBuf1[0] + alphaPrevFramep[0] + inputsCurFrame[targets[0]];
-      }
-      for (int i = low; i < high; i++) {
-        double s1 = transBuf1[i] + alphaPrevFramep[i];
-        double s2 = transBuf2[i] + alphaPrevFramep[i - 1];
-        alphaCurFrame[i] = w2l::logSumExp(s1, s2) + inputsCurFrame[targets[i]];
+      double* alphaPrevFramep;
+      double* alphaCurFrame;
+      if (checkpoint) {
+        alphaPrevFramep = alphaWork + ((t - 1) % 2) * L;
+        alphaCurFrame = alphaWork + (t % 2) * L;
+        std::fill(alphaCurFrame, alphaCurFrame + L, 0.0);
+      } else {
+        alphaPrevFramep = alpha + (t - 1) * L;
+        alphaCurFrame = alpha + t * L;
       }
-      if (high < L) {
-        alphaCurFrame[high] = transBuf2[high] + alphaPrevFramep[high - 1] +
-            inputsCurFrame[targets[high]];
+      forwardStep(
+          t,
+          T,
+          L,
+          targets,
+          inputs + t * N,
+          transBuf1,
+          transBuf2,
+          alphaPrevFramep,
+          alphaCurFrame);
+      if (checkpoint && t % stride == 0) {
+        std::copy(alphaCurFrame, alphaCurFrame + L, alpha + (t / stride) * L);
       }
+      alphaLastFrame = alphaCurFrame;
     }
 
-    fwBuf.res[b] = static_cast<float>(alpha[T * L - 1] * fwBuf.scale[b]);
+    fwBuf.res[b] = static_cast<float>(alphaLastFrame[L - 1] * fwBuf.scale[b]);
   }
 
   auto result = af::array(B, fwBuf.res.data());
 
   /* Backward */
-  auto gradFunc = [B, N, T, batchL, fwBuf](
+  auto gradFunc = [B, N, T, batchL, checkpoint, stride, fwBuf](
                       std::vector<Variable>& inputs,
                       const Variable& gradOutput) {
-    auto bwBuf = bwParams(N, T, B, batchL);
+    auto bwBuf = bwParams(N, T, B, batchL, checkpoint);
+    int gradFrames = checkpoint ? 2 : T;
     gradOutput.host(bwBuf.outputsGrad.data());
 
 #pragma omp parallel for num_threads(B)
     for (int b = 0; b < B; b++) {
       const float grad = fwBuf.scale[b] * bwBuf.outputsGrad[b];
       float* inputsGrad = bwBuf.inputsGrad.data() + b * N * T;
-      double* alphaGrad = bwBuf.alphaGrad.data() + b * batchL * T;
+      double* alphaGrad = bwBuf.alphaGrad.data() + b * batchL * gradFrames;
       double* transGrad = bwBuf.transGrad.data() + b * N * N;
-      const double* alpha = fwBuf.alpha.data() + b * batchL * T;
+      const double* alpha = checkpoint
+          ? fwBuf.alpha.data() + b * batchL * ((T + stride - 1) / stride)
+          : fwBuf.alpha.data() + b * batchL * T;
+      double* alphaBlock =
+          checkpoint ? bwBuf.alphaBlock.data() + b * batchL * stride : nullptr;
       auto targets = fwBuf.targetsRaw.data() + b * batchL;
       int L = w2l::getTargetSize(targets, batchL);
       L = std::min(L, T);
@@ -126,35 +189,71 @@ Variable ForceAlignmentCriterion::forward(
             i > 0 ? fwBuf.transRaw[N * targets[i] + targets[i - 1]] : 0;
       }
       // bw
-      alphaGrad[T * L - 1] = 1;
-      for (int t = T - 1; t > 0; t--) {
-        float* inputsCurFrame = inputsGrad + t * N;
-        const double* alphaPrevFramep = alpha + (t - 1) * L;
-        double* alphaGradCurFrame = alphaGrad + t * L;
-        double* alphaGradPrevFrame = alphaGrad + (t - 1) * L;
-        int high = t < L ? t + 1 : L;
-        int low = T - t < L ? L - (T - t) : 0;
-
-        for (int i = low; i < high; i++) {
-          inputsCurFrame[targets[i]] += grad * alphaGradCurFrame[i];
-
-          if ((high < L || t == L - 1) && i == high - 1 && i > 0) {
-            alphaGradPrevFrame[i - 1] += alphaGradCurFrame[i];
-            transBuf2[i] += alphaGradCurFrame[i];
-          } else if (i == 0) {
-            alphaGradPrevFrame[i] += alphaGradCurFrame[i];
-            transBuf1[i] += alphaGradCurFrame[i];
-          } else {
-            double m_1 = fwTransBuf1[i] + alphaPrevFramep[i];
-            double m_2 = fwTransBuf2[i] + alphaPrevFramep[i - 1];
-            double s1 = 0, s2 = 0;
-            w2l::dLogSumExp(m_1, m_2, s1, s2, 1);
-
-            transBuf1[i] += s1 * alphaGradCurFrame[i];
-            transBuf2[i] += s2 * alphaGradCurFrame[i];
-
-            alphaGradPrevFrame[i] += s1 * alphaGradCurFrame[i];
-            alphaGradPrevFrame[i - 1] += s2 * alphaGradCurFrame[i];
+      alphaGrad[((T - 1) % gradFrames) * L + L - 1] = 1;
+      // frames [start, end) of alpha are needed to go back from frame `end`
+      // to frame `start`; without checkpointing this is a single block
+      int blockSize = checkpoint ? stride : T;
+      for (int start = ((T - 1) / blockSize) * blockSize; start >= 0;
+           start -= blockSize) {
+        int end = std::min(start + blockSize, T - 1);
+        if (end <= start) {
+          continue;
+        }
+        const double* alphaBlockp = alpha + start * L;
+        if (checkpoint) {
+          std::fill(alphaBlock, alphaBlock + (end - start) * L, 0.0);
+          std::copy(
+              alpha + (start / stride) * L,
+              alpha + (start / stride + 1) * L,
+              alphaBlock);
+          for (int t = start + 1; t < end; t++) {
+            forwardStep(
+                t,
+                T,
+                L,
+                targets,
+                fwBuf.inputsRaw.data() + b * N * T + t * N,
+                fwTransBuf1,
+                fwTransBuf2,
+                alphaBlock + (t - 1 - start) * L,
+                alphaBlock + (t - start) * L);
+          }
+          alphaBlockp = alphaBlock;
+        }
+
+        for (int t = end; t > start; t--) {
+          float* inputsCurFrame = inputsGrad + t * N;
+          const double* alphaPrevFramep = alphaBlockp + (t - 1 - start) * L;
+          double* alphaGradCurFrame = alphaGrad + (t % gradFrames) * L;
+          double* alphaGradPrevFrame =
+              alphaGrad + ((t - 1) % gradFrames) * L;
+          if (checkpoint) {
+            std::fill(alphaGradPrevFrame, alphaGradPrevFrame + L, 0.0);
+          }
+          int high = t < L ? t + 1 : L;
+          int low = T - t < L ? L - (T - t) : 0;
+
+          for (int i = low; i < high; i++) {
+            inputsCurFrame[targets[i]] += grad * alphaGradCurFrame[i];
+
+            if ((high < L || t == L - 1) && i == high - 1 && i > 0) {
+              alphaGradPrevFrame[i - 1] += alphaGradCurFrame[i];
+              transBuf2[i] += alphaGradCurFrame[i];
+            } else if (i == 0) {
+              alphaGradPrevFrame[i] += alphaGradCurFrame[i];
+              transBuf1[i] += alphaGradCurFrame[i];
+            } else {
+              double m_1 = fwTransBuf1[i] + alphaPrevFramep[i];
+              double m_2 = fwTransBuf2[i] + alphaPrevFramep[i - 1];
+              double s1 = 0, s2 = 0;
+              w2l::dLogSumExp(m_1, m_2, s1, s2, 1);
+
+              transBuf1[i] += s1 * alphaGradCurFrame[i];
+              transBuf2[i] += s2 * alphaGradCurFrame[i];
+
+              alphaGradPrevFrame[i] += s1 * alphaGradCurFrame[i];
+              alphaGradPrevFrame[i - 1] += s2 * alphaGradCurFrame[i];
+            }
           }
         }
       }
@@ -185,7 +284,8 @@ Variable ForceAlignmentCriterion::forward(
 }
 
 std::string ForceAlignmentCriterion::prettyString() const {
-  return "ForceAlignmentCriterion";
+  return checkpoint_ ? "ForceAlignmentCriterion (checkpoint)"
+                     : "ForceAlignmentCriterion";
 }
 
 } // namespace w2l
@@ -16,9 +16,16 @@ namespace w2l {
 
 class ForceAlignmentCriterion : public fl::BinaryModule {
  public:
+  /**
+   * If `checkpoint` is set, the alpha table is only kept every
+   * ceil(sqrt(T)) frames and the frames in between are recomputed block by
+   * block during backward. This trades one extra forward pass for
+   * O(sqrt(T)) instead of O(T) memory per utterance.
+   */
   explicit ForceAlignmentCriterion(
       int N,
-      w2l::CriterionScaleMode scalemode = w2l::CriterionScaleMode::NONE);
+      w2l::CriterionScaleMode scalemode = w2l::CriterionScaleMode::NONE,
+      bool checkpoint = false);
 
   fl::Variable forward(const fl::Variable& input, const fl::Variable& target)
       override;
@@ -31,25 +38,36 @@ class ForceAlignmentCriterion : public fl::BinaryModule {
 
   int N_;
   w2l::CriterionScaleMode scaleMode_;
+  bool checkpoint_{false};
 
   FL_SAVE_LOAD_WITH_BASE(
       fl::BinaryModule,
       fl::serializeAs<int64_t>(N_),
-      scaleMode_)
+      scaleMode_,
+      fl::versioned(checkpoint_, 1))
 
   struct fwParams {
     std::vector<int> targetsRaw;
     std::vector<float> inputsRaw, transRaw, scale;
     std::vector<float> res;
+    // all T frames, or every stride-th frame in checkpoint mode
     std::vector<double> alpha;
+    // two rolling frames used to run the recursion in checkpoint mode
+    std::vector<double> alphaWork;
     std::vector<double> transBuf1, transBuf2;
 
-    fwParams(int n, int t, int b, int l) {
+    fwParams(int n, int t, int b, int l, bool checkpoint) {
       targetsRaw.resize(l * b);
       inputsRaw.resize(b * t * n);
       res.resize(b);
       scale.resize(b);
-      alpha.resize(b * l * t);
+      if (checkpoint) {
+        int stride = w2l::getCheckpointStride(t);
+        alpha.resize(b * l * ((t + stride - 1) / stride));
+        alphaWork.resize(b * l * 2);
+      } else {
+        alpha.resize(b * l * t);
+      }
       transBuf1.resize(b * l);
       transBuf2.resize(b * l);
       transRaw.resize(n * n);
@@ -57,14 +75,22 @@ class ForceAlignmentCriterion : public fl::BinaryModule {
   };
 
   struct bwParams {
+    // all T frames, or two rolling frames in checkpoint mode
     std::vector<double> alphaGrad;
+    // alpha frames of the block being recomputed in checkpoint mode
+    std::vector<double> alphaBlock;
     std::vector<float> inputsGrad, transGradRes, outputsGrad;
     std::vector<double> transGrad;
     std::vector<double> fwTransBuf1, fwTransBuf2;
     std::vector<double> transBuf1, transBuf2;
 
-    bwParams(int n, int t, int b, int l) {
-      alphaGrad.resize(b * l * t, 0);
+    bwParams(int n, int t, int b, int l, bool checkpoint) {
+      if (checkpoint) {
+        alphaGrad.resize(b * l * 2, 0);
+        alphaBlock.resize(b * l * w2l::getCheckpointStride(t));
+      } else {
+        alphaGrad.resize(b * l * t, 0);
+      }
       inputsGrad.resize(b * t * n, 0);
       transGrad.resize(b * n * n, 0);
       outputsGrad.resize(b);
@@ -82,3 +108,4 @@ typedef ForceAlignmentCriterion FACLoss;
 } // namespace w2l
 
 CEREAL_REGISTER_TYPE(w2l::ForceAlignmentCriterion)
+CEREAL_CLASS_VERSION(w2l::ForceAlignmentCriterion, 1)
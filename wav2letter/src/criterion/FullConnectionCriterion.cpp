@@ -18,8 +18,9 @@ namespace w2l {
 
 FullConnectionCriterion::FullConnectionCriterion(
     int N,
-    w2l::CriterionScaleMode scalemode)
-    : N_(N), scaleMode_(scalemode) {
+    w2l::CriterionScaleMode scalemode,
+    bool checkpoint)
+    : N_(N), scaleMode_(scalemode), checkpoint_(checkpoint) {
   if (N_ <= 0) {
     throw std::invalid_argument(
         "FCC: Size of transition matrix is less than 0.");
@@ -29,7 +30,8 @@ FullConnectionCriterion::FullConnectionCriterion(
 }
 
 std::string FullConnectionCriterion::prettyString() const {
-  return "FullConnectionCriterion";
+  return checkpoint_ ? "FullConnectionCriterion (checkpoint)"
+                     : "FullConnectionCriterion";
 }
 
 } // namespace w2l
@@ -16,9 +16,15 @@ namespace w2l {
 
 class FullConnectionCriterion : public fl::BinaryModule {
  public:
+  /**
+   * If `checkpoint` is set, the alpha table is only kept every
+   * ceil(sqrt(T)) frames and the frames in between are recomputed block by
+   * block during backward (see ForceAlignmentCriterion).
+   */
   explicit FullConnectionCriterion(
       int N,
-      w2l::CriterionScaleMode scalemode = w2l::CriterionScaleMode::NONE);
+      w2l::CriterionScaleMode scalemode = w2l::CriterionScaleMode::NONE,
+      bool checkpoint = false);
 
   fl::Variable forward(const fl::Variable& input, const fl::Variable& target)
       override;
@@ -31,38 +37,58 @@ class FullConnectionCriterion : public fl::BinaryModule {
 
   int N_;
   w2l::CriterionScaleMode scaleMode_;
+  bool checkpoint_{false};
 
   FL_SAVE_LOAD_WITH_BASE(
       fl::BinaryModule,
       fl::serializeAs<int64_t>(N_),
-      scaleMode_)
+      scaleMode_,
+      fl::versioned(checkpoint_, 1))
 
   struct fwParams {
     std::vector<int> targetsRaw;
     std::vector<float> inputsRaw, transRaw, scale;
 
     std::vector<float> res;
+    // all T frames, or every stride-th frame in checkpoint mode
     std::vector<double> alpha;
+    // not kept in checkpoint mode, backward recomputes the max instead
     std::vector<int> alphaIndex;
+    // two rolling frames used to run the recursion in checkpoint mode
+    std::vector<double> alphaWork;
 
-    fwParams(int n, int t, int b, int l) {
+    fwParams(int n, int t, int b, int l, bool checkpoint) {
       targetsRaw.resize(l * b);
       inputsRaw.resize(b * t * n);
-      alphaIndex.resize(b * n * t);
       res.resize(b);
       scale.resize(b);
-      alpha.resize(b * n * t);
+      if (checkpoint) {
+        int stride = w2l::getCheckpointStride(t);
+        alpha.resize(b * n * ((t + stride - 1) / stride));
+        alphaWork.resize(b * n * 2);
+      } else {
+        alphaIndex.resize(b * n * t);
+        alpha.resize(b * n * t);
+      }
       transRaw.resize(n * n);
     }
   };
 
   struct bwParams {
+    // all T frames, or two rolling frames in checkpoint mode
     std::vector<double> alphaGrad;
+    // alpha frames of the block being recomputed in checkpoint mode
+    std::vector<double> alphaBlock;
     std::vector<float> inputsGrad, transGradRes, outputsGrad;
     std::vector<double> transGrad;
 
-    bwParams(int n, int t, int b) {
-      alphaGrad.resize(b * n * t, 0);
+    bwParams(int n, int t, int b, bool checkpoint) {
+      if (checkpoint) {
+        alphaGrad.resize(b * n * 2, 0);
+        alphaBlock.resize(b * n * w2l::getCheckpointStride(t));
+      } else {
+        alphaGrad.resize(b * n * t, 0);
+      }
       inputsGrad.resize(b * t * n, 0);
       transGrad.resize(b * n * n, 0);
       outputsGrad.resize(b);
@@ -76,3 +102,4 @@ typedef FullConnectionCriterion FCCLoss;
 } // namespace w2l
 
 CEREAL_REGISTER_TYPE(w2l::FullConnectionCriterion)
+CEREAL_CLASS_VERSION(w2l::FullConnectionCriterion, 1)
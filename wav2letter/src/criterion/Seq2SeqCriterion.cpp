@@ -11,6 +11,8 @@
 #include <algorithm>
 #include <queue>
 
+#include "common/Trace.h"
+
 using namespace fl;
 
 namespace w2l {
@@ -103,6 +105,7 @@ std::vector<Variable> Seq2SeqCriterion::forward(
   if (inputs.size() != 2) {
     throw std::invalid_argument("Invalid inputs size");
   }
+  W2L_TRACE_SCOPE("criterion/seq2seq");
   const auto& input = inputs[0];
   const auto& target = inputs[1];
 
@@ -275,7 +278,13 @@ std::vector<int> Seq2SeqCriterion::beamPath(
   return beamPaths[0].path;
 }
 
-// beam are candidates that need to be extended
+// beam are candidates that need to be extended. All of them must have paths
+// of the same length so that they can be advanced in a single batched step.
+//
+// Live hypotheses are kept as one batched Seq2SeqState (batch dim = beam
+// index) which is gathered by parent index after each step. Paths are stored
+// as parent pointers into `nodes` and only materialized for the returned
+// hypotheses. Only the top 2 * beamSize scores are copied back to the host.
 std::vector<Seq2SeqCriterion::CandidateHypo> Seq2SeqCriterion::beamSearch(
     const af::array& input,
     std::vector<Seq2SeqCriterion::CandidateHypo> beam,
@@ -284,54 +293,140 @@ std::vector<Seq2SeqCriterion::CandidateHypo> Seq2SeqCriterion::beamSearch(
   bool wasTrain = train_;
   eval();
 
+  // (token, parent node), parent is -1 for the root of a path
+  std::vector<std::pair<int, int>> nodes;
+  auto getPath = [&nodes](int node) {
+    std::vector<int> path;
+    for (; node >= 0; node = nodes[node].second) {
+      path.push_back(nodes[node].first);
+    }
+    std::reverse(path.begin(), path.end());
+    return path;
+  };
+  auto getState = [](const Seq2SeqState& batched, int idx) {
+    Seq2SeqState state;
+    state.step = batched.step;
+    state.hidden = Variable(batched.hidden.array()(af::span, idx), false);
+    state.alpha =
+        Variable(batched.alpha.array()(af::span, af::span, idx), false);
+    state.summary =
+        Variable(batched.summary.array()(af::span, af::span, idx), false);
+    return state;
+  };
+
+  // live hypotheses
+  std::vector<float> scores;
+  std::vector<int> lastNodes;
+  Seq2SeqState state;
+  std::vector<Variable> hiddens, alphas, summaries;
+  size_t pathLen = beam.empty() ? 0 : beam[0].path.size();
+  for (auto& hypo : beam) {
+    if (hypo.path.size() != pathLen) {
+      throw std::invalid_argument(
+          "beamSearch: initial hypotheses must have the same length");
+    }
+    int node = -1;
+    for (int token : hypo.path) {
+      nodes.emplace_back(token, node);
+      node = nodes.size() - 1;
+    }
+    scores.push_back(hypo.score);
+    lastNodes.push_back(node);
+    state.step = hypo.state.step;
+    if (!hypo.state.hidden.isempty()) {
+      hiddens.push_back(hypo.state.hidden);
+      alphas.push_back(hypo.state.alpha);
+      summaries.push_back(hypo.state.summary);
+    }
+  }
+  if (!hiddens.empty()) {
+    if (hiddens.size() != beam.size()) {
+      throw std::invalid_argument(
+          "beamSearch: initial hypotheses must all have a state or none");
+    }
+    state.hidden = concatenate(hiddens, 1);
+    state.alpha = concatenate(alphas, 2);
+    state.summary = concatenate(summaries, 2);
+  }
+
   std::vector<Seq2SeqCriterion::CandidateHypo> complete;
-  std::vector<Seq2SeqCriterion::CandidateHypo> newBeam;
   auto cmpfn = [](Seq2SeqCriterion::CandidateHypo& lhs,
                   Seq2SeqCriterion::CandidateHypo& rhs) {
     return lhs.score > rhs.score;
   };
 
-  for (int l = 0; l < maxLen; l++) {
-    newBeam.resize(0);
-    for (auto& hypo : beam) {
-      Variable y;
-      if (!hypo.path.empty()) {
-        y = constant(hypo.path.back(), 1, s32, false);
-      }
+  Seq2SeqState outState;
+  Variable xEncoded;
+  std::vector<int> tokens;
+  std::vector<int> parents;
+  std::vector<float> topScores;
+  std::vector<int> topIdx;
+  for (int l = 0; l < maxLen && !scores.empty(); l++) {
+    int K = scores.size();
+    if (xEncoded.isempty() || xEncoded.dims(2) != K) {
+      xEncoded = Variable(af::tile(input, 1, 1, K), false);
+    }
 
-      Variable ox;
-      Seq2SeqState state;
-      std::tie(ox, state) = decodeStep(Variable(input, false), y, hypo.state);
-      ox = logSoftmax(ox, 0);
-      auto oxVector = w2l::afToVector<float>(ox.array());
-      for (int idx = 0; idx < oxVector.size(); idx++) {
-        std::vector<int> path_(hypo.path);
-        path_.push_back(idx);
-        newBeam.emplace_back(hypo.score + oxVector[idx], path_, state);
+    Variable y;
+    if (lastNodes[0] >= 0) {
+      tokens.resize(K);
+      for (int k = 0; k < K; k++) {
+        tokens[k] = nodes[lastNodes[k]].first;
       }
+      y = Variable(af::array(1, K, tokens.data()), false);
     }
 
-    std::partial_sort(
-        newBeam.begin(),
-        newBeam.begin() +
-            std::min(2 * beamSize, static_cast<int>(newBeam.size())),
-        newBeam.end(),
-        cmpfn);
-
-    beam.resize(0);
-    for (int idx = 0; idx < newBeam.size(); idx++) {
-      auto& hypo = newBeam[idx];
+    Variable ox;
+    std::tie(ox, outState) = decodeStep(xEncoded, y, state);
+    // [nClass, K]
+    auto logProbs = af::moddims(logSoftmax(ox, 0).array(), ox.dims(0), K);
+    int nClass = logProbs.dims(0);
+    logProbs = logProbs +
+        af::tile(af::moddims(af::array(K, scores.data()), 1, K), nClass);
+
+    af::array topValues, topIndices;
+    int nTop = std::min(2 * beamSize, nClass * K);
+    af::topk(topValues, topIndices, af::flat(logProbs), nTop, 0);
+    topScores.resize(nTop);
+    topIdx.resize(nTop);
+    topValues.host(topScores.data());
+    topIndices.as(s32).host(topIdx.data());
+
+    std::vector<float> newScores;
+    std::vector<int> newNodes;
+    parents.resize(0);
+    for (int idx = 0; idx < nTop; idx++) {
+      int parent = topIdx[idx] / nClass;
+      int token = topIdx[idx] % nClass;
       // We only move the top beamSize hypothesises into complete.
-      if (idx < beamSize && hypo.path.back() == eos_) {
-        hypo.path.pop_back();
-        complete.push_back(hypo);
-      } else if (hypo.path.back() != eos_) {
-        beam.push_back(hypo);
+      if (idx < beamSize && token == eos_) {
+        complete.emplace_back(
+            topScores[idx],
+            getPath(lastNodes[parent]),
+            getState(outState, parent));
+      } else if (token != eos_) {
+        nodes.emplace_back(token, lastNodes[parent]);
+        newScores.push_back(topScores[idx]);
+        newNodes.push_back(nodes.size() - 1);
+        parents.push_back(parent);
       }
-      if (beam.size() >= beamSize) {
+      if (newScores.size() >= beamSize) {
         break;
       }
     }
+    scores.swap(newScores);
+    lastNodes.swap(newNodes);
+
+    if (!parents.empty()) {
+      af::array parentIdx(parents.size(), parents.data());
+      state.step = outState.step;
+      state.hidden =
+          Variable(outState.hidden.array()(af::span, parentIdx), false);
+      state.alpha = Variable(
+          outState.alpha.array()(af::span, af::span, parentIdx), false);
+      state.summary = Variable(
+          outState.summary.array()(af::span, af::span, parentIdx), false);
+    }
 
     if (complete.size() >= beamSize) {
       std::partial_sort(
@@ -341,7 +436,7 @@ std::vector<Seq2SeqCriterion::CandidateHypo> Seq2SeqCriterion::beamSearch(
       // if lowest score in complete is better than best future hypo
       // then its not possible for any future hypothesis to replace existing
       // hypothesises in complete.
-      if (complete.back().score > beam[0].score) {
+      if (scores.empty() || complete.back().score > scores[0]) {
         break;
       }
     }
@@ -351,7 +446,14 @@ std::vector<Seq2SeqCriterion::CandidateHypo> Seq2SeqCriterion::beamSearch(
     train();
   }
 
-  return complete.empty() ? beam : complete;
+  if (!complete.empty()) {
+    return complete;
+  }
+  std::vector<Seq2SeqCriterion::CandidateHypo> live;
+  for (int k = 0; k < scores.size(); k++) {
+    live.emplace_back(scores[k], getPath(lastNodes[k]), getState(state, k));
+  }
+  return live;
 }
 
 std::pair<Variable, Seq2SeqState> Seq2SeqCriterion::decodeStep(
@@ -0,0 +1,117 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "AttentionUtils.h"
+
+#include <algorithm>
+
+using namespace fl;
+
+namespace w2l {
+
+std::vector<std::pair<int, int>> getWindowRanges(const af::array& attnWeight) {
+  int U = attnWeight.dims(0);
+  int T = attnWeight.dims(1);
+
+  // [targetlen, seqlen]
+  auto active = af::anyTrue(attnWeight > 0, 2);
+  auto frames = af::range(af::dim4(U, T), 1, af::dtype::s32);
+  auto starts = af::min(af::select(active, frames, T), 1).as(af::dtype::s32);
+  auto ends =
+      af::max(af::select(active, frames + 1, 0), 1).as(af::dtype::s32);
+
+  std::vector<int> startsHost(U), endsHost(U);
+  starts.host(startsHost.data());
+  ends.host(endsHost.data());
+
+  std::vector<std::pair<int, int>> ranges(U);
+  for (int u = 0; u < U; u++) {
+    if (startsHost[u] >= endsHost[u]) {
+      ranges[u] = std::make_pair(0, T);
+    } else {
+      ranges[u] = std::make_pair(startsHost[u], endsHost[u]);
+    }
+  }
+  return ranges;
+}
+
+std::pair<Variable, Variable> windowedAttention(
+    const Variable& state,
+    const Variable& xEncoded,
+    const Variable& attnWeight,
+    const AttendFn& attend) {
+  int U = state.dims(1);
+  int T = xEncoded.dims(1);
+  int B = xEncoded.dims(2);
+  if (attnWeight.isempty()) {
+    return attend(state, xEncoded, attnWeight);
+  }
+
+  auto ranges = getWindowRanges(attnWeight.array());
+  int maxWidth = 0;
+  for (const auto& range : ranges) {
+    maxWidth = std::max(maxWidth, range.second - range.first);
+  }
+  if (2 * maxWidth >= T) {
+    return attend(state, xEncoded, attnWeight);
+  }
+
+  // group target steps [uStart, uEnd) seeing frames [start, end)
+  struct Group {
+    int uStart, uEnd, start, end;
+  };
+  std::vector<Group> groups;
+  for (int u = 0; u < U; u++) {
+    if (!groups.empty()) {
+      auto& group = groups.back();
+      int start = std::min(group.start, ranges[u].first);
+      int end = std::max(group.end, ranges[u].second);
+      if (end - start <= 2 * maxWidth) {
+        group.uEnd = u + 1;
+        group.start = start;
+        group.end = end;
+        continue;
+      }
+    }
+    groups.push_back({u, u + 1, ranges[u].first, ranges[u].second});
+  }
+
+  std::vector<Variable> attentions, summaries;
+  for (const auto& group : groups) {
+    auto uSeq = af::seq(group.uStart, group.uEnd - 1);
+    auto tSeq = af::seq(group.start, group.end - 1);
+    Variable attention, summary;
+    std::tie(attention, summary) = attend(
+        state(af::span, uSeq, af::span),
+        xEncoded(af::span, tSeq, af::span),
+        attnWeight(uSeq, tSeq, af::span));
+
+    // pad the attention back to [targetlen, seqlen, batchsize]
+    int groupU = group.uEnd - group.uStart;
+    std::vector<Variable> padded;
+    if (group.start > 0) {
+      padded.push_back(constant(
+          0.0, af::dim4(groupU, group.start, B), attention.type(), false));
+    }
+    padded.push_back(attention);
+    if (group.end < T) {
+      padded.push_back(constant(
+          0.0, af::dim4(groupU, T - group.end, B), attention.type(), false));
+    }
+    attentions.push_back(
+        padded.size() == 1 ? attention : concatenate(padded, 1));
+    summaries.push_back(summary);
+  }
+
+  if (groups.size() == 1) {
+    return std::make_pair(attentions[0], summaries[0]);
+  }
+  return std::make_pair(concatenate(attentions, 0), concatenate(summaries, 1));
+}
+
+} // namespace w2l
@@ -0,0 +1,47 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include <flashlight/flashlight.h>
+
+namespace w2l {
+
+// (state, xEncoded, attnWeight) -> (attention, summaries), see AttentionBase
+using AttendFn = std::function<std::pair<fl::Variable, fl::Variable>(
+    const fl::Variable&,
+    const fl::Variable&,
+    const fl::Variable&)>;
+
+/**
+ * For each target step u of a window mask [targetlen, seqlen, batchsize],
+ * returns the frames [start, end) outside of which the mask is zero for all
+ * batch elements. Rows with an empty mask span the whole input.
+ */
+std::vector<std::pair<int, int>> getWindowRanges(const af::array& attnWeight);
+
+/**
+ * Evaluates `attend` only on the frames a window mask lets through.
+ * Consecutive target steps are grouped while the union of their windows
+ * stays within twice the widest window; each group sees keys / values
+ * sliced to that union. Attention is zero-padded back to [targetlen,
+ * seqlen, batchsize], so outputs (and gradients) are the same as running
+ * `attend` on the full input. Falls back to a single call if the windows
+ * cover most of the input.
+ */
+std::pair<fl::Variable, fl::Variable> windowedAttention(
+    const fl::Variable& state,
+    const fl::Variable& xEncoded,
+    const fl::Variable& attnWeight,
+    const AttendFn& attend);
+
+} // namespace w2l
@@ -8,15 +8,54 @@
 
 #include "ContentAttention.h"
 
+#include <algorithm>
+
 using namespace fl;
 
 namespace w2l {
 
+namespace {
+
+// [targetlen, seqlen, batchsize]
+Variable mlpScores(
+    const std::shared_ptr<Module>& net,
+    const Variable& state,
+    const Variable& xEncoded) {
+  int U = state.dims(1);
+  int H = xEncoded.dims(0);
+  int T = xEncoded.dims(1);
+  int B = xEncoded.dims(2);
+
+  auto tileHx = tile(moddims(xEncoded, {H, 1, T, B}), {1, U, 1, 1});
+  auto tileHy = tile(moddims(state, {H, U, 1, B}), {1, 1, T, 1});
+
+  // [hiddendim, targetlen, seqlen, batchsize]
+  auto hidden = tileHx + tileHy;
+
+  return moddims(net->forward({hidden}).front(), {U, T, B});
+}
+
+} // namespace
+
 std::pair<Variable, Variable> ContentAttention::forward(
     const Variable& state,
     const Variable& xEncoded,
     const Variable& /* unused */,
     const Variable& attnWeight) {
+  // only evaluate scores on the frames the window lets through
+  return windowedAttention(
+      state,
+      xEncoded,
+      attnWeight,
+      [this](const Variable& s, const Variable& x, const Variable& w) {
+        return attend(s, x, w);
+      });
+}
+
+std::pair<Variable, Variable> ContentAttention::attend(
+    const Variable& state,
+    const Variable& xEncoded,
+    const Variable& attnWeight) {
   int dim = xEncoded.dims(0);
   if (dim != (1 + keyValue_) * state.dims(0)) {
     throw std::invalid_argument("Invalid dimension for content attention");
@@ -61,19 +100,22 @@ std::pair<Variable, Variable> NeuralContentAttention::forward(
     const Variable& xEncoded,
     const Variable& /* unused */,
     const Variable& attnWeight) {
-  int U = state.dims(1);
-  int H = xEncoded.dims(0);
-  int T = xEncoded.dims(1);
-  int B = xEncoded.dims(2);
-
-  auto tileHx = tile(moddims(xEncoded, {H, 1, T, B}), {1, U, 1, 1});
-  auto tileHy = tile(moddims(state, {H, U, 1, B}), {1, 1, T, 1});
-
-  // [hiddendim, targetlen, seqlen, batchsize]
-  auto hidden = tileHx + tileHy;
+  // only evaluate scores on the frames the window lets through
+  return windowedAttention(
+      state,
+      xEncoded,
+      attnWeight,
+      [this](const Variable& s, const Variable& x, const Variable& w) {
+        return attend(s, x, w);
+      });
+}
 
+std::pair<Variable, Variable> NeuralContentAttention::attend(
+    const Variable& state,
+    const Variable& xEncoded,
+    const Variable& attnWeight) {
   // [targetlen, seqlen, batchsize]
-  auto nnOut = moddims(module(0)->forward({hidden}).front(), {U, T, B});
+  auto nnOut = scores(state, xEncoded);
 
   if (!attnWeight.isempty()) {
     nnOut = nnOut + log(attnWeight);
@@ -88,6 +130,98 @@ std::pair<Variable, Variable> NeuralContentAttention::forward(
   return std::make_pair(attention, summaries);
 }
 
+Variable NeuralContentAttention::scores(
+    const Variable& state,
+    const Variable& xEncoded) {
+  int U = state.dims(1);
+  int H = xEncoded.dims(0);
+  int T = xEncoded.dims(1);
+  int B = xEncoded.dims(2);
+
+  auto net = module(0);
+  int chunk = std::max(
+      static_cast<int64_t>(1),
+      chunkSize_ / (static_cast<int64_t>(H) * U * B));
+  if (chunk >= T) {
+    return mlpScores(net, state, xEncoded);
+  }
+
+  // Score chunk by chunk without keeping the graph, the backward pass
+  // recomputes each chunk's activations instead.
+  auto out = af::array(U, T, B, state.type());
+  for (int start = 0; start < T; start += chunk) {
+    auto frames = af::seq(start, std::min(start + chunk, T) - 1);
+    auto chunkScores = mlpScores(
+        net,
+        Variable(state.array(), false),
+        Variable(xEncoded.array()(af::span, frames, af::span), false));
+    out(af::span, frames, af::span) = chunkScores.array();
+  }
+
+  auto gradFunc = [net, chunk](
+                      std::vector<Variable>& inputs,
+                      const Variable& gradOutput) {
+    auto& state = inputs[0];
+    auto& xEncoded = inputs[1];
+    int T = xEncoded.dims(1);
+    auto stateGrad = af::constant(0.0, state.dims(), state.type());
+    auto xEncodedGrad = af::constant(0.0, xEncoded.dims(), xEncoded.type());
+
+    // Chunks run through detached copies of the MLP parameters, so that
+    // their grad hooks (e.g. a distributed allreduce) fire once, with the
+    // sum over the chunks, instead of once per chunk
+    auto params = net->params();
+    std::vector<Variable> detached;
+    for (size_t i = 0; i < params.size(); ++i) {
+      detached.emplace_back(params[i].array(), params[i].isCalcGrad());
+      net->setParams(detached[i], i);
+    }
+    try {
+      for (int start = 0; start < T; start += chunk) {
+        auto frames = af::seq(start, std::min(start + chunk, T) - 1);
+        Variable stateChunk(state.array(), state.isCalcGrad());
+        Variable xEncodedChunk(
+            xEncoded.array()(af::span, frames, af::span),
+            xEncoded.isCalcGrad());
+        mlpScores(net, stateChunk, xEncodedChunk)
+            .backward(Variable(
+                gradOutput.array()(af::span, frames, af::span), false));
+        if (state.isCalcGrad()) {
+          stateGrad += stateChunk.grad().array();
+        }
+        if (xEncoded.isCalcGrad()) {
+          xEncodedGrad(af::span, frames, af::span) =
+              xEncodedChunk.grad().array();
+        }
+      }
+    } catch (...) {
+      for (size_t i = 0; i < params.size(); ++i) {
+        net->setParams(params[i], i);
+      }
+      throw;
+    }
+    for (size_t i = 0; i < params.size(); ++i) {
+      net->setParams(params[i], i);
+    }
+
+    state.addGrad(Variable(stateGrad, false));
+    xEncoded.addGrad(Variable(xEncodedGrad, false));
+    for (size_t i = 0; i < params.size(); ++i) {
+      if (detached[i].isCalcGrad() && detached[i].isGradAvailable()) {
+        inputs[2 + i].addGrad(Variable(detached[i].grad().array(), false));
+      }
+    }
+  };
+
+  // the MLP parameters are listed so that the output requires a gradient
+  // whenever they do
+  std::vector<Variable> inputs = {state, xEncoded};
+  for (const auto& param : net->params()) {
+    inputs.push_back(param);
+  }
+  return Variable(out, inputs, gradFunc);
+}
+
 std::string NeuralContentAttention::prettyString() const {
   return "NeuralContentBasedAttention";
 }
@@ -9,6 +9,7 @@
 #pragma once
 
 #include "AttentionBase.h"
+#include "AttentionUtils.h"
 
 namespace w2l {
 
@@ -27,6 +28,11 @@ class ContentAttention : public AttentionBase {
  private:
   bool keyValue_;
 
+  std::pair<fl::Variable, fl::Variable> attend(
+      const fl::Variable& state,
+      const fl::Variable& xEncoded,
+      const fl::Variable& attnWeight);
+
   FL_SAVE_LOAD_WITH_BASE(AttentionBase, fl::versioned(keyValue_, 1))
 };
 
@@ -43,7 +49,25 @@ class NeuralContentAttention : public AttentionBase {
 
   std::string prettyString() const override;
 
+  // Upper bound on the number of elements of the [hiddendim, targetlen,
+  // seqlen, batchsize] activations materialized at once
+  void setChunkSize(int64_t chunkSize) {
+    chunkSize_ = chunkSize;
+  }
+
  private:
+  int64_t chunkSize_{1 << 24};
+
+  std::pair<fl::Variable, fl::Variable> attend(
+      const fl::Variable& state,
+      const fl::Variable& xEncoded,
+      const fl::Variable& attnWeight);
+
+  // Additive scores [targetlen, seqlen, batchsize], computed in chunks over
+  // seqlen so that the [hiddendim, targetlen, seqlen, batchsize] hidden
+  // activations are never materialized (or kept for backward) as a whole.
+  fl::Variable scores(const fl::Variable& state, const fl::Variable& xEncoded);
+
   FL_SAVE_LOAD_WITH_BASE(AttentionBase)
 };
 
@@ -38,6 +38,91 @@ TEST(AttentionTest, NeuralContentAttention) {
   ASSERT_TRUE(allClose(alphas, alphas1, 1e-6));
 }
 
+TEST(AttentionTest, NeuralContentAttentionChunked) {
+  int H = 8, B = 2, T = 25, U = 5;
+  NeuralContentAttention attention(H, 2);
+  Variable encodedx(af::randn(H, T, B), true);
+  Variable encodedy(af::randn(H, U, B), true);
+
+  auto run = [&]() {
+    encodedx.zeroGrad();
+    encodedy.zeroGrad();
+    attention.zeroGrad();
+    Variable alphas, summaries;
+    std::tie(alphas, summaries) = attention(encodedy, encodedx, Variable{});
+    sum(summaries * summaries, {0, 1, 2}).backward();
+    std::vector<af::array> res = {alphas.array(),
+                                  encodedx.grad().array(),
+                                  encodedy.grad().array()};
+    for (const auto& param : attention.params()) {
+      res.push_back(param.grad().array());
+    }
+    return res;
+  };
+
+  auto expected = run();
+  // 3 frames per chunk, the last chunk is partial
+  attention.setChunkSize(H * U * B * 3);
+  auto chunked = run();
+  ASSERT_EQ(expected.size(), chunked.size());
+  for (int i = 0; i < expected.size(); i++) {
+    ASSERT_TRUE(allClose(expected[i], chunked[i], 1e-5));
+  }
+
+  // the grad hooks of the parameters (allreduce) fire once, not per chunk
+  auto params = attention.params();
+  std::vector<int> hookCalls(params.size(), 0);
+  for (size_t i = 0; i < params.size(); i++) {
+    params[i].registerGradHook(
+        [&hookCalls, i](Variable& /* unused */) { ++hookCalls[i]; });
+  }
+  run();
+  for (size_t i = 0; i < params.size(); i++) {
+    ASSERT_EQ(hookCalls[i], 1);
+    params[i].registerGradHook(nullptr);
+  }
+}
+
+TEST(AttentionTest, WindowedAttention) {
+  int H = 8, B = 2, T = 60, U = 12;
+  Variable encodedx(af::randn(H, T, B), true);
+  Variable encodedy(af::randn(H, U, B), true);
+
+  // band mask moving 4 frames per step, 6 frames wide
+  auto maskArray = af::constant(0.0, U, T, B);
+  for (int u = 0; u < U; u++) {
+    maskArray(u, af::seq(4 * u, 4 * u + 5), af::span) = 1.0;
+  }
+  Variable mask(maskArray, false);
+
+  auto attend = [](const Variable& s, const Variable& x, const Variable& w) {
+    auto attention = softmax(matmulTN(s, x) + log(w), 1);
+    return std::make_pair(attention, matmulNT(x, attention));
+  };
+
+  Variable alphas, summaries;
+  std::tie(alphas, summaries) = attend(encodedy, encodedx, mask);
+  auto loss = sum(summaries * summaries, {0, 1, 2});
+  loss.backward();
+  auto gradx = encodedx.grad().array();
+  auto grady = encodedy.grad().array();
+  encodedx.zeroGrad();
+  encodedy.zeroGrad();
+
+  Variable alphasW, summariesW;
+  std::tie(alphasW, summariesW) =
+      windowedAttention(encodedy, encodedx, mask, attend);
+  ASSERT_EQ(alphasW.dims(), af::dim4(U, T, B));
+  ASSERT_EQ(summariesW.dims(), af::dim4(H, U, B));
+  ASSERT_TRUE(allClose(alphas.array(), alphasW.array(), 1e-5));
+  ASSERT_TRUE(allClose(summaries.array(), summariesW.array(), 1e-5));
+
+  auto lossW = sum(summariesW * summariesW, {0, 1, 2});
+  lossW.backward();
+  ASSERT_TRUE(allClose(gradx, encodedx.grad().array(), 1e-4));
+  ASSERT_TRUE(allClose(grady, encodedy.grad().array(), 1e-4));
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -7,6 +7,7 @@
  */
 
 #include "criterion/ConnectionistTemporalClassificationCriterion.h"
+#include "common/Trace.h"
 #include "criterion/CriterionUtils.h"
 
 using namespace fl;
@@ -15,6 +16,7 @@ namespace w2l {
 
 std::vector<Variable> ConnectionistTemporalClassificationCriterion::forward(
     const std::vector<Variable>& inputs) {
+  W2L_TRACE_SCOPE("criterion/ctc");
   if (inputs.size() != 2) {
     throw std::invalid_argument("Invalid inputs size");
   }
@@ -1,12 +1,50 @@
 #include "criterion/FullConnectionCriterion.h"
 
+#include <algorithm>
+
+#include "common/Trace.h"
+
 using namespace fl;
 
 namespace w2l {
 
+namespace {
+
+// Computes frame t of the alpha table from frame t - 1, alphaIndexCurFrame
+// (if not null) receives the argmax over the previous frame for each label
+void forwardStep(
+    int N,
+    const float* transRaw,
+    const float* inputs,
+    const double* alphaPrevFrame,
+    double* alphaCurFrame,
+    int* alphaIndexCurFrame) {
+  for (int i = 0; i < N; i++) {
+    double sum = 0, max = NEG_INFINITY_DBL;
+    for (int j = 0; j < N; j++) {
+      double z = transRaw[i * N + j] + alphaPrevFrame[j];
+      if (max < z) {
+        if (alphaIndexCurFrame) {
+          alphaIndexCurFrame[i] = j;
+        }
+        max = z;
+      }
+    }
+    for (int j = 0; j < N; j++) {
+      double z = transRaw[i * N + j] + alphaPrevFrame[j];
+      sum += std::exp(z - max);
+    }
+
+    alphaCurFrame[i] = max + std::log(sum) + inputs[i];
+  }
+}
+
+} // namespace
+
 Variable FullConnectionCriterion::forward(
     const Variable& input,
     const Variable& target) {
+  W2L_TRACE_SCOPE("criterion/fcc");
   int N = input.dims(0);
   int T = input.dims(1);
   int B = input.dims(2);
@@ -16,7 +54,10 @@ Variable FullConnectionCriterion::forward(
   }
 
   /* Forward */
-  auto fwBuf = fwParams(N, T, B, L);
+  bool checkpoint = checkpoint_;
+  int stride = w2l::getCheckpointStride(T);
+  int numCheckpoints = (T + stride - 1) / stride;
+  auto fwBuf = fwParams(N, T, B, L, checkpoint);
   target.host(fwBuf.targetsRaw.data());
   input.host(fwBuf.inputsRaw.data());
   params_[0].host(fwBuf.transRaw.data());
@@ -32,40 +73,48 @@ Variable FullConnectionCriterion::forward(
       throw std::invalid_argument("Target size cannot be empty for FCC");
     }
     fwBuf.scale[b] = scaleFn(N, T, TN);
-    double* alpha = fwBuf.alpha.data() + b * N * T;
-    int* alphaIndex = fwBuf.alphaIndex.data() + b * N * T;
     float* inputsRaw = fwBuf.inputsRaw.data() + b * N * T;
 
+    // in checkpoint mode the recursion runs on two rolling frames and only
+    // every stride-th frame is copied to `alpha`
+    double* alpha;
+    double* alphaWork = nullptr;
+    int* alphaIndex = nullptr;
+    if (checkpoint) {
+      alpha = fwBuf.alpha.data() + b * N * numCheckpoints;
+      alphaWork = fwBuf.alphaWork.data() + b * N * 2;
+    } else {
+      alpha = fwBuf.alpha.data() + b * N * T;
+      alphaIndex = fwBuf.alphaIndex.data() + b * N * T;
+    }
+
+    double* alphaCurFrame = checkpoint ? alphaWork : alpha;
     for (int i = 0; i < N; i++) {
-      alpha[i] = inputsRaw[i];
+      alphaCurFrame[i] = inputsRaw[i];
+    }
+    if (checkpoint) {
+      std::copy(alphaWork, alphaWork + N, alpha);
     }
 
-    double* alphaCurFrame;
-    int* alphaIndexCurFrame;
     for (int t = 1; t < T; t++) {
-      double* alphaPrevFrame = alpha + (t - 1) * N;
-      alphaCurFrame = alpha + t * N;
-      alphaIndexCurFrame = alphaIndex + t * N;
-      const float* inputs = inputsRaw + t * N;
-      for (int i = 0; i < N; i++) {
-        double sum = 0, max = NEG_INFINITY_DBL;
-        for (int j = 0; j < N; j++) {
-          double z = fwBuf.transRaw[i * N + j] + alphaPrevFrame[j];
-          if (max < z) {
-            alphaIndexCurFrame[i] = j;
-            max = z;
-          }
-        }
-        for (int j = 0; j < N; j++) {
-          double z = fwBuf.transRaw[i * N + j] + alphaPrevFrame[j];
-          sum += std::exp(z - max);
-        }
-
-        alphaCurFrame[i] = max + std::log(sum) + inputs[i];
+      double* alphaPrevFrame = alphaCurFrame;
+      if (checkpoint) {
+        alphaCurFrame = alphaWork + (t % 2) * N;
+      } else {
+        alphaCurFrame = alpha + t * N;
+      }
+      forwardStep(
+          N,
+          fwBuf.transRaw.data(),
+          inputsRaw + t * N,
+          alphaPrevFrame,
+          alphaCurFrame,
+          checkpoint ? nullptr : alphaIndex + t * N);
+      if (checkpoint && t % stride == 0) {
+        std::copy(alphaCurFrame, alphaCurFrame + N, alpha + (t / stride) * N);
       }
     }
 
-    alphaCurFrame = alpha + (T - 1) * N;
     double sum = 0, max = NEG_INFINITY_DBL;
     for (long i = 0; i < N; i++) {
       if (max < alphaCurFrame[i]) {
@@ -81,73 +130,118 @@ Variable FullConnectionCriterion::forward(
   auto result = af::array(B, fwBuf.res.data());
 
   /* Backward */
-  auto gradFunc = [B, N, T, fwBuf](
+  auto gradFunc = [B, N, T, checkpoint, stride, numCheckpoints, fwBuf](
                       std::vector<Variable>& inputs,
                       const Variable& gradOutput) {
-    auto bwBuf = bwParams(N, T, B);
+    auto bwBuf = bwParams(N, T, B, checkpoint);
+    int gradFrames = checkpoint ? 2 : T;
     gradOutput.host(bwBuf.outputsGrad.data());
 
 #pragma omp parallel for num_threads(B)
     for (int b = 0; b < B; b++) {
       const float grad = fwBuf.scale[b] * bwBuf.outputsGrad[b];
+      const float* inputsRaw = fwBuf.inputsRaw.data() + b * N * T;
       float* inputsGrad = bwBuf.inputsGrad.data() + b * N * T;
-      double* alphaGrad = bwBuf.alphaGrad.data() + b * N * T;
-      const double* alpha = fwBuf.alpha.data() + b * N * T;
-      const int* alphaIndex = fwBuf.alphaIndex.data() + b * N * T;
+      double* alphaGrad = bwBuf.alphaGrad.data() + b * N * gradFrames;
+      const double* alpha = checkpoint
+          ? fwBuf.alpha.data() + b * N * numCheckpoints
+          : fwBuf.alpha.data() + b * N * T;
+      const int* alphaIndex =
+          checkpoint ? nullptr : fwBuf.alphaIndex.data() + b * N * T;
+      double* alphaBlock =
+          checkpoint ? bwBuf.alphaBlock.data() + b * N * stride : nullptr;
       double* transGrad = bwBuf.transGrad.data() + b * N * N;
 
-      // bw step 1
-      {
-        const double* alphaCurFrame = alpha + (T - 1) * N;
-        double* alphaGradCurFrame = alphaGrad + (T - 1) * N;
-        float* inputsGradCurFrame = inputsGrad + (T - 1) * N;
-        double max = NEG_INFINITY_DBL;
-        for (int j = 0; j < N; j++) {
-          if (max < alphaCurFrame[j]) {
-            max = alphaCurFrame[j];
+      // frames [start, end) of alpha are processed together; without
+      // checkpointing this is a single block
+      int blockSize = checkpoint ? stride : T;
+      for (int start = ((T - 1) / blockSize) * blockSize; start >= 0;
+           start -= blockSize) {
+        int end = std::min(start + blockSize, T);
+        const double* alphaBlockp = alpha + start * N;
+        if (checkpoint) {
+          std::copy(
+              alpha + (start / stride) * N,
+              alpha + (start / stride + 1) * N,
+              alphaBlock);
+          for (int t = start + 1; t < end; t++) {
+            forwardStep(
+                N,
+                fwBuf.transRaw.data(),
+                inputsRaw + t * N,
+                alphaBlock + (t - 1 - start) * N,
+                alphaBlock + (t - start) * N,
+                nullptr);
           }
+          alphaBlockp = alphaBlock;
         }
 
-        double alphaGradSum = 0;
-        for (int j = 0; j < N; j++) {
-          alphaGradSum += std::exp(alphaCurFrame[j] - max);
-        }
-        for (int j = 0; j < N; j++) {
-          alphaGradCurFrame[j] =
-              std::exp(alphaCurFrame[j] - max) / alphaGradSum;
-          inputsGradCurFrame[j] = alphaGradCurFrame[j] * grad;
-        }
-      }
+        // bw step 1
+        if (end == T) {
+          const double* alphaCurFrame = alphaBlockp + (T - 1 - start) * N;
+          double* alphaGradCurFrame = alphaGrad + ((T - 1) % gradFrames) * N;
+          float* inputsGradCurFrame = inputsGrad + (T - 1) * N;
+          double max = NEG_INFINITY_DBL;
+          for (int j = 0; j < N; j++) {
+            if (max < alphaCurFrame[j]) {
+              max = alphaCurFrame[j];
+            }
+          }
 
-      // bw
-      for (int t = T - 2; t >= 0; t--) {
-        const double* alphaCurFrame = alpha + t * N;
-        double* alphaGradCurFrame = alphaGrad + t * N;
-        double* alphaGradPrevFrame = alphaGrad + (t + 1) * N;
-        const int* alphaIndexCurFrame = alphaIndex + (t + 1) * N;
-        float* inputsGradCurFrame = inputsGrad + t * N;
-
-        std::vector<double> m(N * N);
-        for (int i = 0; i < N; i++) {
-          double max = fwBuf.transRaw[i * N + alphaIndexCurFrame[i]] +
-              alphaCurFrame[alphaIndexCurFrame[i]];
           double alphaGradSum = 0;
           for (int j = 0; j < N; j++) {
-            m[i * N + j] =
-                std::exp(fwBuf.transRaw[i * N + j] + alphaCurFrame[j] - max);
-            alphaGradSum += m[i * N + j];
+            alphaGradSum += std::exp(alphaCurFrame[j] - max);
           }
           for (int j = 0; j < N; j++) {
-            m[i * N + j] = m[i * N + j] / alphaGradSum;
+            alphaGradCurFrame[j] =
+                std::exp(alphaCurFrame[j] - max) / alphaGradSum;
+            inputsGradCurFrame[j] = alphaGradCurFrame[j] * grad;
           }
         }
 
-        for (int i = 0; i < N; i++) {
-          for (int j = 0; j < N; j++) {
-            alphaGradCurFrame[i] += m[j * N + i] * alphaGradPrevFrame[j];
-            transGrad[j * N + i] += m[j * N + i] * alphaGradPrevFrame[j] * grad;
+        // bw
+        for (int t = std::min(end, T - 1) - 1; t >= start; t--) {
+          const double* alphaCurFrame = alphaBlockp + (t - start) * N;
+          double* alphaGradCurFrame = alphaGrad + (t % gradFrames) * N;
+          double* alphaGradPrevFrame = alphaGrad + ((t + 1) % gradFrames) * N;
+          float* inputsGradCurFrame = inputsGrad + t * N;
+          if (checkpoint) {
+            std::fill(alphaGradCurFrame, alphaGradCurFrame + N, 0.0);
+          }
+
+          std::vector<double> m(N * N);
+          for (int i = 0; i < N; i++) {
+            double max;
+            if (alphaIndex) {
+              const int* alphaIndexCurFrame = alphaIndex + (t + 1) * N;
+              max = fwBuf.transRaw[i * N + alphaIndexCurFrame[i]] +
+                  alphaCurFrame[alphaIndexCurFrame[i]];
+            } else {
+              max = NEG_INFINITY_DBL;
+              for (int j = 0; j < N; j++) {
+                max = std::max(
+                    max, fwBuf.transRaw[i * N + j] + alphaCurFrame[j]);
+              }
+            }
+            double alphaGradSum = 0;
+            for (int j = 0; j < N; j++) {
+              m[i * N + j] =
+                  std::exp(fwBuf.transRaw[i * N + j] + alphaCurFrame[j] - max);
+              alphaGradSum += m[i * N + j];
+            }
+            for (int j = 0; j < N; j++) {
+              m[i * N + j] = m[i * N + j] / alphaGradSum;
+            }
+          }
+
+          for (int i = 0; i < N; i++) {
+            for (int j = 0; j < N; j++) {
+              alphaGradCurFrame[i] += m[j * N + i] * alphaGradPrevFrame[j];
+              transGrad[j * N + i] +=
+                  m[j * N + i] * alphaGradPrevFrame[j] * grad;
+            }
+            inputsGradCurFrame[i] = alphaGradCurFrame[i] * grad;
           }
-          inputsGradCurFrame[i] = alphaGradCurFrame[i] * grad;
         }
       }
     }
@@ -3,12 +3,15 @@
 #include <algorithm>
 #include <vector>
 
+#include "common/Trace.h"
+
 namespace w2l {
 
 af::array viterbiPath(const af::array& input, const af::array& trans) {
   if (input.isempty()) {
     return af::array();
   }
+  W2L_TRACE_SCOPE("criterion/viterbi");
   auto N = input.dims(0);
   auto T = input.dims(1);
   auto B = input.dims(2);
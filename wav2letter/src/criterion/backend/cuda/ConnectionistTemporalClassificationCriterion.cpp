@@ -11,6 +11,7 @@
 #include <flashlight/autograd/autograd.h>
 #include <flashlight/common/cuda.h>
 
+#include "common/Trace.h"
 #include "criterion/ConnectionistTemporalClassificationCriterion.h"
 #include "criterion/CriterionUtils.h"
 
@@ -29,6 +30,7 @@ inline void throw_on_error(ctcStatus_t status, const char* message) {
 
 std::vector<Variable> ConnectionistTemporalClassificationCriterion::forward(
     const std::vector<Variable>& inputs) {
+  W2L_TRACE_SCOPE("criterion/ctc");
   if (inputs.size() != 2) {
     throw std::invalid_argument("Invalid inputs size");
   }
@@ -1,10 +1,12 @@
 #include "criterion/FullConnectionCriterion.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 
 #include <flashlight/common/cuda.h>
 
+#include "common/Trace.h"
 #include "criterion/CriterionUtils.h"
 #include "criterion/backend/cuda/kernels/FullConnectionCriterion.cuh"
 
@@ -12,48 +14,126 @@ using namespace af;
 
 namespace w2l {
 
+// Runs the forward recursion over frames [start, start + len) of `inp`, with
+// frame `start` already stored in frame 0 of `fccacc`
+static void forwardBlock(
+    int start,
+    int len,
+    int B,
+    int N,
+    const array& inp,
+    const array& trans,
+    array& transtmp,
+    array& fccacc) {
+  fl::DevicePtr inp_raw(inp);
+  fl::DevicePtr trans_raw(trans);
+  fl::DevicePtr transtmp_raw(transtmp);
+  fl::DevicePtr fccacc_raw(fccacc);
+
+  FL_CUDA_CHECK(w2l::cuda::fullConnectionCriterionForward(
+      len,
+      B,
+      N,
+      static_cast<const float*>(inp_raw.get()) + start * B * N,
+      static_cast<const float*>(trans_raw.get()),
+      static_cast<double*>(transtmp_raw.get()),
+      static_cast<double*>(fccacc_raw.get()),
+      fl::cuda::getActiveStream()));
+}
+
+// Runs the backward recursion over frames [start, start + len), with alpha
+// for these frames in `fccacc` (starting at frame 0) and frame
+// `start + len - 1` of `fccgacc` already computed
+static void backwardBlock(
+    int start,
+    int len,
+    int B,
+    int N,
+    const array& trans,
+    array& transtmp,
+    const array& fccacc,
+    array& fccgacc,
+    array& gtrans) {
+  fl::DevicePtr trans_raw(trans);
+  fl::DevicePtr fccacc_raw(fccacc);
+  fl::DevicePtr transtmp_raw(transtmp);
+  fl::DevicePtr fccgacc_raw(fccgacc);
+  fl::DevicePtr gtrans_raw(gtrans);
+
+  FL_CUDA_CHECK(w2l::cuda::fullConnectionCriterionBackward(
+      len,
+      B,
+      N,
+      static_cast<const float*>(trans_raw.get()),
+      static_cast<double*>(transtmp_raw.get()),
+      static_cast<const double*>(fccacc_raw.get()),
+      static_cast<double*>(fccgacc_raw.get()) + start * B * N,
+      static_cast<double*>(gtrans_raw.get()),
+      fl::cuda::getActiveStream()));
+}
+
+/**
+ * Without checkpointing `fccacc` holds all T frames of alpha [N, B, T].
+ * Otherwise it only holds every `stride`-th frame: the frames in between are
+ * recomputed from the input one block at a time, and the gradient wrt alpha
+ * is only kept for the current block.
+ */
 static void backward(
     std::vector<fl::Variable>& inputs,
     const fl::Variable& grad_output,
     int B,
     int N,
     int T,
+    int stride,
     const array& fccacc,
+    const array& fccaccLast,
     const array& scale) {
   assert(inputs.size() == 2);
   const auto& gscale = scale * grad_output.array(); // [B]
+  const auto& input = inputs[0].array(); // [N, T, B]
   const auto& trans = inputs[1].array(); // [N, N]
   array transtmp(N, N, B, f64);
-  array fccgacc(N, B, T, f64);
   auto gtrans = constant(0, N, N, B, f64);
 
-  const auto& final_em = fccacc(span, span, T - 1); // [N, B]
+  const auto& final_em = fccaccLast; // [N, B]
   const auto& final_max = max(final_em, 0); // [1, B]
   const auto& final_exp = exp(final_em - tile(final_max, N)); // [N, B]
   const auto& final_dlse = final_exp / tile(sum(final_exp, 0), N); // [N, B]
-  fccgacc(span, span, T - 1) = final_dlse;
-
-  {
-    fl::DevicePtr trans_raw(trans);
-    fl::DevicePtr fccacc_raw(fccacc);
-    fl::DevicePtr transtmp_raw(transtmp);
-    fl::DevicePtr fccgacc_raw(fccgacc);
-    fl::DevicePtr gtrans_raw(gtrans);
-
-    FL_CUDA_CHECK(w2l::cuda::fullConnectionCriterionBackward(
-        T,
-        B,
-        N,
-        static_cast<const float*>(trans_raw.get()),
-        static_cast<double*>(transtmp_raw.get()),
-        static_cast<const double*>(fccacc_raw.get()),
-        static_cast<double*>(fccgacc_raw.get()),
-        static_cast<double*>(gtrans_raw.get()),
-        fl::cuda::getActiveStream()));
+
+  array gem; // [N, B, T]
+  if (stride == 0) {
+    array fccgacc(N, B, T, f64);
+    fccgacc(span, span, T - 1) = final_dlse;
+    backwardBlock(0, T, B, N, trans, transtmp, fccacc, fccgacc, gtrans);
+    gem = (fccgacc * tile(moddims(gscale, 1, B), N, 1, T)).as(f32);
+  } else {
+    // the gradient wrt alpha only lives in a buffer of stride + 1 frames,
+    // each block is scaled into the f32 input gradient as it's done
+    gem = array(N, B, T, f32);
+    array block(N, B, stride + 1, f64);
+    array gblock(N, B, stride + 1, f64);
+    const auto& blockScale = tile(moddims(gscale, 1, B), N);
+    array carry = final_dlse; // gradient wrt alpha at the block's last frame
+    for (int k = fccacc.dims(2) - 1; k >= 0; --k) {
+      int start = k * stride;
+      int len = std::min(stride, T - 1 - start) + 1;
+      gblock(span, span, len - 1) = carry;
+      auto frames = seq(start, start + len - 1);
+      if (len > 1) {
+        // [N, B, len], reordered from the input for this block only
+        array blockInp = w2l::reorder(input(span, frames, span), 0, 2, 1);
+        block(span, span, 0) = fccacc(span, span, k);
+        forwardBlock(0, len, B, N, blockInp, trans, transtmp, block);
+        backwardBlock(0, len, B, N, trans, transtmp, block, gblock, gtrans);
+      }
+      gem(span, span, frames) =
+          (gblock(span, span, seq(0, len - 1)) * tile(blockScale, 1, 1, len))
+              .as(f32);
+      carry = gblock(span, span, 0).copy();
+    }
   }
 
-  const auto& gem = fccgacc * tile(moddims(gscale, 1, B), N, 1, T); // [N, B, T]
-  auto gem_r = w2l::reorder(gem, 0, 2, 1).as(f32);
+  auto gem_r = w2l::reorder(gem, 0, 2, 1);
   auto gtrans_r = sum(gtrans * tile(moddims(gscale, 1, 1, B), N, N), 2).as(f32);
 
   inputs[0].addGrad(fl::Variable(gem_r, false));
@@ -63,6 +143,7 @@ static void backward(
 fl::Variable FullConnectionCriterion::forward(
     const fl::Variable& input,
     const fl::Variable& target) {
+  W2L_TRACE_SCOPE("criterion/fcc");
   int N = input.dims(0);
   int T = input.dims(1);
   int B = input.dims(2);
@@ -92,27 +173,35 @@ fl::Variable FullConnectionCriterion::forward(
   array scale(B, scale_host.data());
   array inp(w2l::reorder(input.array(), 0, 2, 1)); // [N, B, T]
   array transtmp(N, N, B, f64);
-  array fccacc(N, B, T, f64);
-  fccacc(span, span, 0) = inp(span, span, 0);
-
-  {
-    fl::DevicePtr inp_raw(inp);
-    fl::DevicePtr trans_raw(transitions.array());
-    fl::DevicePtr transtmp_raw(transtmp);
-    fl::DevicePtr fccacc_raw(fccacc);
-
-    FL_CUDA_CHECK(w2l::cuda::fullConnectionCriterionForward(
-        T,
-        B,
-        N,
-        static_cast<const float*>(inp_raw.get()),
-        static_cast<const float*>(trans_raw.get()),
-        static_cast<double*>(transtmp_raw.get()),
-        static_cast<double*>(fccacc_raw.get()),
-        fl::cuda::getActiveStream()));
+  array fccacc, fccaccLast;
+  int stride = 0;
+  if (!checkpoint_) {
+    fccacc = array(N, B, T, f64);
+    fccacc(span, span, 0) = inp(span, span, 0);
+    forwardBlock(0, T, B, N, inp, transitions.array(), transtmp, fccacc);
+    fccaccLast = fccacc(span, span, T - 1);
+  } else {
+    // keep every stride-th frame only, the recursion itself runs in a
+    // buffer of stride + 1 frames
+    stride = w2l::getCheckpointStride(T);
+    int numCheckpoints = (T + stride - 1) / stride;
+    fccacc = array(N, B, numCheckpoints, f64);
+    array block(N, B, stride + 1, f64);
+    block(span, span, 0) = inp(span, span, 0);
+    for (int k = 0; k < numCheckpoints; ++k) {
+      int start = k * stride;
+      int len = std::min(stride, T - 1 - start) + 1;
+      fccacc(span, span, k) = block(span, span, 0);
+      if (len > 1) {
+        forwardBlock(
+            start, len, B, N, inp, transitions.array(), transtmp, block);
+      }
+      fccaccLast = block(span, span, len - 1).copy();
+      block(span, span, 0) = fccaccLast;
+    }
   }
 
-  const auto& final_em = fccacc(span, span, T - 1); // [N, B]
+  const auto& final_em = fccaccLast; // [N, B]
   const auto& final_max = max(final_em, 0); // [1, B]
   const auto& final_lse =
       final_max + log(sum(exp(final_em - tile(final_max, N)), 0)); // [1, B]
@@ -122,10 +211,11 @@ fl::Variable FullConnectionCriterion::forward(
     throw std::runtime_error("Loss is NaN value");
   }
 
-  auto grad_func = [B, N, T, fccacc, scale](
+  auto grad_func = [B, N, T, stride, fccacc, fccaccLast, scale](
                        std::vector<fl::Variable>& inputs,
                        const fl::Variable& grad_output) {
-    backward(inputs, grad_output, B, N, T, fccacc, scale);
+    backward(
+        inputs, grad_output, B, N, T, stride, fccacc, fccaccLast, scale);
   };
   return fl::Variable(fcc.as(f32), {input, transitions}, grad_func);
 }
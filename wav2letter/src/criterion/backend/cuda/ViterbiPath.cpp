@@ -4,6 +4,7 @@
 
 #include <flashlight/common/cuda.h>
 
+#include "common/Trace.h"
 #include "criterion/backend/cuda/kernels/ViterbiPath.cuh"
 
 namespace w2l {
@@ -12,6 +13,7 @@ af::array viterbiPath(const af::array& input, const af::array& trans) {
   if (input.isempty()) {
     return af::array();
   }
+  W2L_TRACE_SCOPE("criterion/viterbi");
   auto N = input.dims(0);
   auto T = input.dims(1);
   auto B = input.dims(2);
@@ -0,0 +1,306 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * Benchmark for all criteria and viterbiPath.
+ *
+ * Sweeps over the cartesian product of --bench_N/T/L/B, times fwd+bwd (fwd
+ * only for viterbi) after --bench_warmup untimed runs and writes median /
+ * p90 timings and device memory to --bench_output as JSON. The memory is the
+ * most ArrayFire memory in use after forward or after backward, with the
+ * memory manager emptied before each case. With --bench_baseline,
+ * cases whose median got slower than the baseline by more than
+ * --bench_tolerance are reported and the exit code is 1.
+ *
+ * Example:
+ *   CriterionBenchmark --bench_criteria=asg,ctc --bench_T=200,1000 \
+ *     --bench_output=now.json --bench_baseline=before.json
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <arrayfire.h>
+#include <flashlight/flashlight.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "common/Utils.h"
+#include "criterion/attention/attention.h"
+#include "criterion/criterion.h"
+
+using namespace fl;
+using namespace w2l;
+
+DEFINE_string(
+    bench_criteria,
+    "ctc,asg,fac,fcc,linseg,seq2seq,viterbi",
+    "comma-separated list of criteria to benchmark");
+DEFINE_string(bench_N, "30", "comma-separated list of alphabet sizes");
+DEFINE_string(bench_T, "200,487", "comma-separated list of input lengths");
+DEFINE_string(bench_L, "34", "comma-separated list of target lengths");
+DEFINE_string(bench_B, "1,10", "comma-separated list of batch sizes");
+DEFINE_int64(bench_hidden, 256, "encoder dimension for seq2seq");
+DEFINE_int64(bench_warmup, 5, "untimed iterations before measuring");
+DEFINE_int64(bench_iters, 20, "timed iterations per case");
+DEFINE_int64(bench_device, -1, "ArrayFire device to use, -1 for default");
+DEFINE_string(bench_output, "", "write results as JSON to this file");
+DEFINE_string(
+    bench_baseline,
+    "",
+    "JSON file written by a previous run to compare against");
+DEFINE_double(
+    bench_tolerance,
+    0.1,
+    "relative slowdown of the median over the baseline flagged as regression");
+
+namespace {
+
+struct BenchResult {
+  std::string name;
+  std::string criterion;
+  int N, T, L, B;
+  double medianMs, p90Ms, meanMs;
+  double deviceMb; // ArrayFire memory in use after fwd or bwd, max over runs
+};
+
+std::vector<int> parseInts(const std::string& str) {
+  std::vector<int> res;
+  for (const auto& tok : split(',', str, true)) {
+    res.push_back(std::stoi(tok));
+  }
+  return res;
+}
+
+double percentile(std::vector<double> vals, double p) {
+  std::sort(vals.begin(), vals.end());
+  size_t idx = std::min(
+      vals.size() - 1, static_cast<size_t>(p * (vals.size() - 1) + 0.5));
+  return vals[idx];
+}
+
+double deviceMb() {
+  size_t allocBytes, allocBuffers, lockBytes, lockBuffers;
+  af::deviceMemInfo(&allocBytes, &allocBuffers, &lockBytes, &lockBuffers);
+  return lockBytes / (1024.0 * 1024.0);
+}
+
+// Target of length L per batch element with labels in [0, N - 2] (N - 1 is
+// left for blank / eos) and a random amount of `pad` for B > 1.
+Variable makeTarget(int N, int L, int B, int pad = -1) {
+  auto t = (af::randu(L, B) * (N - 1)).as(af::dtype::s32);
+  for (int b = 1; b < B; ++b) {
+    // at least one label, or FAC/FCC reject the target with --bench_L=1
+    int len = std::max(1, L / 2 + rand() % (L - L / 2));
+    if (len < L) {
+      t(af::seq(len, L - 1), b) = pad;
+    }
+  }
+  return Variable(t, false);
+}
+
+// Returns a function running one fwd (+ bwd) pass, and keeps in `peakMb` the
+// most memory in use after forward or after backward.
+std::function<void()>
+makeCase(const std::string& crit, int N, int T, int L, int B, double& peakMb) {
+  auto input = Variable(af::log(af::randu(N, T, B)), true);
+  auto target = makeTarget(N, L, B);
+  auto record = [&peakMb](const Variable& loss) {
+    af::sync();
+    peakMb = std::max(peakMb, deviceMb());
+    loss.backward();
+    af::sync();
+    peakMb = std::max(peakMb, deviceMb());
+  };
+
+  std::shared_ptr<SequenceCriterion> seqCrit;
+  if (crit == "ctc") {
+    seqCrit = std::make_shared<ConnectionistTemporalClassificationCriterion>();
+  } else if (crit == "asg") {
+    seqCrit = std::make_shared<AutoSegmentationCriterion>(N);
+  } else if (crit == "linseg") {
+    seqCrit = std::make_shared<LinearSegmentationCriterion>(N);
+  } else if (crit == "seq2seq") {
+    seqCrit = std::make_shared<Seq2SeqCriterion>(
+        N, FLAGS_bench_hidden, N - 1, L, std::make_shared<ContentAttention>());
+    input = Variable(af::randn(FLAGS_bench_hidden, T, B), true);
+    target = makeTarget(N, L, B, N - 1); // padded with eos
+  }
+  if (seqCrit) {
+    return [seqCrit, input, target, record]() {
+      record(seqCrit->forward({input, target}).front());
+    };
+  }
+
+  std::shared_ptr<BinaryModule> binCrit;
+  if (crit == "fac") {
+    binCrit = std::make_shared<ForceAlignmentCriterion>(N);
+  } else if (crit == "fcc") {
+    binCrit = std::make_shared<FullConnectionCriterion>(N);
+  }
+  if (binCrit) {
+    return [binCrit, input, target, record]() {
+      record(binCrit->forward(input, target));
+    };
+  }
+
+  if (crit == "viterbi") {
+    auto trans = af::randu(N, N);
+    auto inputArr = input.array();
+    return [inputArr, trans, &peakMb]() {
+      auto path = viterbiPath(inputArr, trans);
+      af::sync();
+      peakMb = std::max(peakMb, deviceMb());
+    };
+  }
+
+  LOG(FATAL) << "Unknown criterion '" << crit << "'";
+  return nullptr;
+}
+
+BenchResult runCase(const std::string& crit, int N, int T, int L, int B) {
+  BenchResult res;
+  res.criterion = crit;
+  res.N = N;
+  res.T = T;
+  res.L = L;
+  res.B = B;
+  res.name = format("%s/N=%d/T=%d/L=%d/B=%d", crit.c_str(), N, T, L, B);
+  res.deviceMb = 0;
+
+  // free the buffers the previous cases left cached
+  af::deviceGC();
+  auto step = makeCase(crit, N, T, L, B, res.deviceMb);
+  for (int i = 0; i < FLAGS_bench_warmup; ++i) {
+    step();
+  }
+  af::sync();
+
+  res.deviceMb = 0;
+  std::vector<double> times;
+  for (int i = 0; i < FLAGS_bench_iters; ++i) {
+    auto s = af::timer::start();
+    step();
+    af::sync();
+    times.push_back(af::timer::stop(s) * 1000.0);
+  }
+  res.medianMs = percentile(times, 0.5);
+  res.p90Ms = percentile(times, 0.9);
+  double sum = 0;
+  for (auto t : times) {
+    sum += t;
+  }
+  res.meanMs = sum / times.size();
+  return res;
+}
+
+void writeJson(std::ostream& os, const std::vector<BenchResult>& results) {
+  os << "{\n  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto& r = results[i];
+    // one case per line, see readBaseline()
+    os << "    {\"name\": \"" << r.name << "\", \"criterion\": \""
+       << r.criterion << "\", \"N\": " << r.N << ", \"T\": " << r.T
+       << ", \"L\": " << r.L << ", \"B\": " << r.B << std::fixed
+       << std::setprecision(4) << ", \"median_ms\": " << r.medianMs
+       << ", \"p90_ms\": " << r.p90Ms << ", \"mean_ms\": " << r.meanMs
+       << ", \"device_mb\": " << r.deviceMb << "}"
+       << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  os << "  ]\n}\n";
+}
+
+// Reads name -> median_ms from a file written by writeJson()
+std::map<std::string, double> readBaseline(const std::string& path) {
+  std::ifstream file(path);
+  if (!file) {
+    LOG(FATAL) << "Could not open baseline file " << path;
+  }
+  std::map<std::string, double> baseline;
+  std::string line;
+  const std::string nameKey = "\"name\": \"";
+  const std::string medianKey = "\"median_ms\": ";
+  while (std::getline(file, line)) {
+    auto namePos = line.find(nameKey);
+    auto medianPos = line.find(medianKey);
+    if (namePos == std::string::npos || medianPos == std::string::npos) {
+      continue;
+    }
+    namePos += nameKey.size();
+    auto name = line.substr(namePos, line.find('"', namePos) - namePos);
+    baseline[name] = std::stod(line.substr(medianPos + medianKey.size()));
+  }
+  return baseline;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  if (FLAGS_bench_device >= 0) {
+    af::setDevice(FLAGS_bench_device);
+  }
+  af::info();
+
+  std::vector<BenchResult> results;
+  for (const auto& crit : split(',', FLAGS_bench_criteria, true)) {
+    for (int N : parseInts(FLAGS_bench_N)) {
+      for (int T : parseInts(FLAGS_bench_T)) {
+        for (int L : parseInts(FLAGS_bench_L)) {
+          for (int B : parseInts(FLAGS_bench_B)) {
+            if (L > T) {
+              continue;
+            }
+            results.push_back(runCase(crit, N, T, L, B));
+            const auto& r = results.back();
+            std::cout << std::left << std::setw(40) << r.name << std::fixed
+                      << std::setprecision(3) << " median " << r.medianMs
+                      << " ms, p90 " << r.p90Ms << " ms, device "
+                      << r.deviceMb << " MB" << std::endl;
+          }
+        }
+      }
+    }
+  }
+
+  if (!FLAGS_bench_output.empty()) {
+    std::ofstream out(FLAGS_bench_output);
+    writeJson(out, results);
+    LOG(INFO) << "Results written to " << FLAGS_bench_output;
+  }
+
+  if (FLAGS_bench_baseline.empty()) {
+    return 0;
+  }
+  auto baseline = readBaseline(FLAGS_bench_baseline);
+  int regressions = 0;
+  for (const auto& r : results) {
+    auto it = baseline.find(r.name);
+    if (it == baseline.end()) {
+      continue;
+    }
+    double ratio = r.medianMs / it->second;
+    if (ratio > 1.0 + FLAGS_bench_tolerance) {
+      ++regressions;
+      std::cout << "REGRESSION " << r.name << ": " << it->second << " -> "
+                << r.medianMs << " ms (x" << std::setprecision(2) << ratio
+                << ")" << std::endl;
+    }
+  }
+  std::cout << regressions << " regression(s) against "
+            << FLAGS_bench_baseline << std::endl;
+  return regressions > 0 ? 1 : 0;
+}
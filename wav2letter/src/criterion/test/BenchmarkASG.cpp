@@ -19,11 +19,25 @@
 using namespace fl;
 using namespace w2l;
 
-int main() {
-  af::setDevice(1);
-  int N = 30, T = 487, L = 34, B = 20;
+namespace {
+
+// Size of the alpha tables (FAC + FCC, including the FCC argmax table) kept
+// between forward and backward by the CPU backend
+double alphaTableMb(int N, int T, int L, int B, bool checkpoint) {
+  double frames = T;
+  double indexBytes = sizeof(int);
+  if (checkpoint) {
+    int stride = getCheckpointStride(T);
+    frames = (T + stride - 1) / stride;
+    indexBytes = 0;
+  }
+  double frameBytes = L * sizeof(double) + N * (sizeof(double) + indexBytes);
+  return B * frames * frameBytes / (1024.0 * 1024.0);
+}
 
-  auto asg = AutoSegmentationCriterion(N);
+void benchmark(int N, int T, int L, int B, bool checkpoint) {
+  auto asg = AutoSegmentationCriterion(
+      N, w2l::CriterionScaleMode::NONE, 0.0, checkpoint);
 
   auto input = Variable(af::randu(N, T, B) * 2 - 1, true);
 
@@ -46,7 +60,20 @@ int main() {
   }
   af::sync();
   auto e = af::timer::stop(s);
-  std::cout << "Total time (fwd+bwd pass) " << std::setprecision(5)
-            << e * 1000.0 / ntimes << " msec" << std::endl;
+  std::cout << "T=" << T << (checkpoint ? " checkpoint" : " full") << ": "
+            << "Total time (fwd+bwd pass) " << std::setprecision(5)
+            << e * 1000.0 / ntimes << " msec, alpha tables "
+            << alphaTableMb(N, T, L, B, checkpoint) << " MB" << std::endl;
+}
+
+} // namespace
+
+int main() {
+  af::setDevice(1);
+  int N = 30, L = 34, B = 20;
+  for (int T : {487, 3000}) {
+    benchmark(N, T, L, B, false);
+    benchmark(N, T, L, B, true);
+  }
   return 0;
 }
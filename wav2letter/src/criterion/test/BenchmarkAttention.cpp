@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <flashlight/flashlight.h>
+
+#include <iomanip>
+#include <iostream>
+
+#include <arrayfire.h>
+
+#include "criterion/attention/attention.h"
+
+using namespace fl;
+using namespace w2l;
+
+namespace {
+
+double lockedMb() {
+  size_t allocBytes, allocBuffers, lockBytes, lockBuffers;
+  af::deviceMemInfo(&allocBytes, &allocBuffers, &lockBytes, &lockBuffers);
+  return lockBytes / (1024.0 * 1024.0);
+}
+
+// Memory held by the graph between forward and backward, and fwd+bwd time
+void timeNeuralContentAttention(int H, int U, int T, int B, int64_t chunk) {
+  NeuralContentAttention attention(H);
+  attention.setChunkSize(chunk);
+  auto encodedx = Variable(af::randn(H, T, B), true);
+  auto encodedy = Variable(af::randn(H, U, B), true);
+
+  af::deviceGC();
+  af::sync();
+  double before = lockedMb();
+  auto summaries = attention(encodedy, encodedx, Variable{}).second;
+  af::sync();
+  double held = lockedMb() - before;
+  summaries.backward();
+  summaries = Variable();
+
+  int iters = 10;
+  af::sync();
+  auto s = af::timer::start();
+  for (int i = 0; i < iters; ++i) {
+    attention(encodedy, encodedx, Variable{}).second.backward();
+  }
+  af::sync();
+  auto e = af::timer::stop(s);
+  std::cout << "H=" << H << " U=" << U << " T=" << T << " B=" << B
+            << " chunk=" << chunk << ": held after forward " << std::fixed
+            << std::setprecision(1) << held << " MB, fwd+bwd "
+            << std::setprecision(3) << e * 1000.0 / iters << " msec"
+            << std::endl;
+}
+
+} // namespace
+
+int main() {
+  af::info();
+  int H = 256, B = 2;
+  for (int T : {200, 800}) {
+    int U = T / 4;
+    // a chunk larger than H x U x T x B is the unchunked computation
+    timeNeuralContentAttention(H, U, T, B, int64_t(H) * U * T * B);
+    timeNeuralContentAttention(H, U, T, B, 1 << 24);
+    timeNeuralContentAttention(H, U, T, B, 1 << 22);
+  }
+  return 0;
+}
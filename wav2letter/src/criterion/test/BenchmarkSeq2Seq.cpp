@@ -37,7 +37,7 @@ void timeBeamSearch() {
   seq2seq.beamPath(input);
 
   int iters = 10;
-  std::vector<int> beamsizes = {1, 5, 10, 20};
+  std::vector<int> beamsizes = {1, 5, 10, 20, 50};
   for (auto b : beamsizes) {
     auto s = af::timer::start();
     for (int i = 0; i < iters; ++i) {
@@ -46,7 +46,8 @@ void timeBeamSearch() {
     af::sync();
     auto e = af::timer::stop(s);
     std::cout << "Total time (beam size: " << b << ") " << std::setprecision(5)
-              << e * 1000.0 / iters << " msec" << std::endl;
+              << e * 1000.0 / iters << " msec, " << iters / e << " utts/sec"
+              << std::endl;
   }
 }
 
@@ -416,6 +416,69 @@ TEST(CriterionTest, FACJacobian) {
   jacobian_test(func_trans, transition);
 }
 
+TEST(CriterionTest, FCCCheckpoint) {
+  // T is not a multiple of the checkpoint stride on purpose
+  int N = 10, T = 47, L = 12, B = 3;
+  auto in = logSoftmax(Variable(af::randu(N, T, B), true), 0);
+  auto t = af::abs(af::randu(L, B, af::dtype::s32)) % (N - 1);
+  auto tgt = Variable(t.as(af::dtype::s32), false);
+  auto transition = Variable(af::randu(N, N), true);
+
+  auto fcc = FullConnectionCriterion(N, w2l::CriterionScaleMode::NONE);
+  auto fccCkpt =
+      FullConnectionCriterion(N, w2l::CriterionScaleMode::NONE, true);
+  fcc.setParams(transition, 0);
+  fccCkpt.setParams(transition, 0);
+
+  auto loss = fcc(in, tgt);
+  loss.backward();
+  auto inGrad = in.grad().array();
+  auto transGrad = fcc.param(0).grad().array();
+  in.zeroGrad();
+  fccCkpt.param(0).zeroGrad();
+
+  auto lossCkpt = fccCkpt(in, tgt);
+  lossCkpt.backward();
+  checkZero(loss.array() - lossCkpt.array(), 1e-4);
+  checkZero(inGrad - in.grad().array(), 1e-4);
+  checkZero(transGrad - fccCkpt.param(0).grad().array(), 1e-4);
+}
+
+TEST(CriterionTest, FACCheckpoint) {
+  int N = 10, T = 47, L = 12, B = 3;
+  auto in = logSoftmax(Variable(af::randu(N, T, B), true), 0);
+  auto t = af::abs(af::randu(L, B, af::dtype::s32)) % (N - 1);
+  auto tgt = Variable(t.as(af::dtype::s32), false);
+  auto transition = Variable(af::randu(N, N), true);
+
+  auto fac = ForceAlignmentCriterion(N, w2l::CriterionScaleMode::NONE);
+  auto facCkpt =
+      ForceAlignmentCriterion(N, w2l::CriterionScaleMode::NONE, true);
+  fac.setParams(transition, 0);
+  facCkpt.setParams(transition, 0);
+
+  auto loss = fac(in, tgt);
+  loss.backward();
+  auto inGrad = in.grad().array();
+  auto transGrad = fac.param(0).grad().array();
+  in.zeroGrad();
+  facCkpt.param(0).zeroGrad();
+
+  auto lossCkpt = facCkpt(in, tgt);
+  lossCkpt.backward();
+  checkZero(loss.array() - lossCkpt.array(), 1e-4);
+  checkZero(inGrad - in.grad().array(), 1e-4);
+  checkZero(transGrad - facCkpt.param(0).grad().array(), 1e-4);
+
+  // Jacobian in checkpoint mode
+  auto inSmall = Variable(af::log(af::randu(N, 11, 2)), true);
+  auto tgtSmall = Variable(t(af::seq(3), af::seq(2)).as(af::dtype::s32), false);
+  auto func_small = [&](Variable& inp) {
+    return facCkpt.forward(inp, tgtSmall);
+  };
+  jacobian_test(func_small, inSmall);
+}
+
 TEST(CriterionTest, ASGCost) {
   // Test case: 1
   constexpr int N1 = 2, L1 = 2, T1 = 3, B1 = 2;
@@ -122,6 +122,45 @@ TEST(Seq2SeqTest, Seq2SeqBeamSearchViterbi) {
   }
 }
 
+TEST(Seq2SeqTest, Seq2SeqBeamSearchScores) {
+  int nclass = 20;
+  int hiddendim = 16;
+  int inputsteps = 30;
+  int maxoutputlen = 8;
+  int beamsize = 5;
+
+  Seq2SeqCriterion seq2seq(
+      nclass,
+      hiddendim,
+      -1 /* no eos, beam search runs to maxoutputlen */,
+      maxoutputlen,
+      std::make_shared<ContentAttention>());
+
+  seq2seq.eval();
+  auto input = af::randn(hiddendim, inputsteps, 1, f32);
+
+  std::vector<Seq2SeqCriterion::CandidateHypo> beam;
+  beam.emplace_back(Seq2SeqCriterion::CandidateHypo{});
+  auto hypos = seq2seq.beamSearch(input, beam, beamsize, maxoutputlen);
+  ASSERT_EQ(hypos.size(), beamsize);
+
+  // rescore each path one hypothesis at a time
+  for (auto& hypo : hypos) {
+    ASSERT_EQ(hypo.path.size(), maxoutputlen);
+    Seq2SeqState state;
+    Variable y, ox;
+    float score = 0;
+    for (int token : hypo.path) {
+      std::tie(ox, state) =
+          seq2seq.decodeStep(Variable(input, false), y, state);
+      auto scores = w2l::afToVector<float>(logSoftmax(ox, 0));
+      score += scores[token];
+      y = constant(token, 1, s32, false);
+    }
+    ASSERT_NEAR(score, hypo.score, 1e-3);
+  }
+}
+
 TEST(Seq2SeqTest, Seq2SeqMedianWindow) {
   int nclass = 40;
   int hiddendim = 256;
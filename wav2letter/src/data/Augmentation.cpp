@@ -0,0 +1,172 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "data/Augmentation.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "common/Defines.h"
+
+namespace w2l {
+
+namespace {
+
+constexpr size_t kNoiseChunk = 4096; // random numbers drawn at a time
+
+} // namespace
+
+AugmentationOptions AugmentationOptions::fromFlags() {
+  AugmentationOptions opts;
+  opts.snr = FLAGS_augsnr;
+  opts.speed = FLAGS_augspeed;
+  opts.timeWarp = FLAGS_augtimewarp;
+  opts.freqMask = FLAGS_augfreqmask;
+  opts.numFreqMasks = FLAGS_augnfreqmask;
+  opts.timeMask = FLAGS_augtimemask;
+  opts.numTimeMasks = FLAGS_augntimemask;
+  return opts;
+}
+
+uint64_t augmentationSeed(uint64_t batchSeed, uint64_t index) {
+  AugmentationRng rng(batchSeed ^ (index * 0xd1b54a32d192ed03ULL));
+  return rng.next();
+}
+
+void addNoise(std::vector<float>& audio, double snr, AugmentationRng& rng) {
+  if (audio.empty()) {
+    return;
+  }
+  double power = 0;
+  for (auto x : audio) {
+    power += x * x;
+  }
+  power /= audio.size();
+  float stddev = std::sqrt(power / std::pow(10.0, snr / 10));
+  if (stddev == 0) {
+    return;
+  }
+
+  // Box-Muller on chunks of uniforms, the loop over a chunk vectorizes
+  std::vector<float> u1(kNoiseChunk), u2(kNoiseChunk);
+  const float twoPi = 2 * M_PI;
+  for (size_t start = 0; start < audio.size(); start += kNoiseChunk) {
+    auto n = std::min(kNoiseChunk, audio.size() - start);
+    for (size_t i = 0; i < n; ++i) {
+      u1[i] = 1.0 - rng.uniform(); // in (0, 1]
+      u2[i] = rng.uniform();
+    }
+    auto out = audio.data() + start;
+    for (size_t i = 0; i < n; ++i) {
+      out[i] += stddev * std::sqrt(-2 * std::log(u1[i])) *
+          std::cos(twoPi * u2[i]);
+    }
+  }
+}
+
+std::vector<float>
+changeSpeed(const std::vector<float>& audio, int64_t channels, double factor) {
+  int64_t nFrames = audio.size() / channels;
+  if (nFrames < 2 || factor <= 0 || factor == 1) {
+    return audio;
+  }
+  int64_t outFrames = static_cast<int64_t>((nFrames - 1) / factor) + 1;
+  std::vector<float> out(outFrames * channels);
+  for (int64_t i = 0; i < outFrames; ++i) {
+    double pos = i * factor;
+    auto j = std::min(static_cast<int64_t>(pos), nFrames - 1);
+    auto j1 = std::min(j + 1, nFrames - 1);
+    float frac = pos - j;
+    auto a = audio.data() + j * channels;
+    auto b = audio.data() + j1 * channels;
+    auto o = out.data() + i * channels;
+    for (int64_t c = 0; c < channels; ++c) {
+      o[c] = a[c] + frac * (b[c] - a[c]);
+    }
+  }
+  return out;
+}
+
+void timeWarp(
+    float* feat,
+    int64_t T,
+    int64_t validT,
+    int64_t K,
+    int64_t maxWarp,
+    AugmentationRng& rng) {
+  if (maxWarp <= 0 || validT <= 2 * maxWarp + 1) {
+    return;
+  }
+  // frame w0 moves to w1, the frames on each side are stretched linearly
+  auto last = validT - 1;
+  auto w0 = rng.uniformInt(maxWarp, last - maxWarp);
+  auto w1 = w0 + rng.uniformInt(-maxWarp, maxWarp);
+  if (w1 == w0) {
+    return;
+  }
+  std::vector<int64_t> src(validT);
+  std::vector<float> frac(validT);
+  for (int64_t t = 0; t < validT; ++t) {
+    double pos = t < w1 ? static_cast<double>(t) * w0 / w1
+                        : w0 +
+            static_cast<double>(t - w1) * (last - w0) /
+                std::max<int64_t>(last - w1, 1);
+    src[t] = std::min(static_cast<int64_t>(pos), last - 1);
+    frac[t] = pos - src[t];
+  }
+  std::vector<float> column(validT);
+  for (int64_t k = 0; k < K; ++k) {
+    auto col = feat + k * T;
+    std::copy(col, col + validT, column.begin());
+    for (int64_t t = 0; t < validT; ++t) {
+      auto a = column[src[t]];
+      col[t] = a + frac[t] * (column[src[t] + 1] - a);
+    }
+  }
+}
+
+void maskFeatures(
+    float* feat,
+    int64_t T,
+    int64_t validT,
+    int64_t K,
+    const AugmentationOptions& opts,
+    AugmentationRng& rng) {
+  if (validT <= 0 || K <= 0) {
+    return;
+  }
+  double sum = 0;
+  for (int64_t k = 0; k < K; ++k) {
+    auto col = feat + k * T;
+    for (int64_t t = 0; t < validT; ++t) {
+      sum += col[t];
+    }
+  }
+  float mean = sum / (validT * K);
+
+  if (opts.freqMask > 0) {
+    for (int64_t m = 0; m < opts.numFreqMasks; ++m) {
+      auto width = rng.uniformInt(0, std::min(opts.freqMask, K));
+      auto start = rng.uniformInt(0, K - width);
+      for (auto k = start; k < start + width; ++k) {
+        std::fill(feat + k * T, feat + k * T + validT, mean);
+      }
+    }
+  }
+  if (opts.timeMask > 0) {
+    for (int64_t m = 0; m < opts.numTimeMasks; ++m) {
+      auto width = rng.uniformInt(0, std::min(opts.timeMask, validT));
+      auto start = rng.uniformInt(0, validT - width);
+      for (int64_t k = 0; k < K; ++k) {
+        std::fill(feat + k * T + start, feat + k * T + start + width, mean);
+      }
+    }
+  }
+}
+
+} // namespace w2l
@@ -0,0 +1,110 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace w2l {
+
+/**
+ * On-the-fly augmentation of training batches, applied by featurize and thus
+ * in the data loader threads, behind the prefetching of W2lDataset.
+ *  - on the audio: additive white noise at a given SNR, speed perturbation
+ *    by linear resampling;
+ *  - on the features (with -pow, -mfsc or -mfcc), as in SpecAugment: time
+ *    warping, then frequency and time masks filled with the mean of the
+ *    sample.
+ * Every sample draws from its own random stream, seeded from the batch seed
+ * and its position in the batch, so that the result does not depend on which
+ * thread loads the batch.
+ */
+struct AugmentationOptions {
+  double snr = 0; // dB, 0 for no noise
+  double speed = 0; // factors in [1 - speed, 1 + speed]
+  int64_t timeWarp = 0; // max warp distance in frames
+  int64_t freqMask = 0; // max width of a frequency mask
+  int64_t numFreqMasks = 1;
+  int64_t timeMask = 0; // max width of a time mask in frames
+  int64_t numTimeMasks = 1;
+
+  static AugmentationOptions fromFlags();
+
+  bool audioEnabled() const {
+    return snr != 0 || speed > 0;
+  }
+
+  bool featuresEnabled() const {
+    return timeWarp > 0 || (freqMask > 0 && numFreqMasks > 0) ||
+        (timeMask > 0 && numTimeMasks > 0);
+  }
+
+  bool enabled() const {
+    return audioEnabled() || featuresEnabled();
+  }
+};
+
+// splitmix64: small, fast and with the same output on every platform,
+// unlike the distributions of <random>
+class AugmentationRng {
+ public:
+  explicit AugmentationRng(uint64_t seed) : state_(seed) {}
+
+  uint64_t next() {
+    uint64_t z = (state_ += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  // in [0, 1)
+  double uniform() {
+    return (next() >> 11) * (1.0 / (1ULL << 53));
+  }
+
+  // in [lo, hi]
+  int64_t uniformInt(int64_t lo, int64_t hi) {
+    return lo + static_cast<int64_t>(next() % (hi - lo + 1));
+  }
+
+ private:
+  uint64_t state_;
+};
+
+// Seed of sample `index` of a batch with seed `batchSeed`
+uint64_t augmentationSeed(uint64_t batchSeed, uint64_t index);
+
+// Adds white gaussian noise at `snr` dB of the power of `audio`
+void addNoise(std::vector<float>& audio, double snr, AugmentationRng& rng);
+
+// Linear resampling of interleaved `channels` audio, played `factor` times
+// faster
+std::vector<float>
+changeSpeed(const std::vector<float>& audio, int64_t channels, double factor);
+
+// Augmentations of one T x K (Col Major) feature matrix, of which only the
+// first `validT` frames are not padding
+
+void timeWarp(
+    float* feat,
+    int64_t T,
+    int64_t validT,
+    int64_t K,
+    int64_t maxWarp,
+    AugmentationRng& rng);
+
+void maskFeatures(
+    float* feat,
+    int64_t T,
+    int64_t validT,
+    int64_t K,
+    const AugmentationOptions& opts,
+    AugmentationRng& rng);
+
+} // namespace w2l
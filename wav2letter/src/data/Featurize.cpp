@@ -9,12 +9,14 @@
 #include "Featurize.h"
 
 #include <math.h>
+#include <algorithm>
 #include <fstream>
 #include <vector>
 
 #include <glog/logging.h>
 
 #include "common/Defines.h"
+#include "common/Trace.h"
 #include "common/Transforms.h"
 #include "common/Utils.h"
 #include "feature/Mfcc.h"
@@ -39,47 +41,84 @@ speech::PowerSpectrum<float>& getPowerSpectrum() {
   static speech::PowerSpectrum<float> powspec(defineSpeechFeatureParams());
   return powspec;
 }
+
+// Pads every input to `maxInSize` and transposes it from T x CHANNELS
+// (Row Major) to T x CHANNELS (Col Major) into `out`
+void mergeInputs(
+    const std::vector<const std::vector<float>*>& inputs,
+    size_t maxInSize,
+    float* out) {
+  int64_t T = maxInSize / FLAGS_channels;
+  LOG_IF(FATAL, T * FLAGS_channels != maxInSize)
+      << "input size is not a multiple of the number of channels";
+  std::fill(out, out + maxInSize * inputs.size(), 0.0);
+  for (size_t b = 0; b < inputs.size(); ++b) {
+    const auto& in = *inputs[b];
+    auto dst = out + b * maxInSize;
+    for (size_t i = 0; i < in.size(); ++i) {
+      dst[(i % FLAGS_channels) * T + i / FLAGS_channels] = in[i];
+    }
+  }
+}
 } // namespace
 
 W2lFeatureData featurize(
     const std::vector<W2lLoaderData>& data,
-    const DictionaryMap& dicts) {
+    const DictionaryMap& dicts,
+    const AugmentationOptions& augmentation /* = AugmentationOptions() */,
+    uint64_t seed /* = 0 */) {
   if (data.empty()) {
     return {};
   }
+  W2L_TRACE_SCOPE("data/featurize");
   auto batchSz = data.size(); // 1 strip
   W2lFeatureData feat;
-  std::vector<std::string> sampleIds; //1 pre_sample id
+
+  // Augment Input
+  std::vector<AugmentationRng> rngs;
+  if (augmentation.enabled()) {
+    for (size_t b = 0; b < batchSz; ++b) {
+      rngs.emplace_back(augmentationSeed(seed, b));
+    }
+  }
+  std::vector<const std::vector<float>*> inputs(batchSz);
+  std::vector<std::vector<float>> augmented(
+      augmentation.audioEnabled() ? batchSz : 0);
+  for (size_t b = 0; b < batchSz; ++b) {
+    inputs[b] = &data[b].input;
+    if (!augmentation.audioEnabled()) {
+      continue;
+    }
+    W2L_TRACE_SCOPE("data/augment");
+    if (augmentation.speed > 0) {
+      auto factor = 1 + augmentation.speed * (2 * rngs[b].uniform() - 1);
+      augmented[b] = changeSpeed(data[b].input, FLAGS_channels, factor);
+    } else {
+      augmented[b] = data[b].input;
+    }
+    if (augmentation.snr != 0) {
+      addNoise(augmented[b], augmentation.snr, rngs[b]);
+    }
+    inputs[b] = &augmented[b];
+  }
 
   // Featurize Input
   size_t maxInSize = 0;
-  for (const auto& d : data) {
-    maxInSize = std::max(maxInSize, d.input.size());
+  for (auto in : inputs) {
+    maxInSize = std::max(maxInSize, in->size());
   }
   //LOG(INFO) << "*******************************maxInSize is :" << maxInSize;
   int64_t T = maxInSize / FLAGS_channels;
 
-  // CHANNELS X T X BATCHSZ (Col Major)
-  std::vector<float> mergedInput(maxInSize * batchSz, 0.0);
-  // Batch into a single array
-  for (size_t b = 0; b < batchSz; ++b) {
-    if (data[b].input.empty()) {
-      continue;
-    }
-    std::copy(
-        data[b].input.begin(),
-        data[b].input.end(),
-        mergedInput.begin() + b * maxInSize);
-  }
-  // T X CHANNELS X BATCHSZ (Col Major)
-  auto inFeat =
-      transpose2d<float>(std::move(mergedInput), T, FLAGS_channels, batchSz);
   feat.inputDims = af::dim4(T, FLAGS_channels, 1, batchSz);
   if (FLAGS_pow || FLAGS_mfsc || FLAGS_mfcc) {
     if ((FLAGS_mfcc && FLAGS_mfsc) || (FLAGS_pow && FLAGS_mfsc) ||
         (FLAGS_mfcc && FLAGS_pow)) {
       LOG(FATAL) << "Only one of -mfsc, -mfcc, -pow options can set to true";
     }
+    // T X CHANNELS X BATCHSZ (Col Major)
+    std::vector<float> inFeat(maxInSize * batchSz);
+    mergeInputs(inputs, maxInSize, inFeat.data());
     int64_t featSz = 1;
     if (FLAGS_mfcc) {
       auto& mfcc = getMfcc();
@@ -94,46 +133,111 @@ W2lFeatureData featurize(
     if (FLAGS_pow) {
       auto& powspec = getPowerSpectrum();
       featSz = powspec.getFeatureParams().powSpecFeatSz(); //257
-      
+
       auto res = powspec.myapply(inFeat);
-      inFeat = res[0]; //raw dft feature vectors T x K
-      feat.inputFft = res[1]; // raw complex fft feature vectors T x 2K
+      inFeat = std::move(res[0]); //raw dft feature vectors T x K
+      if (FLAGS_powfft) {
+        // raw complex fft feature vectors T x 2K
+        feat.inputFft = StagingBuffer<float>(res[1].size());
+        std::copy(res[1].begin(), res[1].end(), feat.inputFft.begin());
+      }
     }
     T = inFeat.size() / (FLAGS_channels * batchSz * featSz);
+    LOG_IF(FATAL, inFeat.size() != T * featSz * FLAGS_channels * batchSz);
     // Before: FEAT X FRAMES X CHANNELS X BATCHSIZE (Col Major)
-    inFeat = transpose2d<float>(inFeat, T, featSz, FLAGS_channels * batchSz);
+    feat.input = StagingBuffer<float>(inFeat.size());
+    transpose2d<float>(
+        inFeat.data(),
+        feat.input.data(),
+        T,
+        featSz,
+        FLAGS_channels * batchSz);
     // After: FRAMES X FEAT X CHANNELS X BATCHSIZE (Col Major)
     feat.inputDims = af::dim4(T, featSz, FLAGS_channels, batchSz);
-    
-    feat.fftDims = af::dim4(2*featSz, T, FLAGS_channels, batchSz);
+
+    if (augmentation.featuresEnabled() && maxInSize > 0) {
+      W2L_TRACE_SCOPE("data/augment");
+      for (size_t b = 0; b < batchSz; ++b) {
+        // frames of the sample before padding
+        int64_t validT = (T * inputs[b]->size() + maxInSize - 1) / maxInSize;
+        for (int64_t c = 0; c < FLAGS_channels; ++c) {
+          auto block =
+              feat.input.data() + (b * FLAGS_channels + c) * T * featSz;
+          auto rng = rngs[b]; // the same for every channel
+          timeWarp(block, T, validT, featSz, augmentation.timeWarp, rng);
+          maskFeatures(block, T, validT, featSz, augmentation, rng);
+        }
+      }
+    }
+
+    if (!feat.inputFft.empty()) {
+      feat.fftDims = af::dim4(2 * featSz, T, FLAGS_channels, batchSz);
+    }
+  } else {
+    feat.input = StagingBuffer<float>(maxInSize * batchSz);
+    mergeInputs(inputs, maxInSize, feat.input.data());
   }
 
   if (FLAGS_localnrmlleftctx > 0 || FLAGS_localnrmlrightctx > 0) {
-    feat.input = localNormalize(
-        inFeat, FLAGS_localnrmlleftctx, FLAGS_localnrmlrightctx, T, batchSz);
-  } else {
-    //feat.input = normalize(inFeat, batchSz);
-    feat.input = inFeat;
+    localNormalizeInPlace(
+        feat.input.data(),
+        feat.input.size(),
+        FLAGS_localnrmlleftctx,
+        FLAGS_localnrmlrightctx,
+        T,
+        batchSz);
   }
 
   // Featurize Target
-  for (auto targetIter : data[0].targets) {
-    auto targetType = targetIter.first;
+  bool tokenized = !data[0].targetIndices.empty();
+  std::vector<int> targetTypes;
+  if (tokenized) {
+    for (const auto& targetIter : data[0].targetIndices) {
+      targetTypes.push_back(targetIter.first);
+    }
+  } else {
+    for (const auto& targetIter : data[0].targets) {
+      targetTypes.push_back(targetIter.first);
+    }
+  }
+  for (auto targetType : targetTypes) {
     std::vector<std::vector<int>> tgtFeat;
     size_t maxTgtSize = 0;
     if (dicts.find(targetType) == dicts.end()) {
       LOG(FATAL) << "Dictionary not provided for target: " << targetType;
     }
-    auto dict = dicts.find(targetType)->second;
+    const auto& dict = dicts.find(targetType)->second;
+
+    int padVal = kTargetPadValue;
+    if (targetType == kTargetIdx) {
+      padVal = FLAGS_eostoken ? dict.getIndex(kEosToken) : kTargetPadValue;
+    } else if (targetType == kWordIdx) {
+      padVal = dict.getIndex(kUnkToken);
+    } else {
+      LOG(FATAL) << "Unrecognized target type" << targetType;
+    }
 
     for (const auto& d : data) {
-      if (d.targets.find(targetType) == d.targets.end()) {
-        LOG(FATAL) << "Target type not found for featurization: " << targetType;
+      std::vector<int> tgtVec;
+      if (tokenized) {
+        auto spans = d.targetIndices.find(targetType);
+        if (spans == d.targetIndices.end()) {
+          LOG(FATAL) << "Target type not found for featurization: "
+                     << targetType;
+        }
+        for (const auto& span : spans->second) {
+          tgtVec.insert(tgtVec.end(), span.begin(), span.end());
+        }
+      } else {
+        auto target = d.targets.find(targetType);
+        if (target == d.targets.end()) {
+          LOG(FATAL) << "Target type not found for featurization: "
+                     << targetType;
+        }
+        tgtVec = dict.mapTokensToIndices(target->second);
       }
-      auto target = d.targets.find(targetType)->second;
 
       if (targetType == kTargetIdx) {
-        auto tgtVec = dict.mapTokensToIndices(target);
         if (!FLAGS_surround.empty()) {
           auto idx = dict.getIndex(FLAGS_surround);
           tgtVec.emplace_back(idx);
@@ -151,63 +255,37 @@ W2lFeatureData featurize(
         if (FLAGS_eostoken) {
           tgtVec.emplace_back(dict.getIndex(kEosToken));
         }
-        tgtFeat.emplace_back(tgtVec);
-        maxTgtSize = std::max(maxTgtSize, tgtVec.size());
-
-        int padVal =
-            FLAGS_eostoken ? dict.getIndex(kEosToken) : kTargetPadValue;
-        // L X BATCHSZ (Col Major)
-        feat.targets[targetType].resize(batchSz * maxTgtSize, padVal);
-        feat.targetDims[targetType] = af::dim4(maxTgtSize, batchSz);
-      } else if (targetType == kWordIdx) {
-        auto tgtVec = dict.mapTokensToIndices(target);
-        tgtFeat.emplace_back(tgtVec);
-        maxTgtSize = std::max(maxTgtSize, tgtVec.size());
-
-        int padVal = dict.getIndex(kUnkToken);
-        // L X BATCHSZ (Col Major)
-        feat.targets[targetType].resize(batchSz * maxTgtSize, padVal);
-        feat.targetDims[targetType] = af::dim4(maxTgtSize, batchSz);
-      } else {
-        LOG(FATAL) << "Unrecognized target type" << targetType;
       }
+      maxTgtSize = std::max(maxTgtSize, tgtVec.size());
+      tgtFeat.emplace_back(std::move(tgtVec));
     }
 
     // Batch into a single array
+    // L X BATCHSZ (Col Major)
+    auto& tgt = feat.targets[targetType];
+    tgt = StagingBuffer<int>(batchSz * maxTgtSize, padVal);
+    feat.targetDims[targetType] = af::dim4(maxTgtSize, batchSz);
     for (size_t i = 0; i < batchSz; ++i) {
-      if (tgtFeat[i].empty()) {
-        continue;
-      }
       std::copy(
-          tgtFeat[i].begin(),
-          tgtFeat[i].end(),
-          feat.targets[targetType].begin() + maxTgtSize * i);
+          tgtFeat[i].begin(), tgtFeat[i].end(), tgt.begin() + maxTgtSize * i);
     }
   }
 
   // Featurize sampleid
   size_t maxSampleIdLen = 0;
-  for (size_t b = 0; b < batchSz; ++b) {
-    sampleIds.emplace_back(data[b].sampleId);
-    maxSampleIdLen = std::max(maxSampleIdLen, data[b].sampleId.size());
+  for (const auto& d : data) {
+    maxSampleIdLen = std::max(maxSampleIdLen, d.sampleId.size());
   }
 
   // Pack the sample ids
   // batchsize X maxSampleIdLen
-  feat.sampleIds.resize(batchSz * maxSampleIdLen, -1);
-  auto offset = 0;
-  for (auto& sampleId : sampleIds) {
-    auto charId = 0;
-    for (auto& c : sampleId) {
-      feat.sampleIds[offset + charId] = int(c);
-      charId += 1;
-    }
-    std::transform(
-        feat.sampleIds.begin() + offset,
-        feat.sampleIds.begin() + offset + sampleId.size(),
+  feat.sampleIds = StagingBuffer<int>(batchSz * maxSampleIdLen, -1);
+  for (size_t b = 0; b < batchSz; ++b) {
+    const auto& sampleId = data[b].sampleId;
+    std::copy(
         sampleId.begin(),
-        [](unsigned char c) -> int { return int(c); });
-    offset += maxSampleIdLen;
+        sampleId.end(),
+        feat.sampleIds.begin() + b * maxSampleIdLen);
   }
   feat.sampleIdsDims = af::dim4(maxSampleIdLen, batchSz);
 
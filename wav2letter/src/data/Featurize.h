@@ -12,29 +12,37 @@
 #include <unordered_map>
 
 #include "common/Dictionary.h"
+#include "data/Augmentation.h"
 #include "data/NumberedFilesLoader.h"
+#include "data/StagingBuffer.h"
 #include "feature/FeatureParams.h"
 #include "feature/Sound.h"
 
 namespace w2l {
 
 typedef std::unordered_map<int, af::dim4> DimsMap;
-typedef std::unordered_map<int, std::vector<int>> TargetFeatMap;
+typedef std::unordered_map<int, StagingBuffer<int>> TargetFeatMap;
 
+// A batch laid out as the arrays of W2lDataset::get, in pinned host buffers
+// (see HostBufferPool) which go back to the pool with the last copy
 struct W2lFeatureData {
-  std::vector<float> input; //unnormalized input
-  TargetFeatMap targets; 
+  StagingBuffer<float> input; //unnormalized input
+  TargetFeatMap targets;
   af::dim4 inputDims; // T x K x FLAGS_channels x batchSz
   DimsMap targetDims;
-  std::vector<int> sampleIds;
+  StagingBuffer<int> sampleIds;
   af::dim4 sampleIdsDims;
-  std::vector<float> inputFft; //raw complex fft input
+  StagingBuffer<float> inputFft; //raw complex fft input, with FLAGS_powfft
   af::dim4 fftDims; // 2K x T x FLAGS_channels x batchSz
 };
 
+// `augmentation` is applied with random streams derived from `seed`, see
+// AugmentationOptions
 W2lFeatureData featurize(
     const std::vector<W2lLoaderData>& data,
-    const DictionaryMap& dicts);
+    const DictionaryMap& dicts,
+    const AugmentationOptions& augmentation = AugmentationOptions(),
+    uint64_t seed = 0);
 
 speech::FeatureParams defineSpeechFeatureParams();
 
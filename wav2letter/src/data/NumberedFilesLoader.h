@@ -18,10 +18,15 @@ namespace w2l {
 
 typedef std::unordered_map<int, std::string> TargetExtMap;
 typedef std::unordered_map<int, std::vector<std::string>> TargetMap;
+typedef std::unordered_map<int, std::vector<IndexSpan>> TargetIndexMap;
 
 struct W2lLoaderData {
   std::vector<float> input;
   TargetMap targets;
+  // Already tokenized targets, the concatenation of the spans which view
+  // memory owned by the dataset. Used by featurize instead of `targets`
+  // when not empty.
+  TargetIndexMap targetIndices;
   std::string sampleId;
 };
 
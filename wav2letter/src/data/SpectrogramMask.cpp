@@ -0,0 +1,197 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "data/SpectrogramMask.h"
+
+#include <algorithm>
+#include <fstream>
+#include <unordered_map>
+
+#include <cnpy.h>
+#include <glog/logging.h>
+
+#include "common/Utils.h"
+
+namespace w2l {
+
+namespace {
+
+constexpr size_t kMaxCachedMasks = 32;
+
+bool endsWith(const std::string& str, const std::string& suffix) {
+  return str.size() >= suffix.size() &&
+      str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Resolves an inclusive [lo, hi] range with negative values counted from the
+// end and clamps it to [0, size). Returns false if the range is empty.
+bool resolveRange(int64_t& lo, int64_t& hi, int64_t size) {
+  lo = lo < 0 ? size + lo : lo;
+  hi = hi < 0 ? size + hi : hi;
+  lo = std::max<int64_t>(lo, 0);
+  hi = std::min<int64_t>(hi, size - 1);
+  return lo <= hi;
+}
+
+} // namespace
+
+SpectrogramMask::SpectrogramMask(const std::string& path) {
+  if (endsWith(path, ".npy")) {
+    auto npy = cnpy::npy_load(path);
+    if (npy.shape.size() != 2) {
+      LOG(FATAL) << "Mask bitmap " << path << " must be 2-D (T, K)";
+    }
+    // any nonzero byte marks the bin, whatever the dtype
+    std::vector<float> bits(npy.num_vals);
+    const char* raw = npy.data<char>();
+    for (size_t i = 0; i < npy.num_vals; ++i) {
+      const char* v = raw + i * npy.word_size;
+      bits[i] = std::any_of(v, v + npy.word_size, [](char c) { return c; });
+    }
+    const int64_t T = npy.shape[0], K = npy.shape[1];
+    bitmap_ = npy.fortran_order ? af::array(T, K, bits.data())
+                                : af::array(K, T, bits.data()).T();
+    return;
+  }
+
+  std::ifstream file(path);
+  if (!file) {
+    LOG(FATAL) << "Could not open mask spec " << path;
+  }
+  std::vector<int64_t> legacy;
+  std::string line;
+  int64_t lineNum = 0;
+  while (std::getline(file, line)) {
+    ++lineNum;
+    auto tokens = splitOnWhitespace(line.substr(0, line.find('#')), true);
+    if (tokens.empty()) {
+      continue;
+    }
+    std::vector<int64_t> args;
+    for (size_t i = 1; i < tokens.size(); ++i) {
+      args.push_back(std::stoll(tokens[i]));
+    }
+    const auto& cmd = tokens[0];
+    if (cmd == "band" && args.size() == 2) {
+      addBand(args[0], args[1]);
+    } else if (cmd == "frames" && args.size() == 2) {
+      addFrames(args[0], args[1]);
+    } else if (cmd == "region" && args.size() == 4) {
+      addRegion(args[0], args[1], args[2], args[3]);
+    } else if (cmd == "point" && args.size() == 2) {
+      addPoint(args[0], args[1]);
+    } else if (tokens.size() == 1) {
+      legacy.push_back(std::stoll(cmd));
+    } else {
+      LOG(FATAL) << "Invalid mask spec line " << lineNum << " in " << path
+                 << ": '" << line << "'";
+    }
+  }
+  if (legacy.size() % 2 != 0) {
+    LOG(FATAL) << "Odd number of coordinates in mask spec " << path;
+  }
+  for (size_t i = 0; i < legacy.size(); i += 2) {
+    addPoint(legacy[i + 1], legacy[i] / 2); // fft column, then frame
+  }
+  std::sort(points_.begin(), points_.end());
+  points_.erase(std::unique(points_.begin(), points_.end()), points_.end());
+}
+
+std::shared_ptr<SpectrogramMask> SpectrogramMask::get(const std::string& path) {
+  static std::mutex mutex;
+  static std::unordered_map<std::string, std::shared_ptr<SpectrogramMask>>
+      specs;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto& spec = specs[path];
+  if (!spec) {
+    spec = std::make_shared<SpectrogramMask>(path);
+  }
+  return spec;
+}
+
+void SpectrogramMask::addBand(int64_t k0, int64_t k1) {
+  addRegion(0, -1, k0, k1);
+}
+
+void SpectrogramMask::addFrames(int64_t t0, int64_t t1) {
+  addRegion(t0, t1, 0, -1);
+}
+
+void SpectrogramMask::addRegion(
+    int64_t t0,
+    int64_t t1,
+    int64_t k0,
+    int64_t k1) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  regions_.push_back({t0, t1, k0, k1});
+  cache_.clear();
+}
+
+void SpectrogramMask::addPoint(int64_t t, int64_t k) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  points_.emplace_back(t, k);
+  cache_.clear();
+}
+
+af::array SpectrogramMask::apply(const af::array& input) {
+  auto keep = mask(input.dims(0), input.dims(1));
+  if (input.dims(2) * input.dims(3) > 1) {
+    keep = af::tile(keep, 1, 1, input.dims(2), input.dims(3));
+  }
+  return input * keep;
+}
+
+af::array SpectrogramMask::mask(int64_t T, int64_t K) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto key = std::make_pair(T, K);
+  auto it = cache_.find(key);
+  if (it != cache_.end()) {
+    return it->second;
+  }
+  if (cache_.size() >= kMaxCachedMasks) {
+    cache_.clear();
+  }
+  auto keep = build(T, K);
+  cache_[key] = keep;
+  return keep;
+}
+
+int64_t SpectrogramMask::numMasked(int64_t T, int64_t K) {
+  return T * K - static_cast<int64_t>(af::sum<float>(mask(T, K)));
+}
+
+af::array SpectrogramMask::build(int64_t T, int64_t K) const {
+  auto keep = af::constant(1.0, T, K);
+  for (auto r : regions_) {
+    if (resolveRange(r.t0, r.t1, T) && resolveRange(r.k0, r.k1, K)) {
+      keep(af::seq(r.t0, r.t1), af::seq(r.k0, r.k1)) = 0.0;
+    }
+  }
+
+  std::vector<int> indices;
+  indices.reserve(points_.size());
+  for (const auto& p : points_) {
+    if (p.first >= 0 && p.first < T && p.second >= 0 && p.second < K) {
+      indices.push_back(p.first + p.second * T);
+    }
+  }
+  if (!indices.empty()) {
+    keep(af::array(indices.size(), indices.data())) = 0.0;
+  }
+
+  if (!bitmap_.isempty()) {
+    auto t = std::min<int64_t>(T, bitmap_.dims(0));
+    auto k = std::min<int64_t>(K, bitmap_.dims(1));
+    auto slice = keep(af::seq(t), af::seq(k));
+    keep(af::seq(t), af::seq(k)) =
+        slice * (1.0 - bitmap_(af::seq(t), af::seq(k)));
+  }
+  return keep;
+}
+
+} // namespace w2l
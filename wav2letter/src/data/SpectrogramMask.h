@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <arrayfire.h>
+
+namespace w2l {
+
+/**
+ * Set of time-frequency bins of a T x K feature map (frames x dims, as in
+ * kInputIdx) to be zeroed.
+ *
+ * A spec file is one of
+ *  - a `.npy` bitmap of shape (T, K) (numpy order); nonzero entries are
+ *    zeroed. Inputs longer than the bitmap are left untouched past T.
+ *  - a text file of directives, one per line, `#` starts a comment:
+ *      band <k0> <k1>              all frames, dims k0..k1
+ *      frames <t0> <t1>            all dims, frames t0..t1
+ *      region <t0> <t1> <k0> <k1>  rectangle
+ *      point <t> <k>               single bin
+ *    Ranges are inclusive; negative values count from the end (-1 is the
+ *    last frame / dim).
+ *  - the legacy coordinate list (50low.txt, zero.txt): bare integers on
+ *    alternating lines, fft column (2k or 2k+1) then frame.
+ *
+ * The spec is parsed once; `apply()` builds the 0/1 mask for a given T x K
+ * on the device (a few slice assignments plus one scatter for the points),
+ * caches it and masks the input with a single multiply.
+ */
+class SpectrogramMask {
+ public:
+  SpectrogramMask() = default;
+
+  // Parses a spec file, see above
+  explicit SpectrogramMask(const std::string& path);
+
+  /**
+   * Returns the parsed spec for `path`, loading it on first use. Safe to call
+   * from several threads.
+   */
+  static std::shared_ptr<SpectrogramMask> get(const std::string& path);
+
+  void addBand(int64_t k0, int64_t k1);
+  void addFrames(int64_t t0, int64_t t1);
+  void addRegion(int64_t t0, int64_t t1, int64_t k0, int64_t k1);
+  void addPoint(int64_t t, int64_t k);
+
+  // Multiplies `input` (T x K x C x B) by the mask for T x K
+  af::array apply(const af::array& input);
+
+  // 1 for kept bins, 0 for masked ones
+  af::array mask(int64_t T, int64_t K);
+
+  // Number of bins zeroed in a T x K map
+  int64_t numMasked(int64_t T, int64_t K);
+
+ private:
+  struct Region {
+    int64_t t0, t1, k0, k1; // inclusive, may be negative
+  };
+
+  af::array build(int64_t T, int64_t K) const;
+
+  std::vector<Region> regions_;
+  std::vector<std::pair<int64_t, int64_t>> points_; // (t, k)
+  af::array bitmap_; // T x K, 1 = masked
+
+  std::mutex mutex_;
+  std::map<std::pair<int64_t, int64_t>, af::array> cache_;
+};
+
+} // namespace w2l
@@ -0,0 +1,136 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "data/StagingBuffer.h"
+
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#include <arrayfire.h>
+
+namespace w2l {
+
+namespace {
+
+constexpr size_t kMinBlockBytes = 1 << 12;
+constexpr size_t kDefaultMaxCachedBytes = size_t(1) << 30;
+
+size_t blockSize(size_t bytes) {
+  size_t size = kMinBlockBytes;
+  while (size < bytes) {
+    size <<= 1;
+  }
+  return size;
+}
+
+} // namespace
+
+struct HostBufferPool::State {
+  std::mutex mutex;
+  std::unordered_map<size_t, std::vector<void*>> free; // by block size
+  size_t cachedBytes{0};
+  size_t maxCachedBytes;
+  bool pinned;
+  bool closed{false};
+
+  void* allocate(size_t size) {
+    if (pinned) {
+      return af::pinned(size, u8);
+    }
+    auto ptr = std::malloc(size);
+    if (!ptr) {
+      throw std::bad_alloc();
+    }
+    return ptr;
+  }
+
+  void deallocate(void* ptr) {
+    if (pinned) {
+      af::freePinned(ptr);
+    } else {
+      std::free(ptr);
+    }
+  }
+
+  void release(void* ptr, size_t size) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!closed && cachedBytes + size <= maxCachedBytes) {
+        free[size].push_back(ptr);
+        cachedBytes += size;
+        return;
+      }
+    }
+    deallocate(ptr);
+  }
+};
+
+HostBufferPool& HostBufferPool::get() {
+  static auto pool = new HostBufferPool(kDefaultMaxCachedBytes);
+  return *pool;
+}
+
+HostBufferPool::HostBufferPool(
+    size_t maxCachedBytes,
+    bool pinned /* = true */)
+    : state_(std::make_shared<State>()) {
+  state_->maxCachedBytes = maxCachedBytes;
+  state_->pinned = pinned;
+}
+
+HostBufferPool::~HostBufferPool() {
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->closed = true;
+  }
+  clear();
+}
+
+std::shared_ptr<void> HostBufferPool::acquire(size_t bytes) {
+  auto size = blockSize(bytes);
+  void* ptr = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    auto it = state_->free.find(size);
+    if (it != state_->free.end() && !it->second.empty()) {
+      ptr = it->second.back();
+      it->second.pop_back();
+      state_->cachedBytes -= size;
+    }
+  }
+  if (!ptr) {
+    ptr = state_->allocate(size);
+  }
+  auto state = state_;
+  return std::shared_ptr<void>(
+      ptr, [state, size](void* p) { state->release(p, size); });
+}
+
+size_t HostBufferPool::cachedBytes() const {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  return state_->cachedBytes;
+}
+
+void HostBufferPool::clear() {
+  std::unordered_map<size_t, std::vector<void*>> free;
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    free.swap(state_->free);
+    state_->cachedBytes = 0;
+  }
+  for (const auto& blocks : free) {
+    for (auto ptr : blocks.second) {
+      state_->deallocate(ptr);
+    }
+  }
+}
+
+} // namespace w2l
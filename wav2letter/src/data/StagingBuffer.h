@@ -0,0 +1,135 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+namespace w2l {
+
+/**
+ * Pool of page-locked (pinned) host blocks to assemble batches in.
+ *
+ * Host to device copies from pinned memory skip the staging copy the driver
+ * otherwise makes. Pinned allocations are slow, so blocks are kept once
+ * released and handed out again: sizes are rounded up to a power of 2 for
+ * batches of similar padded size to share blocks. At most `maxCachedBytes` of
+ * free blocks are kept, the others are freed on release.
+ */
+class HostBufferPool {
+ public:
+  // The pool featurize assembles batches in, never destroyed so that no
+  // pinned block is freed after ArrayFire shut down
+  static HostBufferPool& get();
+
+  explicit HostBufferPool(size_t maxCachedBytes, bool pinned = true);
+
+  // Blocks still in use are freed when they are released
+  ~HostBufferPool();
+
+  HostBufferPool(const HostBufferPool&) = delete;
+  HostBufferPool& operator=(const HostBufferPool&) = delete;
+
+  // A block of at least `bytes` bytes, back to the pool when the last copy of
+  // the pointer is released
+  std::shared_ptr<void> acquire(size_t bytes);
+
+  // Bytes held by free blocks
+  size_t cachedBytes() const;
+
+  // Free all the free blocks
+  void clear();
+
+ private:
+  struct State;
+  std::shared_ptr<State> state_;
+};
+
+// A fixed size array of T in a block of a HostBufferPool. Copies share the
+// block, which goes back to the pool with the last of them.
+template <typename T>
+class StagingBuffer {
+  static_assert(
+      std::is_trivially_copyable<T>::value,
+      "StagingBuffer holds raw memory");
+
+ public:
+  typedef T value_type;
+  typedef T* iterator;
+  typedef const T* const_iterator;
+  typedef size_t size_type;
+
+  StagingBuffer() {}
+
+  // Uninitialized
+  explicit StagingBuffer(
+      size_t size,
+      HostBufferPool& pool = HostBufferPool::get())
+      : size_(size) {
+    if (size_ > 0) {
+      block_ = pool.acquire(size_ * sizeof(T));
+    }
+  }
+
+  StagingBuffer(
+      size_t size,
+      const T& value,
+      HostBufferPool& pool = HostBufferPool::get())
+      : StagingBuffer(size, pool) {
+    std::fill(begin(), end(), value);
+  }
+
+  T* data() {
+    return static_cast<T*>(block_.get());
+  }
+
+  const T* data() const {
+    return static_cast<const T*>(block_.get());
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  T& operator[](size_t i) {
+    return data()[i];
+  }
+
+  const T& operator[](size_t i) const {
+    return data()[i];
+  }
+
+  T* begin() {
+    return data();
+  }
+
+  T* end() {
+    return data() + size_;
+  }
+
+  const T* begin() const {
+    return data();
+  }
+
+  const T* end() const {
+    return data() + size_;
+  }
+
+ private:
+  std::shared_ptr<void> block_;
+  size_t size_{0};
+};
+
+} // namespace w2l
@@ -8,8 +8,23 @@
 
 #include "data/Utils.h"
 
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "common/Defines.h"
+#include "common/Utils-base.h"
+
 namespace w2l {
 
+namespace {
+
+constexpr char kSampleIndexMagic[] = "W2LIDX01";
+
+} // namespace
+
 std::vector<int64_t> sortSamples(
     const std::vector<SpeechSampleMetaInfo>& samples,
     const std::string& dataorder,
@@ -102,4 +117,120 @@ void filterSamples(
   LOG(INFO) << "Filtered " << initialSize - samples.size() << "/" << initialSize
             << " samples";
 }
+
+std::string fileStateKey(const std::vector<std::string>& paths) {
+  std::ostringstream key;
+  for (const auto& path : paths) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+      return "";
+    }
+    key << path << " " << st.st_size << " " << st.st_mtime << "\n";
+  }
+  return key.str();
+}
+
+std::string indexCachePath(const std::string& source) {
+  if (FLAGS_indexcache.empty()) {
+    return "";
+  }
+  uint64_t h = 14695981039346656037ULL; // FNV-1a
+  for (unsigned char c : source) {
+    h = (h ^ c) * 1099511628211ULL;
+  }
+  char name[32];
+  snprintf(
+      name, sizeof(name), "%016llx.idx", static_cast<unsigned long long>(h));
+  return pathsConcat(FLAGS_indexcache, name);
+}
+
+bool loadSampleIndex(
+    const std::string& path,
+    const std::string& key,
+    std::vector<SpeechSampleMetaInfo>& samples) {
+  if (path.empty() || key.empty()) {
+    return false;
+  }
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  char magic[sizeof(kSampleIndexMagic) - 1];
+  uint64_t keySize = 0, nSamples = 0;
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char*>(&keySize), sizeof(keySize));
+  if (!file || std::string(magic, sizeof(magic)) != kSampleIndexMagic ||
+      keySize != key.size()) {
+    return false;
+  }
+  std::string savedKey(keySize, '\0');
+  file.read(&savedKey[0], keySize);
+  file.read(reinterpret_cast<char*>(&nSamples), sizeof(nSamples));
+  if (!file || savedKey != key) {
+    return false;
+  }
+  std::vector<double> durations(nSamples);
+  std::vector<int64_t> refLengths(nSamples), indices(nSamples);
+  file.read(
+      reinterpret_cast<char*>(durations.data()), nSamples * sizeof(double));
+  file.read(
+      reinterpret_cast<char*>(refLengths.data()), nSamples * sizeof(int64_t));
+  file.read(
+      reinterpret_cast<char*>(indices.data()), nSamples * sizeof(int64_t));
+  if (!file) {
+    LOG(WARNING) << "Truncated sample index " << path;
+    return false;
+  }
+  samples.clear();
+  samples.reserve(nSamples);
+  for (uint64_t i = 0; i < nSamples; ++i) {
+    samples.emplace_back(durations[i], refLengths[i], indices[i]);
+  }
+  return true;
+}
+
+void saveSampleIndex(
+    const std::string& path,
+    const std::string& key,
+    const std::vector<SpeechSampleMetaInfo>& samples) {
+  if (path.empty() || key.empty()) {
+    return;
+  }
+  uint64_t keySize = key.size(), nSamples = samples.size();
+  std::vector<double> durations;
+  std::vector<int64_t> refLengths, indices;
+  for (const auto& sample : samples) {
+    durations.push_back(sample.audiolength());
+    refLengths.push_back(sample.reflength());
+    indices.push_back(sample.index());
+  }
+  // written aside and renamed, concurrent readers never see a partial file
+  auto tmpPath = path + ".tmp" + std::to_string(::getpid());
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    file.write(kSampleIndexMagic, sizeof(kSampleIndexMagic) - 1);
+    file.write(reinterpret_cast<const char*>(&keySize), sizeof(keySize));
+    file.write(key.data(), keySize);
+    file.write(reinterpret_cast<const char*>(&nSamples), sizeof(nSamples));
+    file.write(
+        reinterpret_cast<const char*>(durations.data()),
+        nSamples * sizeof(double));
+    file.write(
+        reinterpret_cast<const char*>(refLengths.data()),
+        nSamples * sizeof(int64_t));
+    file.write(
+        reinterpret_cast<const char*>(indices.data()),
+        nSamples * sizeof(int64_t));
+    if (!file) {
+      LOG(WARNING) << "Could not write sample index " << tmpPath;
+      std::remove(tmpPath.c_str());
+      return;
+    }
+  }
+  if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    LOG(WARNING) << "Could not move sample index to " << path;
+    std::remove(tmpPath.c_str());
+  }
+}
+
 } // namespace w2l
@@ -43,48 +43,6 @@ class SpeechSampleMetaInfo {
   }
 };
 
-// Helper class used to store data in W2lListFilesDataset
-class SpeechSample {
- private:
-  std::string sampleId_; // utterance id
-  std::string audioFilePath_; // full path to audio file
-  std::vector<std::string> transcript_; // word transcripts
-
- public:
-  SpeechSample() {}
-
-  SpeechSample(
-      std::string sampleId,
-      std::string audioFile,
-      std::vector<std::string> trans)
-      : sampleId_(sampleId),
-        audioFilePath_(audioFile),
-        transcript_(std::move(trans)) {}
-
-  std::string getSampleId() const {
-    return sampleId_;
-  }
-
-  std::string getAudioFile() const {
-    return audioFilePath_;
-  }
-
-  int64_t numWords() const {
-    return transcript_.size();
-  }
-
-  std::vector<std::string> getTranscript() const {
-    return transcript_;
-  }
-
-  std::string getTranscript(int64_t id) const {
-    if (id >= transcript_.size()) {
-      throw std::out_of_range("getTranscript idx out of range");
-    }
-    return transcript_[id];
-  }
-};
-
 std::vector<int64_t> sortSamples(
     const std::vector<SpeechSampleMetaInfo>& samples,
     const std::string& dataorder,
@@ -98,4 +56,23 @@ void filterSamples(
     const int64_t minTargetSz,
     const int64_t maxTargetSz);
 
+// "path size mtime" of every file, used to tell whether an index built from
+// them is still valid; empty if one of them cannot be stat'ed
+std::string fileStateKey(const std::vector<std::string>& paths);
+
+// Path of the index cache of `source` (any description of a data source)
+// in FLAGS_indexcache, empty if caching is disabled
+std::string indexCachePath(const std::string& source);
+
+// Sample metadata saved along with `key`. load returns false if there is no
+// cache at `path`, it is unreadable or it was saved with a different key.
+bool loadSampleIndex(
+    const std::string& path,
+    const std::string& key,
+    std::vector<SpeechSampleMetaInfo>& samples);
+void saveSampleIndex(
+    const std::string& path,
+    const std::string& key,
+    const std::vector<SpeechSampleMetaInfo>& samples);
+
 } // namespace w2l
@@ -8,12 +8,16 @@
 
 #include "W2lDataset.h"
 
+#include <algorithm>
 #include <functional>
 #include <numeric>
+#include <random>
+#include <sstream>
 
 #include <glog/logging.h>
 
 #include "common/Defines.h"
+#include "common/Trace.h"
 #include "common/Utils.h"
 
 namespace w2l {
@@ -41,6 +45,8 @@ int64_t W2lDataset::size() const {
 //get a sample input
 std::vector<af::array> W2lDataset::get(const int64_t idx) const {
   checkIndexBounds(idx);
+  W2L_TRACE_SCOPE("data/get");
+  cursor_ = idx + 1;
 
   W2lFeatureData feat;
   if (FLAGS_nthread > 0) {
@@ -48,13 +54,16 @@ std::vector<af::array> W2lDataset::get(const int64_t idx) const {
   } else {
     feat = getFeatureData(idx);
   }
+  // The arrays are copied from the pinned buffers of feat, which go back to
+  // the pool on return
+  W2L_TRACE_SCOPE("data/h2d");
   std::vector<af::array> result(kNumDataIdx);
   result[kInputIdx] = feat.input.empty()
       ? af::array(feat.inputDims)
       : af::array(feat.inputDims, feat.input.data());
   for (const auto& target : feat.targets) {
     auto targetType = target.first;
-    auto targetData = target.second;
+    const auto& targetData = target.second;
     auto targetDims = feat.targetDims[targetType];
     result[targetType] = targetData.empty()
         ? af::array(targetDims)
@@ -64,19 +73,26 @@ std::vector<af::array> W2lDataset::get(const int64_t idx) const {
       ? af::array(feat.sampleIdsDims)
       : af::array(feat.sampleIdsDims, feat.sampleIds.data());
 
+  // empty unless FLAGS_powfft
   result[kFftIdx] = feat.inputFft.empty()
-    ? af::array(feat.fftDims)
-    : af::array(feat.fftDims, feat.inputFft.data());
+      ? af::array(feat.fftDims)
+      : af::array(feat.fftDims, feat.inputFft.data());
   return result;
 }
 
 int64_t W2lDataset::getGlobalBatchIdx(const int64_t idx) {
-  return sampleBatches_[idx][0] / (worldSize_ * batchSize_);
+  return packer_->globalBatchIdx(sampleBatches_[idx][0]);
 }
 
 W2lFeatureData W2lDataset::getFeatureData(const int64_t idx) const {
-  auto ldData = getLoaderData(idx);
-  return featurize(ldData, dicts_);
+  std::vector<W2lLoaderData> ldData;
+  {
+    W2L_TRACE_SCOPE("data/load");
+    ldData = getLoaderData(idx);
+  }
+  auto seed = augmentationSeed(
+      augmentationSeed(augmentationSeed(FLAGS_seed, seed_), epoch_), idx);
+  return featurize(ldData, dicts_, augmentation_, seed);
 }
 
 W2lFeatureData W2lDataset::getFeatureDataAndPrefetch(const int64_t idx) const {
@@ -84,6 +100,7 @@ W2lFeatureData W2lDataset::getFeatureDataAndPrefetch(const int64_t idx) const {
   // check cache
   auto cachedata = prefetchCache_.find(idx);
   if (cachedata != prefetchCache_.end()) {
+    W2L_TRACE_SCOPE("data/wait");
     feat = cachedata->second.get();
     prefetchCache_.erase(idx);
   } else {
@@ -115,10 +132,132 @@ W2lFeatureData W2lDataset::getFeatureDataAndPrefetch(const int64_t idx) const {
 
 void W2lDataset::shuffle(int seed) {
   prefetchCache_.clear();
-  RoundRobinBatchPacker shuffler(batchSize_, worldSize_, worldRank_);
+  seed_ = seed;
+  cursor_ = 0;
+  if (!packer_) {
+    if (FLAGS_batchframes > 0) {
+      if (static_cast<int64_t>(sampleSizes_.size()) != sampleCount_) {
+        LOG(FATAL) << "--batchframes needs the sample sizes of the dataset";
+      }
+      packer_ = std::make_shared<TokenBudgetBatchPacker>(
+          sampleSizes_, FLAGS_batchframes, batchSize_, worldSize_, worldRank_);
+    } else {
+      packer_ = std::make_shared<RoundRobinBatchPacker>(
+          batchSize_, worldSize_, worldRank_);
+    }
+  }
   // We shuffle such that calling `get(idx)` from different mpi jobs with same
   // `idx` would return similar length samples
-  sampleBatches_ = shuffler.getBatches(sampleCount_, seed);
+  sampleBatches_ = packer_->getBatches(sampleCount_, seed);
+}
+
+void W2lDataset::setAugmentation(const AugmentationOptions& augmentation) {
+  prefetchCache_.clear(); // loaded without it
+  augmentation_ = augmentation;
+}
+
+void W2lDataset::setEpoch(int64_t epoch) {
+  if (epoch == epoch_) {
+    return;
+  }
+  if (augmentation_.enabled()) {
+    prefetchCache_.clear(); // augmented for the previous epoch
+  }
+  epoch_ = epoch;
+}
+
+W2lDataLoaderState W2lDataset::getState() const {
+  W2lDataLoaderState state;
+  state.epoch = epoch_;
+  state.seed = seed_;
+  state.numBatches = size();
+  state.cursor = cursor_;
+  for (const auto& it : prefetchCache_) {
+    state.prefetch.push_back(it.first);
+  }
+  std::sort(state.prefetch.begin(), state.prefetch.end());
+  return state;
+}
+
+void W2lDataset::setState(const W2lDataLoaderState& state) {
+  shuffle(state.seed);
+  epoch_ = state.epoch;
+  if (state.numBatches != size()) {
+    LOG(WARNING) << "Dataset has " << size() << " batches instead of "
+                 << state.numBatches << ", restarting the epoch";
+    return;
+  }
+  cursor_ = state.cursor;
+  if (FLAGS_nthread <= 0) {
+    return;
+  }
+  // same as the prefetching of get(cursor - 1)
+  for (auto i : state.prefetch) {
+    if (i >= cursor_ && i <= cursor_ + FLAGS_nthread && i < size()) {
+      prefetchCache_.emplace(
+          i,
+          threadpool_->enqueue(
+              [this](int64_t j) { return this->getFeatureData(j); }, i));
+    }
+  }
+}
+
+std::string W2lDataLoaderState::toString() const {
+  std::ostringstream ss;
+  ss << epoch << " " << seed << " " << numBatches << " " << cursor;
+  for (auto i : prefetch) {
+    ss << " " << i;
+  }
+  return ss.str();
+}
+
+W2lDataLoaderState W2lDataLoaderState::fromString(const std::string& str) {
+  W2lDataLoaderState state;
+  std::istringstream ss(str);
+  if (!(ss >> state.epoch >> state.seed >> state.numBatches >> state.cursor)) {
+    LOG(FATAL) << "Invalid data loader state '" << str << "'";
+  }
+  int64_t i;
+  while (ss >> i) {
+    state.prefetch.push_back(i);
+  }
+  if (!ss.eof()) {
+    LOG(FATAL) << "Invalid data loader state '" << str << "'";
+  }
+  return state;
+}
+
+double W2lDataset::paddingEfficiency() const {
+  if (sampleSizes_.empty()) {
+    return 1.0;
+  }
+  double real = 0, padded = 0;
+  for (const auto& batch : sampleBatches_) {
+    double maxSize = 0;
+    for (auto i : batch) {
+      real += sampleSizes_[i];
+      maxSize = std::max(maxSize, sampleSizes_[i]);
+    }
+    padded += maxSize * batch.size();
+  }
+  return padded > 0 ? real / padded : 1.0;
+}
+
+void W2lDataset::setSampleSizes(
+    const std::vector<SpeechSampleMetaInfo>& samples,
+    const std::vector<int64_t>& order) {
+  int64_t maxIdx = -1;
+  for (const auto& sample : samples) {
+    maxIdx = std::max(maxIdx, sample.index());
+  }
+  std::vector<double> sizeOf(maxIdx + 1, 0.0);
+  for (const auto& sample : samples) {
+    sizeOf[sample.index()] = sample.audiolength();
+  }
+  sampleSizes_.resize(order.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    sampleSizes_[i] = sizeOf[order[i]];
+  }
 }
 
 std::vector<std::vector<int64_t>> RoundRobinBatchPacker::getBatches(
@@ -170,4 +309,76 @@ std::vector<std::vector<int64_t>> RoundRobinBatchPacker::getBatches(
   return batches;
 }
 
+int64_t RoundRobinBatchPacker::globalBatchIdx(int64_t sample) const {
+  return sample / (worldSize_ * batchSize_);
+}
+
+TokenBudgetBatchPacker::TokenBudgetBatchPacker(
+    const std::vector<double>& sampleSizes,
+    double maxBatchFrames,
+    int64_t maxBatchSize,
+    int64_t worldSize,
+    int64_t worldRank)
+    : worldSize_(worldSize), worldRank_(worldRank) {
+  int64_t nSamples = sampleSizes.size();
+  auto maxOf = [&sampleSizes](int64_t begin, int64_t end) {
+    return *std::max_element(
+        sampleSizes.begin() + begin, sampleSizes.begin() + end);
+  };
+  // Global batches grow by one sample per process at a time, the padded size
+  // of the batch of every process is bounded by the largest input of the
+  // global batch. Fewer than worldSize samples left over are dropped.
+  int64_t start = 0;
+  while (nSamples - start >= worldSize_) {
+    int64_t end = start + worldSize_;
+    double maxSize = maxOf(start, end);
+    int64_t perProcess = 1;
+    while (end + worldSize_ <= nSamples &&
+           (maxBatchSize <= 0 || perProcess < maxBatchSize)) {
+      double size = std::max(maxSize, maxOf(end, end + worldSize_));
+      if ((perProcess + 1) * size > maxBatchFrames) {
+        break;
+      }
+      maxSize = size;
+      end += worldSize_;
+      ++perProcess;
+    }
+    starts_.push_back(start);
+    start = end;
+  }
+  starts_.push_back(start);
+}
+
+std::vector<std::vector<int64_t>> TokenBudgetBatchPacker::getBatches(
+    int64_t nSamples,
+    int64_t seed) const {
+  if (nSamples < starts_.back()) {
+    LOG(FATAL) << "TokenBudgetBatchPacker: built for more samples than "
+               << nSamples;
+  }
+  int64_t nGlobalBatches = starts_.size() - 1;
+  std::vector<int64_t> globalBatchIdx(nGlobalBatches);
+  std::iota(globalBatchIdx.begin(), globalBatchIdx.end(), 0);
+
+  if (seed >= 0) {
+    auto rng = std::default_random_engine(seed);
+    std::shuffle(globalBatchIdx.begin(), globalBatchIdx.end(), rng);
+  }
+
+  std::vector<std::vector<int64_t>> batches(nGlobalBatches);
+  for (int64_t i = 0; i < nGlobalBatches; i++) {
+    auto begin = starts_[globalBatchIdx[i]];
+    auto perProcess = (starts_[globalBatchIdx[i] + 1] - begin) / worldSize_;
+    batches[i].resize(perProcess);
+    std::iota(
+        batches[i].begin(), batches[i].end(), begin + perProcess * worldRank_);
+  }
+  return batches;
+}
+
+int64_t TokenBudgetBatchPacker::globalBatchIdx(int64_t sample) const {
+  return std::upper_bound(starts_.begin(), starts_.end(), sample) -
+      starts_.begin() - 1;
+}
+
 } // namespace w2l
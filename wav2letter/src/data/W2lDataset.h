@@ -8,17 +8,39 @@
 
 #pragma once
 
+#include <memory>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
 #include <flashlight/flashlight.h>
 
 #include "common/Dictionary.h"
+#include "data/Augmentation.h"
 #include "data/Featurize.h"
 #include "data/NumberedFilesLoader.h"
+#include "data/Utils.h"
 
 namespace w2l {
 
+class BatchPacker;
+
+// Position of the data pipeline, to be saved with a model so that a preempted
+// run can resume within its epoch, see W2lDataset::getState()
+struct W2lDataLoaderState {
+  int64_t epoch{0}; // as set by the training loop
+  int64_t seed{-1}; // of the last shuffle
+  int64_t numBatches{0}; // to detect a change of the dataset
+  int64_t cursor{0}; // next batch to read
+  std::vector<int64_t> prefetch; // batches being loaded in the background
+
+  W2lDataLoaderState() {}
+
+  // "epoch seed numBatches cursor prefetch...", space separated
+  std::string toString() const;
+  static W2lDataLoaderState fromString(const std::string& str);
+};
+
 class W2lDataset : public fl::Dataset {
  public:
   W2lDataset(
@@ -44,7 +66,37 @@ class W2lDataset : public fl::Dataset {
 
   void shuffle(int seed);
 
+  // The epoch of the training loop, part of the augmentation seeds so that
+  // every epoch draws new augmentations
+  void setEpoch(int64_t epoch);
+
+  // The epoch, the seed of the last shuffle, the batch after the last one
+  // read with get() and the batches being prefetched
+  W2lDataLoaderState getState() const;
+
+  // Shuffles with the saved seed and starts prefetching the saved batches, so
+  // that get(state.cursor) finds its batch loaded or in flight. The earlier
+  // batches of the epoch are not read again. If the number of batches
+  // changed, the epoch restarts at batch 0.
+  void setState(const W2lDataLoaderState& state);
+
+  // Augment the batches in featurize, see AugmentationOptions. Each batch
+  // draws from streams seeded by FLAGS_seed, the last shuffle, the epoch and
+  // its index, so a batch is augmented the same way whichever thread loads
+  // it.
+  void setAugmentation(const AugmentationOptions& augmentation);
+
+  // Input size of the samples of this process over the padded input size of
+  // their batches, i.e. the fraction of featurized input which is not padding
+  double paddingEfficiency() const;
+
  protected:
+  // Records the input size of every sample, `order` being the sorted sample
+  // ids (see sortSamples). Needed by FLAGS_batchframes, call before shuffle.
+  void setSampleSizes(
+      const std::vector<SpeechSampleMetaInfo>& samples,
+      const std::vector<int64_t>& order);
+
   DictionaryMap dicts_;
 
   int64_t sampleCount_; // Num individual samples in the dataset before batching
@@ -60,6 +112,13 @@ class W2lDataset : public fl::Dataset {
       prefetchCache_;
 
   std::vector<std::vector<int64_t>> sampleBatches_;
+  int64_t seed_{-1};
+  int64_t epoch_{0};
+  AugmentationOptions augmentation_;
+  mutable int64_t cursor_{0};
+
+  std::vector<double> sampleSizes_; // in sorted order
+  std::shared_ptr<BatchPacker> packer_;
 };
 
 // Abstract class which defines an interface to pack samples
@@ -70,6 +129,10 @@ class BatchPacker {
   virtual std::vector<std::vector<int64_t>> getBatches(
       int64_t numSamples,
       int64_t seed) const = 0;
+
+  // Position, in the unshuffled order, of the global batch (the batches of
+  // all processes for one iteration) holding `sample`
+  virtual int64_t globalBatchIdx(int64_t sample) const = 0;
 };
 
 // Implementation which packs the samples into batches in Round Robin
@@ -84,9 +147,43 @@ class RoundRobinBatchPacker : public BatchPacker {
       int64_t numSamples,
       int64_t seed) const override;
 
+  virtual int64_t globalBatchIdx(int64_t sample) const override;
+
  private:
   int64_t batchSize_;
   int64_t worldSize_;
   int64_t worldRank_;
 };
+
+// Implementation which packs consecutive samples into batches of varying
+// size: a batch grows while (number of samples) x (largest input size) stays
+// within `maxBatchFrames`, the padded size featurize allocates for it, and
+// holds at most `maxBatchSize` samples (no limit if <= 0). Each global batch
+// gives the same number of samples to every process so that they stay in
+// lockstep. With sorted samples, batches of short inputs get large and
+// batches of long inputs small.
+class TokenBudgetBatchPacker : public BatchPacker {
+ public:
+  // `sampleSizes[i]` is the input size of sample i, a sample larger than the
+  // budget gets a batch of its own
+  TokenBudgetBatchPacker(
+      const std::vector<double>& sampleSizes,
+      double maxBatchFrames,
+      int64_t maxBatchSize,
+      int64_t worldSize,
+      int64_t worldRank);
+
+  // Use seed < 0, for no shuffling of the batches
+  virtual std::vector<std::vector<int64_t>> getBatches(
+      int64_t numSamples,
+      int64_t seed) const override;
+
+  virtual int64_t globalBatchIdx(int64_t sample) const override;
+
+ private:
+  int64_t worldSize_;
+  int64_t worldRank_;
+  // first sample of every global batch, then the end of the last one
+  std::vector<int64_t> starts_;
+};
 } // namespace w2l
@@ -7,6 +7,8 @@
  */
 
 #include <glog/logging.h>
+#include <algorithm>
+#include <fstream>
 #include <functional>
 #include <numeric>
 
@@ -25,14 +27,23 @@ W2lListFilesDataset::W2lListFilesDataset(
     bool fallback2Ltr /* = false */,
     bool skipUnk /* = false */)
     : W2lDataset(dicts, batchSize, worldRank, worldSize),
-      lexicon_(lexicon),
       fallback2Ltr_(fallback2Ltr),
-      skipUnk_(skipUnk) {
+      skipUnk_(skipUnk),
+      stringOffsets_(1, 0),
+      targetOffsets_(1, 0),
+      wordOffsets_(1, 0),
+      transcriptOffsets_(1, 0) {
   includeWrd_ = (dicts.find(kWordIdx) != dicts.end());
 
   LOG_IF(FATAL, dicts.find(kTargetIdx) == dicts.end())
       << "Target dictionary does not exist";
 
+  const auto& tokenDict = dicts_.at(kTargetIdx);
+  lexicon_ = std::make_shared<CompiledLexicon>(lexicon, tokenDict);
+  separatorIdx_ = tokenDict.contains(FLAGS_wordseparator)
+      ? tokenDict.getIndex(FLAGS_wordseparator)
+      : -1;
+
   auto filesVec = split(',', filenames);
   std::vector<SpeechSampleMetaInfo> speechSamplesMetaInfo;
   for (const auto& f : filesVec) {
@@ -55,6 +66,7 @@ W2lListFilesDataset::W2lListFilesDataset(
       FLAGS_dataorder,
       FLAGS_inputbinsize,
       FLAGS_outputbinsize);
+  setSampleSizes(speechSamplesMetaInfo, sampleSizeOrder_);
 
   shuffle(-1);
   LOG(INFO) << "Total batches (i.e. iters): " << sampleBatches_.size();
@@ -64,28 +76,53 @@ W2lListFilesDataset::~W2lListFilesDataset() {
   threadpool_ = nullptr; // join all threads
 }
 
+int64_t W2lListFilesDataset::numSamples() const {
+  return targetOffsets_.size() - 1;
+}
+
 std::vector<W2lLoaderData> W2lListFilesDataset::getLoaderData(
     const int64_t idx) const {
+  auto str = [this](int64_t k) {
+    return strings_.substr(
+        stringOffsets_[k], stringOffsets_[k + 1] - stringOffsets_[k]);
+  };
   std::vector<W2lLoaderData> data(sampleBatches_[idx].size(), W2lLoaderData());
   for (int64_t id = 0; id < sampleBatches_[idx].size(); ++id) {
     auto i = sampleSizeOrder_[sampleBatches_[idx][id]];
 
-    if (!(i >= 0 && i < data_.size())) {
+    if (!(i >= 0 && i < numSamples())) {
       throw std::out_of_range(
           "W2lListFilesDataset::getLoaderData idx out of range");
     }
 
-    data[id].sampleId = data_[i].getSampleId();
-    data[id].input = speech::loadSound<float>(data_[i].getAudioFile().c_str());
-    data[id].targets[kTargetIdx] = wrd2Target(
-        data_[i].getTranscript(),
-        lexicon_,
-        dicts_.at(kTargetIdx),
-        fallback2Ltr_,
-        skipUnk_);
+    data[id].sampleId = str(2 * i);
+    data[id].input = speech::loadSound<float>(str(2 * i + 1).c_str());
+
+    auto& target = data[id].targetIndices[kTargetIdx];
+    if (FLAGS_sampletarget > 0 &&
+        transcriptOffsets_[i + 1] > transcriptOffsets_[i]) {
+      std::vector<IndexSpan> spellings;
+      for (auto w = transcriptOffsets_[i]; w < transcriptOffsets_[i + 1];
+           ++w) {
+        const auto& word = transcriptWords_[w];
+        if (word.lexiconId >= 0) {
+          spellings.push_back(lexicon_->sampleSpelling(word.lexiconId));
+        } else {
+          spellings.emplace_back(
+              letters_.data() + word.begin, word.end - word.begin);
+        }
+      }
+      target = joinSpellings(spellings, *lexicon_, &separatorIdx_);
+    } else {
+      target.emplace_back(
+          targets_.data() + targetOffsets_[i],
+          targetOffsets_[i + 1] - targetOffsets_[i]);
+    }
 
     if (includeWrd_) {
-      data[id].targets[kWordIdx] = data_[i].getTranscript();
+      data[id].targetIndices[kWordIdx].emplace_back(
+          words_.data() + wordOffsets_[i],
+          wordOffsets_[i + 1] - wordOffsets_[i]);
     }
   }
   return data;
@@ -93,45 +130,180 @@ std::vector<W2lLoaderData> W2lListFilesDataset::getLoaderData(
 
 std::vector<SpeechSampleMetaInfo> W2lListFilesDataset::loadListFile(
     const std::string& filename) {
-  std::ifstream infile(filename);
+  std::ifstream infile(filename, std::ios::binary);
 
   LOG_IF(FATAL, !infile) << "Could not read file '" << filename << "'";
 
+  std::string content;
+  infile.seekg(0, std::ios::end);
+  content.resize(infile.tellg());
+  infile.seekg(0, std::ios::beg);
+  infile.read(&content[0], content.size());
+  LOG_IF(FATAL, !infile) << "Could not read file '" << filename << "'";
+
+  // chunks of about 1MB, cut after a newline
+  std::vector<size_t> bounds = {0};
+  size_t nChunks = content.size() / (1 << 20) + 1;
+  for (size_t c = 1; c < nChunks; ++c) {
+    auto from = std::max(bounds.back(), c * content.size() / nChunks);
+    auto pos = content.find('\n', from);
+    if (pos == std::string::npos) {
+      break;
+    }
+    bounds.push_back(pos + 1);
+  }
+  bounds.push_back(content.size());
+
+  std::vector<ListChunk> chunks(bounds.size() - 1);
+#pragma omp parallel for schedule(dynamic)
+  for (int64_t c = 0; c < static_cast<int64_t>(chunks.size()); ++c) {
+    parseListLines(
+        content.data() + bounds[c], content.data() + bounds[c + 1], chunks[c]);
+  }
+
+  int64_t firstIdx = numSamples();
+  int64_t idx = firstIdx;
+  std::vector<SpeechSampleMetaInfo> samplesMetaInfo;
+  for (auto& chunk : chunks) {
+    auto stringBase = strings_.size();
+    strings_ += chunk.strings;
+    for (auto end : chunk.stringEnds) {
+      stringOffsets_.push_back(stringBase + end);
+    }
+    auto letterBase = static_cast<int64_t>(letters_.size());
+    letters_.insert(letters_.end(), chunk.letters.begin(), chunk.letters.end());
+    auto transcriptBase = transcriptWords_.size();
+    for (auto word : chunk.transcriptWords) {
+      if (word.lexiconId < 0) {
+        word.begin += letterBase;
+        word.end += letterBase;
+      }
+      transcriptWords_.push_back(word);
+    }
+    for (auto end : chunk.transcriptEnds) {
+      transcriptOffsets_.push_back(transcriptBase + end);
+    }
+    auto wordBase = words_.size();
+    words_.insert(words_.end(), chunk.words.begin(), chunk.words.end());
+    for (auto end : chunk.wordEnds) {
+      wordOffsets_.push_back(wordBase + end);
+    }
+    auto targetBase = targets_.size();
+    targets_.insert(targets_.end(), chunk.targets.begin(), chunk.targets.end());
+    int64_t targetBegin = 0;
+    for (size_t i = 0; i < chunk.targetEnds.size(); ++i) {
+      targetOffsets_.push_back(targetBase + chunk.targetEnds[i]);
+      samplesMetaInfo.emplace_back(SpeechSampleMetaInfo(
+          chunk.durations[i], chunk.targetEnds[i] - targetBegin, idx++));
+      targetBegin = chunk.targetEnds[i];
+    }
+    chunk = ListChunk();
+  }
+
+  auto cachePath = indexCachePath("list " + filename);
+  auto key = fileStateKey({filename});
+  std::vector<SpeechSampleMetaInfo> checked;
+  if (loadSampleIndex(cachePath, key, checked) &&
+      checked.size() == samplesMetaInfo.size()) {
+    LOG(INFO) << "Audio files of " << filename << " already checked, see "
+              << cachePath;
+  } else {
+    std::vector<char> found(samplesMetaInfo.size());
+#pragma omp parallel for schedule(dynamic, 256)
+    for (int64_t i = 0; i < static_cast<int64_t>(found.size()); ++i) {
+      auto k = 2 * (firstIdx + i) + 1;
+      found[i] = fileExists(strings_.substr(
+          stringOffsets_[k], stringOffsets_[k + 1] - stringOffsets_[k]));
+    }
+    for (size_t i = 0; i < found.size(); ++i) {
+      auto k = 2 * (firstIdx + i) + 1;
+      LOG_IF(FATAL, !found[i])
+          << "No file found - "
+          << strings_.substr(
+                 stringOffsets_[k], stringOffsets_[k + 1] - stringOffsets_[k]);
+    }
+    saveSampleIndex(cachePath, key, samplesMetaInfo);
+  }
+
+  LOG(INFO) << samplesMetaInfo.size() << " files found. ";
+
+  return samplesMetaInfo;
+}
+
+void W2lListFilesDataset::parseListLines(
+    const char* begin,
+    const char* end,
+    ListChunk& chunk) const {
+  const auto& tokenDict = dicts_.at(kTargetIdx);
+
   // The format of the list: columns should be space-separated
   // [utterance id] [audio file (full path)] [audio length] [word transcripts]
-  std::string line;
-  std::vector<SpeechSampleMetaInfo> samplesMetaInfo;
-  auto curDataSize = data_.size();
-  int64_t idx = curDataSize;
-  while (std::getline(infile, line)) {
+  std::vector<IndexSpan> spellings;
+  std::vector<TranscriptWord> transcript;
+  while (begin < end) {
+    auto lineEnd = std::find(begin, end, '\n');
+    std::string line(begin, lineEnd);
+    begin = lineEnd == end ? end : lineEnd + 1;
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
     auto tokens = splitOnWhitespace(line, true);
+    if (tokens.empty() && lineEnd == end) {
+      break; // no newline at the end of the file
+    }
 
     LOG_IF(FATAL, tokens.size() < 3) << "Cannot parse " << line;
 
-    // check if audio file exists
-    LOG_IF(FATAL, !fileExists(tokens[1])) << "No file found - " << tokens[1];
+    chunk.strings += tokens[0];
+    chunk.stringEnds.push_back(chunk.strings.size());
+    chunk.strings += tokens[1];
+    chunk.stringEnds.push_back(chunk.strings.size());
 
-    data_.emplace_back(SpeechSample(
-        tokens[0],
-        tokens[1],
-        std::vector<std::string>(tokens.begin() + 3, tokens.end())));
-
-    auto audioLength = std::stod(tokens[2]);
-    auto targets = wrd2Target(
-        data_.back().getTranscript(),
-        lexicon_,
-        dicts_.at(kTargetIdx),
-        fallback2Ltr_,
-        skipUnk_);
+    // letters may grow while the words are looked up, spans are taken after
+    spellings.clear();
+    transcript.clear();
+    bool canSample = false;
+    for (auto w = tokens.begin() + 3; w != tokens.end(); ++w) {
+      auto id = lexicon_->findTargetWord(*w);
+      if (id >= 0) {
+        transcript.push_back({id, 0, 0});
+        canSample = canSample || lexicon_->numSpellings(id) > 1;
+      } else {
+        auto wordBegin = chunk.letters.size();
+        auto ltrs = unknownWordTarget(*w, tokenDict, fallback2Ltr_, skipUnk_);
+        chunk.letters.insert(chunk.letters.end(), ltrs.begin(), ltrs.end());
+        transcript.push_back({-1,
+                              static_cast<int64_t>(wordBegin),
+                              static_cast<int64_t>(chunk.letters.size())});
+      }
+    }
+    for (const auto& word : transcript) {
+      spellings.push_back(
+          word.lexiconId >= 0
+              ? lexicon_->spelling(word.lexiconId, 0)
+              : IndexSpan(
+                    chunk.letters.data() + word.begin,
+                    word.end - word.begin));
+    }
+    for (const auto& span :
+         joinSpellings(spellings, *lexicon_, &separatorIdx_)) {
+      chunk.targets.insert(chunk.targets.end(), span.begin(), span.end());
+    }
+    chunk.targetEnds.push_back(chunk.targets.size());
+    if (canSample) {
+      chunk.transcriptWords.insert(
+          chunk.transcriptWords.end(), transcript.begin(), transcript.end());
+    }
+    chunk.transcriptEnds.push_back(chunk.transcriptWords.size());
 
-    samplesMetaInfo.emplace_back(
-        SpeechSampleMetaInfo(audioLength, targets.size(), idx));
+    if (includeWrd_) {
+      auto words = dicts_.at(kWordIdx).mapTokensToIndices(
+          std::vector<std::string>(tokens.begin() + 3, tokens.end()));
+      chunk.words.insert(chunk.words.end(), words.begin(), words.end());
+    }
+    chunk.wordEnds.push_back(chunk.words.size());
 
-    ++idx;
+    chunk.durations.push_back(std::stod(tokens[2]));
   }
-
-  LOG(INFO) << samplesMetaInfo.size() << " files found. ";
-
-  return samplesMetaInfo;
 }
 } // namespace w2l
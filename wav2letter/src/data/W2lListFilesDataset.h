@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include "common/CompiledLexicon.h"
 #include "common/Utils.h"
 #include "data/Utils.h"
 #include "data/W2lDataset.h"
@@ -32,13 +33,62 @@ class W2lListFilesDataset : public W2lDataset {
       const int64_t idx) const override;
 
  private:
+  // A word of a transcript: a lexicon id, or -1 and a range of letters_
+  struct TranscriptWord {
+    int64_t lexiconId;
+    int64_t begin;
+    int64_t end;
+  };
+
   std::vector<int64_t> sampleSizeOrder_;
-  std::vector<SpeechSample> data_;
-  LexiconMap lexicon_;
+  std::shared_ptr<CompiledLexicon> lexicon_;
+  int separatorIdx_;
   bool includeWrd_;
   bool fallback2Ltr_;
   bool skipUnk_;
 
+  // Everything is stored at load time, indexed by the position of the sample
+  // in the list files. Sample i has the id and audio path in
+  // strings_[stringOffsets_[2i], stringOffsets_[2i + 1]) and
+  // [stringOffsets_[2i + 1], stringOffsets_[2i + 2]) ...
+  std::string strings_;
+  std::vector<int64_t> stringOffsets_;
+  // ... its target, using the first spelling of each word, and word indices
+  // in the same way ...
+  std::vector<int> targets_;
+  std::vector<int64_t> targetOffsets_;
+  std::vector<int> words_;
+  std::vector<int64_t> wordOffsets_;
+  // ... and, if one of its words has several spellings to sample from with
+  // FLAGS_sampletarget, all of its words in
+  // transcriptWords_[transcriptOffsets_[i], transcriptOffsets_[i + 1])
+  std::vector<TranscriptWord> transcriptWords_;
+  std::vector<int64_t> transcriptOffsets_;
+  std::vector<int> letters_;
+
+  // Samples of a range of lines of a list file, stored as above but with
+  // end offsets relative to the chunk
+  struct ListChunk {
+    std::string strings;
+    std::vector<int64_t> stringEnds;
+    std::vector<int> targets;
+    std::vector<int64_t> targetEnds;
+    std::vector<int> words;
+    std::vector<int64_t> wordEnds;
+    std::vector<TranscriptWord> transcriptWords;
+    std::vector<int64_t> transcriptEnds;
+    std::vector<int> letters;
+    std::vector<double> durations;
+  };
+
+  int64_t numSamples() const;
+
+  // Parses the list in chunks on all threads, and checks that the audio
+  // files exist unless FLAGS_indexcache shows it was done for this version
+  // of the list
   std::vector<SpeechSampleMetaInfo> loadListFile(const std::string& filename);
+
+  void parseListLines(const char* begin, const char* end, ListChunk& chunk)
+      const;
 };
 } // namespace w2l
@@ -53,6 +53,7 @@ W2lNumberedFilesDataset::W2lNumberedFilesDataset(
       FLAGS_dataorder,
       FLAGS_inputbinsize,
       FLAGS_outputbinsize);
+  setSampleSizes(speechSamplesMetaInfo, sampleSizeOrder_);
   shuffle(-1);
   LOG(INFO) << "Total batches (i.e. iters): " << sampleBatches_.size();
 }
@@ -77,8 +78,50 @@ std::vector<W2lLoaderData> W2lNumberedFilesDataset::getLoaderData(
 }
 
 std::vector<SpeechSampleMetaInfo> W2lNumberedFilesDataset::loadSampleSizes() {
-  std::vector<SpeechSampleMetaInfo> speechSamplesMetaInfo(
-      cumulativeSizes_.back());
+  // The index is valid while the first and last files of every loader, their
+  // directories and every target file are unchanged: adding or removing files
+  // changes the size found by the loader or the mtime of a directory, and a
+  // target rewritten in place changes its own size or mtime. Targets are only
+  // stat'ed here, which is much cheaper than reading them.
+  std::string source = "numbered " + FLAGS_input + " " + FLAGS_target;
+  std::vector<std::string> stateFiles;
+  for (const auto& l : loaders_) {
+    source += " " + l.filename(0, FLAGS_input);
+    for (auto i : {int64_t(0), l.size() - 1}) {
+      for (const auto& ext : {FLAGS_input, FLAGS_target}) {
+        auto file = l.filename(i, ext);
+        stateFiles.push_back(file);
+        stateFiles.push_back(file.substr(0, file.find_last_of('/') + 1));
+      }
+    }
+  }
+  auto cachePath = indexCachePath(source);
+  auto key = fileStateKey(stateFiles);
+  if (!key.empty()) {
+    key += "sizes";
+    uint64_t targetState = 14695981039346656037ULL; // FNV-1a
+    bool targetsFound = true;
+    for (const auto& l : loaders_) {
+      key += " " + std::to_string(l.size());
+      for (int64_t i = 0; i < l.size() && targetsFound; ++i) {
+        auto state = fileStateKey({l.filename(i, FLAGS_target)});
+        targetsFound = !state.empty();
+        for (unsigned char c : state) {
+          targetState = (targetState ^ c) * 1099511628211ULL;
+        }
+      }
+    }
+    key = targetsFound ? key + " targets " + std::to_string(targetState) : "";
+  }
+
+  std::vector<SpeechSampleMetaInfo> speechSamplesMetaInfo;
+  if (loadSampleIndex(cachePath, key, speechSamplesMetaInfo) &&
+      static_cast<int64_t>(speechSamplesMetaInfo.size()) ==
+          cumulativeSizes_.back()) {
+    LOG(INFO) << "Loaded sample sizes from " << cachePath;
+    return speechSamplesMetaInfo;
+  }
+  speechSamplesMetaInfo.resize(cumulativeSizes_.back());
   for (int64_t j = 0; j < loaders_.size(); ++j) {
     const auto& l = loaders_[j];
 #pragma omp parallel for schedule(static)
@@ -94,6 +137,7 @@ std::vector<SpeechSampleMetaInfo> W2lNumberedFilesDataset::loadSampleSizes() {
           SpeechSampleMetaInfo(durationMs, ref.size(), idx);
     }
   }
+  saveSampleIndex(cachePath, key, speechSamplesMetaInfo);
   return speechSamplesMetaInfo;
 }
 } // namespace w2l
@@ -6,6 +6,10 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <fstream>
+#include <numeric>
+#include <set>
+
 #include <arrayfire.h>
 #include <flashlight/flashlight.h>
 #include <gmock/gmock.h>
@@ -13,8 +17,11 @@
 
 #include "common/Defines.h"
 #include "common/Utils.h"
+#include "data/Augmentation.h"
 #include "data/Featurize.h"
 #include "data/NumberedFilesLoader.h"
+#include "data/SpectrogramMask.h"
+#include "data/StagingBuffer.h"
 #include "data/W2lListFilesDataset.h"
 #include "data/W2lNumberedFilesDataset.h"
 
@@ -134,6 +141,46 @@ TEST(DataTest, targetFeaturizer) {
   ASSERT_EQ(tgtArray(tgtLen - 2, 1).scalar<int>(), eosIdx);
 }
 
+TEST(DataTest, targetIndicesFeaturizer) {
+  auto dict = getDict();
+  dict.addToken("1");
+  gflags::FlagSaver flagsaver;
+  w2l::FLAGS_replabel = 1;
+  w2l::FLAGS_criterion = kAsgCriterion;
+  w2l::FLAGS_surround = "|";
+
+  std::vector<std::vector<std::string>> targets = {{"a", "b", "b", "c"},
+                                                   {"d", "d", "d"}};
+  std::vector<W2lLoaderData> strData, idxData;
+  std::vector<std::vector<int>> indices;
+  for (const auto& t : targets) {
+    indices.push_back(dict.mapTokensToIndices(t));
+  }
+  for (size_t i = 0; i < targets.size(); ++i) {
+    strData.emplace_back();
+    strData.back().targets[kTargetIdx] = targets[i];
+    strData.back().sampleId = "id" + std::to_string(i);
+    // split the target over two spans
+    idxData.emplace_back();
+    auto& spans = idxData.back().targetIndices[kTargetIdx];
+    spans.emplace_back(indices[i].data(), 1);
+    spans.emplace_back(indices[i].data() + 1, indices[i].size() - 1);
+    idxData.back().sampleId = strData.back().sampleId;
+  }
+
+  DictionaryMap dicts;
+  dicts.insert({kTargetIdx, dict});
+  auto strFeat = featurize(strData, dicts);
+  auto idxFeat = featurize(idxData, dicts);
+  ASSERT_EQ(strFeat.targetDims[kTargetIdx], idxFeat.targetDims[kTargetIdx]);
+  ASSERT_THAT(
+      idxFeat.targets[kTargetIdx],
+      ::testing::ElementsAreArray(strFeat.targets[kTargetIdx]));
+  ASSERT_THAT(
+      idxFeat.sampleIds, ::testing::ElementsAreArray(strFeat.sampleIds));
+  ASSERT_EQ(idxFeat.sampleIdsDims, af::dim4(3, 2));
+}
+
 TEST(DataTest, NumberedFilesLoader) {
   NumberedFilesLoader numfilesds(
       w2l::pathsConcat(loadPath, "dataset"), "wav", {{kTargetIdx, "tkn"}});
@@ -188,6 +235,56 @@ TEST(DataTest, W2lDataset) {
   ASSERT_EQ(input.dims(), af::dim4(24000));
 }
 
+TEST(DataTest, W2lDatasetState) {
+  gflags::FlagSaver flagsaver;
+  w2l::FLAGS_mfcc = false;
+  w2l::FLAGS_mfsc = false;
+  w2l::FLAGS_pow = false;
+  w2l::FLAGS_nthread = 2;
+  w2l::FLAGS_replabel = 0;
+  w2l::FLAGS_surround = "";
+  w2l::FLAGS_dataorder = "none";
+  w2l::FLAGS_input = "wav";
+
+  auto dict = getDict();
+  DictionaryMap dicts;
+  dicts.insert({kTargetIdx, dict});
+
+  W2lNumberedFilesDataset ds(w2l::pathsConcat(loadPath, "dataset"), dicts, 1);
+  ds.shuffle(5);
+  ds.setEpoch(3);
+  ds.get(0);
+  auto state = ds.getState();
+  ASSERT_EQ(state.epoch, 3);
+  ASSERT_EQ(state.seed, 5);
+  ASSERT_EQ(state.numBatches, ds.size());
+  ASSERT_EQ(state.cursor, 1);
+  ASSERT_THAT(state.prefetch, ::testing::ElementsAre(1, 2));
+
+  auto restored = W2lDataLoaderState::fromString(state.toString());
+  ASSERT_EQ(restored.toString(), state.toString());
+
+  W2lNumberedFilesDataset resumed(
+      w2l::pathsConcat(loadPath, "dataset"), dicts, 1);
+  resumed.setState(restored);
+  ASSERT_EQ(resumed.getState().toString(), state.toString());
+  for (int64_t i = 1; i < ds.size(); ++i) {
+    auto expected = ds.get(i)[kFileIdIdx];
+    auto actual = resumed.get(i)[kFileIdIdx];
+    ASSERT_TRUE(af::allTrue<bool>(expected == actual));
+  }
+  ASSERT_EQ(resumed.getState().cursor, ds.size());
+
+  // the augmentation of a batch changes with the epoch
+  AugmentationOptions augmentation;
+  augmentation.snr = 20;
+  ds.setAugmentation(augmentation);
+  auto epoch3 = ds.get(0)[kInputIdx];
+  ASSERT_TRUE(af::allTrue<bool>(epoch3 == ds.get(0)[kInputIdx]));
+  ds.setEpoch(4);
+  ASSERT_FALSE(af::allTrue<bool>(epoch3 == ds.get(0)[kInputIdx]));
+}
+
 TEST(DataTest, W2lListDataset) {
   gflags::FlagSaver flagsaver;
   w2l::FLAGS_mfcc = false;
@@ -249,6 +346,178 @@ TEST(DataTest, W2lListDataset) {
     ASSERT_EQ(target(i).scalar<int>(), expectedTarget[i]);
   }
   ASSERT_EQ(input.dims(), af::dim4(24000));
+
+  // sample between the pronunciations of a word
+  w2l::FLAGS_sampletarget = 1.0;
+  lexicon["uh"].push_back({"a", "h"});
+  W2lListFilesDataset sampledDs(fileList, dicts, lexicon, 1);
+  std::set<int> firstTokens;
+  for (int i = 0; i < 50; ++i) {
+    auto sampled = sampledDs.get(0)[kTargetIdx];
+    ASSERT_EQ(sampled.dims(), af::dim4(expectedTarget.size()));
+    firstTokens.insert(sampled(0).scalar<int>());
+    ASSERT_EQ(sampled(2).scalar<int>(), expectedTarget[2]);
+  }
+  ASSERT_EQ(firstTokens, std::set<int>({0, 20}));
+}
+
+TEST(DataTest, Augmentation) {
+  AugmentationRng rng(augmentationSeed(1, 0));
+  std::vector<float> audio(16000);
+  for (size_t i = 0; i < audio.size(); ++i) {
+    audio[i] = std::sin(2 * M_PI * 440 * i / 16000.0);
+  }
+
+  // noise at 10dB: a tenth of the power of the signal
+  auto noisy = audio;
+  addNoise(noisy, 10, rng);
+  double noisePower = 0;
+  for (size_t i = 0; i < audio.size(); ++i) {
+    noisePower += (noisy[i] - audio[i]) * (noisy[i] - audio[i]);
+  }
+  ASSERT_NEAR(noisePower / audio.size(), 0.05, 0.005);
+
+  // 2 channels, twice faster
+  std::vector<float> stereo = {0, 10, 1, 11, 2, 12, 3, 13, 4, 14};
+  ASSERT_THAT(
+      changeSpeed(stereo, 2, 2.0), ::testing::ElementsAre(0, 10, 2, 12, 4, 14));
+  ASSERT_EQ(changeSpeed(stereo, 2, 0.5).size(), 18u);
+
+  // T = 6 x K = 3 with 5 frames of data 0, 1, ..., 14 of mean 7, masks
+  // don't touch the padding
+  std::vector<float> feat(18);
+  for (int k = 0; k < 3; ++k) {
+    for (int t = 0; t < 5; ++t) {
+      feat[k * 6 + t] = k * 5 + t;
+    }
+    feat[k * 6 + 5] = -1;
+  }
+  AugmentationOptions opts;
+  opts.freqMask = 1;
+  opts.numFreqMasks = 1;
+  opts.timeMask = 2;
+  opts.numTimeMasks = 1;
+  maskFeatures(feat.data(), 6, 5, 3, opts, rng);
+  int masked = 0, kept = 0;
+  for (int k = 0; k < 3; ++k) {
+    ASSERT_EQ(feat[k * 6 + 5], -1);
+    for (int t = 0; t < 5; ++t) {
+      if (feat[k * 6 + t] == k * 5 + t) {
+        ++kept;
+      } else {
+        ASSERT_EQ(feat[k * 6 + t], 7); // the mean
+        ++masked;
+      }
+    }
+  }
+  ASSERT_GT(masked, 0);
+  ASSERT_GT(kept, 0);
+
+  // a warp keeps the endpoints and the monotonicity of a ramp
+  std::vector<float> ramp(40);
+  std::iota(ramp.begin(), ramp.end(), 0);
+  timeWarp(ramp.data(), 20, 20, 2, 5, rng);
+  for (int k = 0; k < 2; ++k) {
+    ASSERT_EQ(ramp[k * 20], k * 20);
+    ASSERT_FLOAT_EQ(ramp[k * 20 + 19], k * 20 + 19);
+    for (int t = 1; t < 20; ++t) {
+      ASSERT_GE(ramp[k * 20 + t], ramp[k * 20 + t - 1]);
+    }
+  }
+
+  // same seed, same batch
+  gflags::FlagSaver flagsaver;
+  w2l::FLAGS_channels = 1;
+  std::vector<W2lLoaderData> data(2);
+  data[0].input = audio;
+  data[1].input.assign(audio.begin(), audio.begin() + 8000);
+  auto dict = getDict();
+  DictionaryMap dicts;
+  dicts.insert({kTargetIdx, dict});
+  opts.snr = 20;
+  opts.speed = 0.1;
+  auto feat1 = featurize(data, dicts, opts, 7);
+  auto feat2 = featurize(data, dicts, opts, 7);
+  auto feat3 = featurize(data, dicts, opts, 8);
+  ASSERT_EQ(feat1.input.size(), feat2.input.size());
+  ASSERT_TRUE(
+      std::equal(feat1.input.begin(), feat1.input.end(), feat2.input.begin()));
+  ASSERT_NE(feat1.inputDims, af::dim4(16000, 1, 1, 2));
+  ASSERT_FALSE(
+      feat1.input.size() == feat3.input.size() &&
+      std::equal(feat1.input.begin(), feat1.input.end(), feat3.input.begin()));
+}
+
+TEST(DataTest, StagingBuffer) {
+  HostBufferPool pool(1 << 20, false /* pinned */);
+  const int* first;
+  {
+    StagingBuffer<int> buf(1000, 7, pool);
+    ASSERT_EQ(buf.size(), 1000u);
+    ASSERT_THAT(buf, ::testing::Each(7));
+    first = buf.data();
+    auto copy = buf;
+    ASSERT_EQ(copy.data(), first);
+  }
+  // back to the pool with the last copy, rounded up to 4KB
+  ASSERT_EQ(pool.cachedBytes(), 4096u);
+  StagingBuffer<int> again(900, pool);
+  ASSERT_EQ(again.data(), first);
+  ASSERT_EQ(pool.cachedBytes(), 0u);
+
+  // blocks over the cache limit are freed
+  { StagingBuffer<float> big(1 << 19, pool); }
+  ASSERT_EQ(pool.cachedBytes(), 0u);
+
+  StagingBuffer<int> none(0, pool);
+  ASSERT_TRUE(none.empty());
+  ASSERT_EQ(none.begin(), none.end());
+}
+
+TEST(DataTest, SampleIndexCache) {
+  gflags::FlagSaver flagsaver;
+  char* user = getenv("USER");
+  std::string userstr = "unknown";
+  if (user != nullptr) {
+    userstr = std::string(user);
+  }
+  auto listFile = "/tmp/" + userstr + "_indexcache_list.txt";
+  {
+    std::ofstream fs(listFile);
+    fs << "a /nonexistent.flac 10 uh\n";
+  }
+  w2l::FLAGS_indexcache = "/tmp";
+  auto cachePath = indexCachePath("list " + listFile);
+  ASSERT_EQ(cachePath.find("/tmp/"), 0);
+  std::remove(cachePath.c_str());
+
+  std::vector<SpeechSampleMetaInfo> samples = {
+      SpeechSampleMetaInfo(10.5, 3, 0), SpeechSampleMetaInfo(20, 7, 1)};
+  auto key = fileStateKey({listFile});
+  ASSERT_FALSE(key.empty());
+  std::vector<SpeechSampleMetaInfo> loaded;
+  ASSERT_FALSE(loadSampleIndex(cachePath, key, loaded));
+  saveSampleIndex(cachePath, key, samples);
+  ASSERT_TRUE(loadSampleIndex(cachePath, key, loaded));
+  ASSERT_EQ(loaded.size(), samples.size());
+  for (size_t i = 0; i < samples.size(); ++i) {
+    ASSERT_EQ(loaded[i].audiolength(), samples[i].audiolength());
+    ASSERT_EQ(loaded[i].reflength(), samples[i].reflength());
+    ASSERT_EQ(loaded[i].index(), samples[i].index());
+  }
+
+  // a change of the list invalidates the cache
+  {
+    std::ofstream fs(listFile, std::ios::app);
+    fs << "b /nonexistent.flac 20 uh uh\n";
+  }
+  ASSERT_NE(fileStateKey({listFile}), key);
+  ASSERT_FALSE(loadSampleIndex(cachePath, fileStateKey({listFile}), loaded));
+  ASSERT_TRUE(fileStateKey({listFile + ".missing"}).empty());
+
+  w2l::FLAGS_indexcache = "";
+  ASSERT_TRUE(indexCachePath("list " + listFile).empty());
+  std::remove(cachePath.c_str());
 }
 
 TEST(DataTest, W2lDatasetDeterministicSampling) {
@@ -322,6 +591,82 @@ TEST(RoundRobinBatchShufflerTest, params) {
   ASSERT_THAT(batches[1], ::testing::ElementsAre(4, 5));
 }
 
+TEST(TokenBudgetBatchPackerTest, params) {
+  std::vector<double> sizes = {1, 1, 1, 1, 2, 2, 4, 4, 8};
+  // 2 x 1 fits a budget of 4 for each process, 3 x 2 does not
+  auto packer0 = TokenBudgetBatchPacker(sizes, 4, 0, 2, 0);
+  auto packer1 = TokenBudgetBatchPacker(sizes, 4, 0, 2, 1);
+  auto batches = packer0.getBatches(9, -1);
+  EXPECT_EQ(batches.size(), 3);
+  ASSERT_THAT(batches[0], ::testing::ElementsAre(0, 1));
+  ASSERT_THAT(batches[1], ::testing::ElementsAre(4));
+  ASSERT_THAT(batches[2], ::testing::ElementsAre(6));
+  batches = packer1.getBatches(9, -1);
+  EXPECT_EQ(batches.size(), 3);
+  ASSERT_THAT(batches[0], ::testing::ElementsAre(2, 3));
+  ASSERT_THAT(batches[1], ::testing::ElementsAre(5));
+  ASSERT_THAT(batches[2], ::testing::ElementsAre(7));
+  EXPECT_EQ(packer0.globalBatchIdx(5), 1);
+
+  // processes shuffle alike and stay in lockstep
+  auto shuffled0 = packer0.getBatches(9, 3);
+  auto shuffled1 = packer1.getBatches(9, 3);
+  ASSERT_EQ(shuffled0.size(), shuffled1.size());
+  for (size_t i = 0; i < shuffled0.size(); ++i) {
+    ASSERT_EQ(shuffled0[i].size(), shuffled1[i].size());
+    EXPECT_EQ(
+        packer0.globalBatchIdx(shuffled0[i][0]),
+        packer1.globalBatchIdx(shuffled1[i][0]));
+  }
+
+  // the batch size caps the number of samples
+  batches = TokenBudgetBatchPacker(sizes, 4, 1, 2, 0).getBatches(9, -1);
+  EXPECT_EQ(batches.size(), 4);
+  ASSERT_THAT(batches[3], ::testing::ElementsAre(6));
+  batches = TokenBudgetBatchPacker(sizes, 100, 0, 1, 0).getBatches(9, -1);
+  EXPECT_EQ(batches.size(), 1);
+  EXPECT_EQ(batches[0].size(), 9);
+}
+
+TEST(DataTest, SpectrogramMask) {
+  const std::string specPath = "/tmp/w2l_mask_spec.txt";
+  {
+    std::ofstream spec(specPath);
+    spec << "# top two dims and a block\n"
+         << "band -2 -1\n"
+         << "region 1 2 0 1  # frames 1-2, dims 0-1\n"
+         << "point 9 3\n"
+         << "point 100 3\n"; // past the end, ignored
+  }
+  auto mask = SpectrogramMask::get(specPath);
+  ASSERT_EQ(mask, SpectrogramMask::get(specPath)); // parsed once
+
+  const int T = 10, K = 8;
+  auto input = af::constant(2.0, T, K, 1, 3);
+  auto output = mask->apply(input);
+  ASSERT_EQ(output.dims(), input.dims());
+  ASSERT_EQ(mask->numMasked(T, K), 2 * T + 4 + 1);
+  ASSERT_EQ(af::sum<float>(output(af::span, af::seq(K - 2, K - 1))), 0.0);
+  ASSERT_EQ(af::sum<float>(output(af::seq(1, 2), af::seq(0, 1))), 0.0);
+  ASSERT_EQ(output(9, 3, 0, 2).scalar<float>(), 0.0);
+  ASSERT_EQ(output(0, 0, 0, 1).scalar<float>(), 2.0);
+  // a shorter input reuses the spec with its own cached mask, the region
+  // is clipped to frame 1
+  ASSERT_EQ(mask->numMasked(2, K), 2 * 2 + 2);
+
+  // legacy list: fft column then frame, on alternating lines
+  const std::string legacyPath = "/tmp/w2l_mask_legacy.txt";
+  {
+    std::ofstream legacy(legacyPath);
+    legacy << "4\n0\n5\n0\n7\n2\n";
+  }
+  SpectrogramMask legacy(legacyPath);
+  auto keep = legacy.mask(3, 4);
+  ASSERT_EQ(legacy.numMasked(3, 4), 2);
+  ASSERT_EQ(keep(0, 2).scalar<float>(), 0.0);
+  ASSERT_EQ(keep(2, 3).scalar<float>(), 0.0);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
 
@@ -16,6 +16,7 @@
 #include <unordered_map>
 
 #include "Decoder.hpp"
+#include "common/Trace.h"
 
 namespace w2l {
 
@@ -152,6 +153,7 @@ void Decoder::candidatesStore(
 }
 
 void Decoder::decodeBegin() {
+  W2L_TRACE_SCOPE("decoder/begin");
   hyp_.clear();
   hyp_.insert({0, std::vector<DecoderNode>()});
 
@@ -168,6 +170,7 @@ void Decoder::decodeContinue(
     const float* emissions,
     int T,
     int N) {
+  W2L_TRACE_SCOPE("decoder/continue");
   int startFrame = nDecodedFrames_ - nPrunedFrames_;
   // Extend hyp_ buffer
   if (hyp_.size() < startFrame + T + 2) {
@@ -286,6 +289,7 @@ void Decoder::decodeContinue(
 }
 
 void Decoder::decodeEnd(const DecoderOptions& opt) {
+  W2L_TRACE_SCOPE("decoder/end");
   candidatesReset();
   for (const DecoderNode& prevHyp : hyp_[nDecodedFrames_ - nPrunedFrames_]) {
     const TrieNodePtr prevLex = prevHyp.lex_;
@@ -347,6 +351,7 @@ Decoder::decode(
     const float* emissions,
     int T,
     int N) {
+  W2L_TRACE_SCOPE("decoder/decode");
   decodeBegin();
   decodeContinue(opt, transitions, emissions, T, N);
   decodeEnd(opt);
@@ -469,6 +474,7 @@ const DecoderNode* Decoder::findBestAncestor(int& lookBack) const {
 }
 
 void Decoder::prune(int lookBack) {
+  W2L_TRACE_SCOPE("decoder/prune");
   if (nDecodedFrames_ - nPrunedFrames_ - lookBack < 1) {
     return; // Not enough decoded frames to prune
   }
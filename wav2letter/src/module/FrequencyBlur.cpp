@@ -0,0 +1,155 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "module/FrequencyBlur.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+using namespace fl;
+
+namespace w2l {
+
+namespace {
+
+// Normalizer S(m) of the triangle of half-width m and its derivative.
+// floor(m) is piecewise constant, so dS/dm = 2 * floor(m) + 1.
+inline float blurNorm(float m) {
+  float f = std::floor(m);
+  return f * (2 * m - f - 1) + m;
+}
+
+inline float blurNormGrad(float m) {
+  return 2 * std::floor(m) + 1;
+}
+
+// Largest offset d with d < m, clamped to the number of bins
+inline int64_t blurRadius(float m, int64_t K) {
+  return std::min(static_cast<int64_t>(std::ceil(m)) - 1, K - 1);
+}
+
+} // namespace
+
+Variable frequencyBlur(const Variable& input, const Variable& mask) {
+  if (input.dims() != mask.dims()) {
+    throw std::invalid_argument("frequencyBlur: input and mask dims differ");
+  }
+  const int64_t K = input.dims(0);
+  const int64_t cols = input.elements() / K;
+
+  std::vector<float> inVec(input.elements());
+  std::vector<float> maskVec(mask.elements());
+  input.host(inVec.data());
+  mask.host(maskVec.data());
+  std::vector<float> outVec(input.elements(), 0.0);
+
+#pragma omp parallel for
+  for (int64_t c = 0; c < cols; ++c) {
+    const float* in = inVec.data() + c * K;
+    const float* m = maskVec.data() + c * K;
+    float* out = outVec.data() + c * K;
+    for (int64_t p = 0; p < K; ++p) {
+      if (m[p] <= 0) {
+        out[p] += in[p];
+        continue;
+      }
+      const float scale = in[p] / blurNorm(m[p]);
+      const int64_t r = blurRadius(m[p], K);
+      const int64_t lo = std::max(p - r, int64_t(0));
+      const int64_t hi = std::min(p + r, K - 1);
+      for (int64_t i = lo; i <= hi; ++i) {
+        out[i] += scale * (m[p] - std::abs(i - p));
+      }
+    }
+  }
+  auto result = af::array(input.dims(), outVec.data());
+
+  auto gradFunc = [](std::vector<Variable>& inputs,
+                     const Variable& gradOutput) {
+    auto& in = inputs[0];
+    auto& mk = inputs[1];
+    const int64_t K = in.dims(0);
+    const int64_t cols = in.elements() / K;
+
+    std::vector<float> inVec(in.elements());
+    std::vector<float> maskVec(mk.elements());
+    std::vector<float> gradVec(gradOutput.elements());
+    in.host(inVec.data());
+    mk.host(maskVec.data());
+    gradOutput.host(gradVec.data());
+    std::vector<float> inGradVec(in.elements(), 0.0);
+    std::vector<float> maskGradVec(mk.elements(), 0.0);
+
+#pragma omp parallel for
+    for (int64_t c = 0; c < cols; ++c) {
+      const float* x = inVec.data() + c * K;
+      const float* m = maskVec.data() + c * K;
+      const float* g = gradVec.data() + c * K;
+      float* dx = inGradVec.data() + c * K;
+      float* dm = maskGradVec.data() + c * K;
+      for (int64_t p = 0; p < K; ++p) {
+        if (m[p] <= 0) {
+          dx[p] = g[p];
+          continue;
+        }
+        const float S = blurNorm(m[p]);
+        const float dS = blurNormGrad(m[p]);
+        const int64_t r = blurRadius(m[p], K);
+        const int64_t lo = std::max(p - r, int64_t(0));
+        const int64_t hi = std::min(p + r, K - 1);
+        // d/dm (m - d) / S = (S - dS * (m - d)) / S^2
+        float gw = 0, gdw = 0;
+        for (int64_t i = lo; i <= hi; ++i) {
+          const float w = m[p] - std::abs(i - p);
+          gw += g[i] * w;
+          gdw += g[i] * (S - dS * w);
+        }
+        dx[p] = gw / S;
+        dm[p] = x[p] * gdw / (S * S);
+      }
+    }
+
+    if (in.isCalcGrad()) {
+      in.addGrad(Variable(af::array(in.dims(), inGradVec.data()), false));
+    }
+    if (mk.isCalcGrad()) {
+      mk.addGrad(Variable(af::array(mk.dims(), maskGradVec.data()), false));
+    }
+  };
+
+  return Variable(result, {input, mask}, gradFunc);
+}
+
+FrequencyBlur::FrequencyBlur(
+    int64_t numBins,
+    int64_t numFrames,
+    double initWidth)
+    : UnaryModule(
+          {Variable(af::constant(initWidth, numBins, numFrames), true)}) {}
+
+FrequencyBlur::FrequencyBlur(const Variable& mask) : UnaryModule({mask}) {}
+
+Variable FrequencyBlur::forward(const Variable& input) {
+  const auto& mask = params_[0];
+  if (input.dims(0) != mask.dims(0) || input.dims(1) != mask.dims(1)) {
+    throw std::invalid_argument("FrequencyBlur: input and mask dims differ");
+  }
+  auto tiled = tile(mask, af::dim4(1, 1, input.dims(2), input.dims(3)));
+  return frequencyBlur(input, tiled);
+}
+
+std::string FrequencyBlur::prettyString() const {
+  std::ostringstream ss;
+  ss << "FrequencyBlur (" << params_[0].dims(0) << " bins, "
+     << params_[0].dims(1) << " frames)";
+  return ss.str();
+}
+
+} // namespace w2l
@@ -0,0 +1,51 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <flashlight/flashlight.h>
+
+namespace w2l {
+
+/**
+ * Adaptive triangular blur along the first (frequency) dimension. Every bin
+ * p of every column spreads its value to the bins i with |i - p| < m_p,
+ * weighted by the triangle (m_p - |i - p|) / S(m_p), where
+ *   S(m) = sum_{|d| < m} (m - |d|) = floor(m) * (2m - floor(m) - 1) + m
+ * so that the weights of a bin sum to one away from the edges. Bins with
+ * m_p <= 0 are passed through unchanged.
+ *
+ * `input` and `mask` have the same dims K x T x C x B. The forward is banded,
+ * O(K * T * max(m)), and the backward is analytic w.r.t. both inputs. Both
+ * run on the host.
+ */
+fl::Variable frequencyBlur(const fl::Variable& input, const fl::Variable& mask);
+
+/**
+ * Module holding the blur widths as a learnable K x T parameter, shared over
+ * channels and batch.
+ */
+class FrequencyBlur : public fl::UnaryModule {
+ private:
+  FrequencyBlur() = default; // Intentionally private
+
+  FL_SAVE_LOAD_WITH_BASE(fl::UnaryModule)
+
+ public:
+  FrequencyBlur(int64_t numBins, int64_t numFrames, double initWidth);
+
+  explicit FrequencyBlur(const fl::Variable& mask);
+
+  fl::Variable forward(const fl::Variable& input) override;
+
+  std::string prettyString() const override;
+};
+
+} // namespace w2l
+
+CEREAL_REGISTER_TYPE(w2l::FrequencyBlur)
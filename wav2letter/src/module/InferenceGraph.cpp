@@ -0,0 +1,449 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "module/InferenceGraph.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include "common/Utils.h"
+
+namespace w2l {
+
+namespace {
+
+af::array slice(const af::array& x, int dim, int begin, int end) {
+  std::vector<af::index> idx(4, af::span);
+  idx[dim] = af::seq(begin, end - 1);
+  return x(idx[0], idx[1], idx[2], idx[3]);
+}
+
+af::array applyEpilogue(const af::array& x, const InferenceOp& op, int dim) {
+  switch (op.epilogue) {
+    case InferenceEpilogue::RELU:
+      return af::max(x, 0.0);
+    case InferenceEpilogue::PRELU:
+      return af::select(x >= 0, x, x * op.slope);
+    case InferenceEpilogue::TANH:
+      return af::tanh(x);
+    case InferenceEpilogue::GLU: {
+      int half = x.dims(dim) / 2;
+      auto gate = af::sigmoid(slice(x, dim, half, 2 * half));
+      return slice(x, dim, 0, half) * gate;
+    }
+    default:
+      return x;
+  }
+}
+
+// C, C1, C2, L (also wrapped in WN) become CONV / LINEAR, the rest MODULE
+InferenceOp makeOp(
+    const std::vector<std::string>& spec,
+    std::shared_ptr<fl::Module> module) {
+  InferenceOp op;
+  op.spec = spec;
+  op.module = module;
+
+  auto layer = spec;
+  auto params = module->params();
+  af::array weight, bias;
+  if (spec[0] == "WN" && std::dynamic_pointer_cast<fl::WeightNorm>(module)) {
+    weight = foldWeightNorm(params[0].array(), params[1].array());
+    if (params.size() > 2) {
+      bias = params[2].array();
+    }
+    layer.erase(layer.begin(), layer.begin() + 2);
+  } else if (
+      std::dynamic_pointer_cast<fl::Conv2D>(module) ||
+      std::dynamic_pointer_cast<fl::Linear>(module)) {
+    weight = params[0].array();
+    if (params.size() > 1) {
+      bias = params[1].array();
+    }
+  }
+  if (weight.isempty()) {
+    return op;
+  }
+
+  auto at = [&layer](size_t i, int dflt) {
+    return layer.size() > i ? std::stoi(layer[i]) : dflt;
+  };
+  if (layer[0] == "C" || layer[0] == "C1") {
+    op.type = InferenceOpType::CONV;
+    op.sx = at(4, 1);
+    op.px = at(5, 0);
+    op.dx = at(6, 1);
+  } else if (layer[0] == "C2") {
+    op.type = InferenceOpType::CONV;
+    op.sx = at(5, 1);
+    op.sy = at(6, 1);
+    op.px = at(7, 0);
+    op.py = at(8, 0);
+    op.dx = at(9, 1);
+    op.dy = at(10, 1);
+  } else if (layer[0] == "L") {
+    op.type = InferenceOpType::LINEAR;
+  } else {
+    return op;
+  }
+  op.weight = weight;
+  op.bias = bias;
+  return op;
+}
+
+// Eval-mode BN over the channels is y = scale * x + shift, found by probing
+bool foldBatchNorm(InferenceOp& op, const InferenceOp& next) {
+  auto bn = std::dynamic_pointer_cast<fl::BatchNorm>(next.module);
+  bool conv = op.type == InferenceOpType::CONV;
+  int channelDim = conv ? 2 : 0;
+  int nOut = op.weight.dims(conv ? 3 : 0);
+  if (!bn || next.spec.size() != 3 || std::stoi(next.spec[1]) != nOut ||
+      std::stoi(next.spec[2]) != channelDim) {
+    return false;
+  }
+  af::dim4 dims(1, 1, 1, 1);
+  dims[channelDim] = nOut;
+  auto probe = [&bn](const af::array& x) {
+    return af::flat(bn->forward(fl::Variable(x, false)).array());
+  };
+  auto shift = probe(af::constant(0.0, dims));
+  auto scale = probe(af::constant(1.0, dims)) - shift;
+  // without running statistics BN normalizes the probe itself
+  auto check = af::randn(dims);
+  auto expected = af::flat(check) * scale + shift;
+  if (af::max<float>(af::abs(probe(check) - expected)) > 1e-4) {
+    return false;
+  }
+
+  auto bias = op.bias.isempty() ? af::constant(0.0, nOut) : af::flat(op.bias);
+  bias = bias * scale + shift;
+  if (conv) {
+    auto w = op.weight.dims();
+    auto channelScale = af::moddims(scale, 1, 1, 1, nOut);
+    op.weight = op.weight * af::tile(channelScale, w[0], w[1], w[2]);
+    op.bias = af::moddims(bias, 1, 1, nOut);
+  } else {
+    op.weight = op.weight * af::tile(scale, 1, op.weight.dims(1));
+    op.bias = bias;
+  }
+  return true;
+}
+
+bool fuseActivation(InferenceOp& op, const InferenceOp& next) {
+  const auto& spec = next.spec;
+  bool conv = op.type == InferenceOpType::CONV;
+  if (spec[0] == "R") {
+    op.epilogue = InferenceEpilogue::RELU;
+  } else if (spec[0] == "T") {
+    op.epilogue = InferenceEpilogue::TANH;
+  } else if (
+      spec[0] == "PR" && next.module->params().size() == 1 &&
+      next.module->param(0).elements() == 1) {
+    op.epilogue = InferenceEpilogue::PRELU;
+    op.slope = next.module->param(0).array().scalar<float>();
+  } else if (
+      spec[0] == "GLU" && spec.size() == 2 &&
+      std::stoi(spec[1]) == (conv ? 2 : 0) &&
+      op.weight.dims(conv ? 3 : 0) % 2 == 0) {
+    op.epilogue = InferenceEpilogue::GLU;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+int64_t convFrames(
+    int64_t frames,
+    int filterSz,
+    int stride,
+    int pad,
+    int dilation) {
+  int p = derivePadding(frames, filterSz, stride, pad, dilation);
+  return (frames + 2 * p - dilation * (filterSz - 1) - 1) / stride + 1;
+}
+
+// Frames out of one layer for `frames` frames along `dim`, which it may move;
+// -1 if unknown
+int64_t layerFrames(
+    const std::vector<std::string>& spec,
+    int64_t frames,
+    int& dim) {
+  const auto& type = spec[0];
+  auto at = [&spec](size_t i, int dflt) {
+    return spec.size() > i ? std::stoi(spec[i]) : dflt;
+  };
+  if (type == "C" || type == "C1") {
+    if (dim == 1) {
+      return frames; // 1 x 1 along y
+    }
+    return dim == 0 ? convFrames(frames, at(3, 1), at(4, 1), at(5, 0), at(6, 1))
+                    : -1;
+  }
+  if (type == "C2" || type == "M" || type == "A") {
+    if (dim > 1) {
+      return -1;
+    }
+    if (type == "C2") {
+      return convFrames(
+          frames,
+          at(3 + dim, 1),
+          at(5 + dim, 1),
+          at(7 + dim, 0),
+          at(9 + dim, 1));
+    }
+    return convFrames(
+        frames, at(1 + dim, 1), at(3 + dim, 1), at(5 + dim, 0), 1);
+  }
+  if (type == "PD") {
+    return frames + at(2 + 2 * dim, 0) + at(3 + 2 * dim, 0);
+  }
+  if (type == "RO") {
+    for (int d = 0; d < 4; ++d) {
+      if (std::stoi(spec[1 + d]) == dim) {
+        dim = d;
+        return frames;
+      }
+    }
+    return -1;
+  }
+  if (type == "V") {
+    // the frames are the inferred size, or kept where they are
+    for (int d = 0; d < 4; ++d) {
+      if (std::stoi(spec[1 + d]) == -1) {
+        dim = d;
+        return frames;
+      }
+    }
+    return std::stoi(spec[1 + dim]) == 0 ? frames : -1;
+  }
+  if (type == "WN") {
+    return layerFrames(
+        std::vector<std::string>(spec.begin() + 2, spec.end()), frames, dim);
+  }
+  if (type == "L") {
+    return dim == 0 ? -1 : frames;
+  }
+  if (type == "GLU") {
+    return std::stoi(spec[1]) == dim ? -1 : frames;
+  }
+  static const std::vector<std::string> kKeepFrames = {"RES",
+                                                        "BN",
+                                                        "LN",
+                                                        "DO",
+                                                        "ELU",
+                                                        "R",
+                                                        "PR",
+                                                        "LG",
+                                                        "HT",
+                                                        "T",
+                                                        "LSM",
+                                                        "RNN",
+                                                        "GRU",
+                                                        "LSTM"};
+  if (std::find(kKeepFrames.begin(), kKeepFrames.end(), type) !=
+      kKeepFrames.end()) {
+    return frames;
+  }
+  return -1;
+}
+
+} // namespace
+
+std::vector<std::vector<std::string>> getW2lModuleSpecs(
+    const std::vector<std::string>& archLines) {
+  std::vector<std::vector<std::string>> specs;
+  for (size_t lid = 0; lid < archLines.size();) {
+    auto tokens = splitOnWhitespace(archLines[lid], true);
+    ++lid;
+    if (tokens[0] == "RES") {
+      lid += std::stoi(tokens[1]);
+    }
+    specs.emplace_back(std::move(tokens));
+  }
+  return specs;
+}
+
+af::array foldWeightNorm(const af::array& v, const af::array& g) {
+  int normDim = -1;
+  for (int d = 0; d < 4; ++d) {
+    if (g.dims(d) > 1 && g.dims(d) == v.dims(d)) {
+      normDim = d;
+    }
+  }
+  af::array norm = v * v;
+  for (int d = 0; d < 4; ++d) {
+    if (d != normDim) {
+      norm = af::sum(norm, d);
+    }
+  }
+  norm = af::sqrt(norm);
+  af::dim4 tiles;
+  for (int d = 0; d < 4; ++d) {
+    tiles[d] = v.dims(d) / norm.dims(d);
+  }
+  return v * af::tile(af::moddims(g, norm.dims()) / norm, tiles);
+}
+
+int derivePadding(int inSz, int filterSz, int stride, int pad, int dilation) {
+  if (pad != static_cast<int>(fl::PaddingMode::SAME)) {
+    return pad;
+  }
+  int newPad;
+  if (inSz % stride == 0) {
+    newPad = (filterSz - 1) * dilation - stride + 1;
+  } else {
+    newPad = (filterSz - 1) * dilation - (inSz % stride) + 1;
+  }
+  newPad = (newPad + 1) / 2; // equal pad on both sides
+  return std::max(newPad, 0);
+}
+
+int64_t getW2lOutputFrames(
+    const std::vector<std::string>& archLines,
+    int64_t inFrames) {
+  int64_t frames = inFrames;
+  int dim = 0;
+  for (const auto& spec : getW2lModuleSpecs(archLines)) {
+    frames = layerFrames(spec, frames, dim);
+    if (frames < 0) {
+      return -1;
+    }
+  }
+  return frames;
+}
+
+InferenceGraph::InferenceGraph(
+    std::shared_ptr<fl::Sequential> net,
+    const std::vector<std::string>& archLines) {
+  net->eval();
+  auto modules = net->modules();
+  auto specs = getW2lModuleSpecs(archLines);
+  if (specs.size() != modules.size()) {
+    throw std::invalid_argument(
+        "InferenceGraph: arch has " + std::to_string(specs.size()) +
+        " layers but the network " + std::to_string(modules.size()));
+  }
+
+  std::vector<InferenceOp> ops;
+  for (size_t k = 0; k < modules.size(); ++k) {
+    if (specs[k][0] != "DO") { // identity at inference
+      ops.emplace_back(makeOp(specs[k], modules[k]));
+    }
+  }
+
+  const std::vector<std::string> toTimeMajor = {"RO", "2", "0", "3", "1"};
+  for (size_t i = 0; i < ops.size(); ++i) {
+    auto op = ops[i];
+    if (op.type == InferenceOpType::MODULE) {
+      if (op.spec == toTimeMajor && i + 1 < ops.size() &&
+          ops[i + 1].type == InferenceOpType::LINEAR) {
+        ops[i + 1].reorderedInput = true;
+      } else {
+        ops_.emplace_back(std::move(op));
+      }
+      continue;
+    }
+    if (i + 1 < ops.size() && foldBatchNorm(op, ops[i + 1])) {
+      ++i;
+    }
+    if (i + 1 < ops.size() && fuseActivation(op, ops[i + 1])) {
+      ++i;
+    }
+    ops_.emplace_back(std::move(op));
+  }
+}
+
+af::array InferenceGraph::forward(const af::array& input) const {
+  af::array x = input;
+  for (const auto& op : ops_) {
+    if (op.type == InferenceOpType::CONV) {
+      int px = derivePadding(x.dims(0), op.weight.dims(0), op.sx, op.px, op.dx);
+      int py = derivePadding(x.dims(1), op.weight.dims(1), op.sy, op.py, op.dy);
+      fl::Variable in(x, false), weight(op.weight, false);
+      auto out = op.bias.isempty()
+          ? fl::conv2d(in, weight, op.sx, op.sy, px, py, op.dx, op.dy)
+          : fl::conv2d(
+                in,
+                weight,
+                fl::Variable(op.bias, false),
+                op.sx,
+                op.sy,
+                px,
+                py,
+                op.dx,
+                op.dy);
+      x = applyEpilogue(out.array(), op, 2);
+    } else if (op.type == InferenceOpType::LINEAR) {
+      int nIn = op.weight.dims(1);
+      af::array out;
+      if (op.reorderedInput && x.dims(1) == 1 && x.dims(3) == 1) {
+        // W * reorder(x) for T x 1 x C x 1 is W * x^T, the C x T
+        // copy is never made
+        out = af::matmulNT(op.weight, af::moddims(x, x.dims(0), nIn));
+      } else {
+        if (op.reorderedInput) {
+          x = af::reorder(x, 2, 0, 3, 1);
+        }
+        auto dims = x.dims();
+        out = af::matmul(op.weight, af::moddims(x, nIn, dims.elements() / nIn));
+        out = af::moddims(out, out.dims(0), dims[1], dims[2], dims[3]);
+      }
+      if (!op.bias.isempty()) {
+        out = out +
+            af::tile(op.bias, 1, out.dims(1), out.dims(2), out.dims(3));
+      }
+      x = applyEpilogue(out, op, 0);
+    } else {
+      x = op.module->forward({fl::Variable(x, false)}).front().array();
+    }
+  }
+  return x;
+}
+
+std::string InferenceGraph::prettyString() const {
+  std::ostringstream ss;
+  ss << "InferenceGraph";
+  for (size_t i = 0; i < ops_.size(); ++i) {
+    const auto& op = ops_[i];
+    ss << "\n\t(" << i << "): ";
+    if (op.type == InferenceOpType::CONV) {
+      auto w = op.weight.dims();
+      ss << "Conv2D (" << w[2] << "->" << w[3] << ", " << w[0] << "x" << w[1]
+         << ", " << op.sx << "," << op.sy << ", " << op.px << "," << op.py
+         << ", " << op.dx << ", " << op.dy << ")";
+    } else if (op.type == InferenceOpType::LINEAR) {
+      ss << "Linear (" << op.weight.dims(1) << "->" << op.weight.dims(0)
+         << ")";
+      if (op.reorderedInput) {
+        ss << " on RO 2 0 3 1";
+      }
+    } else {
+      ss << op.module->prettyString();
+    }
+    switch (op.epilogue) {
+      case InferenceEpilogue::RELU:
+        ss << " + ReLU";
+        break;
+      case InferenceEpilogue::PRELU:
+        ss << " + PReLU";
+        break;
+      case InferenceEpilogue::TANH:
+        ss << " + Tanh";
+        break;
+      case InferenceEpilogue::GLU:
+        ss << " + GLU";
+        break;
+      default:
+        break;
+    }
+  }
+  return ss.str();
+}
+
+} // namespace w2l
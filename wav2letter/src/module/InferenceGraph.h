@@ -0,0 +1,103 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <flashlight/flashlight.h>
+
+namespace w2l {
+
+enum class InferenceOpType {
+  CONV = 0,
+  LINEAR = 1,
+  MODULE = 2, // the original module, run without gradients
+};
+
+enum class InferenceEpilogue {
+  NONE = 0,
+  RELU = 1,
+  PRELU = 2, // single slope
+  TANH = 3,
+  GLU = 4, // over the output channels
+};
+
+struct InferenceOp {
+  InferenceOpType type{InferenceOpType::MODULE};
+  std::vector<std::string> spec; // arch line tokens
+  std::shared_ptr<fl::Module> module;
+
+  // CONV: kx x ky x Cin x Cout weight, 1 x 1 x Cout bias
+  // LINEAR: Cout x Cin weight, Cout bias
+  af::array weight, bias;
+  int sx{1}, sy{1}, px{0}, py{0}, dx{1}, dy{1};
+  // LINEAR reading the T x 1 x C x B conv layout of an elided `RO 2 0 3 1`
+  bool reorderedInput{false};
+  InferenceEpilogue epilogue{InferenceEpilogue::NONE};
+  float slope{0.0};
+};
+
+/**
+ * Inference-only form of a network built by createW2lSeqModule from
+ * `archLines` (see getW2lArchLines).
+ *
+ * Compilation walks the top-level modules with their arch lines: WN is folded
+ * into the weight of its C, C1, C2 or L layer, DO is dropped, and an eval-mode
+ * BN over the output channels that directly follows such a layer is folded
+ * into its weight and bias. A following R, single slope PR, T, or GLU over the
+ * output channels becomes the epilogue of the op, and a `RO 2 0 3 1` in front
+ * of L is elided by multiplying with the transposed conv output instead. All
+ * other layers keep their module. Ops run on plain arrays with no gradient
+ * bookkeeping; the network's parameters are shared, not copied, unless folded.
+ */
+class InferenceGraph {
+ public:
+  InferenceGraph(
+      std::shared_ptr<fl::Sequential> net,
+      const std::vector<std::string>& archLines);
+
+  af::array forward(const af::array& input) const;
+
+  const std::vector<InferenceOp>& ops() const {
+    return ops_;
+  }
+
+  std::string prettyString() const;
+
+ private:
+  std::vector<InferenceOp> ops_;
+};
+
+/**
+ * Arch line tokens of every top-level module `createW2lSeqModule` builds from
+ * `archLines`; a RES block is one module spanning several lines.
+ */
+std::vector<std::vector<std::string>> getW2lModuleSpecs(
+    const std::vector<std::string>& archLines);
+
+// The weight WeightNorm feeds its module, g * v / |v|
+af::array foldWeightNorm(const af::array& v, const af::array& g);
+
+// Resolves PaddingMode::SAME like fl::Conv2D does
+int derivePadding(int inSz, int filterSz, int stride, int pad, int dilation);
+
+/**
+ * Length of the output of a network built by createW2lSeqModule from
+ * `archLines` for an input of `inFrames` frames along dimension 0, from the
+ * filter sizes, strides, paddings and dilations of its C, C1, C2, M, A and PD
+ * layers. The frames are followed through RO and V; RES blocks keep their
+ * length. Returns -1 if a layer changes the frames in another way (e.g. L or
+ * GLU over them).
+ */
+int64_t getW2lOutputFrames(
+    const std::vector<std::string>& archLines,
+    int64_t inFrames);
+
+} // namespace w2l
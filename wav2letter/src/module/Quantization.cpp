@@ -0,0 +1,312 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "module/Quantization.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+#include "module/InferenceGraph.h"
+
+namespace w2l {
+
+namespace {
+
+float rangeToScale(float range) {
+  return range > 0 ? range / 127.0f : 1.0f;
+}
+
+int8_t quantize(float x, float invScale) {
+  float q = std::round(x * invScale);
+  return static_cast<int8_t>(std::min(127.0f, std::max(-127.0f, q)));
+}
+
+std::vector<float> toHost(const af::array& arr) {
+  std::vector<float> vec(arr.elements());
+  if (!vec.empty()) {
+    arr.as(f32).host(vec.data());
+  }
+  return vec;
+}
+
+} // namespace
+
+QuantizedConv::QuantizedConv(
+    const af::array& weight,
+    const af::array& bias,
+    int sx,
+    int sy,
+    int px,
+    int py,
+    int dx,
+    int dy,
+    float inputRange)
+    : linear_(false),
+      nIn_(weight.dims(2)),
+      nOut_(weight.dims(3)),
+      kx_(weight.dims(0)),
+      ky_(weight.dims(1)),
+      sx_(sx),
+      sy_(sy),
+      px_(px),
+      py_(py),
+      dx_(dx),
+      dy_(dy),
+      bias_(toHost(bias)),
+      inputScale_(rangeToScale(inputRange)) {
+  // a column-major kx x ky x Cin x Cout weight already is one row per output
+  // channel, x fastest, which is the order forward() gathers patches in
+  quantizeWeight(toHost(weight), kx_ * ky_ * nIn_);
+}
+
+QuantizedConv::QuantizedConv(
+    const af::array& weight,
+    const af::array& bias,
+    float inputRange)
+    : linear_(true),
+      nIn_(weight.dims(1)),
+      nOut_(weight.dims(0)),
+      bias_(toHost(bias)),
+      inputScale_(rangeToScale(inputRange)) {
+  quantizeWeight(toHost(af::transpose(weight)), nIn_);
+}
+
+void QuantizedConv::quantizeWeight(
+    const std::vector<float>& weight,
+    int64_t K) {
+  if (!bias_.empty() && bias_.size() != static_cast<size_t>(nOut_)) {
+    throw std::invalid_argument("QuantizedConv: bias does not match weight");
+  }
+  weight_.resize(weight.size());
+  weightScale_.resize(nOut_);
+  for (int o = 0; o < nOut_; ++o) {
+    auto row = weight.begin() + o * K;
+    float range = 0;
+    for (int64_t k = 0; k < K; ++k) {
+      range = std::max(range, std::abs(row[k]));
+    }
+    weightScale_[o] = rangeToScale(range);
+    float inv = 1.0f / weightScale_[o];
+    for (int64_t k = 0; k < K; ++k) {
+      weight_[o * K + k] = quantize(row[k], inv);
+    }
+  }
+}
+
+void QuantizedConv::setEpilogue(QuantEpilogue epilogue) {
+  if (epilogue == QuantEpilogue::GLU && nOut_ % 2 != 0) {
+    throw std::invalid_argument("QuantizedConv: GLU needs an even output");
+  }
+  epilogue_ = static_cast<int>(epilogue);
+}
+
+fl::Variable QuantizedConv::forward(const fl::Variable& input) {
+  auto idims = input.dims();
+  auto x = toHost(input.array());
+  std::vector<int8_t> q(x.size());
+  float invScale = 1.0f / inputScale_;
+#pragma omp parallel for
+  for (int64_t i = 0; i < static_cast<int64_t>(x.size()); ++i) {
+    q[i] = quantize(x[i], invScale);
+  }
+
+  auto epilogue = static_cast<QuantEpilogue>(epilogue_);
+  int outChannels = epilogue == QuantEpilogue::GLU ? nOut_ / 2 : nOut_;
+  int64_t K = static_cast<int64_t>(kx_) * ky_ * nIn_;
+  int64_t X = idims[0], Y = idims[1], N = idims[3];
+  int px = 0, py = 0;
+  int64_t OX = 1, OY = 1, nPos;
+  af::dim4 odims;
+  if (idims[linear_ ? 0 : 2] != nIn_) {
+    throw std::invalid_argument(
+        "QuantizedConv: input has the wrong number of channels");
+  }
+  if (linear_) {
+    nPos = x.size() / nIn_;
+    odims = af::dim4(outChannels, idims[1], idims[2], idims[3]);
+  } else {
+    px = derivePadding(X, kx_, sx_, px_, dx_);
+    py = derivePadding(Y, ky_, sy_, py_, dy_);
+    OX = (X + 2 * px - (kx_ - 1) * dx_ - 1) / sx_ + 1;
+    OY = (Y + 2 * py - (ky_ - 1) * dy_ - 1) / sy_ + 1;
+    nPos = OX * OY * N;
+    odims = af::dim4(OX, OY, outChannels, N);
+  }
+
+  std::vector<float> out(odims.elements());
+#pragma omp parallel
+  {
+    std::vector<int8_t> patch(linear_ ? 0 : K);
+    std::vector<float> acc(nOut_);
+#pragma omp for
+    for (int64_t p = 0; p < nPos; ++p) {
+      const int8_t* column;
+      int64_t outBase, outStride;
+      if (linear_) {
+        column = q.data() + p * nIn_;
+        outBase = p * outChannels;
+        outStride = 1;
+      } else {
+        int64_t ox = p % OX, oy = (p / OX) % OY, n = p / (OX * OY);
+        for (int c = 0; c < nIn_; ++c) {
+          for (int j = 0; j < ky_; ++j) {
+            int64_t y = oy * sy_ - py + j * dy_;
+            for (int i = 0; i < kx_; ++i) {
+              int64_t xi = ox * sx_ - px + i * dx_;
+              bool inside = xi >= 0 && xi < X && y >= 0 && y < Y;
+              patch[i + kx_ * (j + ky_ * c)] = inside
+                  ? q[xi + X * (y + Y * (c + nIn_ * n))]
+                  : 0;
+            }
+          }
+        }
+        column = patch.data();
+        outBase = ox + OX * (oy + OY * outChannels * n);
+        outStride = OX * OY;
+      }
+
+      for (int o = 0; o < nOut_; ++o) {
+        const int8_t* w = weight_.data() + o * K;
+        int32_t sum = 0;
+        for (int64_t k = 0; k < K; ++k) {
+          sum += static_cast<int32_t>(w[k]) * static_cast<int32_t>(column[k]);
+        }
+        acc[o] = sum * inputScale_ * weightScale_[o] +
+            (bias_.empty() ? 0.0f : bias_[o]);
+      }
+
+      for (int o = 0; o < outChannels; ++o) {
+        float v = acc[o];
+        if (epilogue == QuantEpilogue::RELU) {
+          v = std::max(v, 0.0f);
+        } else if (epilogue == QuantEpilogue::GLU) {
+          v = v / (1.0f + std::exp(-acc[o + outChannels]));
+        }
+        out[outBase + o * outStride] = v;
+      }
+    }
+  }
+  return fl::Variable(af::array(odims, out.data()), false);
+}
+
+std::string QuantizedConv::prettyString() const {
+  std::ostringstream ss;
+  if (linear_) {
+    ss << "QuantizedLinear (int8 " << nIn_ << "->" << nOut_ << ")";
+  } else {
+    ss << "QuantizedConv2D (int8 " << nIn_ << "->" << nOut_ << ", " << kx_
+       << "x" << ky_ << ", " << sx_ << "," << sy_ << ", " << px_ << ","
+       << py_ << ", " << dx_ << ", " << dy_ << ")";
+  }
+  auto epilogue = static_cast<QuantEpilogue>(epilogue_);
+  if (epilogue == QuantEpilogue::RELU) {
+    ss << " + ReLU";
+  } else if (epilogue == QuantEpilogue::GLU) {
+    ss << " + GLU";
+  }
+  return ss.str();
+}
+
+std::shared_ptr<fl::Sequential> quantizeW2lSeqModule(
+    std::shared_ptr<fl::Sequential> net,
+    const std::vector<std::string>& archLines,
+    const std::vector<af::array>& calibration) {
+  net->eval();
+  auto modules = net->modules();
+
+  auto specs = getW2lModuleSpecs(archLines);
+  if (specs.size() != modules.size()) {
+    throw std::invalid_argument(
+        "quantizeW2lSeqModule: arch has " + std::to_string(specs.size()) +
+        " layers but the network " + std::to_string(modules.size()));
+  }
+
+  // largest absolute input of every top-level module
+  std::vector<float> ranges(modules.size(), 0.0);
+  for (const auto& input : calibration) {
+    fl::Variable x(input, false);
+    for (size_t k = 0; k < modules.size(); ++k) {
+      ranges[k] = std::max(ranges[k], af::max<float>(af::abs(x.array())));
+      x = modules[k]->forward({x}).front();
+    }
+  }
+
+  auto qnet = std::make_shared<fl::Sequential>();
+  for (size_t k = 0; k < modules.size(); ++k) {
+    auto spec = specs[k];
+    auto module = modules[k];
+    if (spec[0] == "DO") {
+      continue; // identity at inference
+    }
+
+    auto params = module->params();
+    af::array weight, bias;
+    if (spec[0] == "WN" && std::dynamic_pointer_cast<fl::WeightNorm>(module)) {
+      weight = foldWeightNorm(params[0].array(), params[1].array());
+      if (params.size() > 2) {
+        bias = params[2].array();
+      }
+      spec.erase(spec.begin(), spec.begin() + 2);
+    } else if (
+        std::dynamic_pointer_cast<fl::Conv2D>(module) ||
+        std::dynamic_pointer_cast<fl::Linear>(module)) {
+      weight = params[0].array();
+      if (params.size() > 1) {
+        bias = params[1].array();
+      }
+    }
+
+    auto at = [&spec](size_t i, int dflt) {
+      return spec.size() > i ? std::stoi(spec[i]) : dflt;
+    };
+    std::shared_ptr<QuantizedConv> qmodule;
+    int channelDim = 2;
+    if (weight.isempty()) {
+      // not a (weight normed) conv or linear layer
+    } else if (spec[0] == "C" || spec[0] == "C1") {
+      qmodule = std::make_shared<QuantizedConv>(
+          weight, bias, at(4, 1), 1, at(5, 0), 0, at(6, 1), 1, ranges[k]);
+    } else if (spec[0] == "C2") {
+      qmodule = std::make_shared<QuantizedConv>(
+          weight,
+          bias,
+          at(5, 1),
+          at(6, 1),
+          at(7, 0),
+          at(8, 0),
+          at(9, 1),
+          at(10, 1),
+          ranges[k]);
+    } else if (spec[0] == "L") {
+      qmodule = std::make_shared<QuantizedConv>(weight, bias, ranges[k]);
+      channelDim = 0;
+    }
+    if (!qmodule) {
+      qnet->add(module);
+      continue;
+    }
+
+    if (k + 1 < modules.size()) {
+      const auto& next = specs[k + 1];
+      if (next[0] == "R") {
+        qmodule->setEpilogue(QuantEpilogue::RELU);
+        ++k;
+      } else if (next[0] == "GLU" && std::stoi(next[1]) == channelDim) {
+        qmodule->setEpilogue(QuantEpilogue::GLU);
+        ++k;
+      }
+    }
+    qnet->add(qmodule);
+  }
+  qnet->eval();
+  return qnet;
+}
+
+} // namespace w2l
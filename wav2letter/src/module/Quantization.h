@@ -0,0 +1,110 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <flashlight/flashlight.h>
+
+namespace w2l {
+
+enum class QuantEpilogue {
+  NONE = 0,
+  RELU = 1,
+  GLU = 2, // over the output channels
+};
+
+/**
+ * int8 replacement for the Conv2D (C, C1, C2) and Linear (L) layers, run on
+ * the host.
+ *
+ * Weights are quantized symmetrically per output channel, activations
+ * symmetrically per tensor with the range found during calibration. Products
+ * are accumulated in int32 and rescaled to float together with the bias, and
+ * a following ReLU or GLU can be fused into that epilogue. The module has no
+ * parameters; the int8 weights are part of its serialized state.
+ */
+class QuantizedConv : public fl::UnaryModule {
+ public:
+  /**
+   * Conv2D with a kx x ky x Cin x Cout weight and Cout biases (or an empty
+   * bias). Strides, paddings (-1 is SAME) and dilations as in fl::Conv2D.
+   * `inputRange` is the largest absolute input seen during calibration.
+   */
+  QuantizedConv(
+      const af::array& weight,
+      const af::array& bias,
+      int sx,
+      int sy,
+      int px,
+      int py,
+      int dx,
+      int dy,
+      float inputRange);
+
+  // Linear with a Cout x Cin weight and Cout biases (or an empty bias)
+  QuantizedConv(
+      const af::array& weight,
+      const af::array& bias,
+      float inputRange);
+
+  void setEpilogue(QuantEpilogue epilogue);
+
+  fl::Variable forward(const fl::Variable& input) override;
+
+  std::string prettyString() const override;
+
+ private:
+  QuantizedConv() = default; // Intentionally private
+
+  void quantizeWeight(const std::vector<float>& weight, int64_t K);
+
+  bool linear_{false};
+  int nIn_{0}, nOut_{0};
+  int kx_{1}, ky_{1}, sx_{1}, sy_{1}, px_{0}, py_{0}, dx_{1}, dy_{1};
+  std::vector<int8_t> weight_; // nOut x (kx * ky * nIn), row-major
+  std::vector<float> weightScale_;
+  std::vector<float> bias_;
+  float inputScale_{1.0};
+  int epilogue_{0};
+
+  FL_SAVE_LOAD_WITH_BASE(
+      fl::UnaryModule,
+      linear_,
+      nIn_,
+      nOut_,
+      kx_,
+      ky_,
+      sx_,
+      sy_,
+      px_,
+      py_,
+      dx_,
+      dy_,
+      weight_,
+      weightScale_,
+      bias_,
+      inputScale_,
+      epilogue_)
+};
+
+/**
+ * Post-training int8 quantization of a network built by createW2lSeqModule
+ * from `archLines` (see getW2lArchLines). Top-level C, C1, C2, L layers, also
+ * wrapped in WN, become `QuantizedConv`s with ranges calibrated on the
+ * normalized `calibration` inputs; a directly following R, or GLU over the
+ * output channels, is fused. DO layers are dropped. Everything else, e.g.
+ * RES blocks, RNNs and normalizations, is kept as the float module.
+ */
+std::shared_ptr<fl::Sequential> quantizeW2lSeqModule(
+    std::shared_ptr<fl::Sequential> net,
+    const std::vector<std::string>& archLines,
+    const std::vector<af::array>& calibration);
+
+} // namespace w2l
+
+CEREAL_REGISTER_TYPE(w2l::QuantizedConv)
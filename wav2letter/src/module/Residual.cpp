@@ -6,6 +6,7 @@
  * The complete license agreement can be obtained at:
  * http://arrayfire.com/licenses/BSD-3-Clause
  ********************************************************/
+#include <algorithm>
 #include <stdexcept>
 
 #include "module/Residual.h"
@@ -25,6 +26,45 @@ void Residual::addShortcut(int startId, int endId) {
 
   shortcut_[endId - 1].insert(startId);
   reverseShortcut_[startId].insert(endId - 1);
+  planLiveness();
+}
+
+void Residual::planLiveness() {
+  lastUse_.assign(shortcut_.size(), -1);
+  for (int end = 0; end < shortcut_.size(); ++end) {
+    for (auto start : shortcut_[end]) {
+      lastUse_[start] = std::max(lastUse_[start], end);
+    }
+  }
+}
+
+Variable Residual::addShortcuts(
+    const Variable& output,
+    std::vector<Variable>& outputs,
+    int idx) const {
+  const auto& starts = shortcut_[idx];
+  if (starts.empty()) {
+    return output;
+  }
+  std::vector<Variable> inputs = {output};
+  af::array sum = output.array();
+  for (auto id : starts) {
+    inputs.push_back(outputs[id]);
+    sum += outputs[id].array();
+    if (lastUse_[id] == idx) {
+      outputs[id] = Variable();
+    }
+  }
+  // a single node for all connections rather than a chain of partial sums
+  auto gradFunc = [](std::vector<Variable>& inputs,
+                     const Variable& gradOutput) {
+    for (auto& in : inputs) {
+      if (in.isCalcGrad()) {
+        in.addGrad(Variable(gradOutput.array(), false));
+      }
+    }
+  };
+  return Variable(sum, inputs, gradFunc);
 }
 
 std::vector<Variable> Residual::forward(const std::vector<Variable>& inputs) {
@@ -35,24 +75,24 @@ std::vector<Variable> Residual::forward(const std::vector<Variable>& inputs) {
 }
 
 Variable Residual::forward(const Variable& input) {
+  if (lastUse_.size() != shortcut_.size()) {
+    planLiveness(); // after load
+  }
   Variable output = input;
   std::vector<Variable> outputs(shortcut_.size(), Variable());
-  outputs[0] = input;
+  if (lastUse_[0] >= 0) {
+    outputs[0] = input;
+  }
 
   for (int idx = 0; idx < modules_.size(); ++idx) {
-    for (auto id : shortcut_[idx]) {
-      output = output + outputs[id];
-    }
-
+    output = addShortcuts(output, outputs, idx);
     output = modules_[idx]->forward({output}).front();
-    outputs[idx + 1] = output;
-  }
-
-  for (auto id : shortcut_.back()) {
-    output = output + outputs[id];
+    if (idx + 1 < outputs.size() && lastUse_[idx + 1] >= 0) {
+      outputs[idx + 1] = output;
+    }
   }
 
-  return output;
+  return addShortcuts(output, outputs, shortcut_.size() - 1);
 }
 
 std::string Residual::prettyString() const {
@@ -22,6 +22,10 @@ namespace w2l {
  * (1) addShortcut(0, 3) adds a skip connection from the input to the residual
  * block to layer3,
  * (2) addShortcut(2, 5) adds a skip connection from layer2 to the final output
+ *
+ * Only outputs read by a skip connection are kept during forward, and each is
+ * released right after its last reader; all connections ending at the same
+ * layer are summed in one step.
  */
 class Residual : public fl::Container {
  private:
@@ -30,6 +34,17 @@ class Residual : public fl::Container {
   std::vector<std::unordered_set<int>> shortcut_; // start -> end
   std::vector<std::set<int>> reverseShortcut_; // end -> start
 
+  // output id -> last layer whose input reads it, -1 if none. Not serialized,
+  // derived from `shortcut_` on first use
+  std::vector<int> lastUse_;
+
+  void planLiveness();
+
+  fl::Variable addShortcuts(
+      const fl::Variable& output,
+      std::vector<fl::Variable>& outputs,
+      int idx) const;
+
   FL_SAVE_LOAD_WITH_BASE(fl::Container, shortcut_, reverseShortcut_)
 
  public:
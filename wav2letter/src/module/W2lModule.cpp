@@ -32,15 +32,12 @@ std::shared_ptr<Module> parseLines(
 
 namespace w2l {
 
-std::shared_ptr<Sequential> createW2lSeqModule(
+std::vector<std::string> getW2lArchLines(
     const std::string& archfile,
     int64_t nFeatures,
     int64_t nClasses) {
-  auto net = std::make_shared<Sequential>();
   auto layers = getFileContent(archfile);
-  int numLinesParsed = 0;
 
-  // preprocess
   std::vector<std::string> processedLayers;
   for (auto& l : layers) {
     std::string lrepl = trim(l);
@@ -52,6 +49,18 @@ std::shared_ptr<Sequential> createW2lSeqModule(
     }
     processedLayers.emplace_back(lrepl);
   }
+  return processedLayers;
+}
+
+std::shared_ptr<Sequential> createW2lSeqModule(
+    const std::string& archfile,
+    int64_t nFeatures,
+    int64_t nClasses) {
+  auto net = std::make_shared<Sequential>();
+  int numLinesParsed = 0;
+
+  // preprocess
+  auto processedLayers = getW2lArchLines(archfile, nFeatures, nClasses);
 
   int lid = 0;
   while (lid < processedLayers.size()) {
@@ -12,6 +12,12 @@
 
 namespace w2l {
 
+// Lines of an arch file with NFEAT/NLABEL substituted, comments dropped
+std::vector<std::string> getW2lArchLines(
+    const std::string& archfile,
+    int64_t nFeatures,
+    int64_t nClasses);
+
 std::shared_ptr<fl::Sequential> createW2lSeqModule(
     const std::string& archfile,
     int64_t nFeatures,
@@ -0,0 +1,153 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * Peak memory benchmark of a deep Residual block.
+ *
+ * Builds a --bench_layers deep block of C + R pairs with a skip connection
+ * around every --bench_skip layers plus one from the input to the output, and
+ * records the ArrayFire memory in use after every layer of the forward pass,
+ * in eval mode and in train mode (where the backward pass follows). The peak
+ * over layers is printed and optionally written to --bench_output as JSON, to
+ * be compared between builds.
+ *
+ * Example:
+ *   ResidualBenchmark --bench_T=1000 --bench_channels=256
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <arrayfire.h>
+#include <flashlight/flashlight.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "common/Utils.h"
+#include "module/module.h"
+
+using namespace fl;
+using namespace w2l;
+
+DEFINE_int64(bench_layers, 20, "number of layers in the residual block");
+DEFINE_int64(bench_skip, 4, "layers spanned by each skip connection");
+DEFINE_int64(bench_channels, 128, "conv channels");
+DEFINE_int64(bench_T, 1000, "input length");
+DEFINE_int64(bench_B, 4, "batch size");
+DEFINE_int64(bench_device, -1, "ArrayFire device to use, -1 for default");
+DEFINE_string(bench_output, "", "write results as JSON to this file");
+
+namespace {
+
+double deviceMb() {
+  size_t allocBytes, allocBuffers, lockBytes, lockBuffers;
+  af::deviceMemInfo(&allocBytes, &allocBuffers, &lockBytes, &lockBuffers);
+  return lockBytes / (1024.0 * 1024.0);
+}
+
+// Identity that records the memory in use once its input is computed
+class MemoryProbe : public UnaryModule {
+ public:
+  explicit MemoryProbe(double* peakMb) : peakMb_(peakMb) {}
+
+  Variable forward(const Variable& input) override {
+    input.array().eval();
+    af::sync();
+    *peakMb_ = std::max(*peakMb_, deviceMb());
+    return input;
+  }
+
+  std::string prettyString() const override {
+    return "MemoryProbe";
+  }
+
+ private:
+  double* peakMb_;
+};
+
+} // namespace
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  if (FLAGS_bench_device >= 0) {
+    af::setDevice(FLAGS_bench_device);
+  }
+  af::info();
+
+  double peakMb = 0;
+  int L = FLAGS_bench_layers, C = FLAGS_bench_channels;
+  Residual block(L);
+  for (int i = 0; i < L; ++i) {
+    Sequential layer;
+    if (i % 2 == 0) {
+      layer.add(Conv2D(C, C, 5, 1, 1, 1, -1, 0));
+    } else {
+      layer.add(ReLU());
+    }
+    layer.add(MemoryProbe(&peakMb));
+    block.add(layer);
+  }
+  int skip = FLAGS_bench_skip;
+  for (int start = 0; start + skip <= L; start += skip) {
+    block.addShortcut(start, start + skip);
+  }
+  block.addShortcut(0, L + 1);
+  LOG(INFO) << block.prettyString();
+
+  auto input = af::randn(FLAGS_bench_T, 1, C, FLAGS_bench_B);
+  double inputMb = input.bytes() / (1024.0 * 1024.0);
+
+  auto run = [&](bool train) {
+    af::deviceGC();
+    double baseMb = deviceMb();
+    peakMb = baseMb;
+    if (train) {
+      block.train();
+    } else {
+      block.eval();
+    }
+    auto start = af::timer::start();
+    auto output = block.forward(Variable(input, train));
+    if (train) {
+      output.backward();
+    }
+    output.array().eval();
+    af::sync();
+    double ms = af::timer::stop(start) * 1000.0;
+    peakMb = std::max(peakMb, deviceMb());
+    block.zeroGrad();
+    return std::make_pair(peakMb - baseMb, ms);
+  };
+
+  run(false); // warmup
+  auto eval = run(false);
+  auto train = run(true);
+  std::cout << "Residual " << L << " layers, " << C << " channels, T "
+            << FLAGS_bench_T << ", B " << FLAGS_bench_B << " (input "
+            << inputMb << " MB)\n"
+            << "eval  peak " << eval.first << " MB, " << eval.second
+            << " ms\n"
+            << "train peak " << train.first << " MB, " << train.second << " ms"
+            << std::endl;
+
+  if (!FLAGS_bench_output.empty()) {
+    std::ofstream out(FLAGS_bench_output);
+    out << "{\"layers\": " << L << ", \"channels\": " << C
+        << ", \"T\": " << FLAGS_bench_T << ", \"B\": " << FLAGS_bench_B
+        << ", \"eval_peak_mb\": " << eval.first
+        << ", \"eval_ms\": " << eval.second
+        << ", \"train_peak_mb\": " << train.first
+        << ", \"train_ms\": " << train.second << "}\n";
+    LOG(INFO) << "Results written to " << FLAGS_bench_output;
+  }
+  return 0;
+}
@@ -0,0 +1,171 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * Benchmark of inference through the trained modules vs the InferenceGraph
+ * compiled from the same network.
+ *
+ * Builds every --bench_archs network with random weights and, for each input
+ * length in --bench_T and batch size in --bench_B, times the eval-mode
+ * forward of the fl::Sequential and of the InferenceGraph after
+ * --bench_warmup untimed runs. Median timings, the speedup and the largest
+ * output difference are printed and optionally written to --bench_output as
+ * JSON.
+ *
+ * Example:
+ *   W2lModuleBenchmark --bench_T=500 --bench_B=1 --bench_output=graph.json
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <arrayfire.h>
+#include <flashlight/flashlight.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "common/Utils.h"
+#include "module/module.h"
+
+using namespace fl;
+using namespace w2l;
+
+#ifndef MODULE_BENCHMARK_ARCHDIR
+#define MODULE_BENCHMARK_ARCHDIR "."
+#endif
+
+DEFINE_string(
+    bench_archdir,
+    MODULE_BENCHMARK_ARCHDIR,
+    "directory --bench_archs are relative to");
+DEFINE_string(
+    bench_archs,
+    "recipes/timit/configs/conv_relu/network.arch,"
+    "recipes/wsj/configs/conv_glu/network.arch,"
+    "recipes/librispeech/config/conv_glu/network.arch,"
+    "tutorials/1-librispeech_clean/network.arch",
+    "comma-separated list of arch files to benchmark");
+DEFINE_int64(bench_nfeat, 40, "number of input features (NFEAT)");
+DEFINE_int64(bench_nlabel, 30, "number of output classes (NLABEL)");
+DEFINE_string(bench_T, "200,1000", "comma-separated list of input lengths");
+DEFINE_string(bench_B, "1,4", "comma-separated list of batch sizes");
+DEFINE_int64(bench_warmup, 3, "untimed iterations before measuring");
+DEFINE_int64(bench_iters, 10, "timed iterations per case");
+DEFINE_int64(bench_device, -1, "ArrayFire device to use, -1 for default");
+DEFINE_string(bench_output, "", "write results as JSON to this file");
+
+namespace {
+
+struct BenchResult {
+  std::string name;
+  int T, B;
+  int modules, ops;
+  double moduleMs, graphMs; // medians
+  double maxDiff;
+};
+
+std::vector<int> parseInts(const std::string& str) {
+  std::vector<int> res;
+  for (const auto& tok : split(',', str, true)) {
+    res.push_back(std::stoi(tok));
+  }
+  return res;
+}
+
+double medianMs(const std::function<void()>& step) {
+  for (int i = 0; i < FLAGS_bench_warmup; ++i) {
+    step();
+  }
+  af::sync();
+  std::vector<double> times;
+  for (int i = 0; i < FLAGS_bench_iters; ++i) {
+    auto s = af::timer::start();
+    step();
+    af::sync();
+    times.push_back(af::timer::stop(s) * 1000.0);
+  }
+  std::sort(times.begin(), times.end());
+  return times[times.size() / 2];
+}
+
+void writeJson(std::ostream& os, const std::vector<BenchResult>& results) {
+  os << "{\n  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto& r = results[i];
+    os << "    {\"name\": \"" << r.name << "\", \"T\": " << r.T
+       << ", \"B\": " << r.B << ", \"modules\": " << r.modules
+       << ", \"ops\": " << r.ops << std::fixed << std::setprecision(4)
+       << ", \"module_ms\": " << r.moduleMs << ", \"graph_ms\": " << r.graphMs
+       << ", \"max_diff\": " << r.maxDiff << "}"
+       << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  os << "  ]\n}\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  if (FLAGS_bench_device >= 0) {
+    af::setDevice(FLAGS_bench_device);
+  }
+  af::info();
+
+  std::vector<BenchResult> results;
+  for (const auto& arch : split(',', FLAGS_bench_archs, true)) {
+    auto archfile = pathsConcat(FLAGS_bench_archdir, arch);
+    auto net =
+        createW2lSeqModule(archfile, FLAGS_bench_nfeat, FLAGS_bench_nlabel);
+    net->eval();
+    InferenceGraph graph(
+        net,
+        getW2lArchLines(archfile, FLAGS_bench_nfeat, FLAGS_bench_nlabel));
+    LOG(INFO) << archfile << "\n" << graph.prettyString();
+
+    for (int T : parseInts(FLAGS_bench_T)) {
+      for (int B : parseInts(FLAGS_bench_B)) {
+        auto input = af::randn(T, FLAGS_bench_nfeat, 1, B);
+        af::array moduleOut, graphOut;
+        BenchResult r;
+        r.name = format("%s/T=%d/B=%d", arch.c_str(), T, B);
+        r.T = T;
+        r.B = B;
+        r.modules = net->modules().size();
+        r.ops = graph.ops().size();
+        r.moduleMs = medianMs([&]() {
+          moduleOut = net->forward(noGrad(input)).array();
+          moduleOut.eval();
+        });
+        r.graphMs = medianMs([&]() {
+          graphOut = graph.forward(input);
+          graphOut.eval();
+        });
+        r.maxDiff = af::max<float>(af::abs(moduleOut - graphOut));
+        results.push_back(r);
+        std::cout << std::left << std::setw(64) << r.name << std::fixed
+                  << std::setprecision(3) << " modules " << r.moduleMs
+                  << " ms, graph " << r.graphMs << " ms (x"
+                  << r.moduleMs / r.graphMs << "), max diff " << r.maxDiff
+                  << std::endl;
+      }
+    }
+  }
+
+  if (!FLAGS_bench_output.empty()) {
+    std::ofstream out(FLAGS_bench_output);
+    writeJson(out, results);
+    LOG(INFO) << "Results written to " << FLAGS_bench_output;
+  }
+  return 0;
+}
@@ -8,5 +8,8 @@
 
 #pragma once
 
+#include "module/FrequencyBlur.h"
+#include "module/InferenceGraph.h"
+#include "module/Quantization.h"
 #include "module/Residual.h"
 #include "module/W2lModule.h"
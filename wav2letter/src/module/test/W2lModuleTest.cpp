@@ -6,6 +6,10 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <cmath>
+#include <fstream>
+#include <functional>
+
 #include <gtest/gtest.h>
 
 #include <arrayfire.h>
@@ -21,6 +25,44 @@ namespace {
 
 std::string archDir = "";
 
+using JacobianFunc = std::function<Variable(Variable&)>;
+void jacobianTest(
+    JacobianFunc func,
+    Variable& input,
+    float precision = 1E-3,
+    float perturbation = 1E-2) {
+  auto fwdJacobian =
+      af::array(func(input).elements(), input.elements(), af::dtype::f32);
+  for (int i = 0; i < input.elements(); ++i) {
+    af::array orig = input.array()(i);
+    input.array()(i) = orig - perturbation;
+    auto outa = func(input).array();
+    input.array()(i) = orig + perturbation;
+    auto outb = func(input).array();
+    input.array()(i) = orig;
+    fwdJacobian(af::span, i) =
+        af::moddims((outb - outa), outa.elements()) * 0.5 / perturbation;
+  }
+
+  auto bwdJacobian =
+      af::array(func(input).elements(), input.elements(), af::dtype::f32);
+  auto dout = Variable(af::constant(0, func(input).dims()), false);
+  for (int i = 0; i < dout.elements(); ++i) {
+    dout.array()(i) = 1;
+    input.zeroGrad();
+    func(input).backward(dout);
+    bwdJacobian(i, af::span) =
+        af::moddims(input.grad().array(), input.elements());
+    dout.array()(i) = 0;
+  }
+  ASSERT_LE(af::max<float>(af::abs(fwdJacobian - bwdJacobian)), precision);
+}
+
+// Widths in [0.2, 0.8] + {0, 1, 2, 3}, away from the kinks at integers
+af::array randomWidths(const af::dim4& dims) {
+  return af::floor(af::randu(dims) * 4) + 0.2 + 0.6 * af::randu(dims);
+}
+
 } // namespace
 
 TEST(W2lModuleTest, W2lSeqModule) {
@@ -70,6 +112,263 @@ TEST(W2lModuleTest, Serialization) {
   ASSERT_TRUE(allClose(outputl, output));
 }
 
+TEST(W2lModuleTest, ResidualShortcuts) {
+  auto l1 = std::make_shared<Linear>(6, 6);
+  auto l2 = std::make_shared<Tanh>();
+  auto l3 = std::make_shared<Linear>(6, 6);
+  auto l4 = std::make_shared<Tanh>();
+  Residual res(4);
+  res.add(l1);
+  res.add(l2);
+  res.add(l3);
+  res.add(l4);
+  // outputs 0 and 1 have several readers, 2 is read by the final output
+  res.addShortcut(0, 2);
+  res.addShortcut(0, 5);
+  res.addShortcut(1, 3);
+  res.addShortcut(1, 4);
+  res.addShortcut(2, 5);
+
+  auto reference = [&](const Variable& x) {
+    auto o1 = l1->forward(x);
+    auto o2 = l2->forward(o1 + x);
+    auto o3 = l3->forward(o2 + o1);
+    auto o4 = l4->forward(o3 + o1);
+    return o4 + x + o2;
+  };
+
+  auto input = Variable(af::randn(6, 5, 2), true);
+  ASSERT_TRUE(allClose(res.forward(input), reference(input), 1E-5));
+
+  auto fn = [&](Variable& in) { return res.forward(in); };
+  ASSERT_NO_FATAL_FAILURE(jacobianTest(fn, input));
+
+  // the same gradients reach the weights as through the reference
+  res.forward(input).backward();
+  auto grad = l1->param(0).grad().array();
+  res.zeroGrad();
+  input.zeroGrad();
+  reference(input).backward();
+  ASSERT_TRUE(allClose(grad, l1->param(0).grad().array(), 1E-5));
+}
+
+TEST(W2lModuleTest, FrequencyBlurFwd) {
+  const int K = 20, T = 6;
+  auto input = af::randn(K, T);
+  auto mask = randomWidths(input.dims());
+  mask(3, 2) = -1.0; // pass-through bin
+
+  // dense reference from the per-bin formula in Train_expandm.cpp
+  std::vector<float> x(K * T), m(K * T), expected(K * T);
+  input.host(x.data());
+  mask.host(m.data());
+  for (int j = 0; j < T; ++j) {
+    for (int i = 0; i < K; ++i) {
+      float sum = x[j * K + i];
+      for (int p = 0; p < K; ++p) {
+        float mp = m[j * K + p], xp = x[j * K + p];
+        float f = std::floor(mp);
+        float norm = f * (2 * mp - f - 1) + mp;
+        if (std::abs(p - i) < mp) {
+          sum += (p == i) ? xp * (mp - norm) / norm
+                          : xp * (mp - std::abs(i - p)) / norm;
+        }
+      }
+      expected[j * K + i] = sum;
+    }
+  }
+  auto output = frequencyBlur(noGrad(input), noGrad(mask));
+  ASSERT_TRUE(allClose(output.array(), af::array(K, T, expected.data()), 1E-5));
+
+  // weights sum to one, only the edge bins leak past the ends
+  auto narrow = af::constant(1.5, K, T);
+  auto blurred = frequencyBlur(noGrad(input), noGrad(narrow)).array();
+  auto leaked = 0.2 * (input.row(0) + input.row(K - 1));
+  ASSERT_TRUE(allClose(af::sum(blurred, 0), af::sum(input, 0) - leaked, 1E-4));
+}
+
+TEST(W2lModuleTest, FrequencyBlurGrad) {
+  const int K = 8, T = 3;
+  auto input = Variable(af::randn(K, T), true);
+  auto mask = Variable(randomWidths(input.dims()), true);
+
+  auto fnInput = [&](Variable& in) { return frequencyBlur(in, mask); };
+  ASSERT_NO_FATAL_FAILURE(jacobianTest(fnInput, input));
+
+  auto fnMask = [&](Variable& m) { return frequencyBlur(input, m); };
+  ASSERT_NO_FATAL_FAILURE(jacobianTest(fnMask, mask));
+
+  // module shares its widths over channels and batch
+  FrequencyBlur blur(mask);
+  auto batched = Variable(af::tile(input.array(), 1, 1, 2, 3), false);
+  auto out = blur.forward(batched);
+  ASSERT_EQ(out.dims(), batched.dims());
+  ASSERT_TRUE(allClose(
+      out.array()(af::span, af::span, 1, 2),
+      frequencyBlur(input, mask).array()));
+}
+
+TEST(W2lModuleTest, InferenceGraph) {
+  char* user = getenv("USER");
+  std::string userstr = "unknown";
+  if (user != nullptr) {
+    userstr = std::string(user);
+  }
+  const std::string archfile = "/tmp/" + userstr + "_graph_arch.txt";
+  {
+    std::ofstream arch(archfile);
+    arch << "V -1 1 NFEAT 0\n"
+         << "WN 3 C NFEAT 8 3 1 -1\n"
+         << "GLU 2\n"
+         << "DO 0.2\n"
+         << "C2 4 6 3 1 2 1 -1 0\n"
+         << "BN 6 2\n"
+         << "R\n"
+         << "C 6 6 3 1 -1\n"
+         << "PR\n"
+         << "RO 2 0 3 1\n"
+         << "L 6 10\n"
+         << "T\n"
+         << "L 10 NLABEL\n";
+  }
+
+  int C = 5, N = 7, T = 40;
+  auto model = createW2lSeqModule(archfile, C, N);
+  // non-trivial BN running statistics
+  model->train();
+  model->forward(noGrad(af::randn(T, C, 1, 3) * 2 + 1));
+  model->eval();
+  InferenceGraph graph(model, getW2lArchLines(archfile, C, N));
+
+  // WN, BN and activations folded, DO dropped, RO elided
+  const auto& ops = graph.ops();
+  ASSERT_EQ(ops.size(), 6);
+  ASSERT_EQ(ops[0].type, InferenceOpType::MODULE);
+  ASSERT_EQ(ops[1].type, InferenceOpType::CONV);
+  ASSERT_EQ(ops[1].epilogue, InferenceEpilogue::GLU);
+  ASSERT_EQ(ops[2].type, InferenceOpType::CONV);
+  ASSERT_EQ(ops[2].epilogue, InferenceEpilogue::RELU);
+  ASSERT_EQ(ops[3].epilogue, InferenceEpilogue::PRELU);
+  ASSERT_EQ(ops[4].type, InferenceOpType::LINEAR);
+  ASSERT_TRUE(ops[4].reorderedInput);
+  ASSERT_EQ(ops[4].epilogue, InferenceEpilogue::TANH);
+  ASSERT_EQ(ops[5].epilogue, InferenceEpilogue::NONE);
+
+  for (int B : {1, 2}) {
+    auto input = af::randn(T, C, 1, B);
+    auto output = model->forward(noGrad(input)).array();
+    auto compiled = graph.forward(input);
+    ASSERT_EQ(compiled.dims(), output.dims());
+    ASSERT_TRUE(allClose(compiled, output, 1E-4));
+  }
+
+  // output frames, with the strided C2 and its SAME padding
+  auto archLines = getW2lArchLines(archfile, C, N);
+  for (int inT : {40, 41, 17}) {
+    auto output = model->forward(noGrad(af::randn(inT, C, 1, 1)));
+    ASSERT_EQ(getW2lOutputFrames(archLines, inT), output.dims(1));
+  }
+  ASSERT_EQ(getW2lOutputFrames({"L 5 5"}, 40), -1);
+
+  auto rnnArch = pathsConcat(archDir, "test_w2l_rnn_arch.txt");
+  ASSERT_THROW(
+      InferenceGraph(model, getW2lArchLines(rnnArch, C, N)),
+      std::invalid_argument);
+}
+
+TEST(W2lModuleTest, QuantizedConv) {
+  const int T = 30, C = 6, N = 10, B = 2;
+  auto input = af::randn(T, 1, C, B);
+  float range = af::max<float>(af::abs(input));
+  // quantization error relative to the output magnitude
+  auto close = [](const af::array& a, const af::array& b) {
+    return allClose(a, b, 0.03 * af::max<float>(af::abs(b)));
+  };
+
+  Conv2D conv(C, N, 5, 1, 2, 1, -1, 0, 1, 1);
+  auto conv1 = conv.forward(noGrad(input)).array();
+  QuantizedConv qconv(
+      conv.param(0).array(), conv.param(1).array(), 2, 1, -1, 0, 1, 1, range);
+  auto qconv1 = qconv.forward(noGrad(input)).array();
+  ASSERT_EQ(qconv1.dims(), conv1.dims());
+  ASSERT_TRUE(close(qconv1, conv1));
+
+  qconv.setEpilogue(QuantEpilogue::GLU);
+  auto glu = gatedlinearunit(Variable(conv1, false), 2).array();
+  ASSERT_EQ(qconv.forward(noGrad(input)).dims(), glu.dims());
+  ASSERT_TRUE(close(qconv.forward(noGrad(input)).array(), glu));
+
+  auto linInput = af::randn(C, T, B);
+  Linear linear(C, N);
+  auto lin = relu(linear.forward(noGrad(linInput))).array();
+  QuantizedConv qlinear(
+      linear.param(0).array(),
+      linear.param(1).array(),
+      af::max<float>(af::abs(linInput)));
+  qlinear.setEpilogue(QuantEpilogue::RELU);
+  auto qlin = qlinear.forward(noGrad(linInput)).array();
+  ASSERT_EQ(qlin.dims(), lin.dims());
+  ASSERT_TRUE(close(qlin, lin));
+}
+
+TEST(W2lModuleTest, QuantizeW2lSeqModule) {
+  char* user = getenv("USER");
+  std::string userstr = "unknown";
+  if (user != nullptr) {
+    userstr = std::string(user);
+  }
+  const std::string archfile = "/tmp/" + userstr + "_quant_arch.txt";
+  const std::string path = "/tmp/" + userstr + "_quant_test.mdl";
+  {
+    std::ofstream arch(archfile);
+    arch << "V -1 1 NFEAT 0\n"
+         << "WN 3 C NFEAT 8 3 1 -1\n"
+         << "GLU 2\n"
+         << "DO 0.2\n"
+         << "C 4 6 3 1 -1\n"
+         << "R\n"
+         << "RO 2 0 3 1\n"
+         << "L 6 NLABEL\n";
+  }
+
+  int C = 5, N = 7, T = 40;
+  auto model = createW2lSeqModule(archfile, C, N);
+  model->eval();
+  std::vector<af::array> calibration;
+  for (int i = 0; i < 4; ++i) {
+    calibration.emplace_back(af::randn(T, C));
+  }
+  auto archLines = getW2lArchLines(archfile, C, N);
+  auto qmodel = quantizeW2lSeqModule(model, archLines, calibration);
+
+  // WN C + GLU, C + R and L quantized, DO dropped, V and RO kept
+  ASSERT_EQ(qmodel->modules().size(), 5);
+  ASSERT_TRUE(std::dynamic_pointer_cast<View>(qmodel->module(0)));
+  ASSERT_TRUE(std::dynamic_pointer_cast<QuantizedConv>(qmodel->module(1)));
+  ASSERT_TRUE(std::dynamic_pointer_cast<QuantizedConv>(qmodel->module(2)));
+  ASSERT_TRUE(std::dynamic_pointer_cast<Reorder>(qmodel->module(3)));
+  ASSERT_TRUE(std::dynamic_pointer_cast<QuantizedConv>(qmodel->module(4)));
+
+  auto input = noGrad(calibration[0]);
+  auto output = model->forward(input).array();
+  auto qoutput = qmodel->forward(input).array();
+  ASSERT_EQ(qoutput.dims(), output.dims());
+  auto tol = 0.05 * af::max<float>(af::abs(output));
+  ASSERT_TRUE(allClose(qoutput, output, tol));
+
+  save(path, qmodel);
+  std::shared_ptr<Sequential> loaded;
+  load(path, loaded);
+  ASSERT_TRUE(allClose(loaded->forward(input).array(), qoutput));
+
+  ASSERT_THROW(
+      quantizeW2lSeqModule(
+          model,
+          std::vector<std::string>(archLines.begin(), archLines.end() - 1),
+          calibration),
+      std::invalid_argument);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
 
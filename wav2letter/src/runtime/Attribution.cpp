@@ -0,0 +1,159 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "runtime/Attribution.h"
+
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "common/Trace.h"
+#include "runtime/Optimizer.h"
+
+namespace w2l {
+
+namespace {
+
+// fl::Module has no getter for its train/eval mode
+struct ModuleMode : fl::Module {
+  static bool isTrain(const fl::Module& module) {
+    return module.*(&ModuleMode::train_);
+  }
+};
+
+} // namespace
+
+MaskAttributionOptions MaskAttributionOptions::fromFlags() {
+  MaskAttributionOptions opts;
+  opts.mode = FLAGS_attrmode;
+  opts.optimizer = FLAGS_attroptim;
+  opts.iterations = FLAGS_attriters;
+  opts.numNoise = FLAGS_attrnoise;
+  opts.syncInterval = FLAGS_attrsync;
+  opts.lrStep = FLAGS_attrlrstep;
+  opts.noiseStd = FLAGS_attrnoisestd;
+  opts.lambda = FLAGS_attrlambda;
+  opts.lr = FLAGS_attrlr;
+  opts.lrDecay = FLAGS_attrlrdecay;
+  return opts;
+}
+
+MaskAttribution::MaskAttribution(
+    std::shared_ptr<fl::Module> network,
+    const MaskAttributionOptions& opts)
+    : network_(network), opts_(opts) {
+  if (opts_.mode != kNoiseMask && opts_.mode != kAdditiveMask) {
+    LOG(FATAL) << "Unknown attribution mode '" << opts_.mode << "'";
+  }
+  if (opts_.numNoise < 1 || opts_.syncInterval < 1) {
+    LOG(FATAL) << "attribution needs numNoise >= 1 and syncInterval >= 1";
+  }
+}
+
+af::array MaskAttribution::run(
+    const af::array& input,
+    const std::function<void(const MaskAttributionStats&)>& onSync) {
+  if (input.dims(3) != 1) {
+    LOG(FATAL) << "MaskAttribution expects a single sample, got dims "
+               << input.dims();
+  }
+  const int64_t K = opts_.numNoise;
+  const af::dim4 batchDims(input.dims(0), input.dims(1), input.dims(2), K);
+
+  // The network is only used as a fixed function of its input: no dropout,
+  // batch statistics or parameter gradients.
+  auto params = network_->params();
+  std::vector<bool> calcGrad;
+  for (auto& p : params) {
+    calcGrad.push_back(p.isCalcGrad());
+    p.setCalcGrad(false);
+  }
+  bool wasTrain = ModuleMode::isTrain(*network_);
+  network_->eval();
+
+  auto refOutput = network_->forward({fl::Variable(input, false)}).front();
+  auto refTiled = fl::Variable(af::tile(refOutput.array(), 1, 1, 1, K), false);
+  auto inputTiled = fl::Variable(af::tile(input, 1, 1, 1, K), false);
+
+  auto mask = fl::Variable(af::constant(1.0, input.dims()), true);
+  auto opt = initOptimizer({mask}, opts_.optimizer, opts_.lr, 0.0, 0.0);
+
+  // running sums stay on the device until the next sync
+  af::array fitSum = af::constant(0.0, 1);
+  af::array maskSum = af::constant(0.0, 1);
+  int64_t numSummed = 0;
+
+  for (int64_t i = 0; i < opts_.iterations; ++i) {
+    W2L_TRACE_SCOPE("attribution/step");
+    if (opts_.lrStep > 0 && (i + 1) % opts_.lrStep == 0) {
+      opt->setLr(opt->getLr() * opts_.lrDecay);
+    }
+
+    auto noise = fl::Variable(af::randn(batchDims) * opts_.noiseStd, false);
+    auto maskTiled = fl::tile(mask, af::dim4(1, 1, 1, K));
+    fl::Variable perturbed, fitLoss, maskLoss;
+    {
+      W2L_TRACE_SCOPE("attribution/forward");
+      if (opts_.mode == kNoiseMask) {
+        perturbed = inputTiled + maskTiled * noise;
+      } else {
+        perturbed = inputTiled + maskTiled + noise;
+      }
+      auto output = network_->forward({perturbed}).front();
+      auto diff = fl::flat(output - refTiled);
+      fitLoss = fl::sum(diff * diff, {0}) / static_cast<double>(K);
+      maskLoss = opts_.lambda * fl::sum(fl::flat(fl::log(mask * mask)), {0});
+    }
+    auto loss = fitLoss - maskLoss;
+
+    opt->zeroGrad();
+    {
+      W2L_TRACE_SCOPE("attribution/backward");
+      loss.backward();
+    }
+    {
+      W2L_TRACE_SCOPE("attribution/optimizer");
+      opt->step();
+    }
+    Tracer::count("attribution/samples", K);
+
+    fitSum += fitLoss.array();
+    maskSum += maskLoss.array();
+    ++numSummed;
+
+    if ((i + 1) % opts_.syncInterval == 0 || i + 1 == opts_.iterations) {
+      W2L_TRACE_SCOPE("attribution/sync");
+      MaskAttributionStats stats;
+      stats.iteration = i + 1;
+      stats.fitLoss = fitSum.scalar<float>() / numSummed;
+      stats.maskLoss = maskSum.scalar<float>() / numSummed;
+      stats.loss = stats.fitLoss - stats.maskLoss;
+      stats.maskMean = af::mean<float>(mask.array());
+      // NaNs propagate into the sums, so checking once per sync is enough
+      if (std::isnan(stats.loss)) {
+        LOG(FATAL) << "Attribution loss has NaN values at iteration " << i + 1;
+      }
+      if (onSync) {
+        onSync(stats);
+      }
+      fitSum = af::constant(0.0, 1);
+      maskSum = af::constant(0.0, 1);
+      numSummed = 0;
+    }
+  }
+
+  for (size_t i = 0; i < params.size(); ++i) {
+    params[i].setCalcGrad(calcGrad[i]);
+  }
+  if (wasTrain) {
+    network_->train();
+  }
+  return mask.array();
+}
+
+} // namespace w2l
@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <flashlight/flashlight.h>
+
+#include "common/Defines.h"
+
+namespace w2l {
+
+struct MaskAttributionOptions {
+  std::string mode = kNoiseMask; // kNoiseMask or kAdditiveMask
+  std::string optimizer = kSGDoptimizer;
+  int64_t iterations = 1000;
+  int64_t numNoise = 16; // noise draws per step, evaluated as one batch
+  int64_t syncInterval = 100; // steps between host reads of the loss
+  int64_t lrStep = 100;
+  double noiseStd = 0.1;
+  double lambda = 0.0;
+  double lr = 0.01;
+  double lrDecay = 0.9;
+
+  static MaskAttributionOptions fromFlags();
+};
+
+/**
+ * Losses averaged over the last `syncInterval` steps, reported every time the
+ * engine reads back from the device.
+ */
+struct MaskAttributionStats {
+  int64_t iteration;
+  double loss; // fitLoss - maskLoss
+  double fitLoss; // || f(x~) - f(x) ||^2, averaged over the noise draws
+  double maskLoss; // lambda * sum(log(m^2))
+  double maskMean;
+};
+
+/**
+ * Learns an input mask `m` of the same size as the input `x` telling how much
+ * of each input bin the network output depends on. Each step draws
+ * `numNoise` gaussian noises eps_k and perturbs the input as
+ *   x~_k = x + m * eps_k   (kNoiseMask)
+ *   x~_k = x + m + eps_k   (kAdditiveMask)
+ * then minimizes mean_k || f(x~_k) - f(x) ||^2 - lambda * sum(log(m^2)) over
+ * `m` only. All K draws go through the network as a single batch, and the
+ * loss is accumulated on the device and only read back (and checked for NaNs)
+ * every `syncInterval` steps.
+ */
+class MaskAttribution {
+ public:
+  MaskAttribution(
+      std::shared_ptr<fl::Module> network,
+      const MaskAttributionOptions& opts);
+
+  /**
+   * `input` is a single (normalized) sample of dims T x F x C x 1. Returns
+   * the learned mask with the same dims. `onSync` is called with the running
+   * losses every `syncInterval` steps and after the last step.
+   */
+  af::array run(
+      const af::array& input,
+      const std::function<void(const MaskAttributionStats&)>& onSync =
+          nullptr);
+
+ private:
+  std::shared_ptr<fl::Module> network_;
+  MaskAttributionOptions opts_;
+};
+
+} // namespace w2l
@@ -0,0 +1,126 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "runtime/Diagnostics.h"
+
+#include <algorithm>
+
+#include <cnpy.h>
+#include <glog/logging.h>
+
+#include "common/Utils.h"
+
+namespace w2l {
+
+DiagnosticsWriter::DiagnosticsWriter(
+    const std::string& dir,
+    int64_t interval,
+    size_t maxPending)
+    : dir_(dir),
+      interval_(interval),
+      maxPending_(std::max<size_t>(1, maxPending)) {
+  if (!enabled()) {
+    return;
+  }
+  if (!dirExists(dir_)) {
+    dirCreate(dir_);
+  }
+  auto indexPath = pathsConcat(dir_, "index.tsv");
+  index_.open(indexPath, std::ios::out | std::ios::app);
+  if (!index_.is_open()) {
+    LOG(FATAL) << "Could not open diagnostics index " << indexPath;
+  }
+  worker_ = std::thread(&DiagnosticsWriter::run, this);
+}
+
+DiagnosticsWriter::~DiagnosticsWriter() {
+  if (!worker_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  queueCv_.notify_all();
+  worker_.join();
+}
+
+void DiagnosticsWriter::write(
+    const std::string& name,
+    const af::array& arr,
+    int64_t iteration) {
+  if (!enabled()) {
+    return;
+  }
+  Item item;
+  item.name = name;
+  item.iteration = iteration;
+  item.dims = arr.dims();
+  for (int i = std::max(1u, arr.numdims()) - 1; i >= 0; --i) {
+    item.shape.push_back(arr.dims(i));
+  }
+  item.data.resize(arr.elements());
+  if (!item.data.empty()) {
+    auto host = arr.type() == af::dtype::f32 ? arr : arr.as(af::dtype::f32);
+    host.host(item.data.data());
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  doneCv_.wait(lock, [this] { return queue_.size() < maxPending_; });
+  queue_.push_back(std::move(item));
+  lock.unlock();
+  queueCv_.notify_one();
+}
+
+void DiagnosticsWriter::sample(
+    const std::string& name,
+    const af::array& arr,
+    int64_t iteration) {
+  if (due(iteration)) {
+    write(name, arr, iteration);
+  }
+}
+
+void DiagnosticsWriter::flush() {
+  if (!enabled()) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  doneCv_.wait(lock, [this] { return queue_.empty() && inFlight_ == 0; });
+}
+
+void DiagnosticsWriter::run() {
+  while (true) {
+    Item item;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      queueCv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return; // stop_ and drained
+      }
+      item = std::move(queue_.front());
+      queue_.pop_front();
+      ++inFlight_;
+    }
+    doneCv_.notify_all();
+
+    auto file = format("%s_%ld.npy", item.name.c_str(), (long)item.iteration);
+    cnpy::npy_save(pathsConcat(dir_, file), item.data.data(), item.shape, "w");
+    index_ << item.iteration << "\t" << item.name << "\t" << file << "\t"
+           << item.dims[0] << "x" << item.dims[1] << "x" << item.dims[2] << "x"
+           << item.dims[3] << std::endl;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      --inFlight_;
+    }
+    doneCv_.notify_all();
+  }
+}
+
+} // namespace w2l
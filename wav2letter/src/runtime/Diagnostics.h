@@ -0,0 +1,97 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arrayfire.h>
+
+namespace w2l {
+
+/**
+ * Dumps tensors for offline inspection without slowing down the caller.
+ *
+ * `write()` only copies the array to the host; the .npy encoding and the
+ * file I/O happen on a background thread. Every tensor is saved as
+ * `<dir>/<name>_<iteration>.npy` and gets a line
+ * `iteration <tab> name <tab> file <tab> dims` in `<dir>/index.tsv`.
+ *
+ * ArrayFire is column-major, so the .npy shape is the reversed af::dim4
+ * (trailing singleton dims dropped): `np.load(f).T` indexes like the array.
+ *
+ * A writer created with an empty directory is disabled and all calls are
+ * no-ops, so call sites don't need to be guarded.
+ */
+class DiagnosticsWriter {
+ public:
+  /**
+   * `interval` is used by `sample()`: tensors are only written on iterations
+   * that are a multiple of it. At most `maxPending` tensors are buffered;
+   * beyond that `write()` blocks until the worker catches up.
+   */
+  DiagnosticsWriter(
+      const std::string& dir,
+      int64_t interval = 1,
+      size_t maxPending = 64);
+
+  ~DiagnosticsWriter();
+
+  DiagnosticsWriter(const DiagnosticsWriter&) = delete;
+  DiagnosticsWriter& operator=(const DiagnosticsWriter&) = delete;
+
+  bool enabled() const {
+    return !dir_.empty();
+  }
+
+  bool due(int64_t iteration) const {
+    return enabled() && interval_ > 0 && iteration % interval_ == 0;
+  }
+
+  // Unconditionally queue `arr` for writing
+  void write(const std::string& name, const af::array& arr, int64_t iteration);
+
+  // Queue `arr` only if `due(iteration)`
+  void
+  sample(const std::string& name, const af::array& arr, int64_t iteration);
+
+  // Block until everything queued so far is on disk
+  void flush();
+
+ private:
+  struct Item {
+    std::string name;
+    int64_t iteration;
+    af::dim4 dims;
+    std::vector<size_t> shape;
+    std::vector<float> data;
+  };
+
+  void run();
+
+  std::string dir_;
+  int64_t interval_;
+  size_t maxPending_;
+
+  std::deque<Item> queue_;
+  size_t inFlight_{0};
+  bool stop_{false};
+  std::mutex mutex_;
+  std::condition_variable queueCv_;
+  std::condition_variable doneCv_;
+  std::ofstream index_;
+  std::thread worker_;
+};
+
+} // namespace w2l
@@ -6,13 +6,16 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
 #include <cstdlib>
 #include <unordered_map>
 
 #include <flashlight/distributed/distributed.h>
+#include <glog/logging.h>
 
 #include "Distributed.h"
 #include "common/Defines.h"
+#include "common/Trace.h"
 
 namespace w2l {
 
@@ -41,4 +44,227 @@ void maybeInitDistributedEnv(
          {fl::DistributedConstants::kFilePath, rndvFilepath}});
   }
 }
+
+af::array packArrays(const std::vector<af::array>& arrs) {
+  std::vector<double> host;
+  for (const auto& arr : arrs) {
+    if (arr.isempty()) {
+      continue;
+    }
+    auto offset = host.size();
+    host.resize(offset + arr.elements());
+    arr.as(af::dtype::f64).host(host.data() + offset);
+  }
+  if (host.empty()) {
+    return af::array();
+  }
+  return af::array(host.size(), host.data());
+}
+
+std::vector<af::array> unpackArrays(
+    const af::array& packed,
+    const std::vector<af::array>& like) {
+  std::vector<double> host(packed.elements());
+  if (!host.empty()) {
+    packed.as(af::dtype::f64).host(host.data());
+  }
+  std::vector<af::array> arrs;
+  size_t offset = 0;
+  for (const auto& arr : like) {
+    if (arr.isempty()) {
+      arrs.push_back(arr);
+      continue;
+    }
+    if (offset + arr.elements() > host.size()) {
+      LOG(FATAL) << "unpackArrays: packed array has " << host.size()
+                 << " elements, too few for the given arrays";
+    }
+    arrs.push_back(
+        af::array(arr.dims(), host.data() + offset).as(arr.type()));
+    offset += arr.elements();
+  }
+  return arrs;
+}
+
+void allReducePacked(std::vector<af::array>& arrs) {
+  if (!fl::isDistributedInit()) {
+    return;
+  }
+  auto packed = packArrays(arrs);
+  if (packed.isempty()) {
+    return;
+  }
+  fl::allReduce(packed);
+  arrs = unpackArrays(packed, arrs);
+}
+
+std::vector<std::vector<int>> assignGradientBuckets(
+    const std::vector<size_t>& bytes,
+    const std::vector<af::dtype>& types,
+    size_t bucketBytes) {
+  std::vector<std::vector<int>> buckets;
+  size_t filled = 0;
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    bool fits = !buckets.empty() && filled + bytes[i] <= bucketBytes &&
+        types[i] == types[buckets.back().back()];
+    if (!fits) {
+      buckets.emplace_back();
+      filled = 0;
+    }
+    buckets.back().push_back(i);
+    filled += bytes[i];
+  }
+  return buckets;
+}
+
+GradientBucketer::GradientBucketer(
+    const std::vector<std::shared_ptr<fl::Module>>& modules,
+    double scale,
+    size_t bucketBytes)
+    : scale_(scale), device_(af::getDevice()) {
+  if (!fl::isDistributedInit() || fl::getWorldSize() < 2) {
+    return;
+  }
+  for (const auto& module : modules) {
+    for (const auto& param : module->params()) {
+      if (param.isCalcGrad()) {
+        params_.push_back(param);
+      }
+    }
+  }
+  // the last layers get their gradients first
+  std::reverse(params_.begin(), params_.end());
+
+  std::vector<size_t> bytes;
+  std::vector<af::dtype> types;
+  for (const auto& param : params_) {
+    bytes.push_back(param.elements() * af::getSizeOf(param.type()));
+    types.push_back(param.type());
+  }
+  auto assignment = assignGradientBuckets(bytes, types, bucketBytes);
+  bucketOf_.resize(params_.size());
+  slotOf_.resize(params_.size());
+  buckets_.resize(assignment.size());
+  for (size_t b = 0; b < assignment.size(); ++b) {
+    auto& bucket = buckets_[b];
+    bucket.params = assignment[b];
+    bucket.grads.resize(bucket.params.size());
+    bucket.ready.resize(bucket.params.size(), false);
+    bucket.pending = bucket.params.size();
+    for (size_t s = 0; s < bucket.params.size(); ++s) {
+      bucketOf_[bucket.params[s]] = b;
+      slotOf_[bucket.params[s]] = s;
+    }
+  }
+  for (int i = 0; i < static_cast<int>(params_.size()); ++i) {
+    params_[i].registerGradHook(
+        [this, i](fl::Variable& grad) { onGradReady(i, grad); });
+  }
+  comm_ = fl::cpp::make_unique<fl::ThreadPool>(1);
+}
+
+GradientBucketer::~GradientBucketer() {
+  for (auto& bucket : buckets_) {
+    if (bucket.reduced.valid()) {
+      bucket.reduced.wait();
+    }
+  }
+  for (auto& param : params_) {
+    param.registerGradHook(nullptr);
+  }
+}
+
+int64_t GradientBucketer::numBuckets() const {
+  return buckets_.size();
+}
+
+void GradientBucketer::onGradReady(int param, const fl::Variable& grad) {
+  auto& bucket = buckets_[bucketOf_[param]];
+  auto slot = slotOf_[param];
+  if (bucket.ready[slot]) {
+    LOG(FATAL) << "GradientBucketer: gradient computed twice before "
+               << "synchronize()";
+  }
+  bucket.grads[slot] = grad;
+  bucket.ready[slot] = true;
+  anyReady_ = true;
+  if (--bucket.pending == 0) {
+    launchReadyBuckets();
+  }
+}
+
+void GradientBucketer::launchReadyBuckets() {
+  while (nextLaunch_ < buckets_.size() && buckets_[nextLaunch_].pending == 0) {
+    launch(buckets_[nextLaunch_++]);
+  }
+}
+
+void GradientBucketer::launch(Bucket& bucket) {
+  W2L_TRACE_SCOPE("runtime/bucketpack");
+  int64_t total = 0;
+  for (auto p : bucket.params) {
+    total += params_[p].elements();
+  }
+  bucket.packed = af::array(total, params_[bucket.params[0]].type());
+  int64_t offset = 0;
+  for (size_t s = 0; s < bucket.params.size(); ++s) {
+    auto n = params_[bucket.params[s]].elements();
+    auto range = af::seq(offset, offset + n - 1);
+    if (bucket.ready[s]) {
+      bucket.packed(range) = af::flat(bucket.grads[s].array());
+    } else {
+      // no gradient on this process, the others may have one
+      bucket.packed(range) = 0;
+    }
+    offset += n;
+  }
+  if (scale_ != 1.0) {
+    bucket.packed *= scale_;
+  }
+  bucket.packed.eval();
+
+  auto device = device_;
+  auto* target = &bucket;
+  bucket.reduced = comm_->enqueue([device, target]() {
+    W2L_TRACE_SCOPE("runtime/bucketallreduce");
+    af::setDevice(device);
+    fl::allReduce(target->packed);
+  });
+}
+
+void GradientBucketer::synchronize() {
+  if (!comm_ || !anyReady_) {
+    return;
+  }
+  W2L_TRACE_SCOPE("runtime/gradsync");
+  // buckets with missing gradients go out now, with zeros for those
+  for (auto& bucket : buckets_) {
+    bucket.pending = 0;
+  }
+  launchReadyBuckets();
+
+  for (auto& bucket : buckets_) {
+    bucket.reduced.get();
+    int64_t offset = 0;
+    for (size_t s = 0; s < bucket.params.size(); ++s) {
+      auto& param = params_[bucket.params[s]];
+      auto n = param.elements();
+      auto grad = af::moddims(
+          bucket.packed(af::seq(offset, offset + n - 1)), param.dims());
+      if (bucket.ready[s]) {
+        bucket.grads[s].array() = grad;
+      } else {
+        param.addGrad(fl::Variable(grad, false));
+      }
+      bucket.grads[s] = fl::Variable();
+      bucket.ready[s] = false;
+      offset += n;
+    }
+    bucket.pending = bucket.params.size();
+    bucket.packed = af::array();
+  }
+  nextLaunch_ = 0;
+  anyReady_ = false;
+}
+
 } // namespace w2l
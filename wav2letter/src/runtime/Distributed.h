@@ -8,7 +8,12 @@
 
 #pragma once
 
+#include <future>
+#include <memory>
 #include <string>
+#include <vector>
+
+#include <flashlight/flashlight.h>
 
 namespace w2l {
 
@@ -17,4 +22,78 @@ void maybeInitDistributedEnv(
     int worldRank,
     int worldSize,
     const std::string& rndvFilepath);
-}
+
+// Sums `arrs` over all processes with a single allreduce. The arrays are
+// packed into one f64 buffer and keep their type and dims.
+void allReducePacked(std::vector<af::array>& arrs);
+
+// f64 concatenation of the flattened `arrs`, and its inverse given arrays of
+// the original types and dims
+af::array packArrays(const std::vector<af::array>& arrs);
+std::vector<af::array> unpackArrays(
+    const af::array& packed,
+    const std::vector<af::array>& like);
+
+// Groups parameters of `bytes[i]` bytes, listed in the order their gradients
+// become ready, into consecutive buckets of at most `bucketBytes` (a larger
+// parameter gets a bucket of its own). A new bucket also starts whenever the
+// type changes.
+std::vector<std::vector<int>> assignGradientBuckets(
+    const std::vector<size_t>& bytes,
+    const std::vector<af::dtype>& types,
+    size_t bucketBytes);
+
+/**
+ * Replacement for `fl::distributeModuleGrads` which overlaps the gradient
+ * allreduce with the backward pass.
+ *
+ * Parameters are grouped into buckets in reverse order, which is roughly the
+ * order backward() produces their gradients. Once the last gradient of a
+ * bucket is ready, the bucket is scaled, packed into one array and reduced by
+ * a communication thread while backward() carries on. Buckets are launched
+ * in the same order on every process, so the collectives always match.
+ * `synchronize()` must be called after backward() and before the optimizer
+ * step; it waits for the reductions and writes the gradients back.
+ *
+ * Without a distributed environment (or with a single process) this does
+ * nothing.
+ */
+class GradientBucketer {
+ public:
+  GradientBucketer(
+      const std::vector<std::shared_ptr<fl::Module>>& modules,
+      double scale,
+      size_t bucketBytes);
+
+  ~GradientBucketer();
+
+  void synchronize();
+
+  int64_t numBuckets() const;
+
+ private:
+  struct Bucket {
+    std::vector<int> params;
+    std::vector<fl::Variable> grads;
+    std::vector<bool> ready;
+    int pending{0};
+    af::array packed;
+    std::future<void> reduced;
+  };
+
+  void onGradReady(int param, const fl::Variable& grad);
+  void launchReadyBuckets();
+  void launch(Bucket& bucket);
+
+  std::vector<fl::Variable> params_;
+  std::vector<int> bucketOf_; // bucket of each parameter
+  std::vector<int> slotOf_; // position of each parameter in its bucket
+  std::vector<Bucket> buckets_;
+  size_t nextLaunch_{0};
+  bool anyReady_{false};
+  double scale_;
+  int device_;
+  std::unique_ptr<fl::ThreadPool> comm_;
+};
+
+} // namespace w2l
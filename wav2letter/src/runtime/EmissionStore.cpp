@@ -0,0 +1,327 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "runtime/EmissionStore.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include "common/Utils.h"
+#include "runtime/Serial.h"
+
+namespace w2l {
+
+namespace {
+
+std::string shardName(int64_t k, const std::string& ext) {
+  return format("shard_%06ld.%s", static_cast<long>(k), ext.c_str());
+}
+
+// Serialize next to `path`, then rename so readers never see partial files
+template <typename T>
+void saveAtomic(const std::string& path, const T& obj) {
+  auto tmp = path + ".tmp";
+  W2lSerializer::save(tmp, obj);
+  if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+    LOG(FATAL) << "[EmissionStore] Failed to rename " << tmp << " to " << path;
+  }
+}
+
+} // namespace
+
+std::string emissionStorePath(
+    const std::string& emissionDir,
+    const std::string& dataset) {
+  return pathsConcat(emissionDir, cleanFilepath(dataset) + ".shards");
+}
+
+uint16_t floatToHalf(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  uint32_t sign = (x >> 16) & 0x8000;
+  uint32_t rawExp = (x >> 23) & 0xff;
+  uint32_t mant = x & 0x7fffff;
+  if (rawExp == 0xff) {
+    // inf stays inf, NaN stays (quiet) NaN
+    return sign | 0x7c00 | (mant ? 0x200 : 0);
+  }
+  int32_t exp = static_cast<int32_t>(rawExp) - 127 + 15;
+  if (exp >= 31) {
+    return sign | 0x7c00;
+  }
+  if (exp <= 0) {
+    if (exp < -10) {
+      return sign;
+    }
+    // subnormal half, round to nearest even
+    mant |= 0x800000;
+    uint32_t shift = 14 - exp;
+    uint32_t half = mant >> shift;
+    uint32_t rem = mant & ((1u << shift) - 1);
+    uint32_t mid = 1u << (shift - 1);
+    if (rem > mid || (rem == mid && (half & 1))) {
+      ++half;
+    }
+    return sign | half;
+  }
+  uint32_t half = (static_cast<uint32_t>(exp) << 10) | (mant >> 13);
+  uint32_t rem = mant & 0x1fff;
+  // a carry out of the mantissa correctly bumps the exponent
+  if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) {
+    ++half;
+  }
+  return sign | half;
+}
+
+float halfToFloat(uint16_t h) {
+  uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+  int32_t exp = (h >> 10) & 0x1f;
+  uint32_t mant = h & 0x3ff;
+  uint32_t x;
+  if (exp == 0x1f) {
+    x = sign | 0x7f800000 | (mant << 13);
+  } else if (exp == 0) {
+    if (mant == 0) {
+      x = sign;
+    } else {
+      exp = 1;
+      while (!(mant & 0x400)) {
+        mant <<= 1;
+        --exp;
+      }
+      mant &= 0x3ff;
+      x = sign | (static_cast<uint32_t>(exp + 127 - 15) << 23) | (mant << 13);
+    }
+  } else {
+    x = sign | (static_cast<uint32_t>(exp + 127 - 15) << 23) | (mant << 13);
+  }
+  float f;
+  std::memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+/* ===================== EmissionStoreWriter ===================== */
+
+EmissionStoreWriter::EmissionStoreWriter(
+    const std::string& dir,
+    int64_t shardSize,
+    bool fp16,
+    const std::vector<float>& transition,
+    const std::string& gflags)
+    : dir_(dir), shardSize_(std::max<int64_t>(shardSize, 1)) {
+  meta_.transition = transition;
+  meta_.gflags = gflags;
+  meta_.fp16 = fp16;
+  dirCreate(dir_);
+  // a store left over from an earlier run must not look complete
+  std::remove(pathsConcat(dir_, "done.bin").c_str());
+  std::remove(pathsConcat(dir_, "meta.bin").c_str());
+  for (int64_t k = 0;; ++k) {
+    auto idxPath = pathsConcat(dir_, shardName(k, "idx"));
+    if (!fileExists(idxPath)) {
+      break;
+    }
+    std::remove(idxPath.c_str());
+  }
+}
+
+EmissionStoreWriter::~EmissionStoreWriter() {
+  close();
+}
+
+void EmissionStoreWriter::add(
+    const std::vector<float>& emission,
+    int N,
+    int T,
+    const std::vector<int>& wordTarget,
+    const std::vector<int>& letterTarget,
+    const std::string& sampleId) {
+  if (closed_) {
+    throw std::logic_error("EmissionStoreWriter: add() after close()");
+  }
+  if (emission.size() != static_cast<size_t>(N) * T) {
+    throw std::invalid_argument("EmissionStoreWriter: emission is not N x T");
+  }
+  if (nSamples_ == 0) {
+    meta_.emissionN = N;
+    saveAtomic(pathsConcat(dir_, "meta.bin"), meta_);
+  } else if (N != meta_.emissionN) {
+    throw std::invalid_argument("EmissionStoreWriter: alphabet size changed");
+  }
+
+  if (!payload_.is_open()) {
+    auto path = pathsConcat(dir_, shardName(nShards_, "dat"));
+    payload_.open(path, std::ios::binary | std::ios::trunc);
+    if (!payload_.is_open()) {
+      LOG(FATAL) << "[EmissionStore] Failed to open " << path;
+    }
+    shardOffset_ = 0;
+  }
+
+  if (meta_.fp16) {
+    halfBuf_.resize(emission.size());
+    for (size_t i = 0; i < emission.size(); ++i) {
+      halfBuf_[i] = floatToHalf(emission[i]);
+    }
+    payload_.write(
+        reinterpret_cast<const char*>(halfBuf_.data()),
+        halfBuf_.size() * sizeof(uint16_t));
+  } else {
+    payload_.write(
+        reinterpret_cast<const char*>(emission.data()),
+        emission.size() * sizeof(float));
+  }
+
+  EmissionRecord rec;
+  rec.offset = shardOffset_;
+  rec.emissionT = T;
+  rec.wordTarget = wordTarget;
+  rec.letterTarget = letterTarget;
+  rec.sampleId = sampleId;
+  records_.emplace_back(std::move(rec));
+  shardOffset_ += emission.size();
+  ++nSamples_;
+
+  if (records_.size() >= static_cast<size_t>(shardSize_)) {
+    sealShard();
+  }
+}
+
+void EmissionStoreWriter::sealShard() {
+  if (records_.empty()) {
+    return;
+  }
+  payload_.close();
+  if (payload_.fail()) {
+    LOG(FATAL) << "[EmissionStore] Failed to write shard " << nShards_;
+  }
+  saveAtomic(pathsConcat(dir_, shardName(nShards_, "idx")), records_);
+  records_.clear();
+  ++nShards_;
+}
+
+void EmissionStoreWriter::close() {
+  if (closed_) {
+    return;
+  }
+  sealShard();
+  if (nSamples_ == 0) {
+    // readers wait for the metadata, so publish it even for empty stores
+    saveAtomic(pathsConcat(dir_, "meta.bin"), meta_);
+  }
+  saveAtomic(pathsConcat(dir_, "done.bin"), nShards_);
+  closed_ = true;
+}
+
+/* ===================== EmissionShard ===================== */
+
+EmissionShard::EmissionShard(
+    const std::string& dataPath,
+    std::vector<EmissionRecord> recs)
+    : records_(std::move(recs)) {
+  int fd = ::open(dataPath.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("EmissionShard: cannot open " + dataPath);
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw std::runtime_error("EmissionShard: cannot stat " + dataPath);
+  }
+  bytes_ = st.st_size;
+  if (bytes_ > 0) {
+    data_ = ::mmap(nullptr, bytes_, PROT_READ, MAP_SHARED, fd, 0);
+    if (data_ == MAP_FAILED) {
+      data_ = nullptr;
+      ::close(fd);
+      throw std::runtime_error("EmissionShard: cannot map " + dataPath);
+    }
+    ::madvise(data_, bytes_, MADV_SEQUENTIAL);
+  }
+  ::close(fd);
+}
+
+EmissionShard::~EmissionShard() {
+  if (data_) {
+    ::munmap(data_, bytes_);
+  }
+}
+
+const float* EmissionShard::emission(
+    size_t i,
+    int N,
+    bool fp16,
+    std::vector<float>& scratch) const {
+  const auto& rec = records_[i];
+  size_t numel = static_cast<size_t>(N) * rec.emissionT;
+  size_t elemBytes = fp16 ? sizeof(uint16_t) : sizeof(float);
+  if ((rec.offset + numel) * elemBytes > bytes_) {
+    throw std::out_of_range("EmissionShard: record past end of payload");
+  }
+  if (!fp16) {
+    return static_cast<const float*>(data_) + rec.offset;
+  }
+  auto src = static_cast<const uint16_t*>(data_) + rec.offset;
+  scratch.resize(numel);
+  for (size_t j = 0; j < numel; ++j) {
+    scratch[j] = halfToFloat(src[j]);
+  }
+  return scratch.data();
+}
+
+/* ===================== EmissionStoreReader ===================== */
+
+EmissionStoreReader::EmissionStoreReader(const std::string& dir, int pollMs)
+    : dir_(dir), pollMs_(std::max(pollMs, 1)) {
+  auto metaPath = pathsConcat(dir_, "meta.bin");
+  bool logged = false;
+  while (!fileExists(metaPath)) {
+    if (!logged) {
+      LOG(INFO) << "[EmissionStore] Waiting for " << metaPath;
+      logged = true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(pollMs_));
+  }
+  W2lSerializer::load(metaPath, meta_);
+}
+
+std::shared_ptr<EmissionShard> EmissionStoreReader::shard(int64_t k) const {
+  auto idxPath = pathsConcat(dir_, shardName(k, "idx"));
+  auto donePath = pathsConcat(dir_, "done.bin");
+  while (true) {
+    if (fileExists(idxPath)) {
+      std::vector<EmissionRecord> records;
+      W2lSerializer::load(idxPath, records);
+      return std::make_shared<EmissionShard>(
+          pathsConcat(dir_, shardName(k, "dat")), std::move(records));
+    }
+    if (fileExists(donePath)) {
+      int64_t nShards = 0;
+      W2lSerializer::load(donePath, nShards);
+      // the index is renamed in before the done marker
+      if (k >= nShards) {
+        return nullptr;
+      }
+      if (!fileExists(idxPath)) {
+        throw std::runtime_error("EmissionStoreReader: missing " + idxPath);
+      }
+      continue;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(pollMs_));
+  }
+}
+
+} // namespace w2l
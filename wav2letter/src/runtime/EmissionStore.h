@@ -0,0 +1,167 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <flashlight/flashlight.h>
+
+namespace w2l {
+
+/**
+ * Sharded on-disk alternative to a single serialized `EmissionSet`.
+ *
+ * A store is a directory holding
+ *   meta.bin          `EmissionStoreMeta` (written with the first utterance)
+ *   shard_<k>.dat     emissions of shard k back to back, f32 or f16
+ *   shard_<k>.idx     `EmissionRecord`s of shard k
+ *   done.bin          number of shards, written when the producer closes
+ * Every .idx and the done marker are renamed into place only after the data
+ * they describe is on disk, so a reader polling the directory can consume a
+ * shard as soon as its index exists while later shards are still produced.
+ */
+struct EmissionStoreMeta {
+  int emissionN{0};
+  std::vector<float> transition;
+  std::string gflags;
+  bool fp16{false};
+
+  FL_SAVE_LOAD(emissionN, transition, gflags, fp16)
+};
+
+struct EmissionRecord {
+  int64_t offset{0}; // in elements from the start of the shard payload
+  int emissionT{0};
+  std::vector<int> wordTarget;
+  std::vector<int> letterTarget;
+  std::string sampleId;
+
+  FL_SAVE_LOAD(offset, emissionT, wordTarget, letterTarget, sampleId)
+};
+
+class EmissionStoreWriter {
+ public:
+  /**
+   * Utterances are grouped in shards of `shardSize`; with `fp16` the
+   * emissions are stored as IEEE half floats.
+   */
+  EmissionStoreWriter(
+      const std::string& dir,
+      int64_t shardSize,
+      bool fp16,
+      const std::vector<float>& transition,
+      const std::string& gflags);
+
+  ~EmissionStoreWriter();
+
+  EmissionStoreWriter(const EmissionStoreWriter&) = delete;
+  EmissionStoreWriter& operator=(const EmissionStoreWriter&) = delete;
+
+  // `emission` is N x T, column-major as returned by afToVector()
+  void add(
+      const std::vector<float>& emission,
+      int N,
+      int T,
+      const std::vector<int>& wordTarget,
+      const std::vector<int>& letterTarget,
+      const std::string& sampleId);
+
+  // Seal the current shard and mark the store complete
+  void close();
+
+  int64_t size() const {
+    return nSamples_;
+  }
+
+ private:
+  void sealShard();
+
+  std::string dir_;
+  int64_t shardSize_;
+  EmissionStoreMeta meta_;
+  bool closed_{false};
+
+  int64_t nSamples_{0};
+  int64_t nShards_{0};
+  int64_t shardOffset_{0};
+  std::ofstream payload_;
+  std::vector<EmissionRecord> records_;
+  std::vector<uint16_t> halfBuf_;
+};
+
+/**
+ * One shard of a store with its payload mapped read-only. Shards can be
+ * shared across decoder threads.
+ */
+class EmissionShard {
+ public:
+  EmissionShard(const std::string& dataPath, std::vector<EmissionRecord> recs);
+  ~EmissionShard();
+
+  EmissionShard(const EmissionShard&) = delete;
+  EmissionShard& operator=(const EmissionShard&) = delete;
+
+  size_t size() const {
+    return records_.size();
+  }
+
+  const EmissionRecord& record(size_t i) const {
+    return records_[i];
+  }
+
+  /**
+   * Pointer to the N x T emission of utterance `i`. f32 shards point straight
+   * into the mapping; f16 shards are widened into `scratch`.
+   */
+  const float* emission(size_t i, int N, bool fp16, std::vector<float>& scratch)
+      const;
+
+ private:
+  std::vector<EmissionRecord> records_;
+  void* data_{nullptr};
+  size_t bytes_{0};
+};
+
+class EmissionStoreReader {
+ public:
+  /**
+   * Blocks until the producer has written the store's metadata, polling
+   * every `pollMs` milliseconds.
+   */
+  explicit EmissionStoreReader(const std::string& dir, int pollMs = 500);
+
+  const EmissionStoreMeta& meta() const {
+    return meta_;
+  }
+
+  /**
+   * Blocks until shard `k` is sealed and returns it, or returns nullptr once
+   * the store is complete and has no shard `k`. Safe to call concurrently.
+   */
+  std::shared_ptr<EmissionShard> shard(int64_t k) const;
+
+ private:
+  std::string dir_;
+  int pollMs_;
+  EmissionStoreMeta meta_;
+};
+
+// Directory of the sharded store for a dataset under `emissionDir`
+std::string emissionStorePath(
+    const std::string& emissionDir,
+    const std::string& dataset);
+
+uint16_t floatToHalf(float f);
+
+float halfToFloat(uint16_t h);
+
+} // namespace w2l
@@ -14,6 +14,7 @@
 
 #include "common/Defines.h"
 #include "common/Utils.h"
+#include "runtime/Distributed.h"
 
 namespace w2l {
 std::pair<std::string, std::string> getStatus(
@@ -178,21 +179,44 @@ void allreduceSet(fl::TimeMeter& mtr, af::array& val) {
   mtr.set(valVec[0] / worldSize);
 }
 
+namespace {
+
+typedef std::vector<std::function<void(af::array&)>> MeterSetters;
+
+template <typename T>
+void packMeter(T& mtr, std::vector<af::array>& vals, MeterSetters& setters) {
+  vals.push_back(allreduceGet(mtr));
+  setters.emplace_back([&mtr](af::array& val) { allreduceSet(mtr, val); });
+}
+
+} // namespace
+
 template <>
 void syncMeter<TrainMeters>(TrainMeters& mtrs) {
-  syncMeter(mtrs.loss);
-  syncMeter(mtrs.stats);
-  syncMeter(mtrs.runtime);
-  syncMeter(mtrs.timer);
-  syncMeter(mtrs.fwdtimer);
-  syncMeter(mtrs.critfwdtimer);
-  syncMeter(mtrs.bwdtimer);
-  syncMeter(mtrs.optimtimer);
-  syncMeter(mtrs.train.edit);
-  syncMeter(mtrs.train.wordedit);
+  if (!fl::isDistributedInit()) {
+    return;
+  }
+  W2L_TRACE_SCOPE("runtime/allreduce");
+  // one allreduce for all the meters
+  std::vector<af::array> vals;
+  MeterSetters setters;
+  packMeter(mtrs.loss, vals, setters);
+  packMeter(mtrs.stats, vals, setters);
+  packMeter(mtrs.runtime, vals, setters);
+  packMeter(mtrs.timer, vals, setters);
+  packMeter(mtrs.fwdtimer, vals, setters);
+  packMeter(mtrs.critfwdtimer, vals, setters);
+  packMeter(mtrs.bwdtimer, vals, setters);
+  packMeter(mtrs.optimtimer, vals, setters);
+  packMeter(mtrs.train.edit, vals, setters);
+  packMeter(mtrs.train.wordedit, vals, setters);
   for (auto& v : mtrs.valid) {
-    syncMeter(v.second.edit);
-    syncMeter(v.second.wordedit);
+    packMeter(v.second.edit, vals, setters);
+    packMeter(v.second.wordedit, vals, setters);
+  }
+  allReducePacked(vals);
+  for (size_t i = 0; i < vals.size(); ++i) {
+    setters[i](vals[i]);
   }
 }
 
@@ -13,6 +13,7 @@
 #include <flashlight/flashlight.h>
 
 #include "SpeechStatMeter.h"
+#include "common/Trace.h"
 
 #define LOG_MASTER(lvl) LOG_IF(lvl, (fl::getWorldRank() == 0))
 
@@ -73,6 +74,7 @@ void syncMeter(T& mtr) {
   if (!fl::isDistributedInit()) {
     return;
   }
+  W2L_TRACE_SCOPE("runtime/allreduce");
   af::array arr = allreduceGet(mtr);
   fl::allReduce(arr);
   allreduceSet(mtr, arr);
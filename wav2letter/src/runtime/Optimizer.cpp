@@ -18,13 +18,22 @@ std::shared_ptr<fl::FirstOrderOptimizer> initOptimizer(
     double lr,
     double momentum,
     double weightdecay) {
+  return initOptimizer(net->params(), optimizer, lr, momentum, weightdecay);
+}
+
+std::shared_ptr<fl::FirstOrderOptimizer> initOptimizer(
+    const std::vector<fl::Variable>& params,
+    const std::string& optimizer,
+    double lr,
+    double momentum,
+    double weightdecay) {
   std::shared_ptr<fl::FirstOrderOptimizer> opt;
   if (optimizer == kSGDoptimizer) {
     opt = std::make_shared<fl::SGDOptimizer>(
-        net->params(), lr, momentum, weightdecay);
+        params, lr, momentum, weightdecay);
   } else if (optimizer == kAdamOptimizer) {
     opt = std::make_shared<fl::AdamOptimizer>(
-        net->params(),
+        params,
         lr,
         FLAGS_adambeta1,
         FLAGS_adambeta2,
@@ -32,10 +41,10 @@ std::shared_ptr<fl::FirstOrderOptimizer> initOptimizer(
         weightdecay);
   } else if (optimizer == kRMSPropOptimizer) {
     opt = std::make_shared<fl::RMSPropOptimizer>(
-        net->params(), lr, FLAGS_optimrho, FLAGS_optimepsilon, weightdecay);
+        params, lr, FLAGS_optimrho, FLAGS_optimepsilon, weightdecay);
   } else if (optimizer == kAdadeltaOptimizer) {
     opt = std::make_shared<fl::AdadeltaOptimizer>(
-        net->params(), 1.0, FLAGS_optimrho, FLAGS_optimepsilon, weightdecay);
+        params, 1.0, FLAGS_optimrho, FLAGS_optimepsilon, weightdecay);
   } else {
     LOG(FATAL) << "Optimizer option " << optimizer << " not implemented";
   }
@@ -20,4 +20,11 @@ std::shared_ptr<fl::FirstOrderOptimizer> initOptimizer(
     double lr,
     double momentum,
     double weightdecay);
+
+std::shared_ptr<fl::FirstOrderOptimizer> initOptimizer(
+    const std::vector<fl::Variable>& params,
+    const std::string& optimizer,
+    double lr,
+    double momentum,
+    double weightdecay);
 } // namespace w2l
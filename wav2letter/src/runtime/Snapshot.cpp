@@ -0,0 +1,333 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "runtime/Snapshot.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <sstream>
+
+#include <glog/logging.h>
+
+#include "common/Defines.h"
+#include "runtime/Serial.h"
+
+namespace w2l {
+
+namespace {
+
+const char kSnapshotMagic[] = "W2LSNAP1";
+constexpr size_t kMagicBytes = 8;
+constexpr uint64_t kAlign = 64;
+
+uint64_t alignUp(uint64_t x) {
+  return (x + kAlign - 1) / kAlign * kAlign;
+}
+
+void pwriteAll(int fd, const void* buf, size_t bytes, uint64_t offset) {
+  auto ptr = static_cast<const char*>(buf);
+  while (bytes > 0) {
+    auto n = ::pwrite(fd, ptr, bytes, offset);
+    if (n < 0) {
+      throw std::runtime_error(
+          "saveSnapshot: write failed: " + std::string(std::strerror(errno)));
+    }
+    ptr += n;
+    bytes -= n;
+    offset += n;
+  }
+}
+
+void fsyncParentDir(const std::string& path) {
+  auto pos = path.find_last_of('/');
+  std::string dir = pos == std::string::npos ? "." : path.substr(0, pos);
+  int fd = ::open(dir.empty() ? "/" : dir.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    ::fsync(fd);
+    ::close(fd);
+  }
+}
+
+// Temporarily swap out parameter data so cereal only sees the architecture
+struct StrippedParams {
+  explicit StrippedParams(const std::shared_ptr<fl::Module>& module) {
+    if (!module) {
+      return;
+    }
+    params = module->params();
+    for (auto& p : params) {
+      data.emplace_back(p.array());
+      p.array() = af::array();
+    }
+  }
+
+  // reverse order, so a parameter shared by two modules ends up restored
+  ~StrippedParams() {
+    for (size_t i = params.size(); i-- > 0;) {
+      params[i].array() = data[i];
+    }
+  }
+
+  std::vector<fl::Variable> params;
+  std::vector<af::array> data;
+};
+
+} // namespace
+
+uint32_t crc32(const void* data, size_t bytes, uint32_t crc) {
+  static const std::vector<uint32_t> table = []() {
+    std::vector<uint32_t> t(256);
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      }
+      t[i] = c;
+    }
+    return t;
+  }();
+  auto p = static_cast<const uint8_t*>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < bytes; ++i) {
+    crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+void saveSnapshot(
+    const std::string& path,
+    const std::unordered_map<std::string, std::string>& config,
+    std::shared_ptr<fl::Module> network,
+    std::shared_ptr<SequenceCriterion> criterion,
+    int nThreads) {
+  std::vector<std::vector<fl::Variable>> params = {
+      network ? network->params() : std::vector<fl::Variable>(),
+      criterion ? criterion->params() : std::vector<fl::Variable>()};
+
+  // table of contents, payloads start right after the magic
+  std::vector<SnapshotTensor> tensors;
+  uint64_t offset = kAlign;
+  for (size_t m = 0; m < params.size(); ++m) {
+    for (size_t i = 0; i < params[m].size(); ++i) {
+      const auto& arr = params[m][i].array();
+      SnapshotTensor t;
+      t.module = m;
+      t.index = i;
+      for (int d = 0; d < 4; ++d) {
+        t.dims.push_back(arr.dims(d));
+      }
+      t.type = static_cast<int>(arr.type());
+      t.offset = offset;
+      t.bytes = arr.bytes();
+      offset = alignUp(offset + t.bytes);
+      tensors.emplace_back(std::move(t));
+    }
+  }
+
+  auto tmpPath = path + ".tmp";
+  int fd = ::open(tmpPath.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  if (fd < 0) {
+    throw std::runtime_error("saveSnapshot: cannot open " + tmpPath);
+  }
+  try {
+    pwriteAll(fd, kSnapshotMagic, kMagicBytes, 0);
+
+    // device -> host copies stay on this thread, the pool checksums and
+    // writes the previous tensors meanwhile
+    fl::ThreadPool pool(std::max(nThreads, 1));
+    std::vector<std::future<void>> pending;
+    size_t t = 0;
+    for (size_t m = 0; m < params.size(); ++m) {
+      for (size_t i = 0; i < params[m].size(); ++i, ++t) {
+        auto host = std::make_shared<std::vector<char>>(tensors[t].bytes);
+        if (!host->empty()) {
+          params[m][i].array().host(host->data());
+        }
+        auto& entry = tensors[t];
+        pending.emplace_back(pool.enqueue([fd, host, &entry]() {
+          entry.crc = crc32(host->data(), host->size());
+          pwriteAll(fd, host->data(), host->size(), entry.offset);
+        }));
+      }
+    }
+    for (auto& f : pending) {
+      f.get();
+    }
+
+    std::ostringstream header;
+    {
+      StrippedParams netGuard(network);
+      StrippedParams critGuard(criterion);
+      cereal::BinaryOutputArchive ar(header);
+      ar(std::string(W2L_VERSION), config, network, criterion, tensors);
+    }
+    auto headerStr = header.str();
+    uint64_t headerBytes = headerStr.size();
+    pwriteAll(fd, headerStr.data(), headerBytes, offset);
+    offset += headerBytes;
+    pwriteAll(fd, &headerBytes, sizeof(headerBytes), offset);
+    offset += sizeof(headerBytes);
+    pwriteAll(fd, kSnapshotMagic, kMagicBytes, offset);
+
+    if (::fsync(fd) != 0) {
+      throw std::runtime_error("saveSnapshot: fsync failed on " + tmpPath);
+    }
+  } catch (...) {
+    ::close(fd);
+    std::remove(tmpPath.c_str());
+    throw;
+  }
+  ::close(fd);
+  if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    throw std::runtime_error("saveSnapshot: cannot rename to " + path);
+  }
+  fsyncParentDir(path);
+}
+
+Snapshot::Snapshot(const std::string& path) : path_(path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Snapshot: cannot open " + path);
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw std::runtime_error("Snapshot: cannot stat " + path);
+  }
+  bytes_ = st.st_size;
+  if (bytes_ < kAlign + sizeof(uint64_t) + kMagicBytes) {
+    ::close(fd);
+    throw std::runtime_error("Snapshot: file too small " + path);
+  }
+  data_ = ::mmap(nullptr, bytes_, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data_ == MAP_FAILED) {
+    data_ = nullptr;
+    throw std::runtime_error("Snapshot: cannot map " + path);
+  }
+
+  auto base = static_cast<const char*>(data_);
+  uint64_t headerBytes;
+  auto trailer = base + bytes_ - kMagicBytes - sizeof(headerBytes);
+  std::memcpy(&headerBytes, trailer, sizeof(headerBytes));
+  if (std::memcmp(base, kSnapshotMagic, kMagicBytes) != 0 ||
+      std::memcmp(trailer + sizeof(headerBytes), kSnapshotMagic, kMagicBytes) !=
+          0 ||
+      headerBytes > static_cast<uint64_t>(trailer - base - kAlign)) {
+    ::munmap(data_, bytes_);
+    data_ = nullptr;
+    throw std::runtime_error("Snapshot: corrupt or truncated " + path);
+  }
+
+  try {
+    std::istringstream header(
+        std::string(trailer - headerBytes, headerBytes), std::ios::binary);
+    cereal::BinaryInputArchive ar(header);
+    std::string version;
+    ar(version, config_, network_, criterion_, tensors_);
+    for (const auto& t : tensors_) {
+      if (t.offset + t.bytes > bytes_) {
+        throw std::runtime_error("Snapshot: tensor past end of " + path);
+      }
+    }
+  } catch (...) {
+    ::munmap(data_, bytes_);
+    data_ = nullptr;
+    throw;
+  }
+}
+
+Snapshot::~Snapshot() {
+  if (data_) {
+    ::munmap(data_, bytes_);
+  }
+}
+
+void Snapshot::checkCrc(size_t i) const {
+  const auto& t = tensors_[i];
+  auto ptr = static_cast<const char*>(data_) + t.offset;
+  if (crc32(ptr, t.bytes) != t.crc) {
+    throw std::runtime_error(
+        "Snapshot: CRC mismatch in tensor " + std::to_string(i) + " of " +
+        path_);
+  }
+}
+
+af::array Snapshot::tensor(size_t i) const {
+  checkCrc(i);
+  return read(i);
+}
+
+af::array Snapshot::read(size_t i) const {
+  const auto& t = tensors_[i];
+  af::dim4 dims(t.dims[0], t.dims[1], t.dims[2], t.dims[3]);
+  af::array arr(dims, static_cast<af::dtype>(t.type));
+  if (t.bytes > 0) {
+    arr.write(
+        reinterpret_cast<const unsigned char*>(data_) + t.offset,
+        t.bytes,
+        afHost);
+  }
+  return arr;
+}
+
+void Snapshot::materialize(int nThreads) {
+  {
+    fl::ThreadPool pool(std::max(nThreads, 1));
+    std::vector<std::future<void>> checks;
+    for (size_t i = 0; i < tensors_.size(); ++i) {
+      checks.emplace_back(pool.enqueue([this, i]() { checkCrc(i); }));
+    }
+    for (auto& f : checks) {
+      f.get();
+    }
+  }
+  for (size_t i = 0; i < tensors_.size(); ++i) {
+    const auto& t = tensors_[i];
+    auto arr = read(i);
+    std::shared_ptr<fl::Module> module = network_;
+    if (t.module == 1) {
+      module = criterion_;
+    }
+    auto calcGrad = module->param(t.index).isCalcGrad();
+    module->setParams(fl::Variable(arr, calcGrad), t.index);
+  }
+}
+
+bool isSnapshot(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  char magic[kMagicBytes];
+  if (!file.read(magic, kMagicBytes)) {
+    return false;
+  }
+  return std::memcmp(magic, kSnapshotMagic, kMagicBytes) == 0;
+}
+
+void loadModel(
+    const std::string& path,
+    std::unordered_map<std::string, std::string>& config,
+    std::shared_ptr<fl::Module>& network,
+    std::shared_ptr<SequenceCriterion>& criterion) {
+  if (!isSnapshot(path)) {
+    W2lSerializer::load(path, config, network, criterion);
+    return;
+  }
+  Snapshot snapshot(path);
+  snapshot.materialize();
+  config = snapshot.config();
+  network = snapshot.network();
+  criterion = snapshot.criterion();
+}
+
+} // namespace w2l
@@ -0,0 +1,126 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <flashlight/flashlight.h>
+
+#include "criterion/SequenceCriterion.h"
+
+namespace w2l {
+
+/**
+ * Model snapshot with a tensor table of contents.
+ *
+ * Layout:
+ *   "W2LSNAP1"                   magic, padded to 64 bytes
+ *   tensor payloads              raw parameter data, each 64-byte aligned
+ *   header                       cereal archive: W2L_VERSION, config,
+ *                                network and criterion with their parameters
+ *                                stripped, then the `SnapshotTensor` table
+ *   uint64 header size, "W2LSNAP1"
+ *
+ * Payloads are written by a pool of threads into `<path>.tmp`, which is
+ * fsync'ed and renamed over `path`, so a crash mid-save never leaves a
+ * truncated model behind. Every payload carries a CRC32 that is checked when
+ * it's read back.
+ */
+struct SnapshotTensor {
+  int module{0}; // 0: network, 1: criterion
+  int index{0}; // position in module->params()
+  std::vector<int64_t> dims;
+  int type{0}; // af::dtype
+  uint64_t offset{0};
+  uint64_t bytes{0};
+  uint32_t crc{0};
+
+  FL_SAVE_LOAD(module, index, dims, type, offset, bytes, crc)
+};
+
+void saveSnapshot(
+    const std::string& path,
+    const std::unordered_map<std::string, std::string>& config,
+    std::shared_ptr<fl::Module> network,
+    std::shared_ptr<SequenceCriterion> criterion,
+    int nThreads = 4);
+
+/**
+ * Read side of a snapshot. Opening only maps the file and parses the header,
+ * so the config and architecture are available immediately; parameter data
+ * is read from the mapping, and CRC-checked, on demand.
+ */
+class Snapshot {
+ public:
+  explicit Snapshot(const std::string& path);
+  ~Snapshot();
+
+  Snapshot(const Snapshot&) = delete;
+  Snapshot& operator=(const Snapshot&) = delete;
+
+  const std::unordered_map<std::string, std::string>& config() const {
+    return config_;
+  }
+
+  // Modules have empty parameters until `materialize()` is called
+  std::shared_ptr<fl::Module> network() const {
+    return network_;
+  }
+
+  std::shared_ptr<SequenceCriterion> criterion() const {
+    return criterion_;
+  }
+
+  const std::vector<SnapshotTensor>& tensors() const {
+    return tensors_;
+  }
+
+  // Parameter `i` of the table of contents, throws on a CRC mismatch
+  af::array tensor(size_t i) const;
+
+  // Fill in all parameters, checking CRCs on `nThreads` threads
+  void materialize(int nThreads = 4);
+
+ private:
+  void checkCrc(size_t i) const;
+  af::array read(size_t i) const;
+
+  std::string path_;
+  void* data_{nullptr};
+  size_t bytes_{0};
+  std::unordered_map<std::string, std::string> config_;
+  std::shared_ptr<fl::Module> network_;
+  std::shared_ptr<SequenceCriterion> criterion_;
+  std::vector<SnapshotTensor> tensors_;
+};
+
+bool isSnapshot(const std::string& path);
+
+/**
+ * Load a model saved either as a snapshot or with
+ * `W2lSerializer::save(path, config, network, criterion)`.
+ *
+ * Loading is eager: a snapshot is fully materialized, so every payload is
+ * CRC-checked and copied to the device before this returns. Compared with
+ * `W2lSerializer` only the file format changes, with parallel CRC checks and
+ * no cereal pass over the weights. Use `Snapshot` directly to read the config
+ * or single tensors without touching the rest.
+ */
+void loadModel(
+    const std::string& path,
+    std::unordered_map<std::string, std::string>& config,
+    std::shared_ptr<fl::Module>& network,
+    std::shared_ptr<SequenceCriterion>& criterion);
+
+uint32_t crc32(const void* data, size_t bytes, uint32_t crc = 0);
+
+} // namespace w2l
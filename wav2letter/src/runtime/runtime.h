@@ -8,8 +8,12 @@
 
 #pragma once
 
+#include "runtime/Attribution.h"
 #include "runtime/Data.h"
+#include "runtime/Diagnostics.h"
 #include "runtime/Distributed.h"
+#include "runtime/EmissionStore.h"
 #include "runtime/Logger.h"
 #include "runtime/Optimizer.h"
 #include "runtime/Serial.h"
+#include "runtime/Snapshot.h"
@@ -7,21 +7,35 @@
  */
 
 #include <stdint.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cmath>
+#include <fstream>
 #include <unordered_map>
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <cnpy.h>
 #include <flashlight/flashlight.h>
 
+#include "common/Utils.h"
+#include "criterion/criterion.h"
 #include "module/module.h"
+#include "runtime/Attribution.h"
+#include "runtime/Diagnostics.h"
+#include "runtime/Distributed.h"
+#include "runtime/EmissionStore.h"
 #include "runtime/Serial.h"
+#include "runtime/Snapshot.h"
 #include "runtime/SpeechStatMeter.h"
 
 using namespace w2l;
 
 namespace {
 const std::string kPath = "/tmp/test.bin";
+const char kWorkerRankEnv[] = "W2L_TEST_WORLD_RANK";
+const char kRndvEnv[] = "W2L_TEST_RNDV_FILEPATH";
 
 bool afEqual(const fl::Variable& a, const fl::Variable& b) {
   if (a.isCalcGrad() != b.isCalcGrad()) {
@@ -99,6 +113,299 @@ TEST(RuntimeTest, SpeechStatMeter) {
   ASSERT_EQ(stats2[4], 2.0);
 }
 
+TEST(RuntimeTest, MaskAttribution) {
+  auto model = std::make_shared<fl::Sequential>();
+  model->add(fl::Tanh());
+  auto input = af::randn(8, 5, 1, 1);
+
+  MaskAttributionOptions opts;
+  opts.mode = kAdditiveMask;
+  opts.noiseStd = 0.0;
+  opts.numNoise = 4;
+  opts.iterations = 200;
+  opts.syncInterval = 50;
+  opts.lr = 0.1;
+  opts.lrStep = 0;
+
+  // without noise the mask only moves the output away from f(x), so the fit
+  // loss has to go down from the first to the last sync
+  std::vector<MaskAttributionStats> stats;
+  MaskAttribution attribution(model, opts);
+  auto mask = attribution.run(
+      input, [&stats](const MaskAttributionStats& s) { stats.push_back(s); });
+  ASSERT_EQ(mask.dims(), input.dims());
+  ASSERT_EQ(stats.size(), 4);
+  ASSERT_EQ(stats.back().iteration, 200);
+  ASSERT_LT(stats.back().fitLoss, stats.front().fitLoss);
+  ASSERT_LT(af::max<float>(af::abs(mask)), 1.0);
+
+  opts.mode = kNoiseMask;
+  opts.noiseStd = 0.1;
+  opts.lambda = 0.01;
+  opts.iterations = 10;
+  mask = MaskAttribution(model, opts).run(input);
+  ASSERT_EQ(mask.dims(), input.dims());
+  ASSERT_FALSE(af::anyTrue<bool>(af::isNaN(mask)));
+
+  // the network is back in train mode afterwards: dropout is active again
+  model->add(fl::Dropout(0.5));
+  opts.iterations = 1;
+  MaskAttribution(model, opts).run(input);
+  auto ones = fl::Variable(af::constant(1.0, 64), false);
+  auto dropped = model->forward(ones).array();
+  ASSERT_TRUE(af::anyTrue<bool>(dropped == 0));
+}
+
+TEST(RuntimeTest, DiagnosticsWriter) {
+  const std::string dir = "/tmp/w2l_diagnostics_test";
+  auto arr = af::randu(3, 2);
+  {
+    DiagnosticsWriter diagnostics(dir, 2);
+    diagnostics.sample("skipped", arr, 3);
+    diagnostics.sample("m", arr, 4);
+    diagnostics.write("ids", af::iota(af::dim4(5), af::dim4(1), s32), 7);
+    diagnostics.flush();
+    ASSERT_FALSE(fileExists(pathsConcat(dir, "skipped_3.npy")));
+  } // joins the writer thread
+
+  // column-major af array -> reversed numpy shape
+  auto m = cnpy::npy_load(pathsConcat(dir, "m_4.npy"));
+  ASSERT_EQ(m.shape, std::vector<size_t>({2, 3}));
+  std::vector<float> expected(arr.elements());
+  arr.host(expected.data());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    ASSERT_EQ(m.data<float>()[i], expected[i]);
+  }
+  auto ids = cnpy::npy_load(pathsConcat(dir, "ids_7.npy"));
+  ASSERT_EQ(ids.shape, std::vector<size_t>({5}));
+  ASSERT_EQ(ids.data<float>()[4], 4.0);
+
+  ASSERT_TRUE(fileExists(pathsConcat(dir, "index.tsv")));
+  DiagnosticsWriter disabled("");
+  ASSERT_FALSE(disabled.enabled());
+  disabled.write("nothing", arr, 0);
+}
+
+TEST(RuntimeTest, EmissionStore) {
+  const std::string dir = "/tmp/w2l_emission_store_test";
+  const int N = 3;
+  std::vector<std::vector<float>> emissions = {
+      {0.5, -1, 2, 0, 0.25, 7}, {1, 2, 3}, {-0.125, 4, 8, 16, 32, 64, 1, 2, 3}};
+  for (bool fp16 : {false, true}) {
+    {
+      EmissionStoreWriter writer(dir, 2, fp16, {0.1, 0.2}, "--flag=1");
+      for (size_t i = 0; i < emissions.size(); ++i) {
+        int T = emissions[i].size() / N;
+        writer.add(emissions[i], N, T, {1, 2}, {3}, std::to_string(i));
+      }
+      ASSERT_EQ(writer.size(), 3);
+    } // seals the last shard and marks the store done
+
+    EmissionStoreReader reader(dir);
+    ASSERT_EQ(reader.meta().emissionN, N);
+    ASSERT_EQ(reader.meta().transition, std::vector<float>({0.1, 0.2}));
+    ASSERT_EQ(reader.meta().gflags, "--flag=1");
+    size_t seen = 0;
+    std::vector<float> scratch;
+    for (int64_t k = 0;; ++k) {
+      auto shard = reader.shard(k);
+      if (!shard) {
+        break;
+      }
+      for (size_t i = 0; i < shard->size(); ++i, ++seen) {
+        const auto& rec = shard->record(i);
+        ASSERT_EQ(rec.sampleId, std::to_string(seen));
+        ASSERT_EQ(
+            static_cast<size_t>(rec.emissionT * N), emissions[seen].size());
+        ASSERT_EQ(rec.wordTarget, std::vector<int>({1, 2}));
+        // all values above are exact in fp16
+        auto data = shard->emission(i, N, fp16, scratch);
+        for (size_t j = 0; j < emissions[seen].size(); ++j) {
+          ASSERT_EQ(data[j], emissions[seen][j]);
+        }
+      }
+    }
+    ASSERT_EQ(seen, emissions.size());
+  }
+  ASSERT_EQ(halfToFloat(floatToHalf(65520.0)), INFINITY);
+  ASSERT_NEAR(halfToFloat(floatToHalf(0.1)), 0.1, 1e-4);
+}
+
+TEST(RuntimeTest, Snapshot) {
+  const std::string path = "/tmp/w2l_snapshot_test.bin";
+  std::unordered_map<std::string, std::string> config(
+      {{"date", "01-01-01"}, {"lr", "0.1"}});
+  auto model = std::make_shared<fl::Sequential>();
+  model->add(fl::Conv2D(4, 6, 2, 1));
+  model->add(fl::GatedLinearUnit(2));
+  model->add(fl::Linear(3, 5));
+  std::shared_ptr<SequenceCriterion> criterion =
+      std::make_shared<AutoSegmentationCriterion>(5);
+
+  saveSnapshot(path, config, model, criterion, 2);
+  ASSERT_TRUE(isSnapshot(path));
+  ASSERT_FALSE(fileExists(path + ".tmp"));
+  // saving leaves the live parameters untouched
+  ASSERT_FALSE(model->param(0).array().isempty());
+
+  std::unordered_map<std::string, std::string> configload;
+  std::shared_ptr<fl::Module> modelload;
+  std::shared_ptr<SequenceCriterion> critload;
+  loadModel(path, configload, modelload, critload);
+  EXPECT_THAT(config, ::testing::ContainerEq(configload));
+  ASSERT_EQ(model->prettyString(), modelload->prettyString());
+  ASSERT_TRUE(afEqual(criterion->param(0), critload->param(0)));
+  model->eval();
+  modelload->eval();
+  auto in = fl::Variable(af::randu(10, 1, 4), false);
+  ASSERT_TRUE(afEqual(model->forward(in), modelload->forward(in)));
+
+  // headers are readable without touching the parameters
+  Snapshot lazy(path);
+  ASSERT_EQ(lazy.tensors().size(), model->params().size() + 1);
+  ASSERT_TRUE(lazy.network()->param(0).array().isempty());
+  ASSERT_TRUE(afEqual(fl::Variable(lazy.tensor(1), true), model->param(1)));
+
+  // flip one payload byte of the first tensor
+  auto offset = lazy.tensors()[0].offset;
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekg(offset);
+    char c = file.get();
+    file.seekp(offset);
+    file.put(c ^ 0x1);
+  }
+  Snapshot corrupt(path);
+  ASSERT_THROW(corrupt.tensor(0), std::runtime_error);
+  ASSERT_THROW(corrupt.materialize(), std::runtime_error);
+  ASSERT_EQ(crc32("123456789", 9), 0xCBF43926u);
+}
+
+TEST(RuntimeTest, GradientBuckets) {
+  auto f32 = af::dtype::f32;
+  auto buckets = assignGradientBuckets(
+      {40, 40, 100, 8, 8, 8}, {f32, f32, f32, f32, af::dtype::f64, f32}, 64);
+  // too large to share, then a type change on each side of 4
+  ASSERT_EQ(buckets.size(), 6u);
+  for (int b = 0; b < 6; ++b) {
+    EXPECT_THAT(buckets[b], ::testing::ElementsAre(b));
+  }
+  buckets = assignGradientBuckets({8, 8, 8, 8}, {f32, f32, f32, f32}, 16);
+  ASSERT_EQ(buckets.size(), 2u);
+  EXPECT_THAT(buckets[0], ::testing::ElementsAre(0, 1));
+  EXPECT_THAT(buckets[1], ::testing::ElementsAre(2, 3));
+
+  // meters of different types share one buffer
+  std::vector<long long> counts = {3, 1LL << 40, -2};
+  std::vector<af::array> arrs = {af::array(3, counts.data()),
+                                 af::array(),
+                                 af::randu(2, 2, af::dtype::f64)};
+  auto packed = packArrays(arrs);
+  ASSERT_EQ(packed.elements(), 7);
+  ASSERT_EQ(packed.type(), af::dtype::f64);
+  auto unpacked = unpackArrays(packed, arrs);
+  ASSERT_EQ(unpacked.size(), 3u);
+  ASSERT_EQ(unpacked[0].type(), af::dtype::s64);
+  ASSERT_EQ(afToVector<long long>(unpacked[0]), counts);
+  ASSERT_TRUE(unpacked[1].isempty());
+  ASSERT_EQ(unpacked[2].dims(), arrs[2].dims());
+  ASSERT_TRUE(af::allTrue<bool>(unpacked[2] == arrs[2]));
+
+  // a single process has nothing to reduce
+  auto model = std::make_shared<fl::Linear>(3, 5);
+  GradientBucketer bucketer({model}, 1.0, 1024);
+  ASSERT_EQ(bucketer.numBuckets(), 0);
+  auto out = model->forward(fl::Variable(af::randu(3, 2), false));
+  fl::sum(out, {0, 1}).backward();
+  bucketer.synchronize();
+  ASSERT_FALSE(model->param(0).grad().array().isempty());
+}
+
+namespace {
+
+// One of the 2 processes of GradientBucketerDistributed: the gradients reduced
+// in buckets must be those of fl::distributeModuleGrads.
+void runBucketerWorker(int rank, const std::string& rndvFilepath) {
+  maybeInitDistributedEnv(true, rank, 2, rndvFilepath);
+  auto makeModel = []() {
+    af::setSeed(1); // same initialization on both processes
+    auto model = std::make_shared<fl::Sequential>();
+    model->add(fl::Linear(6, 5));
+    model->add(fl::Tanh());
+    model->add(fl::Linear(5, 4));
+    return model;
+  };
+  auto reference = makeModel();
+  auto bucketed = makeModel();
+  fl::distributeModuleGrads(reference, 0.5);
+  GradientBucketer bucketer({bucketed}, 0.5, 5 * 4 * sizeof(float));
+  ASSERT_GT(bucketer.numBuckets(), 1);
+
+  af::setSeed(10 + rank);
+  // the hooks are rearmed by synchronize(), run 2 steps
+  for (int step = 0; step < 2; ++step) {
+    auto input = fl::Variable(af::randu(6, 3), false);
+    reference->zeroGrad();
+    bucketed->zeroGrad();
+    // one after the other, so that the collectives come in the same order on
+    // both processes
+    fl::sum(reference->forward(input), {0, 1}).backward();
+    fl::sum(bucketed->forward(input), {0, 1}).backward();
+    bucketer.synchronize();
+    for (size_t i = 0; i < reference->params().size(); ++i) {
+      ASSERT_TRUE(fl::allClose(
+          reference->param(i).grad().array(),
+          bucketed->param(i).grad().array(),
+          1e-5));
+    }
+  }
+}
+
+} // namespace
+
+TEST(RuntimeTest, GradientBucketerDistributed) {
+  auto rank = getEnvVar(kWorkerRankEnv);
+  if (!rank.empty()) {
+    runBucketerWorker(std::stoi(rank), getEnvVar(kRndvEnv));
+    return;
+  }
+
+  // run this test again in 2 processes on a file rendezvous
+  const std::string rndvFilepath =
+      "/tmp/w2l_bucketer_rndv_" + std::to_string(getpid());
+  dirCreate(rndvFilepath);
+  char program[] = "RuntimeTest";
+  char filter[] = "--gtest_filter=RuntimeTest.GradientBucketerDistributed";
+  std::vector<pid_t> workers;
+  for (int r = 0; r < 2; ++r) {
+    std::vector<std::string> env;
+    for (char** e = environ; *e; ++e) {
+      env.emplace_back(*e);
+    }
+    env.push_back(std::string(kWorkerRankEnv) + "=" + std::to_string(r));
+    env.push_back(std::string(kRndvEnv) + "=" + rndvFilepath);
+    std::vector<char*> envp;
+    for (auto& var : env) {
+      envp.push_back(&var[0]);
+    }
+    envp.push_back(nullptr);
+    char* argv[] = {program, filter, nullptr};
+    auto pid = fork();
+    if (pid == 0) {
+      execve("/proc/self/exe", argv, envp.data());
+      _exit(127);
+    }
+    ASSERT_GT(pid, 0);
+    workers.push_back(pid);
+  }
+  for (auto pid : workers) {
+    int status;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+  }
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();